@@ -1,11 +1,12 @@
 #include "client/async_log_client.h"
 
-#include <algorithm>
 #include <event2/http.h>
 #include <glog/logging.h>
-#include <iterator>
 #include <memory>
+#include <sstream>
 
+#include "client/response_cache.h"
+#include "client/response_parser.h"
 #include "log/cert.h"
 #include "proto/serializer.h"
 #include "util/json_wrapper.h"
@@ -13,17 +14,24 @@
 using cert_trans::AsyncLogClient;
 using cert_trans::Cert;
 using cert_trans::CertChain;
+using cert_trans::ParseGetEntriesAndProofResponse;
+using cert_trans::ParseGetEntriesResponse;
+using cert_trans::ParseGetProofByHashResponse;
+using cert_trans::ParseGetProofsResponse;
+using cert_trans::ParseGetSTHConsistencyResponse;
+using cert_trans::ParseGetSTHResponse;
 using cert_trans::PreCertChain;
+using cert_trans::ResponseCache;
 using cert_trans::URL;
 using cert_trans::UrlFetcher;
 using ct::DigitallySigned;
 using ct::MerkleAuditProof;
+using ct::ShortMerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
-using std::back_inserter;
 using std::bind;
 using std::make_shared;
-using std::move;
+using std::ostringstream;
 using std::placeholders::_1;
 using std::shared_ptr;
 using std::string;
@@ -42,6 +50,22 @@ string UriEncode(const string& input) {
 }
 
 
+string CacheKey(const URL& url) {
+  ostringstream key;
+  key << url;
+  return key.str();
+}
+
+
+// Adds a successfully parsed response to the cache, if there is one.
+void MaybeCacheResponse(ResponseCache* cache, const URL& url,
+                        const UrlFetcher::Response& resp) {
+  if (cache) {
+    cache->Insert(CacheKey(url), resp.body);
+  }
+}
+
+
 // Do some common checks, calls the callback with the appropriate
 // error if something is wrong.
 bool SanityCheck(UrlFetcher::Response* resp,
@@ -69,37 +93,9 @@ void DoneGetSTH(UrlFetcher::Response* resp, SignedTreeHead* sth,
     return;
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  JsonInt tree_size(jresponse, "tree_size");
-  if (!tree_size.Ok() || tree_size.Value() < 0)
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  JsonInt timestamp(jresponse, "timestamp");
-  if (!timestamp.Ok() || timestamp.Value() < 0)
+  if (!ParseGetSTHResponse(resp->body, sth))
     return done(AsyncLogClient::BAD_RESPONSE);
 
-  JsonString root_hash(jresponse, "sha256_root_hash");
-  if (!root_hash.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  JsonString jsignature(jresponse, "tree_head_signature");
-  if (!jsignature.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-  DigitallySigned signature;
-  if (Deserializer::DeserializeDigitallySigned(jsignature.FromBase64(),
-                                               &signature) != Deserializer::OK)
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  sth->Clear();
-  sth->set_version(ct::V1);
-  sth->set_tree_size(tree_size.Value());
-  sth->set_timestamp(timestamp.Value());
-  sth->set_sha256_root_hash(root_hash.FromBase64());
-  sth->mutable_signature()->CopyFrom(signature);
-
   return done(AsyncLogClient::OK);
 }
 
@@ -141,7 +137,8 @@ void DoneGetRoots(UrlFetcher::Response* resp, vector<shared_ptr<Cert> >* roots,
 }
 
 
-void DoneGetEntries(UrlFetcher::Response* resp,
+void DoneGetEntries(UrlFetcher::Response* resp, ResponseCache* cache,
+                    const URL& url, int num_requested,
                     vector<AsyncLogClient::Entry>* entries,
                     const AsyncLogClient::Callback& done, util::Task* task) {
   unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
@@ -151,77 +148,49 @@ void DoneGetEntries(UrlFetcher::Response* resp,
     return;
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
+  const size_t old_size(entries->size());
+  if (!ParseGetEntriesResponse(resp->body, entries))
     return done(AsyncLogClient::BAD_RESPONSE);
 
-  JsonArray jentries(jresponse, "entries");
-  if (!jentries.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  vector<AsyncLogClient::Entry> new_entries;
-  new_entries.reserve(jentries.Length());
+  // The server is allowed to return fewer entries than requested, in
+  // which case asking again later could return more.
+  if (entries->size() - old_size == static_cast<size_t>(num_requested)) {
+    MaybeCacheResponse(cache, url, *resp);
+  }
 
-  for (int n = 0; n < jentries.Length(); ++n) {
-    JsonObject entry(jentries, n);
-    if (!entry.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
-    }
+  return done(AsyncLogClient::OK);
+}
 
-    JsonString leaf_input(entry, "leaf_input");
-    if (!leaf_input.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
-    }
 
-    AsyncLogClient::Entry log_entry;
-    if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input.FromBase64(),
-                                                &log_entry.leaf) !=
-        Deserializer::OK) {
-      return done(AsyncLogClient::BAD_RESPONSE);
-    }
+void DoneGetEntriesAndProof(UrlFetcher::Response* resp, ResponseCache* cache,
+                            const URL& url, int num_requested,
+                            vector<AsyncLogClient::Entry>* entries,
+                            vector<string>* range_proof,
+                            const AsyncLogClient::Callback& done,
+                            util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
 
-    JsonString extra_data(entry, "extra_data");
-    if (!extra_data.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
-    }
-
-    // This is an optional non-standard extension, used only by the log
-    // internally when running in clustered mode.
-    JsonString sct_data(entry, "sct");
-    if (sct_data.Ok()) {
-      unique_ptr<SignedCertificateTimestamp> sct(
-          new SignedCertificateTimestamp);
-      if (Deserializer::DeserializeSCT(sct_data.FromBase64(), sct.get()) !=
-          Deserializer::OK) {
-        return done(AsyncLogClient::BAD_RESPONSE);
-      }
-      log_entry.sct.reset(sct.release());
-    }
-
-    if (log_entry.leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
-      Deserializer::DeserializeX509Chain(extra_data.FromBase64(),
-                                         log_entry.entry.mutable_x509_entry());
-    } else if (log_entry.leaf.timestamped_entry().entry_type() ==
-               ct::PRECERT_ENTRY) {
-      Deserializer::DeserializePrecertChainEntry(
-          extra_data.FromBase64(), log_entry.entry.mutable_precert_entry());
-    } else {
-      LOG(FATAL) << "Don't understand entry type: "
-                 << log_entry.leaf.timestamped_entry().entry_type();
-    }
-
-    new_entries.emplace_back(move(log_entry));
+  if (!SanityCheck(resp, done, task)) {
+    return;
   }
 
-  entries->reserve(entries->size() + new_entries.size());
-  move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
+  const size_t old_size(entries->size());
+  if (!ParseGetEntriesAndProofResponse(resp->body, entries, range_proof))
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  // As for get-entries, fewer entries than requested could be
+  // returned, and asking again later could return more.
+  if (entries->size() - old_size == static_cast<size_t>(num_requested)) {
+    MaybeCacheResponse(cache, url, *resp);
+  }
 
   return done(AsyncLogClient::OK);
 }
 
 
-void DoneQueryInclusionProof(UrlFetcher::Response* resp,
-                             const SignedTreeHead& sth,
+void DoneQueryInclusionProof(UrlFetcher::Response* resp, ResponseCache* cache,
+                             const URL& url, const SignedTreeHead& sth,
                              MerkleAuditProof* proof,
                              const AsyncLogClient::Callback& done,
                              util::Task* task) {
@@ -232,31 +201,19 @@ void DoneQueryInclusionProof(UrlFetcher::Response* resp,
     return;
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  JsonInt leaf_index(jresponse, "leaf_index");
-  if (!leaf_index.Ok() || leaf_index.Value() < 0)
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  JsonArray audit_path(jresponse, "audit_path");
-  if (!audit_path.Ok())
+  int64_t leaf_index;
+  vector<string> path_nodes;
+  if (!ParseGetProofByHashResponse(resp->body, &leaf_index, &path_nodes))
     return done(AsyncLogClient::BAD_RESPONSE);
 
-  vector<string> path_nodes;
-  for (int n = 0; n < audit_path.Length(); ++n) {
-    JsonString path_node(audit_path, n);
-    CHECK(path_node.Ok());
-    path_nodes.push_back(path_node.FromBase64());
-  }
+  MaybeCacheResponse(cache, url, *resp);
 
   proof->Clear();
   proof->set_version(ct::V1);
   proof->set_tree_size(sth.tree_size());
   proof->set_timestamp(sth.timestamp());
   proof->mutable_tree_head_signature()->CopyFrom(sth.signature());
-  proof->set_leaf_index(leaf_index.Value());
+  proof->set_leaf_index(leaf_index);
   for (vector<string>::const_iterator it = path_nodes.begin();
        it != path_nodes.end(); ++it) {
     proof->add_path_node(*it);
@@ -266,9 +223,12 @@ void DoneQueryInclusionProof(UrlFetcher::Response* resp,
 }
 
 
-void DoneGetSTHConsistency(UrlFetcher::Response* resp, vector<string>* proof,
-                           const AsyncLogClient::Callback& done,
-                           util::Task* task) {
+void DoneQueryInclusionProofs(UrlFetcher::Response* resp,
+                              const SignedTreeHead& sth, size_t num_requested,
+                              const vector<int64_t>& leaf_indices,
+                              vector<MerkleAuditProof>* proofs,
+                              const AsyncLogClient::Callback& done,
+                              util::Task* task) {
   unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
   unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
 
@@ -276,25 +236,52 @@ void DoneGetSTHConsistency(UrlFetcher::Response* resp, vector<string>* proof,
     return;
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
+  vector<ShortMerkleAuditProof> short_proofs;
+  if (!ParseGetProofsResponse(resp->body, &short_proofs))
     return done(AsyncLogClient::BAD_RESPONSE);
 
-  JsonArray jproof(jresponse, "consistency");
-  if (!jproof.Ok())
+  // There must be one proof per requested entry, in the order they were
+  // requested in.
+  if (short_proofs.size() != num_requested)
     return done(AsyncLogClient::BAD_RESPONSE);
-
-  vector<string> entries;
-  for (int i = 0; i < jproof.Length(); ++i) {
-    JsonString entry(jproof, i);
-    if (!entry.Ok())
+  for (size_t i = 0; i < short_proofs.size(); ++i) {
+    if (short_proofs[i].leaf_index() >= sth.tree_size() ||
+        (!leaf_indices.empty() &&
+         short_proofs[i].leaf_index() != leaf_indices[i]))
       return done(AsyncLogClient::BAD_RESPONSE);
+  }
+
+  proofs->reserve(proofs->size() + short_proofs.size());
+  for (auto& short_proof : short_proofs) {
+    proofs->emplace_back();
+    MerkleAuditProof* const proof(&proofs->back());
+    proof->set_version(ct::V1);
+    proof->set_tree_size(sth.tree_size());
+    proof->set_timestamp(sth.timestamp());
+    proof->mutable_tree_head_signature()->CopyFrom(sth.signature());
+    proof->set_leaf_index(short_proof.leaf_index());
+    proof->mutable_path_node()->Swap(short_proof.mutable_path_node());
+  }
+
+  return done(AsyncLogClient::OK);
+}
+
+
+void DoneGetSTHConsistency(UrlFetcher::Response* resp, ResponseCache* cache,
+                           const URL& url, vector<string>* proof,
+                           const AsyncLogClient::Callback& done,
+                           util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
 
-    entries.push_back(entry.FromBase64());
+  if (!SanityCheck(resp, done, task)) {
+    return;
   }
 
-  proof->reserve(proof->size() + entries.size());
-  move(entries.begin(), entries.end(), back_inserter(*proof));
+  if (!ParseGetSTHConsistencyResponse(resp->body, proof))
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  MaybeCacheResponse(cache, url, *resp);
 
   return done(AsyncLogClient::OK);
 }
@@ -372,8 +359,16 @@ namespace cert_trans {
 
 AsyncLogClient::AsyncLogClient(util::Executor* const executor,
                                UrlFetcher* fetcher, const string& server_url)
+    : AsyncLogClient(executor, fetcher, nullptr, server_url) {
+}
+
+
+AsyncLogClient::AsyncLogClient(util::Executor* const executor,
+                               UrlFetcher* fetcher, ResponseCache* cache,
+                               const string& server_url)
     : executor_(CHECK_NOTNULL(executor)),
       fetcher_(CHECK_NOTNULL(fetcher)),
+      cache_(cache),
       server_url_(NormalizeURL(server_url)) {
 }
 
@@ -428,9 +423,36 @@ void AsyncLogClient::InternalGetEntries(int first, int last,
                (request_scts ? "&include_scts=true" : ""));
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp,
-                  new util::Task(bind(DoneGetEntries, resp, entries, done, _1),
-                                 executor_));
+  FetchCacheable(url, resp,
+                 new util::Task(bind(DoneGetEntries, resp, cache_, url,
+                                     last - first + 1, entries, done, _1),
+                                executor_));
+}
+
+
+void AsyncLogClient::GetEntriesAndProof(int first, int last,
+                                        int64_t tree_size,
+                                        vector<Entry>* entries,
+                                        vector<string>* range_proof,
+                                        const Callback& done) {
+  CHECK_GE(first, 0);
+  CHECK_GE(last, 0);
+
+  if (last < first || last >= tree_size) {
+    done(INVALID_INPUT);
+    return;
+  }
+
+  URL url(GetURL("get-entries-and-proof"));
+  url.SetQuery("start=" + to_string(first) + "&end=" + to_string(last) +
+               "&tree_size=" + to_string(tree_size));
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  FetchCacheable(url, resp,
+                 new util::Task(bind(DoneGetEntriesAndProof, resp, cache_,
+                                     url, last - first + 1, entries,
+                                     range_proof, done, _1),
+                                executor_));
 }
 
 
@@ -445,9 +467,47 @@ void AsyncLogClient::QueryInclusionProof(const SignedTreeHead& sth,
                "&tree_size=" + to_string(sth.tree_size()));
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp, new util::Task(bind(DoneQueryInclusionProof, resp,
-                                                 sth, proof, done, _1),
-                                            executor_));
+  FetchCacheable(url, resp,
+                 new util::Task(bind(DoneQueryInclusionProof, resp, cache_,
+                                     url, sth, proof, done, _1),
+                                executor_));
+}
+
+
+void AsyncLogClient::QueryInclusionProofs(const SignedTreeHead& sth,
+                                          const vector<int64_t>& leaf_indices,
+                                          vector<MerkleAuditProof>* proofs,
+                                          const Callback& done) {
+  JsonArray jindices;
+  for (const auto& index : leaf_indices) {
+    CHECK_GE(index, 0);
+    jindices.Add(index);
+  }
+
+  JsonObject jsend;
+  jsend.Add("tree_size", sth.tree_size());
+  jsend.Add("leaf_indices", jindices);
+
+  InternalQueryInclusionProofs(sth, jsend.ToString(), leaf_indices.size(),
+                               leaf_indices, proofs, done);
+}
+
+
+void AsyncLogClient::QueryInclusionProofsByHash(
+    const SignedTreeHead& sth, const vector<string>& merkle_leaf_hashes,
+    vector<MerkleAuditProof>* proofs, const Callback& done) {
+  JsonArray jhashes;
+  for (const auto& hash : merkle_leaf_hashes) {
+    jhashes.AddBase64(hash);
+  }
+
+  JsonObject jsend;
+  jsend.Add("tree_size", sth.tree_size());
+  jsend.Add("hashes", jhashes);
+
+  InternalQueryInclusionProofs(sth, jsend.ToString(),
+                               merkle_leaf_hashes.size(), vector<int64_t>(),
+                               proofs, done);
 }
 
 
@@ -461,9 +521,10 @@ void AsyncLogClient::GetSTHConsistency(int64_t first, int64_t second,
   url.SetQuery("first=" + to_string(first) + "&second=" + to_string(second));
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp, new util::Task(bind(DoneGetSTHConsistency, resp,
-                                                 proof, done, _1),
-                                            executor_));
+  FetchCacheable(url, resp,
+                 new util::Task(bind(DoneGetSTHConsistency, resp, cache_, url,
+                                     proof, done, _1),
+                                executor_));
 }
 
 
@@ -490,6 +551,39 @@ URL AsyncLogClient::GetURL(const std::string& subpath) const {
 }
 
 
+void AsyncLogClient::FetchCacheable(const URL& url,
+                                    UrlFetcher::Response* resp,
+                                    util::Task* task) {
+  if (cache_ && cache_->Lookup(CacheKey(url), &resp->body)) {
+    VLOG(1) << "serving " << url << " from the response cache";
+    resp->status_code = HTTP_OK;
+    task->Return();
+    return;
+  }
+
+  fetcher_->Fetch(url, resp, task);
+}
+
+
+void AsyncLogClient::InternalQueryInclusionProofs(
+    const SignedTreeHead& sth, const string& request_body,
+    size_t num_requested, const vector<int64_t>& leaf_indices,
+    vector<MerkleAuditProof>* proofs, const Callback& done) {
+  CHECK_GE(sth.tree_size(), 0);
+
+  UrlFetcher::Request req(GetURL("get-proofs"));
+  req.verb = UrlFetcher::Verb::POST;
+  req.body = request_body;
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  fetcher_->Fetch(req, resp,
+                  new util::Task(bind(DoneQueryInclusionProofs, resp, sth,
+                                      num_requested, leaf_indices, proofs,
+                                      done, _1),
+                                 executor_));
+}
+
+
 void AsyncLogClient::InternalAddChain(const CertChain& cert_chain,
                                       SignedCertificateTimestamp* sct,
                                       bool pre_cert, const Callback& done) {
@@ -21,6 +21,7 @@ namespace cert_trans {
 class Cert;
 class CertChain;
 class PreCertChain;
+class ResponseCache;
 
 
 class AsyncLogClient {
@@ -51,6 +52,13 @@ class AsyncLogClient {
   AsyncLogClient(util::Executor* const executor, UrlFetcher* fetcher,
                  const std::string& server_uri);
 
+  // If |cache| is not NULL, the responses that cannot change (entries,
+  // inclusion proofs at a given tree size, and consistency proofs)
+  // are served from it when possible, and added to it otherwise. The
+  // cache is not owned, and must outlive this object.
+  AsyncLogClient(util::Executor* const executor, UrlFetcher* fetcher,
+                 ResponseCache* cache, const std::string& server_uri);
+
   void GetSTH(ct::SignedTreeHead* sth, const Callback& done);
 
   // This does not clear "roots" before appending to it.
@@ -69,10 +77,34 @@ class AsyncLogClient {
   void GetEntriesAndSCTs(int first, int last, std::vector<Entry>* entries,
                          const Callback& done);
 
+  // This is NON-standard, and only works with SuperDuper logs. It
+  // fetches entries like GetEntries(), along with the proof that the
+  // entries returned are in the tree of size |tree_size| (see
+  // MerkleVerifier::RootFromRangeProof()), which replaces the contents
+  // of |range_proof|.
+  void GetEntriesAndProof(int first, int last, int64_t tree_size,
+                          std::vector<Entry>* entries,
+                          std::vector<std::string>* range_proof,
+                          const Callback& done);
+
   void QueryInclusionProof(const ct::SignedTreeHead& sth,
                            const std::string& merkle_leaf_hash,
                            ct::MerkleAuditProof* proof, const Callback& done);
 
+  // These are NON-standard, and only work with SuperDuper logs. They
+  // fetch the inclusion proofs for several entries, by index or by
+  // hash, in a single request. A reply without exactly one proof per
+  // requested entry, in the same order, is a BAD_RESPONSE. This does
+  // not clear "proofs" before appending to it.
+  void QueryInclusionProofs(const ct::SignedTreeHead& sth,
+                            const std::vector<int64_t>& leaf_indices,
+                            std::vector<ct::MerkleAuditProof>* proofs,
+                            const Callback& done);
+  void QueryInclusionProofsByHash(
+      const ct::SignedTreeHead& sth,
+      const std::vector<std::string>& merkle_leaf_hashes,
+      std::vector<ct::MerkleAuditProof>* proofs, const Callback& done);
+
   // This does not clear "proof" before appending to it.
   void GetSTHConsistency(int64_t first, int64_t second,
                          std::vector<std::string>* proof,
@@ -89,15 +121,29 @@ class AsyncLogClient {
  private:
   URL GetURL(const std::string& subpath) const;
 
+  // Like UrlFetcher::Fetch, but serves the response from |cache_| if
+  // it is there.
+  void FetchCacheable(const URL& url, UrlFetcher::Response* resp,
+                      util::Task* task);
+
   void InternalGetEntries(int first, int last, std::vector<Entry>* entries,
                           bool request_scts, const Callback& done);
 
+  // |leaf_indices| is empty if the proofs were requested by hash.
+  void InternalQueryInclusionProofs(const ct::SignedTreeHead& sth,
+                                    const std::string& request_body,
+                                    size_t num_requested,
+                                    const std::vector<int64_t>& leaf_indices,
+                                    std::vector<ct::MerkleAuditProof>* proofs,
+                                    const Callback& done);
+
   void InternalAddChain(const CertChain& cert_chain,
                         ct::SignedCertificateTimestamp* sct, bool pre_cert,
                         const Callback& done);
 
   util::Executor* const executor_;
   UrlFetcher* const fetcher_;
+  ResponseCache* const cache_;
   const URL server_url_;
 
   DISALLOW_COPY_AND_ASSIGN(AsyncLogClient);
@@ -14,12 +14,15 @@
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <signal.h>
 #include <sstream>
 #include <stdio.h>
 #include <string>
 
 #include "client/http_log_client.h"
+#include "client/response_cache.h"
 #include "client/ssl_client.h"
+#include "client/ssl_scanner.h"
 #include "log/cert.h"
 #include "log/cert_submission_handler.h"
 #include "log/ct_extensions.h"
@@ -100,12 +103,33 @@ DEFINE_string(sth2, "", "File containing second STH");
 DEFINE_uint64(monitor_sleep_time_secs, 60,
               "Amount of time the monitor shall "
               "sleep between probing for a new STH.");
+DEFINE_string(response_cache_dir, "",
+              "If set, entries and proofs retrieved from the log server are "
+              "cached in this directory, and reused by later runs.");
+DEFINE_int64(response_cache_max_bytes, 1LL << 30,
+             "Maximum total size of the responses kept in "
+             "--response_cache_dir, beyond which the least recently used "
+             "ones are deleted.");
+DEFINE_string(scan_targets, "",
+              "File listing the SSL servers to check with the 'scan' "
+              "command, one <address>:<port> per line");
+DEFINE_string(scan_log_public_keys, "",
+              "Comma-separated PEM-encoded public key files of the logs "
+              "whose SCTs the 'scan' command verifies, in addition to "
+              "--ct_server_public_key");
+DEFINE_int32(scan_max_concurrent_handshakes, 100,
+             "Maximum number of handshakes in flight during a scan");
+DEFINE_int32(scan_handshake_timeout_ms, 10000,
+             "Time allowed for each handshake of a scan");
+DEFINE_int32(scan_verify_batch_size, 1000,
+             "Number of scanned servers whose SCTs are verified together");
 
 
 static const char kUsage[] =
     " <command> ...\n"
     "Known commands:\n"
     "connect - connect to an SSL server\n"
+    "scan - check the SCTs served by many SSL servers concurrently\n"
     "upload - upload a submission to a CT log server\n"
     "certificate - make a superfluous proof certificate\n"
     "extension_data - convert an audit proof to TLS extension format\n"
@@ -128,6 +152,8 @@ using cert_trans::CertChain;
 using cert_trans::HTTPLogClient;
 using cert_trans::PreCertChain;
 using cert_trans::ReadPublicKey;
+using cert_trans::ResponseCache;
+using cert_trans::SSLScanner;
 using cert_trans::TbsCertificate;
 using ct::LogEntry;
 using ct::MerkleAuditProof;
@@ -160,6 +186,17 @@ static LogVerifier* GetLogVerifierFromFlags() {
                          new MerkleVerifier(new Sha256Hasher()));
 }
 
+// Returns NULL if no cache directory was specified.
+static ResponseCache* GetResponseCacheFromFlags() {
+  if (FLAGS_response_cache_dir.empty()) {
+    return nullptr;
+  }
+
+  static ResponseCache* const cache(new ResponseCache(
+      FLAGS_response_cache_dir, FLAGS_response_cache_max_bytes));
+  return cache;
+}
+
 // Adds the data to the cert as an extension, formatted as a single
 // ASN.1 octet string.
 static void AddOctetExtension(X509* cert, int nid, const unsigned char* data,
@@ -591,6 +628,118 @@ static SSLClient::HandshakeResult Connect() {
   return result;
 }
 
+static const char* ScanHandshakeResultString(
+    SSLScanner::HandshakeResult result) {
+  switch (result) {
+    case SSLScanner::OK:
+      return "OK";
+    case SSLScanner::SERVER_UNAVAILABLE:
+      return "SERVER_UNAVAILABLE";
+    case SSLScanner::HANDSHAKE_FAILED:
+      return "HANDSHAKE_FAILED";
+    case SSLScanner::TIMED_OUT:
+      return "TIMED_OUT";
+  }
+  return "UNKNOWN";
+}
+
+static const char* ScanSCTSourceString(SSLScanner::SCTSource source) {
+  switch (source) {
+    case SSLScanner::TLS_EXTENSION:
+      return "tls_extension";
+    case SSLScanner::OCSP_RESPONSE:
+      return "ocsp_response";
+    case SSLScanner::EMBEDDED:
+      return "embedded";
+  }
+  return "unknown";
+}
+
+// Prints one line per server, followed by one line per SCT it served.
+// Returns 0 if every server completed the handshake and served at least
+// one SCT which verified, 1 otherwise.
+static int Scan() {
+  CHECK(!FLAGS_scan_targets.empty()) << "Need --scan_targets";
+
+  string targets_data;
+  PCHECK(util::ReadTextFile(FLAGS_scan_targets, &targets_data))
+      << "Could not read " << FLAGS_scan_targets;
+  vector<SSLScanner::Target> targets;
+  std::istringstream targets_stream(targets_data);
+  string line;
+  while (std::getline(targets_stream, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    SSLScanner::Target target("", 0);
+    CHECK(SSLScanner::ParseTarget(line, &target)) << "Invalid target: "
+                                                  << line;
+    targets.push_back(target);
+  }
+
+  vector<LogVerifier*> logs;
+  if (!FLAGS_ct_server_public_key.empty()) {
+    logs.push_back(GetLogVerifierFromFlags());
+  }
+  std::istringstream keys_stream(FLAGS_scan_log_public_keys);
+  string key_file;
+  while (std::getline(keys_stream, key_file, ',')) {
+    if (key_file.empty()) {
+      continue;
+    }
+    StatusOr<EVP_PKEY*> pkey(ReadPublicKey(key_file));
+    CHECK(pkey.ok()) << "could not read log public key file " << key_file
+                     << ": " << pkey.status();
+    logs.push_back(new LogVerifier(new LogSigVerifier(pkey.ValueOrDie()),
+                                   new MerkleVerifier(new Sha256Hasher())));
+  }
+  CHECK(!logs.empty())
+      << "Need --ct_server_public_key or --scan_log_public_keys";
+
+  SSLScanner::Options options;
+  options.ca_dir = FLAGS_ssl_client_trusted_cert_dir;
+  options.max_concurrent_handshakes = FLAGS_scan_max_concurrent_handshakes;
+  options.handshake_timeout_ms = FLAGS_scan_handshake_timeout_ms;
+  options.verify_batch_size = FLAGS_scan_verify_batch_size;
+  SSLScanner scanner(options, logs);
+
+  // Servers may close the connection on us at any point.
+  signal(SIGPIPE, SIG_IGN);
+
+  SSLScanner::Stats stats;
+  const vector<SSLScanner::Result> results(scanner.Scan(targets, &stats));
+
+  int ret = 0;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    const SSLScanner::Result& result(results[i]);
+    std::cout << targets[i].host << ":" << targets[i].port << " "
+              << ScanHandshakeResultString(result.handshake)
+              << (result.chain_verified ? "" : " (chain not verified)")
+              << std::endl;
+    bool verified(false);
+    for (const SSLScanner::SCTResult& sct : result.scts) {
+      std::cout << "  " << ScanSCTSourceString(sct.source) << " "
+                << util::ToBase64(sct.sct.id().key_id()) << " "
+                << (sct.known_log
+                        ? LogVerifier::VerifyResultString(sct.result)
+                        : "Unknown log")
+                << std::endl;
+      verified |= sct.known_log && sct.result == LogVerifier::VERIFY_OK;
+    }
+    if (!verified) {
+      ret = 1;
+    }
+  }
+
+  LOG(INFO) << stats.handshakes << " handshakes (" << stats.failed_handshakes
+            << " failed) in " << stats.elapsed_seconds << " seconds, "
+            << stats.HandshakesPerSecond() << " per second";
+  LOG(INFO) << stats.verified_scts << " of " << stats.scts
+            << " SCTs verified, with " << stats.signature_verifications
+            << " signature verifications";
+  return ret;
+}
+
 enum AuditResult {
   // At least one SCT has a valid proof.
   // (Should be unusual to have more than one SCT from the same log,
@@ -628,7 +777,7 @@ static AuditResult Audit() {
     }
 
     MerkleAuditProof proof;
-    HTTPLogClient client(FLAGS_ct_server);
+    HTTPLogClient client(FLAGS_ct_server, GetResponseCacheFromFlags());
 
     LOG(INFO) << "info = " << ct_data.attached_sct_info(i).DebugString();
     AsyncLogClient::Status ret =
@@ -666,7 +815,7 @@ static AuditResult Audit() {
 }
 
 static int CheckConsistency() {
-  HTTPLogClient client(FLAGS_ct_server);
+  HTTPLogClient client(FLAGS_ct_server, GetResponseCacheFromFlags());
   LogVerifier* verifier = GetLogVerifierFromFlags();
 
   string sth1_str;
@@ -847,7 +996,7 @@ static void WriteCertificate(const std::string& cert, int entry,
 
 void GetEntries() {
   CHECK_NE(FLAGS_ct_server, "");
-  HTTPLogClient client(FLAGS_ct_server);
+  HTTPLogClient client(FLAGS_ct_server, GetResponseCacheFromFlags());
   std::vector<AsyncLogClient::Entry> entries;
   AsyncLogClient::Status error =
       client.GetEntries(FLAGS_get_first, FLAGS_get_last, &entries);
@@ -947,7 +1096,7 @@ int Monitor() {
   CHECK_NE(FLAGS_monitor_action, "");
   CHECK_NE(FLAGS_ct_server, "");
 
-  HTTPLogClient client(FLAGS_ct_server);
+  HTTPLogClient client(FLAGS_ct_server, GetResponseCacheFromFlags());
   monitor::Monitor monitor(GetMonitorDBFromFlags(), GetLogVerifierFromFlags(),
                            &client, FLAGS_monitor_sleep_time_secs);
 
@@ -1005,6 +1154,8 @@ int main(int argc, char** argv) {
     if ((!want_fail && result != SSLClient::OK) ||
         (want_fail && result != SSLClient::HANDSHAKE_FAILED))
       ret = 1;
+  } else if (cmd == "scan") {
+    ret = Scan();
   } else if (cmd == "upload") {
     ret = Upload();
   } else if (cmd == "audit") {
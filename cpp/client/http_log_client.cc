@@ -19,6 +19,7 @@ using cert_trans::Cert;
 using cert_trans::CertChain;
 using cert_trans::HTTPLogClient;
 using cert_trans::PreCertChain;
+using cert_trans::ResponseCache;
 using ct::MerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
@@ -42,9 +43,13 @@ void DoneRequest(AsyncLogClient::Status status, AsyncLogClient::Status* retval,
 }  // namespace
 
 HTTPLogClient::HTTPLogClient(const string& server)
+    : HTTPLogClient(server, nullptr) {
+}
+
+HTTPLogClient::HTTPLogClient(const string& server, ResponseCache* cache)
     : base_(new libevent::Base()),
       fetcher_(base_.get()),
-      client_(base_.get(), &fetcher_, server) {
+      client_(base_.get(), &fetcher_, cache, server) {
 }
 
 AsyncLogClient::Status HTTPLogClient::UploadSubmission(
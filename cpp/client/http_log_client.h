@@ -14,12 +14,17 @@
 namespace cert_trans {
 
 class Cert;
+class ResponseCache;
 
 
 class HTTPLogClient {
  public:
   explicit HTTPLogClient(const std::string& server);
 
+  // See the corresponding AsyncLogClient constructor for how |cache|
+  // is used.
+  HTTPLogClient(const std::string& server, ResponseCache* cache);
+
   AsyncLogClient::Status UploadSubmission(const std::string& submission,
                                           bool pre,
                                           ct::SignedCertificateTimestamp* sct);
@@ -0,0 +1,232 @@
+#include "client/response_cache.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+#include "util/util.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::sort;
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<string>* response_cache_lookups(Counter<string>::New(
+    "response_cache_lookups", "result",
+    "Number of log client response cache lookups, by result (hit, miss)."));
+
+static Gauge<>* response_cache_size_bytes(
+    Gauge<>::New("response_cache_size_bytes",
+                 "Total size of the values in the log client response "
+                 "cache."));
+
+
+const size_t kSubdirLength = 2;
+const char kTmpPrefix[] = "tmp-";
+
+
+struct FoundEntry {
+  time_t mtime;
+  string hash;
+  int64_t size;
+};
+
+
+bool IsSubdirName(const string& name) {
+  return name.size() == kSubdirLength &&
+         name.find_first_not_of("0123456789abcdef") == string::npos;
+}
+
+
+void CreateMissingDirectory(const string& path) {
+  if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST) {
+    PLOG(WARNING) << "could not create response cache directory " << path;
+  }
+}
+
+
+}  // namespace
+
+
+ResponseCache::ResponseCache(const string& dir, int64_t max_bytes)
+    : dir_(dir), max_bytes_(max_bytes), size_bytes_(0) {
+  CHECK(!dir_.empty());
+  CHECK_GT(max_bytes_, 0);
+  CreateMissingDirectory(dir_);
+  LoadIndex();
+}
+
+
+bool ResponseCache::Lookup(const string& key, string* value) {
+  const string hash(util::HexString(Sha256Hasher::Sha256Digest(key)));
+  {
+    lock_guard<mutex> lock(lock_);
+    const auto it(index_.find(hash));
+    if (it == index_.end()) {
+      response_cache_lookups->Increment("miss");
+      return false;
+    }
+    lru_.splice(lru_.end(), lru_, it->second.lru_pos);
+  }
+
+  // The file might get evicted from under us, in which case this is
+  // just a miss.
+  const string path(FilePath(hash));
+  if (!util::ReadBinaryFile(path, value)) {
+    response_cache_lookups->Increment("miss");
+    return false;
+  }
+
+  // Record the use for the benefit of LoadIndex.
+  utimes(path.c_str(), nullptr);
+  response_cache_lookups->Increment("hit");
+  return true;
+}
+
+
+void ResponseCache::Insert(const string& key, const string& value) {
+  const string hash(util::HexString(Sha256Hasher::Sha256Digest(key)));
+  {
+    lock_guard<mutex> lock(lock_);
+    if (index_.find(hash) != index_.end()) {
+      return;
+    }
+  }
+
+  CreateMissingDirectory(dir_ + "/" + hash.substr(0, kSubdirLength));
+  const string tmp_file(
+      util::WriteTemporaryBinaryFile(dir_ + "/" + kTmpPrefix + "XXXXXX",
+                                     value));
+  if (tmp_file.empty()) {
+    LOG(WARNING) << "could not write to response cache in " << dir_;
+    return;
+  }
+  if (rename(tmp_file.c_str(), FilePath(hash).c_str()) != 0) {
+    PLOG(WARNING) << "could not rename " << tmp_file;
+    unlink(tmp_file.c_str());
+    return;
+  }
+
+  lock_guard<mutex> lock(lock_);
+  // Another thread might have inserted the same key concurrently, in
+  // which case it wrote the same contents.
+  if (index_.find(hash) == index_.end()) {
+    AddLocked(hash, value.size());
+    EvictLocked();
+  }
+}
+
+
+int64_t ResponseCache::size_bytes() const {
+  lock_guard<mutex> lock(lock_);
+  return size_bytes_;
+}
+
+
+string ResponseCache::FilePath(const string& hash) const {
+  return dir_ + "/" + hash.substr(0, kSubdirLength) + "/" +
+         hash.substr(kSubdirLength);
+}
+
+
+void ResponseCache::LoadIndex() {
+  vector<FoundEntry> found;
+
+  DIR* const dir(opendir(dir_.c_str()));
+  if (!dir) {
+    PLOG(WARNING) << "could not open response cache directory " << dir_;
+    return;
+  }
+
+  struct dirent* subdir_entry;
+  while ((subdir_entry = readdir(dir)) != nullptr) {
+    const string name(subdir_entry->d_name);
+    if (name.compare(0, strlen(kTmpPrefix), kTmpPrefix) == 0) {
+      // Left over from an interrupted Insert.
+      unlink((dir_ + "/" + name).c_str());
+      continue;
+    }
+    if (!IsSubdirName(name)) {
+      continue;
+    }
+
+    const string subdir_path(dir_ + "/" + name);
+    DIR* const subdir(opendir(subdir_path.c_str()));
+    if (!subdir) {
+      continue;
+    }
+
+    struct dirent* file_entry;
+    while ((file_entry = readdir(subdir)) != nullptr) {
+      const string file_name(file_entry->d_name);
+      struct stat st;
+      if (file_name[0] == '.' ||
+          stat((subdir_path + "/" + file_name).c_str(), &st) != 0 ||
+          !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      found.push_back(FoundEntry{st.st_mtime, name + file_name, st.st_size});
+    }
+    closedir(subdir);
+  }
+  closedir(dir);
+
+  // Oldest first, so that they end up at the front of the LRU list.
+  sort(found.begin(), found.end(),
+       [](const FoundEntry& a, const FoundEntry& b) {
+         return a.mtime < b.mtime;
+       });
+
+  lock_guard<mutex> lock(lock_);
+  for (const auto& entry : found) {
+    AddLocked(entry.hash, entry.size);
+  }
+  EvictLocked();
+
+  LOG(INFO) << "response cache in " << dir_ << " has " << index_.size()
+            << " entries (" << size_bytes_ << " bytes)";
+}
+
+
+void ResponseCache::AddLocked(const string& hash, int64_t size) {
+  CacheEntry& entry(index_[hash]);
+  entry.size = size;
+  entry.lru_pos = lru_.insert(lru_.end(), hash);
+  size_bytes_ += size;
+  response_cache_size_bytes->Set(size_bytes_);
+}
+
+
+void ResponseCache::EvictLocked() {
+  while (size_bytes_ > max_bytes_ && !lru_.empty()) {
+    const string& hash(lru_.front());
+    const auto it(index_.find(hash));
+    CHECK(it != index_.end());
+
+    VLOG(1) << "evicting response cache entry " << hash;
+    if (unlink(FilePath(hash).c_str()) != 0 && errno != ENOENT) {
+      PLOG(WARNING) << "could not delete response cache entry " << hash;
+    }
+    size_bytes_ -= it->second.size;
+    index_.erase(it);
+    lru_.pop_front();
+  }
+  response_cache_size_bytes->Set(size_bytes_);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,69 @@
+#ifndef CERT_TRANS_CLIENT_RESPONSE_CACHE_H_
+#define CERT_TRANS_CLIENT_RESPONSE_CACHE_H_
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// An on-disk, content-addressed cache of log server responses, to be
+// used only for responses that can never change (entries, and proofs
+// at a fixed tree size).
+//
+// Keys are hashed with SHA-256, and each value is stored in its own
+// file, under a subdirectory named after the first byte of the
+// hash. Files are written atomically, so a crash at most loses an
+// entry. When the total size of the values exceeds |max_bytes|, the
+// least recently used entries are deleted. Recency survives restarts
+// through the modification time of the files.
+//
+// Errors reading or writing the cache are logged and otherwise
+// treated as cache misses.
+//
+// This class is thread-safe.
+class ResponseCache {
+ public:
+  ResponseCache(const std::string& dir, int64_t max_bytes);
+
+  // Returns true and sets |value| if |key| is in the cache.
+  bool Lookup(const std::string& key, std::string* value);
+
+  // Does nothing if |key| is already in the cache.
+  void Insert(const std::string& key, const std::string& value);
+
+  int64_t size_bytes() const;
+
+ private:
+  struct CacheEntry {
+    int64_t size;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  std::string FilePath(const std::string& hash) const;
+  void LoadIndex();
+  void AddLocked(const std::string& hash, int64_t size);
+  void EvictLocked();
+
+  const std::string dir_;
+  const int64_t max_bytes_;
+
+  mutable std::mutex lock_;
+  // Indexed by the hex-encoded hash of the key. The front of |lru_|
+  // is the least recently used entry.
+  std::map<std::string, CacheEntry> index_;
+  std::list<std::string> lru_;
+  int64_t size_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ResponseCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_CLIENT_RESPONSE_CACHE_H_
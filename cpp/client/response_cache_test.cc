@@ -0,0 +1,117 @@
+#include "client/response_cache.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+
+using std::string;
+using std::unique_ptr;
+
+const char kKey1[] = "http://example.com/ct/v1/get-entries?start=0&end=9";
+const char kKey2[] = "http://example.com/ct/v1/get-entries?start=10&end=19";
+const char kKey3[] = "http://example.com/ct/v1/get-entries?start=20&end=29";
+
+
+class ResponseCacheTest : public ::testing::Test {
+ protected:
+  ResponseCacheTest()
+      : dir_(util::CreateTemporaryDirectory("/tmp/response_cache_testXXXXXX")) {
+  }
+
+  const string dir_;
+};
+
+
+TEST_F(ResponseCacheTest, Miss) {
+  ResponseCache cache(dir_, 1024);
+  string value;
+  EXPECT_FALSE(cache.Lookup(kKey1, &value));
+}
+
+
+TEST_F(ResponseCacheTest, InsertAndLookup) {
+  ResponseCache cache(dir_, 1024);
+  cache.Insert(kKey1, "value1");
+  cache.Insert(kKey2, string("value\0two", 9));
+
+  string value;
+  ASSERT_TRUE(cache.Lookup(kKey1, &value));
+  EXPECT_EQ("value1", value);
+  ASSERT_TRUE(cache.Lookup(kKey2, &value));
+  EXPECT_EQ(string("value\0two", 9), value);
+  EXPECT_FALSE(cache.Lookup(kKey3, &value));
+  EXPECT_EQ(15, cache.size_bytes());
+}
+
+
+TEST_F(ResponseCacheTest, InsertExistingIsNoop) {
+  ResponseCache cache(dir_, 1024);
+  cache.Insert(kKey1, "value1");
+  cache.Insert(kKey1, "other");
+
+  string value;
+  ASSERT_TRUE(cache.Lookup(kKey1, &value));
+  EXPECT_EQ("value1", value);
+  EXPECT_EQ(6, cache.size_bytes());
+}
+
+
+TEST_F(ResponseCacheTest, PersistsAcrossInstances) {
+  {
+    ResponseCache cache(dir_, 1024);
+    cache.Insert(kKey1, "value1");
+  }
+
+  ResponseCache cache(dir_, 1024);
+  EXPECT_EQ(6, cache.size_bytes());
+  string value;
+  ASSERT_TRUE(cache.Lookup(kKey1, &value));
+  EXPECT_EQ("value1", value);
+}
+
+
+TEST_F(ResponseCacheTest, EvictsLeastRecentlyUsed) {
+  ResponseCache cache(dir_, 12);
+  cache.Insert(kKey1, "value1");
+  cache.Insert(kKey2, "value2");
+
+  string value;
+  ASSERT_TRUE(cache.Lookup(kKey1, &value));
+  cache.Insert(kKey3, "value3");
+
+  EXPECT_EQ(12, cache.size_bytes());
+  EXPECT_TRUE(cache.Lookup(kKey1, &value));
+  EXPECT_FALSE(cache.Lookup(kKey2, &value));
+  EXPECT_TRUE(cache.Lookup(kKey3, &value));
+
+  // The eviction must also have happened on disk.
+  ResponseCache reloaded(dir_, 12);
+  EXPECT_EQ(12, reloaded.size_bytes());
+  EXPECT_FALSE(reloaded.Lookup(kKey2, &value));
+}
+
+
+TEST_F(ResponseCacheTest, EvictsOnLoad) {
+  {
+    ResponseCache cache(dir_, 1024);
+    cache.Insert(kKey1, "value1");
+    cache.Insert(kKey2, "value2");
+  }
+
+  ResponseCache cache(dir_, 6);
+  EXPECT_EQ(6, cache.size_bytes());
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,312 @@
+#include "client/response_parser.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <iterator>
+
+#include "proto/serializer.h"
+#include "util/json_reader.h"
+
+using ct::DigitallySigned;
+using ct::ShortMerkleAuditProof;
+using ct::SignedCertificateTimestamp;
+using ct::SignedTreeHead;
+using std::back_inserter;
+using std::move;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+// Buffers reused from one entry to the next, to avoid allocating
+// memory for every field of every entry.
+struct EntryBuffers {
+  string key;
+  string leaf_input;
+  string extra_data;
+  string sct;
+};
+
+
+bool ParseEntry(JsonReader* reader, EntryBuffers* buffers,
+                AsyncLogClient::Entry* entry) {
+  bool have_leaf_input(false), have_extra_data(false), have_sct(false);
+  reader->BeginObject();
+  while (reader->NextMember(&buffers->key)) {
+    if (buffers->key == "leaf_input") {
+      have_leaf_input = reader->ReadBase64(&buffers->leaf_input);
+    } else if (buffers->key == "extra_data") {
+      have_extra_data = reader->ReadBase64(&buffers->extra_data);
+    } else if (buffers->key == "sct") {
+      // This is an optional non-standard extension, used only by the
+      // log internally when running in clustered mode.
+      have_sct = reader->ReadBase64(&buffers->sct);
+    } else {
+      reader->SkipValue();
+    }
+  }
+  if (!reader->ok() || !have_leaf_input || !have_extra_data) {
+    return false;
+  }
+
+  if (Deserializer::DeserializeMerkleTreeLeaf(buffers->leaf_input,
+                                              &entry->leaf) !=
+      Deserializer::OK) {
+    return false;
+  }
+
+  if (have_sct) {
+    unique_ptr<SignedCertificateTimestamp> sct(new SignedCertificateTimestamp);
+    if (Deserializer::DeserializeSCT(buffers->sct, sct.get()) !=
+        Deserializer::OK) {
+      return false;
+    }
+    entry->sct = move(sct);
+  }
+
+  if (entry->leaf.timestamped_entry().entry_type() == ct::X509_ENTRY) {
+    Deserializer::DeserializeX509Chain(buffers->extra_data,
+                                       entry->entry.mutable_x509_entry());
+  } else if (entry->leaf.timestamped_entry().entry_type() ==
+             ct::PRECERT_ENTRY) {
+    Deserializer::DeserializePrecertChainEntry(
+        buffers->extra_data, entry->entry.mutable_precert_entry());
+  } else {
+    LOG(FATAL) << "Don't understand entry type: "
+               << entry->leaf.timestamped_entry().entry_type();
+  }
+
+  return true;
+}
+
+
+// Reads an array of base64-encoded strings.
+bool ReadBase64Array(JsonReader* reader, vector<string>* values) {
+  values->clear();
+  reader->BeginArray();
+  while (reader->NextElement()) {
+    values->emplace_back();
+    reader->ReadBase64(&values->back());
+  }
+  return reader->ok();
+}
+
+
+// Parses a get-entries response, and its (non-standard) range proof
+// if |range_proof| is not NULL.
+bool ParseEntriesResponse(const string& body,
+                          vector<AsyncLogClient::Entry>* entries,
+                          vector<string>* range_proof) {
+  JsonReader reader(body);
+  EntryBuffers buffers;
+  vector<AsyncLogClient::Entry> new_entries;
+  vector<string> proof;
+  bool have_entries(false), have_proof(false);
+
+  reader.BeginObject();
+  string key;
+  while (reader.NextMember(&key)) {
+    if (range_proof && key == "range_proof") {
+      have_proof = ReadBase64Array(&reader, &proof);
+      continue;
+    }
+    if (key != "entries") {
+      reader.SkipValue();
+      continue;
+    }
+
+    have_entries = true;
+    new_entries.clear();
+    reader.BeginArray();
+    while (reader.NextElement()) {
+      new_entries.emplace_back();
+      if (!ParseEntry(&reader, &buffers, &new_entries.back())) {
+        return false;
+      }
+    }
+  }
+  if (!reader.Finish() || !have_entries || (range_proof && !have_proof)) {
+    return false;
+  }
+
+  entries->reserve(entries->size() + new_entries.size());
+  move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
+  if (range_proof) {
+    range_proof->swap(proof);
+  }
+
+  return true;
+}
+
+
+}  // namespace
+
+
+bool ParseGetEntriesResponse(const string& body,
+                             vector<AsyncLogClient::Entry>* entries) {
+  return ParseEntriesResponse(body, entries, nullptr);
+}
+
+
+bool ParseGetEntriesAndProofResponse(const string& body,
+                                     vector<AsyncLogClient::Entry>* entries,
+                                     vector<string>* range_proof) {
+  return ParseEntriesResponse(body, entries, CHECK_NOTNULL(range_proof));
+}
+
+
+bool ParseGetSTHResponse(const string& body, SignedTreeHead* sth) {
+  JsonReader reader(body);
+  int64_t tree_size(-1), timestamp(-1);
+  string root_hash, signature;
+  bool have_root_hash(false), have_signature(false);
+
+  reader.BeginObject();
+  string key;
+  while (reader.NextMember(&key)) {
+    if (key == "tree_size") {
+      reader.ReadInt(&tree_size);
+    } else if (key == "timestamp") {
+      reader.ReadInt(&timestamp);
+    } else if (key == "sha256_root_hash") {
+      have_root_hash = reader.ReadBase64(&root_hash);
+    } else if (key == "tree_head_signature") {
+      have_signature = reader.ReadBase64(&signature);
+    } else {
+      reader.SkipValue();
+    }
+  }
+  if (!reader.Finish() || tree_size < 0 || timestamp < 0 || !have_root_hash ||
+      !have_signature) {
+    return false;
+  }
+
+  DigitallySigned ds;
+  if (Deserializer::DeserializeDigitallySigned(signature, &ds) !=
+      Deserializer::OK) {
+    return false;
+  }
+
+  sth->Clear();
+  sth->set_version(ct::V1);
+  sth->set_tree_size(tree_size);
+  sth->set_timestamp(timestamp);
+  sth->set_sha256_root_hash(root_hash);
+  sth->mutable_signature()->Swap(&ds);
+
+  return true;
+}
+
+
+bool ParseGetProofByHashResponse(const string& body, int64_t* leaf_index,
+                                 vector<string>* audit_path) {
+  JsonReader reader(body);
+  int64_t index(-1);
+  vector<string> path;
+  bool have_path(false);
+
+  reader.BeginObject();
+  string key;
+  while (reader.NextMember(&key)) {
+    if (key == "leaf_index") {
+      reader.ReadInt(&index);
+    } else if (key == "audit_path") {
+      have_path = ReadBase64Array(&reader, &path);
+    } else {
+      reader.SkipValue();
+    }
+  }
+  if (!reader.Finish() || index < 0 || !have_path) {
+    return false;
+  }
+
+  *leaf_index = index;
+  audit_path->swap(path);
+
+  return true;
+}
+
+
+bool ParseGetProofsResponse(const string& body,
+                            vector<ShortMerkleAuditProof>* proofs) {
+  JsonReader reader(body);
+  vector<ShortMerkleAuditProof> new_proofs;
+  vector<string> path;
+  bool have_proofs(false);
+
+  reader.BeginObject();
+  string key;
+  while (reader.NextMember(&key)) {
+    if (key != "proofs") {
+      reader.SkipValue();
+      continue;
+    }
+
+    have_proofs = true;
+    new_proofs.clear();
+    reader.BeginArray();
+    while (reader.NextElement()) {
+      int64_t index(-1);
+      bool have_path(false);
+      reader.BeginObject();
+      while (reader.NextMember(&key)) {
+        if (key == "leaf_index") {
+          reader.ReadInt(&index);
+        } else if (key == "audit_path") {
+          have_path = ReadBase64Array(&reader, &path);
+        } else {
+          reader.SkipValue();
+        }
+      }
+      if (!reader.ok() || index < 0 || !have_path) {
+        return false;
+      }
+
+      new_proofs.emplace_back();
+      new_proofs.back().set_leaf_index(index);
+      for (auto& node : path) {
+        new_proofs.back().add_path_node()->swap(node);
+      }
+    }
+  }
+  if (!reader.Finish() || !have_proofs) {
+    return false;
+  }
+
+  proofs->reserve(proofs->size() + new_proofs.size());
+  move(new_proofs.begin(), new_proofs.end(), back_inserter(*proofs));
+
+  return true;
+}
+
+
+bool ParseGetSTHConsistencyResponse(const string& body,
+                                    vector<string>* proof) {
+  JsonReader reader(body);
+  vector<string> nodes;
+  bool have_nodes(false);
+
+  reader.BeginObject();
+  string key;
+  while (reader.NextMember(&key)) {
+    if (key == "consistency") {
+      have_nodes = ReadBase64Array(&reader, &nodes);
+    } else {
+      reader.SkipValue();
+    }
+  }
+  if (!reader.Finish() || !have_nodes) {
+    return false;
+  }
+
+  proof->reserve(proof->size() + nodes.size());
+  move(nodes.begin(), nodes.end(), back_inserter(*proof));
+
+  return true;
+}
+
+
+}  // namespace cert_trans
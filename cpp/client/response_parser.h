@@ -0,0 +1,54 @@
+#ifndef CERT_TRANS_CLIENT_RESPONSE_PARSER_H_
+#define CERT_TRANS_CLIENT_RESPONSE_PARSER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "client/async_log_client.h"
+#include "proto/ct.pb.h"
+
+namespace cert_trans {
+
+
+// Parsers for the bodies of the responses to the CT API requests that
+// are made in bulk (see RFC 6962, section 4). They use JsonReader
+// rather than JsonObject, decoding the base64 fields straight out of
+// the response, without building a DOM.
+//
+// They all return false if the response is malformed, in which case
+// their output is left untouched.
+
+// Parses a get-entries response. This does not clear |entries| before
+// appending the retrieved entries.
+bool ParseGetEntriesResponse(const std::string& body,
+                             std::vector<AsyncLogClient::Entry>* entries);
+
+// Parses a (non-standard) get-entries-and-proof response. This does
+// not clear |entries| before appending the retrieved entries, but
+// replaces the contents of |range_proof|.
+bool ParseGetEntriesAndProofResponse(
+    const std::string& body, std::vector<AsyncLogClient::Entry>* entries,
+    std::vector<std::string>* range_proof);
+
+// Parses a get-sth response. The version of |sth| is set to V1.
+bool ParseGetSTHResponse(const std::string& body, ct::SignedTreeHead* sth);
+
+// Parses a get-proof-by-hash response.
+bool ParseGetProofByHashResponse(const std::string& body, int64_t* leaf_index,
+                                 std::vector<std::string>* audit_path);
+
+// Parses a (non-standard) get-proofs response. This does not clear
+// |proofs| before appending to it.
+bool ParseGetProofsResponse(const std::string& body,
+                            std::vector<ct::ShortMerkleAuditProof>* proofs);
+
+// Parses a get-sth-consistency response. This does not clear |proof|
+// before appending to it.
+bool ParseGetSTHConsistencyResponse(const std::string& body,
+                                    std::vector<std::string>* proof);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_CLIENT_RESPONSE_PARSER_H_
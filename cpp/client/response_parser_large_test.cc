@@ -0,0 +1,193 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "client/response_parser.h"
+#include "proto/serializer.h"
+#include "util/json_wrapper.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+DEFINE_int32(entries_per_page, 1000,
+             "Number of entries in the get-entries responses to parse.");
+DEFINE_int32(parse_iterations, 20,
+             "Number of times to parse the get-entries response with each "
+             "parser.");
+
+namespace cert_trans {
+namespace {
+
+using ct::SignedCertificateTimestamp;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+
+string RandomBytes(size_t length) {
+  string retval(length, '\0');
+  for (size_t i = 0; i < length; ++i) {
+    retval[i] = rand() & 0xff;
+  }
+  return retval;
+}
+
+
+// Builds a get-entries response the same way as the server does.
+string MakeGetEntriesResponse(int num_entries) {
+  JsonArray json_entries;
+  for (int i = 0; i < num_entries; ++i) {
+    string leaf_input;
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeV1CertSCTMerkleTreeLeaf(
+                 1400000000000 + i, RandomBytes(1200), "", &leaf_input));
+
+    ct::X509ChainEntry chain;
+    chain.add_certificate_chain(RandomBytes(1100));
+    chain.add_certificate_chain(RandomBytes(900));
+    string extra_data;
+    CHECK_EQ(Serializer::OK,
+             Serializer::SerializeX509Chain(chain, &extra_data));
+
+    SignedCertificateTimestamp sct;
+    sct.set_version(ct::V1);
+    sct.mutable_id()->set_key_id(RandomBytes(32));
+    sct.set_timestamp(1400000000000 + i);
+    sct.mutable_signature()->set_hash_algorithm(
+        ct::DigitallySigned::SHA256);
+    sct.mutable_signature()->set_sig_algorithm(ct::DigitallySigned::ECDSA);
+    sct.mutable_signature()->set_signature(RandomBytes(71));
+    string sct_data;
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCT(sct, &sct_data));
+
+    JsonObject json_entry;
+    json_entry.AddBase64("leaf_input", leaf_input);
+    json_entry.AddBase64("extra_data", extra_data);
+    json_entry.AddBase64("sct", sct_data);
+    json_entries.Add(&json_entry);
+  }
+
+  JsonObject json_reply;
+  json_reply.Add("entries", json_entries);
+  return json_reply.ToString();
+}
+
+
+// How AsyncLogClient used to parse get-entries responses, for
+// comparison.
+bool ParseWithJsonObject(const string& body,
+                         vector<AsyncLogClient::Entry>* entries) {
+  JsonObject jresponse(body);
+  if (!jresponse.Ok())
+    return false;
+
+  JsonArray jentries(jresponse, "entries");
+  if (!jentries.Ok())
+    return false;
+
+  for (int n = 0; n < jentries.Length(); ++n) {
+    JsonObject entry(jentries, n);
+    JsonString leaf_input(entry, "leaf_input");
+    JsonString extra_data(entry, "extra_data");
+    JsonString sct_data(entry, "sct");
+    if (!entry.Ok() || !leaf_input.Ok() || !extra_data.Ok()) {
+      return false;
+    }
+
+    AsyncLogClient::Entry log_entry;
+    if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input.FromBase64(),
+                                                &log_entry.leaf) !=
+        Deserializer::OK) {
+      return false;
+    }
+
+    if (sct_data.Ok()) {
+      log_entry.sct.reset(new SignedCertificateTimestamp);
+      if (Deserializer::DeserializeSCT(sct_data.FromBase64(),
+                                       log_entry.sct.get()) !=
+          Deserializer::OK) {
+        return false;
+      }
+    }
+
+    Deserializer::DeserializeX509Chain(extra_data.FromBase64(),
+                                       log_entry.entry.mutable_x509_entry());
+    entries->emplace_back(std::move(log_entry));
+  }
+
+  return true;
+}
+
+
+class ResponseParserLargeTest : public ::testing::Test {
+ protected:
+  ResponseParserLargeTest()
+      : response_(MakeGetEntriesResponse(FLAGS_entries_per_page)) {
+  }
+
+  void LogThroughput(const string& parser, uint64_t elapsed_ms) {
+    const int original_log_level(FLAGS_minloglevel);
+    FLAGS_minloglevel = 0;
+    LOG(INFO) << parser << ": " << FLAGS_parse_iterations << " pages of "
+              << FLAGS_entries_per_page << " entries (" << response_.size()
+              << " bytes) in " << elapsed_ms << " ms ("
+              << (elapsed_ms > 0
+                      ? response_.size() * FLAGS_parse_iterations /
+                            elapsed_ms / 1000
+                      : 0)
+              << " MB/s)";
+    FLAGS_minloglevel = original_log_level;
+  }
+
+  const string response_;
+};
+
+
+TEST_F(ResponseParserLargeTest, MatchesJsonObject) {
+  vector<AsyncLogClient::Entry> expected, entries;
+  ASSERT_TRUE(ParseWithJsonObject(response_, &expected));
+  ASSERT_TRUE(ParseGetEntriesResponse(response_, &entries));
+
+  ASSERT_EQ(expected.size(), entries.size());
+  ASSERT_EQ(static_cast<size_t>(FLAGS_entries_per_page), entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    EXPECT_EQ(expected[i].leaf.SerializeAsString(),
+              entries[i].leaf.SerializeAsString());
+    EXPECT_EQ(expected[i].entry.SerializeAsString(),
+              entries[i].entry.SerializeAsString());
+    ASSERT_TRUE(entries[i].sct);
+    EXPECT_EQ(expected[i].sct->SerializeAsString(),
+              entries[i].sct->SerializeAsString());
+  }
+}
+
+
+TEST_F(ResponseParserLargeTest, GetEntriesThroughput) {
+  uint64_t start(util::TimeInMilliseconds());
+  for (int i = 0; i < FLAGS_parse_iterations; ++i) {
+    vector<AsyncLogClient::Entry> entries;
+    ASSERT_TRUE(ParseWithJsonObject(response_, &entries));
+  }
+  LogThroughput("JsonObject", util::TimeInMilliseconds() - start);
+
+  start = util::TimeInMilliseconds();
+  for (int i = 0; i < FLAGS_parse_iterations; ++i) {
+    vector<AsyncLogClient::Entry> entries;
+    ASSERT_TRUE(ParseGetEntriesResponse(response_, &entries));
+  }
+  LogThroughput("JsonReader", util::TimeInMilliseconds() - start);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
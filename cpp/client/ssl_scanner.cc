@@ -0,0 +1,530 @@
+#include "client/ssl_scanner.h"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <netdb.h>
+#include <openssl/ocsp.h>
+#include <openssl/x509.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log/cert.h"
+#include "log/cert_submission_handler.h"
+#include "log/ct_extensions.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/serializer.h"
+#include "util/openssl_util.h"
+
+using ct::LogEntry;
+using ct::SignedCertificateTimestamp;
+using ct::SignedCertificateTimestampList;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+
+const uint16_t kCTExtensionType = 18;
+// The OCSP single response extension carrying SCTs (RFC 6962, 3.3).
+const char kOcspSCTListOID[] = "1.3.6.1.4.1.11129.2.4.5";
+
+
+// The index of the Connection of an SSL object in its extra data.
+int ConnectionIndex() {
+  static const int index(
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr));
+  return index;
+}
+
+
+// Returns the SCT list of the first single response which has one in
+// a DER-encoded OCSP response, or an empty string if there is none.
+// Servers only staple the response for their own certificate, so
+// there is no need to match its ID.
+string OcspSCTList(const unsigned char* der, long length) {
+  const unique_ptr<OCSP_RESPONSE, void (*)(OCSP_RESPONSE*)> response(
+      d2i_OCSP_RESPONSE(nullptr, &der, length), OCSP_RESPONSE_free);
+  if (!response) {
+    LOG_OPENSSL_ERRORS(WARNING);
+    return string();
+  }
+  const unique_ptr<OCSP_BASICRESP, void (*)(OCSP_BASICRESP*)> basic(
+      OCSP_response_get1_basic(response.get()), OCSP_BASICRESP_free);
+  if (!basic) {
+    util::ClearOpenSSLErrors();
+    return string();
+  }
+  const unique_ptr<ASN1_OBJECT, void (*)(ASN1_OBJECT*)> oid(
+      CHECK_NOTNULL(OBJ_txt2obj(kOcspSCTListOID, 1)), ASN1_OBJECT_free);
+
+  for (int i = 0; i < OCSP_resp_count(basic.get()); ++i) {
+    OCSP_SINGLERESP* const single(OCSP_resp_get0(basic.get(), i));
+    const int ext_index(
+        OCSP_SINGLERESP_get_ext_by_OBJ(single, oid.get(), -1));
+    if (ext_index < 0) {
+      continue;
+    }
+
+    // The extension value is an OCTET STRING wrapping the SCT list.
+    const ASN1_OCTET_STRING* const value(X509_EXTENSION_get_data(
+        OCSP_SINGLERESP_get_ext(single, ext_index)));
+    const unsigned char* data(value->data);
+    const unique_ptr<ASN1_OCTET_STRING, void (*)(ASN1_OCTET_STRING*)> inner(
+        d2i_ASN1_OCTET_STRING(nullptr, &data, value->length),
+        ASN1_OCTET_STRING_free);
+    if (!inner) {
+      LOG_OPENSSL_ERRORS(WARNING);
+      return string();
+    }
+    return string(reinterpret_cast<const char*>(inner->data),
+                  inner->length);
+  }
+
+  return string();
+}
+
+
+}  // namespace
+
+
+struct SSLScanner::Connection {
+  Connection() : result(nullptr), fd(-1), connecting(true), ssl(nullptr) {
+  }
+
+  ~Connection() {
+    if (ssl) {
+      SSL_free(ssl);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  Result* result;
+  int fd;
+  bool connecting;
+  SSL* ssl;
+  short events;
+  steady_clock::time_point deadline;
+
+  // Filled in by the callbacks during the handshake.
+  string tls_extension;
+  // The chain as built by OpenSSL, up to the trusted root if it could
+  // be verified.
+  unique_ptr<CertChain> chain;
+};
+
+
+SSLScanner::SSLScanner(const Options& options,
+                       const vector<LogVerifier*>& logs)
+    : options_(options), ctx_(SSL_CTX_new(SSLv23_client_method())) {
+  CHECK_LT(0, options_.max_concurrent_handshakes);
+  CHECK_LT(0, options_.handshake_timeout_ms);
+  CHECK_LT(0, options_.verify_batch_size);
+  for (LogVerifier* const log : logs) {
+    logs_[log->KeyID()].reset(log);
+  }
+
+  CHECK_NOTNULL(ctx_);
+  SSL_CTX_set_options(ctx_, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+#ifdef SSL_CTX_set_max_proto_version
+  CHECK_EQ(1, SSL_CTX_set_max_proto_version(ctx_, TLS1_2_VERSION));
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  // Audit servers however weak their configuration is.
+  SSL_CTX_set_security_level(ctx_, 0);
+#endif
+
+  SSL_CTX_set_verify(ctx_, SSL_VERIFY_PEER, NULL);
+  if (!options_.ca_dir.empty()) {
+    CHECK_EQ(1, SSL_CTX_load_verify_locations(ctx_, NULL,
+                                              options_.ca_dir.c_str()))
+        << "Unable to load trusted CA certificates.";
+  } else {
+    LOG(WARNING) << "No trusted CA certificates given.";
+  }
+  SSL_CTX_set_cert_verify_callback(ctx_, &VerifyCallback, NULL);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  CHECK_EQ(1, SSL_CTX_add_client_custom_ext(ctx_, kCTExtensionType, NULL,
+                                            NULL, NULL, &ExtensionCallback,
+                                            NULL));
+#else
+  LOG(WARNING) << "OpenSSL version is too low to check the Certificate "
+                  "Transparency TLS extension";
+#endif
+}
+
+
+SSLScanner::~SSLScanner() {
+  SSL_CTX_free(ctx_);
+}
+
+
+vector<SSLScanner::Result> SSLScanner::Scan(const vector<Target>& targets,
+                                            Stats* stats) {
+  vector<Result> results(targets.size());
+  Stats scan_stats;
+  const steady_clock::time_point start(steady_clock::now());
+
+  vector<unique_ptr<Connection>> active;
+  size_t next(0);
+  while (next < targets.size() || !active.empty()) {
+    while (next < targets.size() &&
+           static_cast<int>(active.size()) <
+               options_.max_concurrent_handshakes) {
+      unique_ptr<Connection> conn(new Connection);
+      conn->result = &results[next];
+      if (StartConnection(targets[next], conn.get())) {
+        active.emplace_back(std::move(conn));
+      } else {
+        ++scan_stats.failed_handshakes;
+      }
+      ++next;
+    }
+    if (active.empty()) {
+      continue;
+    }
+
+    vector<pollfd> fds(active.size());
+    steady_clock::time_point earliest(steady_clock::time_point::max());
+    for (size_t i = 0; i < active.size(); ++i) {
+      fds[i].fd = active[i]->fd;
+      fds[i].events = active[i]->events;
+      fds[i].revents = 0;
+      earliest = std::min(earliest, active[i]->deadline);
+    }
+    const int64_t timeout_ms(std::max<int64_t>(
+        0, duration_cast<milliseconds>(earliest - steady_clock::now())
+                   .count() +
+               1));
+    if (poll(fds.data(), fds.size(), timeout_ms) < 0) {
+      PCHECK(errno == EINTR) << "poll";
+      continue;
+    }
+
+    const steady_clock::time_point now(steady_clock::now());
+    vector<unique_ptr<Connection>> still_active;
+    for (size_t i = 0; i < active.size(); ++i) {
+      Connection* const conn(active[i].get());
+      bool done(false);
+      if (fds[i].revents != 0) {
+        done = ContinueHandshake(conn);
+      }
+      if (!done && now >= conn->deadline) {
+        conn->result->handshake = TIMED_OUT;
+        done = true;
+      }
+
+      if (!done) {
+        still_active.emplace_back(std::move(active[i]));
+      } else if (conn->result->handshake == OK) {
+        ++scan_stats.handshakes;
+        CollectSCTs(conn);
+      } else {
+        ++scan_stats.failed_handshakes;
+      }
+    }
+    active.swap(still_active);
+
+    if (static_cast<int>(pending_.size()) >= options_.verify_batch_size) {
+      VerifyBatch(&scan_stats);
+    }
+  }
+  VerifyBatch(&scan_stats);
+
+  scan_stats.elapsed_seconds =
+      duration<double>(steady_clock::now() - start).count();
+  VLOG(1) << targets.size() << " servers scanned in "
+          << scan_stats.elapsed_seconds << " seconds ("
+          << scan_stats.HandshakesPerSecond() << " handshakes per second)";
+  if (stats) {
+    stats->handshakes += scan_stats.handshakes;
+    stats->failed_handshakes += scan_stats.failed_handshakes;
+    stats->scts += scan_stats.scts;
+    stats->verified_scts += scan_stats.verified_scts;
+    stats->signature_verifications += scan_stats.signature_verifications;
+    stats->elapsed_seconds += scan_stats.elapsed_seconds;
+  }
+
+  return results;
+}
+
+
+// static
+bool SSLScanner::ParseTarget(const string& str, Target* target) {
+  const size_t colon(str.rfind(':'));
+  if (colon == string::npos || colon == 0) {
+    return false;
+  }
+  string host(str.substr(0, colon));
+  if (host[0] == '[') {
+    if (host.size() < 3 || host[host.size() - 1] != ']') {
+      return false;
+    }
+    host = host.substr(1, host.size() - 2);
+  }
+
+  const string port_str(str.substr(colon + 1));
+  char* end;
+  const long port(strtol(port_str.c_str(), &end, 10));
+  if (port_str.empty() || *end != '\0' || port <= 0 || port > 65535) {
+    return false;
+  }
+
+  target->host = host;
+  target->port = port;
+  return true;
+}
+
+
+bool SSLScanner::StartConnection(const Target& target, Connection* conn) {
+  addrinfo hints = {};
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addr;
+  const int gai_error(getaddrinfo(target.host.c_str(),
+                                  to_string(target.port).c_str(), &hints,
+                                  &addr));
+  if (gai_error != 0) {
+    LOG(WARNING) << "Invalid address " << target.host << ": "
+                 << gai_strerror(gai_error);
+    return false;
+  }
+  const unique_ptr<addrinfo, void (*)(addrinfo*)> addr_deleter(addr,
+                                                               freeaddrinfo);
+
+  conn->fd = socket(addr->ai_family, SOCK_STREAM, IPPROTO_TCP);
+  if (conn->fd < 0) {
+    PLOG(WARNING) << "Socket creation failed";
+    return false;
+  }
+  PCHECK(fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK) ==
+         0);
+  if (connect(conn->fd, addr->ai_addr, addr->ai_addrlen) != 0 &&
+      errno != EINPROGRESS) {
+    PLOG(WARNING) << "Connection to " << target.host << ":" << target.port
+                  << " failed";
+    return false;
+  }
+
+  conn->ssl = CHECK_NOTNULL(SSL_new(ctx_));
+  CHECK_EQ(1, SSL_set_fd(conn->ssl, conn->fd));
+  CHECK_EQ(1, SSL_set_ex_data(conn->ssl, ConnectionIndex(), conn));
+  SSL_set_tlsext_status_type(conn->ssl, TLSEXT_STATUSTYPE_ocsp);
+  SSL_set_connect_state(conn->ssl);
+
+  // The socket becomes writable once connected.
+  conn->connecting = true;
+  conn->events = POLLOUT;
+  conn->deadline =
+      steady_clock::now() + milliseconds(options_.handshake_timeout_ms);
+  return true;
+}
+
+
+bool SSLScanner::ContinueHandshake(Connection* conn) {
+  if (conn->connecting) {
+    int error;
+    socklen_t error_len(sizeof(error));
+    PCHECK(getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) ==
+           0);
+    if (error != 0) {
+      VLOG(1) << "Connection failed: " << strerror(error);
+      conn->result->handshake = SERVER_UNAVAILABLE;
+      return true;
+    }
+    conn->connecting = false;
+  }
+
+  const int ret(SSL_do_handshake(conn->ssl));
+  if (ret == 1) {
+    conn->result->handshake = OK;
+    return true;
+  }
+
+  switch (SSL_get_error(conn->ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+      conn->events = POLLIN;
+      return false;
+    case SSL_ERROR_WANT_WRITE:
+      conn->events = POLLOUT;
+      return false;
+    default:
+      VLOG(1) << "SSL handshake failed: " << util::DumpOpenSSLErrorStack();
+      util::ClearOpenSSLErrors();
+      conn->result->handshake = HANDSHAKE_FAILED;
+      return true;
+  }
+}
+
+
+void SSLScanner::CollectSCTs(Connection* conn) {
+  if (!conn->chain || !conn->chain->IsLoaded()) {
+    LOG(WARNING) << "No certificate chain to verify SCTs against";
+    return;
+  }
+  const Cert* const leaf(conn->chain->LeafCert());
+
+  // The SCTs delivered over TLS and OCSP are for the certificate
+  // itself, the embedded ones for its precertificate.
+  const shared_ptr<LogEntry> x509_entry(make_shared<LogEntry>());
+  x509_entry->set_type(ct::X509_ENTRY);
+  string der_cert;
+  if (leaf->DerEncoding(&der_cert) != Cert::TRUE) {
+    LOG(WARNING) << "Failed to encode the leaf certificate";
+    return;
+  }
+  x509_entry->mutable_x509_entry()->set_leaf_certificate(der_cert);
+
+  vector<std::pair<SCTSource, string>> sct_lists;
+  if (!conn->tls_extension.empty()) {
+    sct_lists.emplace_back(TLS_EXTENSION, conn->tls_extension);
+  }
+  unsigned char* ocsp;
+  const long ocsp_length(SSL_get_tlsext_status_ocsp_resp(conn->ssl, &ocsp));
+  if (ocsp && ocsp_length > 0) {
+    const string ocsp_scts(OcspSCTList(ocsp, ocsp_length));
+    if (!ocsp_scts.empty()) {
+      sct_lists.emplace_back(OCSP_RESPONSE, ocsp_scts);
+    }
+  }
+  shared_ptr<LogEntry> precert_entry;
+  if (leaf->HasExtension(NID_ctEmbeddedSignedCertificateTimestampList) ==
+      Cert::TRUE) {
+    string embedded_scts;
+    precert_entry = make_shared<LogEntry>();
+    if (leaf->OctetStringExtensionData(
+            NID_ctEmbeddedSignedCertificateTimestampList, &embedded_scts) !=
+            Cert::TRUE ||
+        !CertSubmissionHandler::X509ChainToEntry(*conn->chain,
+                                                 precert_entry.get())) {
+      LOG(WARNING) << "Failed to reconstruct the precertificate entry";
+    } else {
+      sct_lists.emplace_back(EMBEDDED, embedded_scts);
+    }
+  }
+
+  const string x509_hash(
+      Sha256Hasher::Sha256Digest(x509_entry->SerializeAsString()));
+  const string precert_hash(
+      precert_entry
+          ? Sha256Hasher::Sha256Digest(precert_entry->SerializeAsString())
+          : string());
+  for (const auto& sct_list : sct_lists) {
+    SignedCertificateTimestampList list;
+    if (Deserializer::DeserializeSCTList(sct_list.second, &list) !=
+        Deserializer::OK) {
+      VLOG(1) << "Failed to parse SCT list from source " << sct_list.first;
+      continue;
+    }
+    for (int i = 0; i < list.sct_list_size(); ++i) {
+      SCTResult sct_result;
+      sct_result.source = sct_list.first;
+      if (Deserializer::DeserializeSCT(list.sct_list(i), &sct_result.sct) !=
+          Deserializer::OK) {
+        VLOG(1) << "Skipping SCT which could not be decoded";
+        continue;
+      }
+      sct_result.known_log = false;
+      sct_result.result = LogVerifier::INVALID_FORMAT;
+      conn->result->scts.push_back(sct_result);
+
+      PendingVerification pending;
+      pending.result = conn->result;
+      pending.index = conn->result->scts.size() - 1;
+      const bool embedded(sct_list.first == EMBEDDED);
+      pending.entry = embedded ? precert_entry : x509_entry;
+      pending.entry_hash = embedded ? precert_hash : x509_hash;
+      pending.token = list.sct_list(i);
+      pending_.push_back(pending);
+    }
+  }
+}
+
+
+void SSLScanner::VerifyBatch(Stats* stats) {
+  for (const PendingVerification& pending : pending_) {
+    SCTResult* const sct_result(&pending.result->scts[pending.index]);
+    ++stats->scts;
+    const string& key_id(sct_result->sct.id().key_id());
+    const auto log(logs_.find(key_id));
+    if (log == logs_.end()) {
+      continue;
+    }
+    sct_result->known_log = true;
+
+    const string cache_key(key_id + pending.entry_hash + pending.token);
+    const auto cached(verify_cache_.find(cache_key));
+    if (cached != verify_cache_.end()) {
+      sct_result->result = cached->second;
+    } else {
+      ++stats->signature_verifications;
+      sct_result->result = log->second->VerifySignedCertificateTimestamp(
+          *pending.entry, sct_result->sct, nullptr);
+      verify_cache_[cache_key] = sct_result->result;
+    }
+    if (sct_result->result == LogVerifier::VERIFY_OK) {
+      ++stats->verified_scts;
+    }
+  }
+  pending_.clear();
+}
+
+
+// static
+int SSLScanner::ExtensionCallback(SSL* ssl, unsigned ext_type,
+                                  const unsigned char* in, size_t inlen,
+                                  int* al, void* arg) {
+  CHECK_EQ(ext_type, kCTExtensionType);
+  Connection* const conn(
+      static_cast<Connection*>(SSL_get_ex_data(ssl, ConnectionIndex())));
+  CHECK_NOTNULL(conn)->tls_extension.assign(
+      reinterpret_cast<const char*>(in), inlen);
+  return 1;
+}
+
+
+// static
+int SSLScanner::VerifyCallback(X509_STORE_CTX* store_ctx, void* arg) {
+  SSL* const ssl(static_cast<SSL*>(X509_STORE_CTX_get_ex_data(
+      store_ctx, SSL_get_ex_data_X509_STORE_CTX_idx())));
+  Connection* const conn(
+      static_cast<Connection*>(SSL_get_ex_data(ssl, ConnectionIndex())));
+  CHECK_NOTNULL(conn);
+
+  conn->result->chain_verified = X509_verify_cert(store_ctx) == 1;
+  util::ClearOpenSSLErrors();
+
+  // On failure, this is as much of the chain as could be built, which
+  // is at least the leaf.
+  STACK_OF(X509)* const chain(X509_STORE_CTX_get1_chain(store_ctx));
+  conn->chain.reset(new CertChain);
+  if (chain) {
+    for (int i = 0; i < sk_X509_num(chain); ++i) {
+      conn->chain->AddCert(new Cert(X509_dup(sk_X509_value(chain, i))));
+    }
+    sk_X509_pop_free(chain, X509_free);
+  }
+
+  // Carry on regardless, to audit the SCTs of servers with invalid
+  // chains too.
+  return 1;
+}
+
+
+}  // namespace cert_trans
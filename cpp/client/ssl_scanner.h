@@ -0,0 +1,171 @@
+#ifndef CERT_TRANS_CLIENT_SSL_SCANNER_H_
+#define CERT_TRANS_CLIENT_SSL_SCANNER_H_
+
+#include <map>
+#include <memory>
+#include <openssl/ssl.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/log_verifier.h"
+#include "proto/ct.pb.h"
+
+namespace cert_trans {
+
+
+// Audits the delivery of SCTs by many TLS servers at once. Unlike
+// SSLClient, which does one blocking handshake at a time, this keeps
+// many non-blocking handshakes in flight, collects the SCTs of each
+// server from all three delivery mechanisms (TLS extension, stapled
+// OCSP response and certificate extension), and verifies them in
+// batches once the handshakes are done. Verification results are
+// cached by certificate and SCT, so that a fleet serving the same
+// certificate costs a single signature verification per SCT.
+//
+// The handshakes are capped at TLS 1.2, where the SCT TLS extension
+// is in the ServerHello.
+//
+// Servers closing the connection mid-handshake raise SIGPIPE, which
+// callers should ignore.
+//
+// This class is thread-compatible.
+class SSLScanner {
+ public:
+  struct Options {
+    Options()
+        : max_concurrent_handshakes(100),
+          handshake_timeout_ms(10000),
+          verify_batch_size(1000) {
+    }
+
+    // Trusted root certificates, in OpenSSL "hash format". Failing to
+    // verify the certificate chain does not stop the scan, it is
+    // reported in Result::chain_verified.
+    std::string ca_dir;
+    int max_concurrent_handshakes;
+    int handshake_timeout_ms;
+    // Number of completed handshakes whose SCTs are verified together.
+    int verify_batch_size;
+  };
+
+  struct Target {
+    Target(const std::string& h, uint16_t p) : host(h), port(p) {
+    }
+
+    // A numeric IPv4 or IPv6 address.
+    std::string host;
+    uint16_t port;
+  };
+
+  enum HandshakeResult {
+    OK,
+    SERVER_UNAVAILABLE,
+    HANDSHAKE_FAILED,
+    TIMED_OUT,
+  };
+
+  enum SCTSource {
+    TLS_EXTENSION,
+    OCSP_RESPONSE,
+    EMBEDDED,
+  };
+
+  struct SCTResult {
+    SCTSource source;
+    ct::SignedCertificateTimestamp sct;
+    // False if none of the log keys has the key ID of the SCT, in
+    // which case |result| is meaningless.
+    bool known_log;
+    LogVerifier::VerifyResult result;
+  };
+
+  struct Result {
+    Result() : handshake(SERVER_UNAVAILABLE), chain_verified(false) {
+    }
+
+    HandshakeResult handshake;
+    bool chain_verified;
+    // One per SCT which could be decoded, in the order they were
+    // received.
+    std::vector<SCTResult> scts;
+  };
+
+  struct Stats {
+    Stats()
+        : handshakes(0),
+          failed_handshakes(0),
+          scts(0),
+          verified_scts(0),
+          signature_verifications(0),
+          elapsed_seconds(0) {
+    }
+
+    double HandshakesPerSecond() const {
+      return elapsed_seconds > 0 ? handshakes / elapsed_seconds : 0;
+    }
+
+    // Successful handshakes.
+    int64_t handshakes;
+    int64_t failed_handshakes;
+    int64_t scts;
+    int64_t verified_scts;
+    // The SCTs not served from the verification cache.
+    int64_t signature_verifications;
+    double elapsed_seconds;
+  };
+
+  // Takes ownership of the verifiers, which have the known log keys.
+  SSLScanner(const Options& options, const std::vector<LogVerifier*>& logs);
+  ~SSLScanner();
+
+  // Returns the result of each of |targets|, in the same order, and
+  // adds to |stats| if it is not NULL.
+  std::vector<Result> Scan(const std::vector<Target>& targets,
+                           Stats* stats);
+
+  // Parses "<host>:<port>", where an IPv6 host is in brackets.
+  static bool ParseTarget(const std::string& str, Target* target);
+
+ private:
+  struct Connection;
+
+  // An SCT waiting to be verified, as Result::scts[index] of |result|.
+  struct PendingVerification {
+    Result* result;
+    size_t index;
+    std::shared_ptr<const ct::LogEntry> entry;
+    // Identifies |entry| in the verification cache.
+    std::string entry_hash;
+    std::string token;
+  };
+
+  // Starts connecting to |target|, returns false if it failed straight
+  // away.
+  bool StartConnection(const Target& target, Connection* conn);
+  // Returns true once the handshake is over, one way or the other.
+  bool ContinueHandshake(Connection* conn);
+  void CollectSCTs(Connection* conn);
+  void VerifyBatch(Stats* stats);
+
+  static int ExtensionCallback(SSL* ssl, unsigned ext_type,
+                               const unsigned char* in, size_t inlen,
+                               int* al, void* arg);
+  static int VerifyCallback(X509_STORE_CTX* store_ctx, void* arg);
+
+  const Options options_;
+  std::map<std::string, std::unique_ptr<LogVerifier>> logs_;
+  SSL_CTX* const ctx_;
+
+  std::vector<PendingVerification> pending_;
+  // Indexed by key ID, leaf hash and SCT.
+  std::map<std::string, LogVerifier::VerifyResult> verify_cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(SSLScanner);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_CLIENT_SSL_SCANNER_H_
@@ -0,0 +1,465 @@
+#include "client/ssl_scanner.h"
+
+#include <arpa/inet.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <netinet/in.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ocsp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "log/ct_extensions.h"
+#include "log/log_signer.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/serializer.h"
+#include "util/read_key.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using ct::SignedCertificateTimestampList;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+const char kCaCert[] = "ca-cert.pem";
+const char kLeafCert[] = "test-cert.pem";
+const char kLeafKey[] = "test-key.pem";
+const char kLeafSCT[] = "test-cert.proof";
+const char kEmbeddedCert[] = "test-embedded-cert.pem";
+const char kEmbeddedKey[] = "test-embedded-key.pem";
+const char kLogKey[] = "ct-server-key-public.pem";
+const char kOtherLogKey[] = "google-ct-pilot-server-key-public.pem";
+// For signing the stapled OCSP responses.
+const char kCaKey[] = "ca-key.pem";
+const char kCaKeyPassword[] = "password1";
+
+
+X509* ReadCert(const string& pem) {
+  BIO* const bio(BIO_new_mem_buf(const_cast<char*>(pem.data()), pem.size()));
+  X509* const cert(PEM_read_bio_X509(bio, nullptr, nullptr, nullptr));
+  BIO_free(bio);
+  return CHECK_NOTNULL(cert);
+}
+
+
+EVP_PKEY* ReadKey(const string& pem, const char* password = nullptr) {
+  BIO* const bio(BIO_new_mem_buf(const_cast<char*>(pem.data()), pem.size()));
+  EVP_PKEY* const key(PEM_read_bio_PrivateKey(
+      bio, nullptr, nullptr, const_cast<char*>(password)));
+  BIO_free(bio);
+  return CHECK_NOTNULL(key);
+}
+
+
+// Returns a DER-encoded OCSP response for |leaf|, signed by |issuer|,
+// with |sct_list| in the extension of its single response.
+string MakeOcspResponse(X509* leaf, X509* issuer, EVP_PKEY* issuer_key,
+                        const string& sct_list) {
+  OCSP_BASICRESP* const basic(OCSP_BASICRESP_new());
+  ASN1_TIME* const now(X509_gmtime_adj(nullptr, 0));
+  OCSP_SINGLERESP* const single(OCSP_basic_add1_status(
+      basic, OCSP_cert_to_id(EVP_sha1(), leaf, issuer),
+      V_OCSP_CERTSTATUS_GOOD, 0, nullptr, now, now));
+  CHECK_NOTNULL(single);
+
+  ASN1_OCTET_STRING* const inner(ASN1_OCTET_STRING_new());
+  CHECK_EQ(1, ASN1_OCTET_STRING_set(
+                  inner, reinterpret_cast<const unsigned char*>(
+                             sct_list.data()),
+                  sct_list.size()));
+  unsigned char* inner_der(nullptr);
+  const int inner_length(i2d_ASN1_OCTET_STRING(inner, &inner_der));
+  ASN1_OCTET_STRING* const value(ASN1_OCTET_STRING_new());
+  CHECK_EQ(1, ASN1_OCTET_STRING_set(value, inner_der, inner_length));
+  ASN1_OBJECT* const oid(OBJ_txt2obj("1.3.6.1.4.1.11129.2.4.5", 1));
+  X509_EXTENSION* const ext(
+      X509_EXTENSION_create_by_OBJ(nullptr, oid, 0, value));
+  CHECK_EQ(1, OCSP_SINGLERESP_add_ext(single, ext, -1));
+
+  CHECK_EQ(1, OCSP_basic_sign(basic, issuer, issuer_key, EVP_sha256(),
+                              nullptr, 0));
+  OCSP_RESPONSE* const response(
+      OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic));
+  unsigned char* der(nullptr);
+  const int der_length(i2d_OCSP_RESPONSE(response, &der));
+  const string result(reinterpret_cast<char*>(der), der_length);
+
+  OPENSSL_free(der);
+  OCSP_RESPONSE_free(response);
+  X509_EXTENSION_free(ext);
+  ASN1_OBJECT_free(oid);
+  ASN1_OCTET_STRING_free(value);
+  OPENSSL_free(inner_der);
+  ASN1_OCTET_STRING_free(inner);
+  ASN1_TIME_free(now);
+  OCSP_BASICRESP_free(basic);
+  return result;
+}
+
+
+// A TLS server on the loopback interface, doing one handshake at a
+// time, and optionally sending SCTs in the TLS extension and in a
+// stapled OCSP response.
+class TestServer {
+ public:
+  TestServer(X509* cert, EVP_PKEY* key, const string& tls_sct_list,
+             const string& ocsp_response)
+      : ctx_(CHECK_NOTNULL(SSL_CTX_new(SSLv23_server_method()))),
+        ocsp_response_(ocsp_response),
+        listen_fd_(socket(AF_INET, SOCK_STREAM, 0)),
+        port_(0) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    // The test certificates are signed with SHA-1.
+    SSL_CTX_set_security_level(ctx_, 0);
+#endif
+    CHECK_EQ(1, SSL_CTX_use_certificate(ctx_, cert));
+    CHECK_EQ(1, SSL_CTX_use_PrivateKey(ctx_, key));
+    if (!tls_sct_list.empty()) {
+      // Extension type and length, followed by the data.
+      string serverinfo("\x00\x12", 2);
+      serverinfo.push_back(tls_sct_list.size() >> 8);
+      serverinfo.push_back(tls_sct_list.size() & 0xff);
+      serverinfo.append(tls_sct_list);
+      CHECK_EQ(1, SSL_CTX_use_serverinfo(
+                      ctx_, reinterpret_cast<const unsigned char*>(
+                                serverinfo.data()),
+                      serverinfo.size()));
+    }
+    if (!ocsp_response_.empty()) {
+      SSL_CTX_set_tlsext_status_cb(ctx_, &TestServer::StatusCallback);
+      SSL_CTX_set_tlsext_status_arg(ctx_, this);
+    }
+
+    PCHECK(listen_fd_ >= 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    PCHECK(bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+                sizeof(addr)) == 0);
+    PCHECK(listen(listen_fd_, 128) == 0);
+    socklen_t addr_len(sizeof(addr));
+    PCHECK(getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+                       &addr_len) == 0);
+    port_ = ntohs(addr.sin_port);
+
+    thread_.reset(new thread(&TestServer::Serve, this));
+  }
+
+  ~TestServer() {
+    // Makes accept() fail.
+    shutdown(listen_fd_, SHUT_RDWR);
+    thread_->join();
+    close(listen_fd_);
+    SSL_CTX_free(ctx_);
+  }
+
+  uint16_t port() const {
+    return port_;
+  }
+
+ private:
+  static int StatusCallback(SSL* ssl, void* arg) {
+    const string& response(static_cast<TestServer*>(arg)->ocsp_response_);
+    unsigned char* const copy(
+        static_cast<unsigned char*>(OPENSSL_malloc(response.size())));
+    memcpy(copy, response.data(), response.size());
+    SSL_set_tlsext_status_ocsp_resp(ssl, copy, response.size());
+    return SSL_TLSEXT_ERR_OK;
+  }
+
+  void Serve() {
+    while (true) {
+      const int fd(accept(listen_fd_, nullptr, nullptr));
+      if (fd < 0) {
+        return;
+      }
+      SSL* const ssl(SSL_new(ctx_));
+      SSL_set_fd(ssl, fd);
+      if (SSL_accept(ssl) == 1) {
+        SSL_shutdown(ssl);
+      }
+      ERR_clear_error();
+      SSL_free(ssl);
+      close(fd);
+    }
+  }
+
+  SSL_CTX* const ctx_;
+  const string ocsp_response_;
+  const int listen_fd_;
+  uint16_t port_;
+  unique_ptr<thread> thread_;
+};
+
+
+class SSLScannerTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    const string data_dir(FLAGS_test_srcdir + "/test/testdata");
+    string pem;
+    CHECK(util::ReadTextFile(data_dir + "/" + kCaCert, &pem))
+        << "Could not read test data from " << data_dir
+        << ". Wrong --test_srcdir?";
+    ca_.reset(ReadCert(pem));
+    CHECK(util::ReadTextFile(data_dir + "/" + kLeafCert, &pem));
+    leaf_.reset(ReadCert(pem));
+    CHECK(util::ReadTextFile(data_dir + "/" + kLeafKey, &pem));
+    leaf_key_.reset(ReadKey(pem));
+    CHECK(util::ReadTextFile(data_dir + "/" + kEmbeddedCert, &pem));
+    embedded_.reset(ReadCert(pem));
+    CHECK(util::ReadTextFile(data_dir + "/" + kEmbeddedKey, &pem));
+    embedded_key_.reset(ReadKey(pem));
+    CHECK(util::ReadTextFile(data_dir + "/" + kCaKey, &pem));
+    ca_key_.reset(ReadKey(pem, kCaKeyPassword));
+
+    string sct;
+    CHECK(util::ReadBinaryFile(data_dir + "/" + kLeafSCT, &sct));
+    SignedCertificateTimestampList list;
+    list.add_sct_list(sct);
+    CHECK_EQ(Serializer::OK, Serializer::SerializeSCTList(list, &sct_list_));
+
+    log_key_file_ = data_dir + "/" + kLogKey;
+    other_log_key_file_ = data_dir + "/" + kOtherLogKey;
+
+    // The trusted roots, in OpenSSL "hash format".
+    char ca_dir[] = "/tmp/ssl_scanner_test.XXXXXX";
+    CHECK_NOTNULL(mkdtemp(ca_dir));
+    ca_dir_ = ca_dir;
+    char hash_name[32];
+    snprintf(hash_name, sizeof(hash_name), "/%08lx.0",
+             X509_subject_name_hash(ca_.get()));
+    ca_file_ = ca_dir_ + hash_name;
+    FILE* const ca_file(fopen(ca_file_.c_str(), "w"));
+    PCHECK(ca_file);
+    CHECK_EQ(1, PEM_write_X509(ca_file, ca_.get()));
+    fclose(ca_file);
+  }
+
+  void TearDown() {
+    unlink(ca_file_.c_str());
+    rmdir(ca_dir_.c_str());
+  }
+
+  LogVerifier* NewVerifier(const string& key_file) {
+    util::StatusOr<EVP_PKEY*> pkey(ReadPublicKey(key_file));
+    CHECK(pkey.ok()) << pkey.status();
+    return new LogVerifier(new LogSigVerifier(pkey.ValueOrDie()),
+                           new MerkleVerifier(new Sha256Hasher()));
+  }
+
+  SSLScanner::Options ScannerOptions() const {
+    SSLScanner::Options options;
+    options.ca_dir = ca_dir_;
+    return options;
+  }
+
+  struct X509Deleter {
+    void operator()(X509* cert) const {
+      X509_free(cert);
+    }
+  };
+  struct PKeyDeleter {
+    void operator()(EVP_PKEY* key) const {
+      EVP_PKEY_free(key);
+    }
+  };
+
+  unique_ptr<X509, X509Deleter> ca_;
+  unique_ptr<EVP_PKEY, PKeyDeleter> ca_key_;
+  unique_ptr<X509, X509Deleter> leaf_;
+  unique_ptr<EVP_PKEY, PKeyDeleter> leaf_key_;
+  unique_ptr<X509, X509Deleter> embedded_;
+  unique_ptr<EVP_PKEY, PKeyDeleter> embedded_key_;
+  string sct_list_;
+  string log_key_file_;
+  string other_log_key_file_;
+  string ca_dir_;
+  string ca_file_;
+};
+
+
+TEST_F(SSLScannerTest, TLSExtensionAndOCSP) {
+  TestServer server(leaf_.get(), leaf_key_.get(), sct_list_,
+                    MakeOcspResponse(leaf_.get(), ca_.get(), ca_key_.get(),
+                                     sct_list_));
+  SSLScanner scanner(ScannerOptions(), {NewVerifier(log_key_file_)});
+
+  SSLScanner::Stats stats;
+  const vector<SSLScanner::Result> results(
+      scanner.Scan({SSLScanner::Target("127.0.0.1", server.port())}, &stats));
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ(SSLScanner::OK, results[0].handshake);
+  ASSERT_EQ(2U, results[0].scts.size());
+  EXPECT_EQ(SSLScanner::TLS_EXTENSION, results[0].scts[0].source);
+  EXPECT_EQ(SSLScanner::OCSP_RESPONSE, results[0].scts[1].source);
+  for (const auto& sct : results[0].scts) {
+    EXPECT_TRUE(sct.known_log);
+    EXPECT_EQ(LogVerifier::VERIFY_OK, sct.result);
+  }
+
+  EXPECT_EQ(1, stats.handshakes);
+  EXPECT_EQ(0, stats.failed_handshakes);
+  EXPECT_EQ(2, stats.scts);
+  EXPECT_EQ(2, stats.verified_scts);
+  // The same SCT for the same certificate is only verified once.
+  EXPECT_EQ(1, stats.signature_verifications);
+}
+
+
+TEST_F(SSLScannerTest, Embedded) {
+  TestServer server(embedded_.get(), embedded_key_.get(), string(),
+                    string());
+  SSLScanner scanner(ScannerOptions(), {NewVerifier(log_key_file_)});
+
+  const vector<SSLScanner::Result> results(scanner.Scan(
+      {SSLScanner::Target("127.0.0.1", server.port())}, nullptr));
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ(SSLScanner::OK, results[0].handshake);
+  ASSERT_EQ(1U, results[0].scts.size());
+  EXPECT_EQ(SSLScanner::EMBEDDED, results[0].scts[0].source);
+  EXPECT_TRUE(results[0].scts[0].known_log);
+  EXPECT_EQ(LogVerifier::VERIFY_OK, results[0].scts[0].result);
+}
+
+
+TEST_F(SSLScannerTest, UnknownLog) {
+  TestServer server(leaf_.get(), leaf_key_.get(), sct_list_, string());
+  SSLScanner scanner(ScannerOptions(), {NewVerifier(other_log_key_file_)});
+
+  SSLScanner::Stats stats;
+  const vector<SSLScanner::Result> results(
+      scanner.Scan({SSLScanner::Target("127.0.0.1", server.port())}, &stats));
+  ASSERT_EQ(1U, results.size());
+  EXPECT_EQ(SSLScanner::OK, results[0].handshake);
+  ASSERT_EQ(1U, results[0].scts.size());
+  EXPECT_FALSE(results[0].scts[0].known_log);
+  EXPECT_EQ(0, stats.verified_scts);
+  EXPECT_EQ(0, stats.signature_verifications);
+}
+
+
+TEST_F(SSLScannerTest, Unavailable) {
+  // A port nobody listens on.
+  uint16_t closed_port;
+  {
+    TestServer server(leaf_.get(), leaf_key_.get(), string(), string());
+    closed_port = server.port();
+  }
+
+  // A server which accepts connections (in the kernel), but never
+  // answers.
+  const int silent_fd(socket(AF_INET, SOCK_STREAM, 0));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  PCHECK(bind(silent_fd, reinterpret_cast<sockaddr*>(&addr),
+              sizeof(addr)) == 0);
+  PCHECK(listen(silent_fd, 16) == 0);
+  socklen_t addr_len(sizeof(addr));
+  PCHECK(getsockname(silent_fd, reinterpret_cast<sockaddr*>(&addr),
+                     &addr_len) == 0);
+
+  SSLScanner::Options options(ScannerOptions());
+  options.handshake_timeout_ms = 200;
+  SSLScanner scanner(options, {NewVerifier(log_key_file_)});
+  SSLScanner::Stats stats;
+  const vector<SSLScanner::Result> results(
+      scanner.Scan({SSLScanner::Target("127.0.0.1", closed_port),
+                    SSLScanner::Target("127.0.0.1", ntohs(addr.sin_port)),
+                    SSLScanner::Target("not-an-address", 443)},
+                   &stats));
+  close(silent_fd);
+
+  ASSERT_EQ(3U, results.size());
+  EXPECT_EQ(SSLScanner::SERVER_UNAVAILABLE, results[0].handshake);
+  EXPECT_EQ(SSLScanner::TIMED_OUT, results[1].handshake);
+  EXPECT_EQ(SSLScanner::SERVER_UNAVAILABLE, results[2].handshake);
+  EXPECT_EQ(0, stats.handshakes);
+  EXPECT_EQ(3, stats.failed_handshakes);
+}
+
+
+// Scans a fleet of servers serving the same certificate, more of
+// them than can be scanned concurrently.
+TEST_F(SSLScannerTest, Fleet) {
+  const int kServers(4);
+  const int kTargetsPerServer(25);
+  vector<unique_ptr<TestServer>> servers;
+  vector<SSLScanner::Target> targets;
+  for (int i = 0; i < kServers; ++i) {
+    servers.emplace_back(
+        new TestServer(leaf_.get(), leaf_key_.get(), sct_list_, string()));
+  }
+  for (int i = 0; i < kTargetsPerServer; ++i) {
+    for (const auto& server : servers) {
+      targets.emplace_back("127.0.0.1", server->port());
+    }
+  }
+
+  SSLScanner::Options options(ScannerOptions());
+  options.max_concurrent_handshakes = 16;
+  options.verify_batch_size = 10;
+  SSLScanner scanner(options, {NewVerifier(log_key_file_)});
+  SSLScanner::Stats stats;
+  const vector<SSLScanner::Result> results(scanner.Scan(targets, &stats));
+
+  ASSERT_EQ(targets.size(), results.size());
+  for (const auto& result : results) {
+    EXPECT_EQ(SSLScanner::OK, result.handshake);
+    ASSERT_EQ(1U, result.scts.size());
+    EXPECT_EQ(LogVerifier::VERIFY_OK, result.scts[0].result);
+  }
+  EXPECT_EQ(kServers * kTargetsPerServer, stats.handshakes);
+  EXPECT_EQ(kServers * kTargetsPerServer, stats.verified_scts);
+  EXPECT_EQ(1, stats.signature_verifications);
+  LOG(INFO) << stats.HandshakesPerSecond() << " handshakes per second";
+}
+
+
+TEST(SSLScannerParseTest, ParseTarget) {
+  SSLScanner::Target target("", 0);
+  EXPECT_TRUE(SSLScanner::ParseTarget("127.0.0.1:443", &target));
+  EXPECT_EQ("127.0.0.1", target.host);
+  EXPECT_EQ(443, target.port);
+  EXPECT_TRUE(SSLScanner::ParseTarget("[::1]:8443", &target));
+  EXPECT_EQ("::1", target.host);
+  EXPECT_EQ(8443, target.port);
+
+  EXPECT_FALSE(SSLScanner::ParseTarget("127.0.0.1", &target));
+  EXPECT_FALSE(SSLScanner::ParseTarget(":443", &target));
+  EXPECT_FALSE(SSLScanner::ParseTarget("127.0.0.1:", &target));
+  EXPECT_FALSE(SSLScanner::ParseTarget("127.0.0.1:0", &target));
+  EXPECT_FALSE(SSLScanner::ParseTarget("127.0.0.1:65536", &target));
+  EXPECT_FALSE(SSLScanner::ParseTarget("[::1:443", &target));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  signal(SIGPIPE, SIG_IGN);
+  SSL_library_init();
+  SSL_load_error_strings();
+  OpenSSL_add_all_algorithms();
+  cert_trans::LoadCtExtensions();
+  return RUN_ALL_TESTS();
+}
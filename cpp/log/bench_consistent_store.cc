@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <chrono>
+#include <event2/thread.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "log/etcd_consistent_store.h"
+#include "log/etcd_v3_consistent_store.h"
+#include "log/logged_certificate.h"
+#include "net/http2_url_fetcher.h"
+#include "net/url_fetcher.h"
+#include "util/etcd.h"
+#include "util/etcd_v3.h"
+#include "util/fake_etcd.h"
+#include "util/fake_etcd_v3.h"
+#include "util/libevent_wrapper.h"
+#include "util/masterelection.h"
+#include "util/sync_task.h"
+#include "util/thread_pool.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::ConsistentStore;
+using cert_trans::EntryHandle;
+using cert_trans::EtcdClient;
+using cert_trans::EtcdConsistentStore;
+using cert_trans::EtcdV3Client;
+using cert_trans::EtcdV3ConsistentStore;
+using cert_trans::FakeEtcdClient;
+using cert_trans::FakeEtcdV3Client;
+using cert_trans::GrpcEtcdV3Client;
+using cert_trans::Http2UrlFetcher;
+using cert_trans::LoggedCertificate;
+using cert_trans::MasterElection;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::SyncTask;
+
+DEFINE_string(store, "v3",
+              "Which ConsistentStore to benchmark: \"v2\" "
+              "(EtcdConsistentStore) or \"v3\" (EtcdV3ConsistentStore).");
+DEFINE_string(etcd, "127.0.0.1", "etcd server address");
+DEFINE_int32(etcd_port, 2379, "etcd server port");
+DEFINE_bool(fake_etcd, false,
+            "Use the in-process fake etcd for --store, instead of --etcd.");
+DEFINE_string(etcd_root, "/bench_consistent_store",
+              "etcd key under which to put the store, a new directory is "
+              "used for each run.");
+DEFINE_int32(num_entries, 1000, "number of pending entries to add");
+DEFINE_int32(bytes_per_entry, 1000, "size of the certificate of each entry");
+DEFINE_int32(sequence_batch_size, 100,
+             "number of entries to sequence per sequence mapping update");
+
+namespace {
+
+
+// Always master, with a fixed fencing token.
+class BenchElection : public MasterElection {
+ public:
+  void StartElection() override {
+  }
+
+  void StopElection() override {
+  }
+
+  bool WaitToBecomeMaster() const override {
+    return true;
+  }
+
+  bool IsMaster() const override {
+    return true;
+  }
+
+  int64_t FencingToken() const override {
+    return 1;
+  }
+};
+
+
+class Timer {
+ public:
+  Timer(const char* name, int64_t count)
+      : name_(name), count_(count), start_(steady_clock::now()) {
+  }
+
+  ~Timer() {
+    const double seconds(
+        duration<double>(steady_clock::now() - start_).count());
+    printf("%-24s %8lld in %8.3f seconds: %10.0f/s\n", name_,
+           static_cast<long long>(count_), seconds, count_ / seconds);
+  }
+
+ private:
+  const char* const name_;
+  const int64_t count_;
+  const steady_clock::time_point start_;
+};
+
+
+// The store needs an (empty) sequence mapping to start from, which is
+// created by whoever provisions the log, not by the store.
+void CreateSequenceMapping(libevent::Base* base, EtcdClient* etcd,
+                           EtcdV3Client* etcd_v3, const string& root) {
+  const string key(root + "/sequence_mapping");
+  SyncTask task(base);
+  if (etcd) {
+    EtcdClient::Response resp;
+    etcd->Create(key, "", &resp, task.task());
+    task.Wait();
+  } else {
+    etcdserverpb::TxnRequest req;
+    req.add_success()->mutable_request_put()->set_key(key);
+    etcdserverpb::TxnResponse resp;
+    etcd_v3->Txn(req, &resp, task.task());
+    task.Wait();
+  }
+  CHECK_EQ(Status::OK, task.status());
+}
+
+
+void Run(ConsistentStore<LoggedCertificate>* store) {
+  vector<string> hashes;
+  {
+    Timer timer("AddPendingEntry", FLAGS_num_entries);
+    const string padding(FLAGS_bytes_per_entry, 'x');
+    for (int i = 0; i < FLAGS_num_entries; ++i) {
+      LoggedCertificate cert;
+      cert.mutable_sct()->set_timestamp(i);
+      cert.mutable_entry()->set_type(ct::X509_ENTRY);
+      cert.mutable_entry()->mutable_x509_entry()->set_leaf_certificate(
+          to_string(i) + padding);
+      CHECK_EQ(Status::OK, store->AddPendingEntry(&cert));
+      hashes.emplace_back(cert.Hash());
+    }
+  }
+
+  {
+    Timer timer("GetPendingEntries", FLAGS_num_entries);
+    vector<EntryHandle<LoggedCertificate>> entries;
+    CHECK_EQ(Status::OK, store->GetPendingEntries(&entries));
+    CHECK_EQ(static_cast<size_t>(FLAGS_num_entries), entries.size());
+  }
+
+  {
+    Timer timer("UpdateSequenceMapping",
+                (FLAGS_num_entries + FLAGS_sequence_batch_size - 1) /
+                    FLAGS_sequence_batch_size);
+    for (int begin = 0; begin < FLAGS_num_entries;
+         begin += FLAGS_sequence_batch_size) {
+      EntryHandle<ct::SequenceMapping> mapping;
+      CHECK_EQ(Status::OK, store->GetSequenceMapping(&mapping));
+      for (int i = begin;
+           i < std::min(begin + FLAGS_sequence_batch_size, FLAGS_num_entries);
+           ++i) {
+        ct::SequenceMapping::Mapping* const m(
+            mapping.MutableEntry()->add_mapping());
+        m->set_sequence_number(i);
+        m->set_entry_hash(hashes[i]);
+      }
+      CHECK_EQ(Status::OK, store->UpdateSequenceMapping(&mapping));
+    }
+  }
+
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(1);
+  sth.set_tree_size(FLAGS_num_entries);
+  CHECK_EQ(Status::OK, store->SetServingSTH(sth));
+
+  {
+    Timer timer("CleanupOldEntries", FLAGS_num_entries);
+    const util::StatusOr<int64_t> cleaned(store->CleanupOldEntries());
+    CHECK_EQ(Status::OK, cleaned.status());
+    CHECK_EQ(FLAGS_num_entries, cleaned.ValueOrDie());
+  }
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  evthread_use_pthreads();
+
+  CHECK(FLAGS_store == "v2" || FLAGS_store == "v3") << FLAGS_store;
+  CHECK_GT(FLAGS_num_entries, 0);
+  CHECK_GE(FLAGS_bytes_per_entry, 0);
+  CHECK_GT(FLAGS_sequence_batch_size, 0);
+
+  const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
+  libevent::EventPumpThread pump(event_base);
+  ThreadPool executor(2);
+  BenchElection election;
+  const string root(
+      FLAGS_etcd_root + "/" +
+      to_string(system_clock::now().time_since_epoch().count()));
+
+  unique_ptr<UrlFetcher> fetcher;
+  unique_ptr<EtcdClient> etcd;
+  unique_ptr<EtcdV3Client> etcd_v3;
+  unique_ptr<ConsistentStore<LoggedCertificate>> store;
+  if (FLAGS_store == "v2") {
+    fetcher.reset(new UrlFetcher(event_base.get()));
+    etcd.reset(FLAGS_fake_etcd
+                   ? new FakeEtcdClient(event_base.get())
+                   : new EtcdClient(fetcher.get(), FLAGS_etcd,
+                                    FLAGS_etcd_port));
+    CreateSequenceMapping(event_base.get(), etcd.get(), nullptr, root);
+    store.reset(new EtcdConsistentStore<LoggedCertificate>(
+        event_base.get(), &executor, etcd.get(), &election, root, "bench"));
+  } else {
+    fetcher.reset(new Http2UrlFetcher(event_base.get()));
+    etcd_v3.reset(FLAGS_fake_etcd
+                      ? static_cast<EtcdV3Client*>(new FakeEtcdV3Client)
+                      : new GrpcEtcdV3Client(fetcher.get(), FLAGS_etcd,
+                                             FLAGS_etcd_port));
+    CreateSequenceMapping(event_base.get(), nullptr, etcd_v3.get(), root);
+    store.reset(new EtcdV3ConsistentStore<LoggedCertificate>(
+        event_base.get(), &executor, etcd_v3.get(), &election, root,
+        "bench"));
+  }
+
+  printf("%s store under %s, %d entries of %d bytes\n", FLAGS_store.c_str(),
+         root.c_str(), FLAGS_num_entries, FLAGS_bytes_per_entry);
+  Run(store.get());
+
+  store.reset();
+  return 0;
+}
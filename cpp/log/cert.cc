@@ -10,6 +10,7 @@
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <stdio.h>
 #include <string>
 #include <time.h>
 #include <vector>
@@ -149,6 +150,46 @@ string Cert::PrintNotAfter() const {
   return PrintTime(X509_get_notAfter(x509_));
 }
 
+Cert::Status Cert::NotAfter(uint64_t* result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return ERROR;
+  }
+
+  // Normalise UTCTime and GeneralizedTime alike to YYYYMMDDHHMMSSZ.
+  ASN1_GENERALIZEDTIME* const generalized(
+      ASN1_TIME_to_generalizedtime(X509_get_notAfter(x509_), NULL));
+  if (generalized == NULL) {
+    LOG(WARNING) << "Failed to decode notAfter";
+    LOG_OPENSSL_ERRORS(WARNING);
+    return FALSE;
+  }
+  const string time_str(reinterpret_cast<const char*>(generalized->data),
+                        generalized->length);
+  ASN1_GENERALIZEDTIME_free(generalized);
+
+  struct tm tm = {};
+  char zulu(0);
+  if (time_str.size() != 15 ||
+      sscanf(time_str.c_str(), "%4d%2d%2d%2d%2d%2d%c", &tm.tm_year,
+             &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+             &zulu) != 7 ||
+      zulu != 'Z') {
+    LOG(WARNING) << "Unexpected notAfter: " << time_str;
+    return FALSE;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  const time_t seconds(timegm(&tm));
+  if (seconds < 0) {
+    LOG(WARNING) << "notAfter before the epoch: " << time_str;
+    return FALSE;
+  }
+
+  *result = static_cast<uint64_t>(seconds) * 1000;
+  return TRUE;
+}
+
 string Cert::PrintSignatureAlgorithm() const {
   const char* sigalg = OBJ_nid2ln(X509_get_signature_nid(x509_));
   if (sigalg == NULL)
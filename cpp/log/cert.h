@@ -4,6 +4,7 @@
 #include <gtest/gtest_prod.h>
 #include <openssl/asn1.h>
 #include <openssl/x509.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -64,6 +65,13 @@ class Cert {
 
   Status IsIdenticalTo(const Cert& other) const;
 
+  // Sets the notAfter of the cert in |result|, in milliseconds since
+  // the epoch.
+  // Returns TRUE if the time could be decoded.
+  // Returns FALSE if the time is not a valid ASN.1 time.
+  // Returns ERROR if the cert is not loaded.
+  Status NotAfter(uint64_t* result) const;
+
   // Returns TRUE if the extension is present.
   // Returns FALSE if the extension is not present.
   // Returns ERROR if the cert is not loaded, extension_nid is not recognised
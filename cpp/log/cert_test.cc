@@ -229,6 +229,17 @@ TEST_F(CertTest, PrintNotAfter) {
   EXPECT_EQ("Jun  1 00:00:00 2022 GMT", leaf.PrintNotAfter());
 }
 
+TEST_F(CertTest, NotAfter) {
+  Cert leaf(leaf_pem_);
+  uint64_t not_after;
+  ASSERT_EQ(Cert::TRUE, leaf.NotAfter(&not_after));
+  // Jun  1 00:00:00 2022 GMT
+  EXPECT_EQ(1654041600000ULL, not_after);
+
+  Cert empty;
+  EXPECT_EQ(Cert::ERROR, empty.NotAfter(&not_after));
+}
+
 TEST_F(CertTest, PrintSignatureAlgorithm) {
   Cert leaf(leaf_pem_);
   EXPECT_EQ("sha1WithRSAEncryption", leaf.PrintSignatureAlgorithm());
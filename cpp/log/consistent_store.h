@@ -17,6 +17,8 @@ namespace cert_trans {
 
 template <class Logged>
 class EtcdConsistentStore;
+template <class Logged>
+class EtcdV3ConsistentStore;
 
 
 // Wraps an instance of |T| and associates it with a versioning handle
@@ -86,6 +88,8 @@ class EntryHandle {
 
   template <class Logged>
   friend class EtcdConsistentStore;
+  template <class Logged>
+  friend class EtcdV3ConsistentStore;
   friend class EtcdConsistentStoreTest;
 };
 
@@ -112,6 +116,8 @@ class ConsistentStore {
                                  updates)> ClusterNodeStateCallback;
   typedef std::function<void(const Update<ct::ClusterConfig>& update)>
       ClusterConfigCallback;
+  typedef std::function<void(const std::vector<Update<Logged>>& updates)>
+      PendingEntriesCallback;
 
   ConsistentStore() = default;
 
@@ -151,6 +157,12 @@ class ConsistentStore {
   virtual void WatchClusterConfig(const ClusterConfigCallback& cb,
                                   util::Task* task) = 0;
 
+  // Calls |cb| with the entries that were added, changed or removed,
+  // so that the sequencer can run as soon as new entries arrive. The
+  // first call has all the current entries.
+  virtual void WatchPendingEntries(const PendingEntriesCallback& cb,
+                                   util::Task* task) = 0;
+
   virtual util::Status SetClusterConfig(const ct::ClusterConfig& config) = 0;
 
   // Cleans up entries in the store according to the implementation's policy.
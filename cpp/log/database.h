@@ -6,8 +6,12 @@
 #include <glog/logging.h>
 #include <set>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "base/macros.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
 #include "proto/ct.pb.h"
 
 // The |Logged| class needs to provide this interface:
@@ -78,6 +82,15 @@ class ReadOnlyDatabase {
   virtual LookupResult LookupByIndex(int64_t sequence_number,
                                      Logged* result) const = 0;
 
+  // Look up the Merkle tree leaf hashes of the entries with sequence
+  // numbers in [|start|, |end|), and append them to |leaf_hashes| in
+  // order. This is much cheaper than looking up the entries
+  // themselves. If one of them is missing, return NOT_FOUND, having
+  // appended only the leaf hashes of the entries before it.
+  virtual LookupResult LookupLeafHashRange(
+      int64_t start, int64_t end,
+      std::vector<std::string>* leaf_hashes) const = 0;
+
   // Return the tree head with the freshest timestamp.
   virtual LookupResult LatestTreeHead(ct::SignedTreeHead* result) const = 0;
 
@@ -104,6 +117,10 @@ class ReadOnlyDatabase {
  protected:
   ReadOnlyDatabase() = default;
 
+  // The Merkle tree leaf hash of |logged|, for implementations that
+  // have to recompute it for entries stored without one.
+  static std::string ComputeLeafHash(const Logged& logged);
+
  private:
   DISALLOW_COPY_AND_ASSIGN(ReadOnlyDatabase);
 };
@@ -131,10 +148,22 @@ class Database : public ReadOnlyDatabase<Logged> {
 
   // Attempt to create a new entry with the status LOGGED.
   // Fail if an entry with this hash already exists.
+  // The Merkle tree leaf hash of the entry is computed here, once, and
+  // stored alongside it (see LookupLeafHashRange).
   WriteResult CreateSequencedEntry(const Logged& logged) {
+    return CreateSequencedEntry(logged,
+                                ReadOnlyDatabase<Logged>::ComputeLeafHash(
+                                    logged));
+  }
+
+  // Same as above, for callers that already have the Merkle tree leaf
+  // hash of |logged|.
+  WriteResult CreateSequencedEntry(const Logged& logged,
+                                   const std::string& leaf_hash) {
     CHECK(logged.has_sequence_number());
     CHECK_GE(logged.sequence_number(), 0);
-    return CreateSequencedEntry_(logged);
+    CHECK(!leaf_hash.empty());
+    return CreateSequencedEntry_(logged, leaf_hash);
   }
 
   // Attempt to write a tree head. Fails only if a tree head with this
@@ -151,7 +180,8 @@ class Database : public ReadOnlyDatabase<Logged> {
 
   // See the inline methods with similar names defined above for more
   // documentation.
-  virtual WriteResult CreateSequencedEntry_(const Logged& logged) = 0;
+  virtual WriteResult CreateSequencedEntry_(const Logged& logged,
+                                            const std::string& leaf_hash) = 0;
   virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) = 0;
 
  private:
@@ -159,6 +189,15 @@ class Database : public ReadOnlyDatabase<Logged> {
 };
 
 
+template <class Logged>
+std::string ReadOnlyDatabase<Logged>::ComputeLeafHash(const Logged& logged) {
+  static const TreeHasher* const hasher(new TreeHasher(new Sha256Hasher));
+  std::string serialized_leaf;
+  CHECK(logged.SerializeForLeaf(&serialized_leaf));
+  return hasher->HashLeaf(serialized_leaf);
+}
+
+
 namespace cert_trans {
 
 
@@ -1,7 +1,9 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include <gtest/gtest.h>
+#include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "log/database.h"
 #include "log/file_db.h"
@@ -59,7 +61,7 @@ TYPED_TEST(DBTest, CreateSequenced) {
             this->db()->LookupByHash(logged_cert.Hash(), &lookup_cert));
   TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
 
-  lookup_cert.Clear();
+  lookup_cert = LoggedCertificate();
   EXPECT_EQ(DB::LOOKUP_OK,
             this->db()->LookupByIndex(logged_cert.sequence_number(),
                                       &lookup_cert));
@@ -92,7 +94,7 @@ TYPED_TEST(DBTest, CreateSequencedDuplicateEntry) {
   // Check that we get the original entry back.
   TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
 
-  lookup_cert.Clear();
+  lookup_cert = LoggedCertificate();
   EXPECT_EQ(DB::LOOKUP_OK,
             this->db()->LookupByIndex(logged_cert.sequence_number(),
                                       &lookup_cert));
@@ -121,13 +123,13 @@ TYPED_TEST(DBTest, CreateSequencedDuplicateEntryNewSequenceNumber) {
   TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
 
   // Check that we can find it by sequence number too:
-  lookup_cert.Clear();
+  lookup_cert = LoggedCertificate();
   EXPECT_EQ(DB::LOOKUP_OK,
             this->db()->LookupByIndex(logged_cert.sequence_number(),
                                       &lookup_cert));
 
   // And that we can find the duplicate ok as well:
-  lookup_cert.Clear();
+  lookup_cert = LoggedCertificate();
   EXPECT_EQ(DB::LOOKUP_OK,
             this->db()->LookupByIndex(duplicate_cert.sequence_number(),
                                       &lookup_cert));
@@ -157,7 +159,7 @@ TYPED_TEST(DBTest, CreateSequencedDuplicateSequenceNumber) {
   // Check that we get the original entry back.
   TestSigner::TestEqualLoggedCerts(logged_cert, lookup_cert);
 
-  lookup_cert.Clear();
+  lookup_cert = LoggedCertificate();
   EXPECT_EQ(DB::LOOKUP_OK,
             this->db()->LookupByIndex(logged_cert.sequence_number(),
                                       &lookup_cert));
@@ -235,6 +237,52 @@ TYPED_TEST(DBTest, LookupBySequenceNumber) {
 }
 
 
+TYPED_TEST(DBTest, LookupLeafHashRange) {
+  LoggedCertificate logged_certs[5];
+  for (int i = 0; i < 5; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    logged_certs[i].set_sequence_number(i);
+  }
+  // Leave a gap at 3.
+  for (int i : {0, 1, 2, 4}) {
+    EXPECT_EQ(DB::OK, this->db()->CreateSequencedEntry(logged_certs[i]));
+  }
+
+  std::vector<string> leaf_hashes;
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLeafHashRange(0, 3, &leaf_hashes));
+  ASSERT_EQ(3U, leaf_hashes.size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(logged_certs[i].merkle_leaf_hash(), leaf_hashes[i]);
+  }
+
+  leaf_hashes.clear();
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLeafHashRange(4, 5, &leaf_hashes));
+  ASSERT_EQ(1U, leaf_hashes.size());
+  EXPECT_EQ(logged_certs[4].merkle_leaf_hash(), leaf_hashes[0]);
+
+  leaf_hashes.clear();
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupLeafHashRange(2, 2, &leaf_hashes));
+  EXPECT_TRUE(leaf_hashes.empty());
+
+  // Stops at the gap.
+  EXPECT_EQ(DB::NOT_FOUND,
+            this->db()->LookupLeafHashRange(1, 5, &leaf_hashes));
+  ASSERT_EQ(2U, leaf_hashes.size());
+  EXPECT_EQ(logged_certs[1].merkle_leaf_hash(), leaf_hashes[0]);
+  EXPECT_EQ(logged_certs[2].merkle_leaf_hash(), leaf_hashes[1]);
+
+  // The leaf hashes survive a restart.
+  std::unique_ptr<DB> db2(this->test_db_.SecondDB());
+  leaf_hashes.clear();
+  EXPECT_EQ(DB::LOOKUP_OK, db2->LookupLeafHashRange(0, 3, &leaf_hashes));
+  ASSERT_EQ(3U, leaf_hashes.size());
+  EXPECT_EQ(logged_certs[2].merkle_leaf_hash(), leaf_hashes[2]);
+}
+
+
 TYPED_TEST(DBTest, WriteTreeHead) {
   SignedTreeHead sth, lookup_sth;
   this->test_signer_.CreateUnique(&sth);
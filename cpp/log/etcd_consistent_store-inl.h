@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "base/notification.h"
+#include "log/etcd_consistent_store_base-inl.h"
 #include "log/etcd_consistent_store.h"
 #include "log/logged_certificate.h"
 #include "monitoring/event_metric.h"
@@ -25,14 +26,6 @@ DECLARE_int32(node_state_ttl_seconds);
 namespace cert_trans {
 namespace {
 
-// etcd path constants.
-const char kClusterConfigFile[] = "/cluster_config";
-const char kEntriesDir[] = "/entries/";
-const char kSequenceFile[] = "/sequence_mapping";
-const char kServingSthFile[] = "/serving_sth";
-const char kNodesDir[] = "/nodes/";
-
-
 static Gauge<std::string>* etcd_total_entries =
     Gauge<std::string>::New("etcd_total_entries", "type",
                             "Total number of entries in etcd by type.");
@@ -51,22 +44,16 @@ static Counter<std::string>* etcd_rejected_requests =
                               "Total number of requests rejected due to "
                               "overload, broken down by request type.");
 
+static Counter<>* etcd_fenced_writes =
+    Counter<>::New("etcd_fenced_writes",
+                   "Total number of master-only writes refused because a "
+                   "newer master has written since.");
+
 static Latency<std::chrono::milliseconds, std::string> etcd_latency_by_op_ms(
     "etcd_latency_by_op_ms", "operation",
     "Etcd latency in ms broken down by operation.");
 
 
-void CheckMappingIsOrdered(const ct::SequenceMapping& mapping) {
-  if (mapping.mapping_size() < 2) {
-    return;
-  }
-  for (int64_t i = 0; i < mapping.mapping_size() - 1; ++i) {
-    CHECK_LT(mapping.mapping(i).sequence_number(),
-             mapping.mapping(i + 1).sequence_number());
-  }
-}
-
-
 util::StatusOr<int64_t> GetStat(const std::map<std::string, int64_t>& stats,
                                 const std::string& name) {
   const auto& it(stats.find(name));
@@ -113,20 +100,20 @@ EtcdConsistentStore<Logged>::EtcdConsistentStore(
     libevent::Base* base, util::Executor* executor, EtcdClient* client,
     const MasterElection* election, const std::string& root,
     const std::string& node_id)
-    : client_(CHECK_NOTNULL(client)),
+    : EtcdConsistentStoreBase<Logged>(election, root, node_id,
+                                      etcd_rejected_requests,
+                                      etcd_fenced_writes),
+      client_(CHECK_NOTNULL(client)),
       base_(CHECK_NOTNULL(base)),
       executor_(CHECK_NOTNULL(executor)),
-      election_(CHECK_NOTNULL(election)),
-      root_(root),
-      node_id_(node_id),
       serving_sth_watch_task_(CHECK_NOTNULL(executor)),
       cluster_config_watch_task_(CHECK_NOTNULL(executor)),
       etcd_stats_task_(executor_),
-      received_initial_sth_(false),
-      exiting_(false) {
+      exiting_(false),
+      confirmed_fencing_token_(0) {
   // Set up watches on things we're interested in...
   WatchServingSTH(
-      std::bind(&EtcdConsistentStore<Logged>::OnEtcdServingSTHUpdated, this,
+      std::bind(&EtcdConsistentStore<Logged>::OnServingSTHUpdated, this,
                 std::placeholders::_1),
       serving_sth_watch_task_.task());
   WatchClusterConfig(
@@ -138,10 +125,7 @@ EtcdConsistentStore<Logged>::EtcdConsistentStore(
 
   // And wait for the initial updates to come back so that we've got a
   // view on the current state before proceding...
-  {
-    std::unique_lock<std::mutex> lock(mutex_);
-    serving_sth_cv_.wait(lock, [this]() { return received_initial_sth_; });
-  }
+  WaitForInitialServingSTH();
 }
 
 
@@ -171,26 +155,7 @@ EtcdConsistentStore<Logged>::NextAvailableSequenceNumber() const {
   ScopedLatency scoped_latency(etcd_latency_by_op_ms.GetScopedLatency(
       "next_available_sequence_number"));
 
-  EntryHandle<ct::SequenceMapping> sequence_mapping;
-  util::Status status(GetSequenceMapping(&sequence_mapping));
-  if (!status.ok()) {
-    return status;
-  }
-  etcd_total_entries->Set("sequenced",
-                          sequence_mapping.Entry().mapping_size());
-  if (sequence_mapping.Entry().mapping_size() > 0) {
-    return sequence_mapping.Entry()
-               .mapping(sequence_mapping.Entry().mapping_size() - 1)
-               .sequence_number() +
-           1;
-  }
-
-  if (!serving_sth_) {
-    LOG(WARNING) << "Log has no Serving STH [new log?], returning 0";
-    return 0;
-  }
-
-  return serving_sth_->Entry().tree_size();
+  return GetNextSequenceNumber();
 }
 
 
@@ -213,8 +178,18 @@ util::Status EtcdConsistentStore<Logged>::SetServingSTH(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("set_serving_sth"));
 
-  const std::string full_path(GetFullPath(kServingSthFile));
+  const util::Status fencing_status(CheckFencingToken());
+  if (!fencing_status.ok()) {
+    return fencing_status;
+  }
+
+  const std::string full_path(GetFullKey(kServingSthKey));
   std::unique_lock<std::mutex> lock(mutex_);
+  const util::Status newer_status(
+      CheckIsNewerThanServingSTH(lock, new_sth));
+  if (!newer_status.ok()) {
+    return newer_status;
+  }
 
   // The watcher should have already populated serving_sth_ if etcd had one.
   if (!serving_sth_) {
@@ -222,7 +197,7 @@ util::Status EtcdConsistentStore<Logged>::SetServingSTH(
     LOG(WARNING) << "Creating new " << full_path;
     // There's no current serving STH, so we can try to create one.
     EntryHandle<ct::SignedTreeHead> sth_handle(full_path, new_sth);
-    util::Status status(CreateEntry(&sth_handle));
+    util::Status status(FencedWriteDone(CreateEntry(&sth_handle)));
     if (!status.ok()) {
       return status;
     }
@@ -231,20 +206,10 @@ util::Status EtcdConsistentStore<Logged>::SetServingSTH(
   }
 
   // Looks like we're updating an existing serving_sth.
-  // First check that we're not trying to overwrite it with itself or an older
-  // one:
-  if (serving_sth_->Entry().timestamp() >= new_sth.timestamp()) {
-    return util::Status(util::error::OUT_OF_RANGE,
-                        "Tree head is not newer than existing head");
-  }
-
-  // Ensure that nothing weird is going on with the tree size:
-  CHECK_LE(serving_sth_->Entry().tree_size(), new_sth.tree_size());
-
   VLOG(1) << "Updating existing " << full_path;
   EntryHandle<ct::SignedTreeHead> sth_to_etcd(full_path, new_sth,
                                               serving_sth_->Handle());
-  util::Status status(UpdateEntry(&sth_to_etcd));
+  util::Status status(FencedWriteDone(UpdateEntry(&sth_to_etcd)));
   if (!status.ok()) {
     return status;
   }
@@ -253,36 +218,6 @@ util::Status EtcdConsistentStore<Logged>::SetServingSTH(
 }
 
 
-template <class Logged>
-util::StatusOr<ct::SignedTreeHead> EtcdConsistentStore<Logged>::GetServingSTH()
-    const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (serving_sth_) {
-    return serving_sth_->Entry();
-  } else {
-    return util::Status(util::error::NOT_FOUND, "No current Serving STH.");
-  }
-}
-
-
-template <class Logged>
-bool LeafEntriesMatch(const Logged& a, const Logged& b) {
-  CHECK_EQ(a.entry().type(), b.entry().type());
-  switch (a.entry().type()) {
-    case ct::X509_ENTRY:
-      return a.entry().x509_entry().leaf_certificate() ==
-             b.entry().x509_entry().leaf_certificate();
-    case ct::PRECERT_ENTRY:
-      return a.entry().precert_entry().pre_certificate() ==
-             b.entry().precert_entry().pre_certificate();
-    case ct::UNKNOWN_ENTRY_TYPE:
-      // Handle it below.
-      break;
-  }
-  LOG(FATAL) << "Encountered UNKNOWN_ENTRY_TYPE:\n" << a.entry().DebugString();
-}
-
-
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::AddPendingEntry(Logged* entry) {
   ScopedLatency scoped_latency(
@@ -296,7 +231,7 @@ util::Status EtcdConsistentStore<Logged>::AddPendingEntry(Logged* entry) {
     return status;
   }
 
-  const std::string full_path(GetEntryPath(*entry));
+  const std::string full_path(GetEntryKey(entry->Hash()));
   EntryHandle<Logged> handle(full_path, *entry);
   status = CreateEntry(&handle);
   if (status.CanonicalCode() == util::error::FAILED_PRECONDITION) {
@@ -325,7 +260,7 @@ util::Status EtcdConsistentStore<Logged>::GetPendingEntryForHash(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_pending_entry_for_hash"));
 
-  util::Status status(GetEntry(GetEntryPath(hash), entry));
+  util::Status status(GetEntry(GetEntryKey(hash), entry));
   if (status.ok()) {
     CHECK(!entry->Entry().has_sequence_number());
   }
@@ -340,7 +275,7 @@ util::Status EtcdConsistentStore<Logged>::GetPendingEntries(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_pending_entries"));
 
-  util::Status status(GetAllEntriesInDir(GetFullPath(kEntriesDir), entries));
+  util::Status status(GetAllEntriesInDir(GetFullKey(kEntriesPrefix), entries));
   if (status.ok()) {
     for (const auto& entry : *entries) {
       CHECK(!entry.Entry().has_sequence_number());
@@ -366,12 +301,11 @@ util::Status EtcdConsistentStore<Logged>::GetSequenceMapping(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_sequence_mapping"));
 
-  util::Status status(GetEntry(GetFullPath(kSequenceFile), sequence_mapping));
+  util::Status status(GetEntry(GetFullKey(kSequenceMappingKey), sequence_mapping));
   if (!status.ok()) {
     return status;
   }
-  CheckMappingIsOrdered(sequence_mapping->Entry());
-  CheckMappingIsContiguousWithServingTree(sequence_mapping->Entry());
+  CheckSequenceMapping(sequence_mapping->Entry());
   etcd_total_entries->Set("sequenced",
                           sequence_mapping->Entry().mapping_size());
   return util::Status::OK;
@@ -385,9 +319,12 @@ util::Status EtcdConsistentStore<Logged>::UpdateSequenceMapping(
       etcd_latency_by_op_ms.GetScopedLatency("update_sequence_mapping"));
 
   CHECK(entry->HasHandle());
-  CheckMappingIsOrdered(entry->Entry());
-  CheckMappingIsContiguousWithServingTree(entry->Entry());
-  return UpdateEntry(entry);
+  CheckSequenceMapping(entry->Entry());
+  const util::Status fencing_status(CheckFencingToken());
+  if (!fencing_status.ok()) {
+    return fencing_status;
+  }
+  return FencedWriteDone(UpdateEntry(entry));
 }
 
 
@@ -398,7 +335,7 @@ EtcdConsistentStore<Logged>::GetClusterNodeState() const {
       etcd_latency_by_op_ms.GetScopedLatency("get_cluster_node_state"));
 
   EntryHandle<ct::ClusterNodeState> handle;
-  util::Status status(GetEntry(GetNodePath(node_id_), &handle));
+  util::Status status(GetEntry(GetNodeKey(node_id_), &handle));
   if (!status.ok()) {
     return status;
   }
@@ -416,7 +353,7 @@ util::Status EtcdConsistentStore<Logged>::SetClusterNodeState(
   // nobody else is updating our cluster state.
   ct::ClusterNodeState local_state(state);
   local_state.set_node_id(node_id_);
-  EntryHandle<ct::ClusterNodeState> entry(GetNodePath(node_id_), local_state);
+  EntryHandle<ct::ClusterNodeState> entry(GetNodeKey(node_id_), local_state);
   const std::chrono::seconds ttl(FLAGS_node_state_ttl_seconds);
   return ForceSetEntryWithTTL(ttl, &entry);
 }
@@ -456,7 +393,7 @@ template <class Logged>
 void EtcdConsistentStore<Logged>::WatchServingSTH(
     const typename ConsistentStore<Logged>::ServingSTHCallback& cb,
     util::Task* task) {
-  const std::string full_path(GetFullPath(kServingSthFile));
+  const std::string full_path(GetFullKey(kServingSthKey));
   client_->Watch(
       full_path,
       std::bind(&ConvertSingleUpdate<
@@ -472,7 +409,7 @@ void EtcdConsistentStore<Logged>::WatchClusterNodeStates(
     const typename ConsistentStore<Logged>::ClusterNodeStateCallback& cb,
     util::Task* task) {
   client_->Watch(
-      GetFullPath(kNodesDir),
+      GetFullKey(kNodesPrefix),
       std::bind(
           &ConvertMultipleUpdate<
               ct::ClusterNodeState,
@@ -486,7 +423,7 @@ template <class Logged>
 void EtcdConsistentStore<Logged>::WatchClusterConfig(
     const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
     util::Task* task) {
-  const std::string full_path(GetFullPath(kClusterConfigFile));
+  const std::string full_path(GetFullKey(kClusterConfigKey));
   client_->Watch(
       full_path,
       std::bind(&ConvertSingleUpdate<
@@ -497,15 +434,33 @@ void EtcdConsistentStore<Logged>::WatchClusterConfig(
 }
 
 
+template <class Logged>
+void EtcdConsistentStore<Logged>::WatchPendingEntries(
+    const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+    util::Task* task) {
+  client_->Watch(
+      GetFullKey(kEntriesPrefix),
+      std::bind(&ConvertMultipleUpdate<
+                    Logged,
+                    typename ConsistentStore<Logged>::PendingEntriesCallback>,
+                cb, std::placeholders::_1),
+      task);
+}
+
+
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::SetClusterConfig(
     const ct::ClusterConfig& config) {
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("set_cluster_config"));
 
-  EntryHandle<ct::ClusterConfig> entry(GetFullPath(kClusterConfigFile),
+  const util::Status fencing_status(CheckFencingToken());
+  if (!fencing_status.ok()) {
+    return fencing_status;
+  }
+  EntryHandle<ct::ClusterConfig> entry(GetFullKey(kClusterConfigKey),
                                        config);
-  return ForceSetEntry(&entry);
+  return FencedWriteDone(ForceSetEntry(&entry));
 }
 
 
@@ -677,64 +632,6 @@ util::Status EtcdConsistentStore<Logged>::DeleteEntry(EntryHandle<T>* entry) {
 }
 
 
-template <class Logged>
-std::string EtcdConsistentStore<Logged>::GetEntryPath(
-    const Logged& entry) const {
-  return GetEntryPath(entry.Hash());
-}
-
-
-template <class Logged>
-std::string EtcdConsistentStore<Logged>::GetEntryPath(
-    const std::string& hash) const {
-  return GetFullPath(std::string(kEntriesDir) + util::HexString(hash));
-}
-
-
-template <class Logged>
-std::string EtcdConsistentStore<Logged>::GetNodePath(
-    const std::string& id) const {
-  return GetFullPath(std::string(kNodesDir) + id);
-}
-
-
-template <class Logged>
-std::string EtcdConsistentStore<Logged>::GetFullPath(
-    const std::string& key) const {
-  CHECK(key.size() > 0);
-  CHECK_EQ('/', key[0]);
-  return root_ + key;
-}
-
-
-template <class Logged>
-void EtcdConsistentStore<Logged>::CheckMappingIsContiguousWithServingTree(
-    const ct::SequenceMapping& mapping) const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (serving_sth_ && mapping.mapping_size() > 0) {
-    const uint64_t tree_size(serving_sth_->Entry().tree_size());
-    // The mapping must not have a gap between its lowest mapping and the
-    // serving tree
-    const uint64_t lowest_sequence_number(
-        mapping.mapping(0).sequence_number());
-    CHECK_LE(lowest_sequence_number, tree_size);
-    // It must also be contiguous for all entries not yet included in the
-    // serving tree. (Note that entries below that may not be contiguous
-    // because the clean-up operation may not remove them in order.)
-    bool above_sth(false);
-    for (int i(0); i < mapping.mapping_size() - 1; ++i) {
-      const uint64_t mapped_seq(mapping.mapping(i).sequence_number());
-      if (mapped_seq >= tree_size) {
-        CHECK_EQ(mapped_seq + 1, mapping.mapping(i + 1).sequence_number());
-        above_sth = true;
-      } else {
-        CHECK(!above_sth);
-      }
-    }
-  }
-}
-
-
 // static
 template <class Logged>
 template <class T>
@@ -751,54 +648,6 @@ Update<T> EtcdConsistentStore<Logged>::TypedUpdateFromNode(
 }
 
 
-template <class Logged>
-void EtcdConsistentStore<Logged>::UpdateLocalServingSTH(
-    const std::unique_lock<std::mutex>& lock,
-    const EntryHandle<ct::SignedTreeHead>& handle) {
-  CHECK(lock.owns_lock());
-  CHECK(!serving_sth_ ||
-        serving_sth_->Entry().timestamp() < handle.Entry().timestamp());
-
-  VLOG(1) << "Updating serving_sth_ to: " << handle.Entry().DebugString();
-  serving_sth_.reset(new EntryHandle<ct::SignedTreeHead>(handle));
-}
-
-
-template <class Logged>
-void EtcdConsistentStore<Logged>::OnEtcdServingSTHUpdated(
-    const Update<ct::SignedTreeHead>& update) {
-  std::unique_lock<std::mutex> lock(mutex_);
-
-  if (update.exists_) {
-    VLOG(1) << "Got ServingSTH version " << update.handle_.Handle() << ": "
-            << update.handle_.Entry().DebugString();
-    UpdateLocalServingSTH(lock, update.handle_);
-  } else {
-    LOG(WARNING) << "ServingSTH non-existent/deleted.";
-    // TODO(alcutter): What to do here?
-    serving_sth_.reset();
-  }
-  received_initial_sth_ = true;
-  lock.unlock();
-  serving_sth_cv_.notify_all();
-}
-
-
-template <class Logged>
-void EtcdConsistentStore<Logged>::OnClusterConfigUpdated(
-    const Update<ct::ClusterConfig>& update) {
-  if (update.exists_) {
-    VLOG(1) << "Got ClusterConfig version " << update.handle_.Handle() << ": "
-            << update.handle_.Entry().DebugString();
-    std::lock_guard<std::mutex> lock(mutex_);
-    cluster_config_.reset(new ct::ClusterConfig(update.handle_.Entry()));
-  } else {
-    LOG(WARNING) << "ClusterConfig non-existent/deleted.";
-    // TODO(alcutter): What to do here?
-  }
-}
-
-
 template <class Logged>
 util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
   ScopedLatency scoped_latency(
@@ -808,39 +657,17 @@ util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
     return util::Status(util::error::PERMISSION_DENIED,
                         "Non-master node cannot run cleanups.");
   }
-
-  // Figure out where we're cleaning up to...
-  std::unique_lock<std::mutex> lock(mutex_);
-  if (!serving_sth_) {
-    LOG(INFO) << "No current serving_sth, nothing to do.";
-    return 0;
+  const util::Status fencing_status(CheckFencingToken());
+  if (!fencing_status.ok()) {
+    return fencing_status;
   }
-  const int64_t clean_up_to_sequence_number(
-      serving_sth_->Entry().tree_size() - 1);
-  lock.unlock();
 
-  LOG(INFO) << "Cleaning old entries up to and including sequence number: "
-            << clean_up_to_sequence_number;
-
-  EntryHandle<ct::SequenceMapping> sequence_mapping;
-  util::Status status(GetSequenceMapping(&sequence_mapping));
+  std::vector<std::string> keys_to_delete;
+  util::Status status(GetEntryKeysToCleanup(&keys_to_delete));
   if (!status.ok()) {
-    LOG(WARNING) << "Couldn't get sequence mapping: " << status;
     return status;
   }
 
-  std::vector<std::string> keys_to_delete;
-  for (int mapping_index = 0;
-       mapping_index < sequence_mapping.Entry().mapping_size() &&
-       sequence_mapping.Entry().mapping(mapping_index).sequence_number() <=
-           clean_up_to_sequence_number;
-       ++mapping_index) {
-    // Delete the entry from /entries.
-    keys_to_delete.emplace_back(GetEntryPath(
-        sequence_mapping.Entry().mapping(mapping_index).entry_hash()));
-  }
-
-
   const int64_t num_entries_cleaned(keys_to_delete.size());
   util::SyncTask task(executor_);
   EtcdForceDeleteKeys(client_, std::move(keys_to_delete), task.task());
@@ -899,33 +726,83 @@ void EtcdConsistentStore<Logged>::EtcdStatsFetchDone(
           std::bind(&EtcdConsistentStore<Logged>::StartEtcdStatsFetch, this)));
 }
 
-// This method attempts to modulate the incoming traffic in response to the
-// number of entries currently in etcd.
-//
-// Once the number of entries is above reject_threshold, we will start
-// returning a RESOURCE_EXHAUSTED status, which should result in a 503 being
-// sent to the client.
 template <class Logged>
-util::Status EtcdConsistentStore<Logged>::MaybeReject(
-    const std::string& type) const {
-  std::unique_lock<std::mutex> lock(mutex_);
-
-  if (!cluster_config_) {
-    // No config, whatever.
+util::Status EtcdConsistentStore<Logged>::CheckFencingToken() const {
+  const int64_t token(election_->FencingToken());
+  if (token == 0) {
+    // We've never been master, so have no token to fence with, the caller
+    // must be relying on IsMaster() alone.
+    return util::Status::OK;
+  }
+  if (token == confirmed_fencing_token_.load()) {
     return util::Status::OK;
   }
 
-  const int64_t etcd_size(num_etcd_entries_);
-  const int64_t reject_threshold(
-      cluster_config_->etcd_reject_add_pending_threshold());
-  lock.unlock();
+  ScopedLatency scoped_latency(
+      etcd_latency_by_op_ms.GetScopedLatency("check_fencing_token"));
+
+  const std::string path(GetFullKey(kFencingTokenKey));
+  for (int attempt = 0; attempt < kMaxFencingTokenAttempts; ++attempt) {
+    util::SyncTask get_task(executor_);
+    EtcdClient::GetResponse get_resp;
+    client_->Get(path, &get_resp, get_task.task());
+    get_task.Wait();
+
+    const bool exists(get_task.status().CanonicalCode() !=
+                      util::error::NOT_FOUND);
+    if (exists) {
+      if (!get_task.status().ok()) {
+        return get_task.status();
+      }
+      const util::StatusOr<int64_t> current(
+          CheckRecordedFencingToken(get_resp.node.value_, token));
+      if (!current.ok()) {
+        return current.status();
+      }
+      if (current.ValueOrDie() == token) {
+        confirmed_fencing_token_.store(token);
+        return util::Status::OK;
+      }
+      VLOG(1) << "Raising fencing token from " << current.ValueOrDie()
+              << " to " << token;
+    }
+
+    util::SyncTask set_task(executor_);
+    EtcdClient::Response set_resp;
+    if (exists) {
+      client_->Update(path, std::to_string(token),
+                      get_resp.node.modified_index_, &set_resp,
+                      set_task.task());
+    } else {
+      client_->Create(path, std::to_string(token), &set_resp,
+                      set_task.task());
+    }
+    set_task.Wait();
+    if (set_task.status().ok()) {
+      confirmed_fencing_token_.store(token);
+    }
+    if (set_task.status().CanonicalCode() !=
+        util::error::FAILED_PRECONDITION) {
+      return set_task.status();
+    }
+    // Someone else changed the token under our feet, have another look.
+  }
+
+  return util::Status(util::error::ABORTED,
+                      "Couldn't record fencing token " +
+                          std::to_string(token));
+}
+
 
-  if (etcd_size >= reject_threshold) {
-    etcd_rejected_requests->Increment(type);
-    return util::Status(util::error::RESOURCE_EXHAUSTED,
-                        "Rejected due to high number of pending entries.");
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::FencedWriteDone(
+    const util::Status& status) const {
+  if (status.ok()) {
+    return status;
   }
-  return util::Status::OK;
+  confirmed_fencing_token_.store(0);
+  const util::Status fencing_status(CheckFencingToken());
+  return fencing_status.ok() ? status : fencing_status;
 }
 
 
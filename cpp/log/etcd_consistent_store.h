@@ -1,13 +1,14 @@
 #ifndef CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_H_
 #define CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_H_
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
 #include <vector>
 
 #include "base/macros.h"
-#include "log/consistent_store.h"
+#include "log/etcd_consistent_store_base.h"
 #include "proto/ct.pb.h"
 #include "util/etcd.h"
 #include "util/libevent_wrapper.h"
@@ -20,7 +21,7 @@ class MasterElection;
 
 
 template <class Logged>
-class EtcdConsistentStore : public ConsistentStore<Logged> {
+class EtcdConsistentStore : public EtcdConsistentStoreBase<Logged> {
  public:
   // No change of ownership for |client|, |executor| must continue to be valid
   // at least as long as this object is, and should not be the libevent::Base
@@ -35,8 +36,6 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
 
   util::Status SetServingSTH(const ct::SignedTreeHead& new_sth) override;
 
-  util::StatusOr<ct::SignedTreeHead> GetServingSTH() const override;
-
   util::Status AddPendingEntry(Logged* entry) override;
 
   util::Status GetPendingEntryForHash(
@@ -67,6 +66,10 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
       const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
       util::Task* task) override;
 
+  void WatchPendingEntries(
+      const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+      util::Task* task) override;
+
   util::Status SetClusterConfig(const ct::ClusterConfig& config) override;
 
   // Removes sequenced entries with sequence numbers covered by the current
@@ -100,17 +103,26 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   template <class T>
   util::Status DeleteEntry(EntryHandle<T>* entry);
 
-  std::string GetEntryPath(const Logged& entry) const;
-
-  std::string GetEntryPath(const std::string& hash) const;
-
-  std::string GetNodePath(const std::string& node_id) const;
-
-  std::string GetFullPath(const std::string& key) const;
-
-  void CheckMappingIsContiguousWithServingTree(
-      const ct::SequenceMapping& mapping) const;
-
+  using EtcdConsistentStoreBase<Logged>::kMaxFencingTokenAttempts;
+  using EtcdConsistentStoreBase<Logged>::GetEntryKey;
+  using EtcdConsistentStoreBase<Logged>::GetNodeKey;
+  using EtcdConsistentStoreBase<Logged>::GetFullKey;
+  using EtcdConsistentStoreBase<Logged>::GetNextSequenceNumber;
+  using EtcdConsistentStoreBase<Logged>::CheckSequenceMapping;
+  using EtcdConsistentStoreBase<Logged>::CheckIsNewerThanServingSTH;
+  using EtcdConsistentStoreBase<Logged>::GetEntryKeysToCleanup;
+  using EtcdConsistentStoreBase<Logged>::CheckRecordedFencingToken;
+  using EtcdConsistentStoreBase<Logged>::LeafEntriesMatch;
+  using EtcdConsistentStoreBase<Logged>::OnServingSTHUpdated;
+  using EtcdConsistentStoreBase<Logged>::OnClusterConfigUpdated;
+  using EtcdConsistentStoreBase<Logged>::WaitForInitialServingSTH;
+  using EtcdConsistentStoreBase<Logged>::MaybeReject;
+  using EtcdConsistentStoreBase<Logged>::election_;
+  using EtcdConsistentStoreBase<Logged>::node_id_;
+  using EtcdConsistentStoreBase<Logged>::serving_sth_cv_;
+  using EtcdConsistentStoreBase<Logged>::mutex_;
+  using EtcdConsistentStoreBase<Logged>::serving_sth_;
+  using EtcdConsistentStoreBase<Logged>::num_etcd_entries_;
 
   // The following 3 methods are static just so that they have friend access to
   // the private c'tor/setters of Update<>
@@ -133,36 +145,35 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   template <class T>
   static Update<T> TypedUpdateFromNode(const EtcdClient::Node& node);
 
-  void UpdateLocalServingSTH(const std::unique_lock<std::mutex>& lock,
-                             const EntryHandle<ct::SignedTreeHead>& handle);
-
-  void OnEtcdServingSTHUpdated(const Update<ct::SignedTreeHead>& update);
-
-  void OnClusterConfigUpdated(const Update<ct::ClusterConfig>& update);
-
   void StartEtcdStatsFetch();
   void EtcdStatsFetchDone(EtcdClient::StatsResponse* response,
                           util::Task* task);
 
-  util::Status MaybeReject(const std::string& type) const;
+  // Checks that no newer master than us (as per the fencing token of
+  // |election_|) has written to the store, and records our token there if
+  // we're the newest. Once our token has been confirmed, this does not go
+  // to etcd again until a master-only write fails (see FencedWriteDone()).
+  // Since etcd can't make a write conditional on another key, this
+  // narrows, rather than closes, the window in which a deposed master's
+  // writes could still go through.
+  util::Status CheckFencingToken() const;
+  // To be called with the result of a master-only write. If it failed,
+  // possibly because a newer master wrote first, the fencing token is
+  // checked again, and PERMISSION_DENIED returned if we've been fenced
+  // off. Otherwise, returns |status|.
+  util::Status FencedWriteDone(const util::Status& status) const;
 
   EtcdClient* const client_;  // We don't own this.
   libevent::Base* base_;                  // We don't own this.
   util::Executor* const executor_;        // We don't own this.
-  const MasterElection* const election_;  // We don't own this.
-  const std::string root_;
-  const std::string node_id_;
-  std::condition_variable serving_sth_cv_;
   util::SyncTask serving_sth_watch_task_;
   util::SyncTask cluster_config_watch_task_;
   util::SyncTask etcd_stats_task_;
 
-  mutable std::mutex mutex_;
-  bool received_initial_sth_;
-  std::unique_ptr<EntryHandle<ct::SignedTreeHead>> serving_sth_;
-  std::unique_ptr<ct::ClusterConfig> cluster_config_;
   bool exiting_;
-  int64_t num_etcd_entries_;
+  // The fencing token last found (or made) to be the newest in etcd, or
+  // zero if it has to be checked again.
+  mutable std::atomic<int64_t> confirmed_fencing_token_;
 
   friend class EtcdConsistentStoreTest;
   template <class T>
@@ -0,0 +1,342 @@
+#ifndef CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_BASE_INL_H_
+#define CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_BASE_INL_H_
+
+#include <errno.h>
+#include <glog/logging.h>
+#include <stdlib.h>
+
+#include "log/etcd_consistent_store_base.h"
+#include "util/masterelection.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+// etcd key constants, relative to the root.
+const char kClusterConfigKey[] = "/cluster_config";
+const char kEntriesPrefix[] = "/entries/";
+const char kSequenceMappingKey[] = "/sequence_mapping";
+const char kServingSthKey[] = "/serving_sth";
+const char kNodesPrefix[] = "/nodes/";
+const char kFencingTokenKey[] = "/fencing_token";
+
+
+void CheckMappingIsOrdered(const ct::SequenceMapping& mapping) {
+  if (mapping.mapping_size() < 2) {
+    return;
+  }
+  for (int64_t i = 0; i < mapping.mapping_size() - 1; ++i) {
+    CHECK_LT(mapping.mapping(i).sequence_number(),
+             mapping.mapping(i + 1).sequence_number());
+  }
+}
+
+
+util::StatusOr<int64_t> ParseFencingToken(const std::string& value) {
+  char* end;
+  errno = 0;
+  const long long token(strtoll(value.c_str(), &end, 10));
+  if (value.empty() || errno || *end != '\0' || token < 0) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "Invalid fencing token: \"" + value + "\"");
+  }
+  return token;
+}
+
+
+}  // namespace
+
+
+template <class Logged>
+EtcdConsistentStoreBase<Logged>::EtcdConsistentStoreBase(
+    const MasterElection* election, const std::string& root,
+    const std::string& node_id, Counter<std::string>* rejected_requests,
+    Counter<>* fenced_writes)
+    : election_(CHECK_NOTNULL(election)),
+      root_(root),
+      node_id_(node_id),
+      received_initial_sth_(false),
+      num_etcd_entries_(0),
+      rejected_requests_(CHECK_NOTNULL(rejected_requests)),
+      fenced_writes_(CHECK_NOTNULL(fenced_writes)) {
+}
+
+
+template <class Logged>
+util::StatusOr<ct::SignedTreeHead>
+EtcdConsistentStoreBase<Logged>::GetServingSTH() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (serving_sth_) {
+    return serving_sth_->Entry();
+  } else {
+    return util::Status(util::error::NOT_FOUND, "No current Serving STH.");
+  }
+}
+
+
+template <class Logged>
+std::string EtcdConsistentStoreBase<Logged>::GetEntryKey(
+    const std::string& hash) const {
+  return GetFullKey(std::string(kEntriesPrefix) + util::HexString(hash));
+}
+
+
+template <class Logged>
+std::string EtcdConsistentStoreBase<Logged>::GetNodeKey(
+    const std::string& id) const {
+  return GetFullKey(std::string(kNodesPrefix) + id);
+}
+
+
+template <class Logged>
+std::string EtcdConsistentStoreBase<Logged>::GetFullKey(
+    const std::string& key) const {
+  CHECK(key.size() > 0);
+  CHECK_EQ('/', key[0]);
+  return root_ + key;
+}
+
+
+template <class Logged>
+util::StatusOr<int64_t>
+EtcdConsistentStoreBase<Logged>::GetNextSequenceNumber() const {
+  EntryHandle<ct::SequenceMapping> sequence_mapping;
+  util::Status status(this->GetSequenceMapping(&sequence_mapping));
+  if (!status.ok()) {
+    return status;
+  }
+  const ct::SequenceMapping& mapping(sequence_mapping.Entry());
+  if (mapping.mapping_size() > 0) {
+    return mapping.mapping(mapping.mapping_size() - 1).sequence_number() + 1;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!serving_sth_) {
+    LOG(WARNING) << "Log has no Serving STH [new log?], returning 0";
+    return 0;
+  }
+
+  return serving_sth_->Entry().tree_size();
+}
+
+
+template <class Logged>
+void EtcdConsistentStoreBase<Logged>::CheckSequenceMapping(
+    const ct::SequenceMapping& mapping) const {
+  CheckMappingIsOrdered(mapping);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (serving_sth_ && mapping.mapping_size() > 0) {
+    const uint64_t tree_size(serving_sth_->Entry().tree_size());
+    // The mapping must not have a gap between its lowest mapping and the
+    // serving tree
+    const uint64_t lowest_sequence_number(
+        mapping.mapping(0).sequence_number());
+    CHECK_LE(lowest_sequence_number, tree_size);
+    // It must also be contiguous for all entries not yet included in the
+    // serving tree. (Note that entries below that may not be contiguous
+    // because the clean-up operation may not remove them in order.)
+    bool above_sth(false);
+    for (int i(0); i < mapping.mapping_size() - 1; ++i) {
+      const uint64_t mapped_seq(mapping.mapping(i).sequence_number());
+      if (mapped_seq >= tree_size) {
+        CHECK_EQ(mapped_seq + 1, mapping.mapping(i + 1).sequence_number());
+        above_sth = true;
+      } else {
+        CHECK(!above_sth);
+      }
+    }
+  }
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStoreBase<Logged>::CheckIsNewerThanServingSTH(
+    const std::unique_lock<std::mutex>& lock,
+    const ct::SignedTreeHead& new_sth) const {
+  CHECK(lock.owns_lock());
+  if (!serving_sth_) {
+    return util::Status::OK;
+  }
+
+  // Check that we're not trying to overwrite it with itself or an older
+  // one:
+  if (serving_sth_->Entry().timestamp() >= new_sth.timestamp()) {
+    return util::Status(util::error::OUT_OF_RANGE,
+                        "Tree head is not newer than existing head");
+  }
+
+  // Ensure that nothing weird is going on with the tree size:
+  CHECK_LE(serving_sth_->Entry().tree_size(), new_sth.tree_size());
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStoreBase<Logged>::GetEntryKeysToCleanup(
+    std::vector<std::string>* keys) const {
+  CHECK_NOTNULL(keys);
+  CHECK(keys->empty());
+  // Figure out where we're cleaning up to...
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!serving_sth_) {
+    LOG(INFO) << "No current serving_sth, nothing to do.";
+    return util::Status::OK;
+  }
+  const int64_t clean_up_to_sequence_number(
+      serving_sth_->Entry().tree_size() - 1);
+  lock.unlock();
+
+  LOG(INFO) << "Cleaning old entries up to and including sequence number: "
+            << clean_up_to_sequence_number;
+
+  EntryHandle<ct::SequenceMapping> sequence_mapping;
+  util::Status status(this->GetSequenceMapping(&sequence_mapping));
+  if (!status.ok()) {
+    LOG(WARNING) << "Couldn't get sequence mapping: " << status;
+    return status;
+  }
+
+  for (int mapping_index = 0;
+       mapping_index < sequence_mapping.Entry().mapping_size() &&
+       sequence_mapping.Entry().mapping(mapping_index).sequence_number() <=
+           clean_up_to_sequence_number;
+       ++mapping_index) {
+    keys->emplace_back(GetEntryKey(
+        sequence_mapping.Entry().mapping(mapping_index).entry_hash()));
+  }
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::StatusOr<int64_t>
+EtcdConsistentStoreBase<Logged>::CheckRecordedFencingToken(
+    const std::string& value, int64_t token) const {
+  const util::StatusOr<int64_t> recorded(ParseFencingToken(value));
+  if (!recorded.ok()) {
+    return recorded.status();
+  }
+  if (recorded.ValueOrDie() > token) {
+    fenced_writes_->Increment();
+    return util::Status(util::error::PERMISSION_DENIED,
+                        "Fenced off by a newer master (token " +
+                            std::to_string(recorded.ValueOrDie()) + " > " +
+                            std::to_string(token) + ").");
+  }
+  return recorded;
+}
+
+
+// static
+template <class Logged>
+bool EtcdConsistentStoreBase<Logged>::LeafEntriesMatch(const Logged& a,
+                                                       const Logged& b) {
+  CHECK_EQ(a.entry().type(), b.entry().type());
+  switch (a.entry().type()) {
+    case ct::X509_ENTRY:
+      return a.entry().x509_entry().leaf_certificate() ==
+             b.entry().x509_entry().leaf_certificate();
+    case ct::PRECERT_ENTRY:
+      return a.entry().precert_entry().pre_certificate() ==
+             b.entry().precert_entry().pre_certificate();
+    case ct::UNKNOWN_ENTRY_TYPE:
+      // Handle it below.
+      break;
+  }
+  LOG(FATAL) << "Encountered UNKNOWN_ENTRY_TYPE:\n" << a.entry().DebugString();
+}
+
+
+template <class Logged>
+void EtcdConsistentStoreBase<Logged>::UpdateLocalServingSTH(
+    const std::unique_lock<std::mutex>& lock,
+    const EntryHandle<ct::SignedTreeHead>& handle) {
+  CHECK(lock.owns_lock());
+  CHECK(!serving_sth_ ||
+        serving_sth_->Entry().timestamp() < handle.Entry().timestamp());
+
+  VLOG(1) << "Updating serving_sth_ to: " << handle.Entry().DebugString();
+  serving_sth_.reset(new EntryHandle<ct::SignedTreeHead>(handle));
+}
+
+
+template <class Logged>
+void EtcdConsistentStoreBase<Logged>::OnServingSTHUpdated(
+    const Update<ct::SignedTreeHead>& update) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  if (!update.exists_) {
+    LOG(WARNING) << "ServingSTH non-existent/deleted.";
+    // TODO(alcutter): What to do here?
+    serving_sth_.reset();
+  } else if (serving_sth_ &&
+             serving_sth_->Handle() >= update.handle_.Handle()) {
+    // The subclass already updated it when writing it.
+    VLOG(1) << "Already have ServingSTH version " << update.handle_.Handle();
+  } else {
+    VLOG(1) << "Got ServingSTH version " << update.handle_.Handle() << ": "
+            << update.handle_.Entry().DebugString();
+    UpdateLocalServingSTH(lock, update.handle_);
+  }
+  received_initial_sth_ = true;
+  lock.unlock();
+  serving_sth_cv_.notify_all();
+}
+
+
+template <class Logged>
+void EtcdConsistentStoreBase<Logged>::OnClusterConfigUpdated(
+    const Update<ct::ClusterConfig>& update) {
+  if (update.exists_) {
+    VLOG(1) << "Got ClusterConfig version " << update.handle_.Handle() << ": "
+            << update.handle_.Entry().DebugString();
+    std::lock_guard<std::mutex> lock(mutex_);
+    cluster_config_.reset(new ct::ClusterConfig(update.handle_.Entry()));
+  } else {
+    LOG(WARNING) << "ClusterConfig non-existent/deleted.";
+    // TODO(alcutter): What to do here?
+  }
+}
+
+
+template <class Logged>
+void EtcdConsistentStoreBase<Logged>::WaitForInitialServingSTH() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  serving_sth_cv_.wait(lock, [this]() { return received_initial_sth_; });
+}
+
+
+// This method attempts to modulate the incoming traffic in response to the
+// number of entries currently in etcd.
+//
+// Once the number of entries is above reject_threshold, we will start
+// returning a RESOURCE_EXHAUSTED status, which should result in a 503 being
+// sent to the client.
+template <class Logged>
+util::Status EtcdConsistentStoreBase<Logged>::MaybeReject(
+    const std::string& type) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  if (!cluster_config_) {
+    // No config, whatever.
+    return util::Status::OK;
+  }
+
+  const int64_t etcd_size(num_etcd_entries_);
+  const int64_t reject_threshold(
+      cluster_config_->etcd_reject_add_pending_threshold());
+  lock.unlock();
+
+  if (etcd_size >= reject_threshold) {
+    rejected_requests_->Increment(type);
+    return util::Status(util::error::RESOURCE_EXHAUSTED,
+                        "Rejected due to high number of pending entries.");
+  }
+  return util::Status::OK;
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_BASE_INL_H_
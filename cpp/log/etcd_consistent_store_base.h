@@ -0,0 +1,107 @@
+#ifndef CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_BASE_H_
+#define CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_BASE_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/consistent_store.h"
+#include "monitoring/monitoring.h"
+#include "proto/ct.pb.h"
+#include "util/status.h"
+#include "util/statusor.h"
+
+namespace cert_trans {
+
+class MasterElection;
+
+
+// The parts of EtcdConsistentStore and EtcdV3ConsistentStore which don't
+// depend on the etcd API: the layout of the keys under |root|, and the
+// local view of the serving STH and cluster config, which the stores keep
+// up to date by watching them.
+template <class Logged>
+class EtcdConsistentStoreBase : public ConsistentStore<Logged> {
+ public:
+  util::StatusOr<ct::SignedTreeHead> GetServingSTH() const override;
+
+ protected:
+  // How many times to try recording our fencing token when other masters
+  // are doing so at the same time.
+  static const int kMaxFencingTokenAttempts = 3;
+
+  // |rejected_requests| and |fenced_writes| are the subclass's metrics.
+  EtcdConsistentStoreBase(const MasterElection* election,
+                          const std::string& root, const std::string& node_id,
+                          Counter<std::string>* rejected_requests,
+                          Counter<>* fenced_writes);
+
+  std::string GetEntryKey(const std::string& hash) const;
+
+  std::string GetNodeKey(const std::string& node_id) const;
+
+  std::string GetFullKey(const std::string& key) const;
+
+  // Returns the sequence number following the last one in the sequence
+  // mapping, or the serving tree size if that's empty.
+  util::StatusOr<int64_t> GetNextSequenceNumber() const;
+
+  // CHECKs that |mapping| is ordered by sequence number, and contiguous
+  // with the serving tree.
+  void CheckSequenceMapping(const ct::SequenceMapping& mapping) const;
+
+  // Returns OUT_OF_RANGE if |new_sth| isn't newer than the serving STH.
+  util::Status CheckIsNewerThanServingSTH(
+      const std::unique_lock<std::mutex>& lock,
+      const ct::SignedTreeHead& new_sth) const;
+
+  // Fills in |keys| with the keys of the sequenced entries covered by the
+  // serving STH.
+  util::Status GetEntryKeysToCleanup(std::vector<std::string>* keys) const;
+
+  // Compares our fencing |token| with the |value| recorded in the store.
+  // Returns PERMISSION_DENIED if a newer master recorded it, otherwise
+  // the recorded token.
+  util::StatusOr<int64_t> CheckRecordedFencingToken(const std::string& value,
+                                                    int64_t token) const;
+
+  // CHECKs that the leaf certificates of |a| and |b| are the same.
+  static bool LeafEntriesMatch(const Logged& a, const Logged& b);
+
+  void UpdateLocalServingSTH(const std::unique_lock<std::mutex>& lock,
+                             const EntryHandle<ct::SignedTreeHead>& handle);
+
+  // To be called by the watches of the subclass. The constructor of the
+  // subclass should WaitForInitialServingSTH() once it's set them up.
+  void OnServingSTHUpdated(const Update<ct::SignedTreeHead>& update);
+  void OnClusterConfigUpdated(const Update<ct::ClusterConfig>& update);
+  void WaitForInitialServingSTH();
+
+  util::Status MaybeReject(const std::string& type) const;
+
+  const MasterElection* const election_;  // We don't own this.
+  const std::string root_;
+  const std::string node_id_;
+  std::condition_variable serving_sth_cv_;
+
+  mutable std::mutex mutex_;
+  bool received_initial_sth_;
+  std::unique_ptr<EntryHandle<ct::SignedTreeHead>> serving_sth_;
+  std::unique_ptr<ct::ClusterConfig> cluster_config_;
+  int64_t num_etcd_entries_;
+
+ private:
+  Counter<std::string>* const rejected_requests_;
+  Counter<>* const fenced_writes_;
+
+  DISALLOW_COPY_AND_ASSIGN(EtcdConsistentStoreBase);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_BASE_H_
@@ -306,6 +306,88 @@ TEST_F(EtcdConsistentStoreDeathTest, TestSetServingSTHChecksInconsistentSize) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestSetServingSTHIsFenced) {
+  const string kFencingTokenPath(string(kRoot) + "/fencing_token");
+  // A newer master has already taken over:
+  {
+    SyncTask task(base_.get());
+    EtcdClient::Response resp;
+    client_.ForceSet(kFencingTokenPath, "20", &resp, task.task());
+    task.Wait();
+    ASSERT_OK(task.status());
+  }
+
+  EXPECT_CALL(election_, FencingToken()).WillRepeatedly(Return(10));
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(234);
+  sth.set_tree_size(10);
+  EXPECT_THAT(store_->SetServingSTH(sth),
+              StatusIs(util::error::PERMISSION_DENIED));
+
+  // And an even newer one raises the token again:
+  EXPECT_CALL(election_, FencingToken()).WillRepeatedly(Return(30));
+  EXPECT_OK(store_->SetServingSTH(sth));
+  EXPECT_EQ(234, ServingSTH().timestamp());
+  EtcdClient::GetResponse resp;
+  SyncTask task(base_.get());
+  client_.Get(kFencingTokenPath, &resp, task.task());
+  task.Wait();
+  ASSERT_OK(task.status());
+  EXPECT_EQ("30", resp.node.value_);
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestFencingTokenIsRecheckedAfterFailedWrite) {
+  const string kFencingTokenPath(string(kRoot) + "/fencing_token");
+  EXPECT_CALL(election_, FencingToken()).WillRepeatedly(Return(10));
+  AddSequenceMapping(0, "zero");
+
+  EntryHandle<SequenceMapping> mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+
+  // A newer master takes over, and sequences something:
+  {
+    SyncTask task(base_.get());
+    EtcdClient::Response resp;
+    client_.ForceSet(kFencingTokenPath, "20", &resp, task.task());
+    task.Wait();
+    ASSERT_OK(task.status());
+  }
+  SequenceMapping newer(mapping.Entry());
+  SequenceMapping::Mapping* m(newer.add_mapping());
+  m->set_sequence_number(1);
+  m->set_entry_hash("one");
+  ForceSetEntry(string(kRoot) + "/sequence_mapping", newer);
+
+  // Our token was confirmed by the first update, so we only find out
+  // about the newer master when our write fails.
+  m = mapping.MutableEntry()->add_mapping();
+  m->set_sequence_number(1);
+  m->set_entry_hash("uno");
+  EXPECT_THAT(store_->UpdateSequenceMapping(&mapping),
+              StatusIs(util::error::PERMISSION_DENIED));
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestInvalidFencingToken) {
+  const string kFencingTokenPath(string(kRoot) + "/fencing_token");
+  {
+    SyncTask task(base_.get());
+    EtcdClient::Response resp;
+    client_.ForceSet(kFencingTokenPath, "garbage", &resp, task.task());
+    task.Wait();
+    ASSERT_OK(task.status());
+  }
+
+  EXPECT_CALL(election_, FencingToken()).WillRepeatedly(Return(10));
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(234);
+  sth.set_tree_size(10);
+  EXPECT_THAT(store_->SetServingSTH(sth),
+              StatusIs(util::error::FAILED_PRECONDITION));
+}
+
+
 TEST_F(EtcdConsistentStoreTest, TestAddPendingEntryWorks) {
   LoggedCertificate cert(DefaultCert());
   util::Status status(store_->AddPendingEntry(&cert));
@@ -649,6 +731,31 @@ TEST_F(EtcdConsistentStoreTest, WatchClusterConfig) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, WatchPendingEntries) {
+  LoggedCertificate cert(DefaultCert());
+  Notification notification;
+
+  SyncTask task(&executor_);
+  store_->WatchPendingEntries(
+      [&cert,
+       &notification](const vector<Update<LoggedCertificate>>& updates) {
+        if (updates.empty()) {
+          VLOG(1) << "Ignoring initial empty update.";
+          return;
+        }
+        EXPECT_TRUE(updates[0].exists_);
+        EXPECT_EQ(cert.Hash(), updates[0].handle_.Entry().Hash());
+        notification.Notify();
+      },
+      task.task());
+  util::Status status(store_->AddPendingEntry(&cert));
+  EXPECT_TRUE(status.ok()) << status;
+  EXPECT_TRUE(notification.WaitForNotificationWithTimeout(milliseconds(5000)));
+  task.Cancel();
+  task.Wait();
+}
+
+
 TEST_F(EtcdConsistentStoreTest, TestDoesNotCleanUpIfNotMaster) {
   EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(false));
   EXPECT_THAT(CleanupOldEntries().status(),
@@ -0,0 +1,755 @@
+#ifndef CERT_TRANS_LOG_ETCD_V3_CONSISTENT_STORE_INL_H_
+#define CERT_TRANS_LOG_ETCD_V3_CONSISTENT_STORE_INL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <vector>
+
+#include "log/etcd_consistent_store_base-inl.h"
+#include "log/etcd_v3_consistent_store.h"
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
+#include "util/masterelection.h"
+#include "util/util.h"
+
+DECLARE_int32(etcd_stats_collection_interval_seconds);
+
+DECLARE_int32(node_state_ttl_seconds);
+
+namespace cert_trans {
+namespace {
+
+// The default limit on the number of operations in a transaction
+// (etcd's --max-txn-ops).
+const size_t kMaxTxnOps = 128;
+
+
+static Gauge<std::string>* etcd_v3_total_entries =
+    Gauge<std::string>::New("etcd_v3_total_entries", "type",
+                            "Total number of entries in etcd v3 by type.");
+
+static Counter<std::string>* etcd_v3_rejected_requests =
+    Counter<std::string>::New("etcd_v3_rejected_requests", "type",
+                              "Total number of requests rejected due to "
+                              "overload, broken down by request type.");
+
+static Counter<>* etcd_v3_fenced_writes =
+    Counter<>::New("etcd_v3_fenced_writes",
+                   "Total number of master-only writes refused because a "
+                   "newer master has written since.");
+
+static Latency<std::chrono::milliseconds, std::string>
+    etcd_v3_latency_by_op_ms("etcd_v3_latency_by_op_ms", "operation",
+                             "Etcd v3 latency in ms broken down by "
+                             "operation.");
+
+
+// Fencing tokens are stored zero-padded to the same width, so that
+// comparing them as strings (which is all a transaction can do)
+// compares them as numbers.
+std::string FencingTokenValue(int64_t token) {
+  CHECK_GE(token, 0);
+  char value[21];
+  snprintf(value, sizeof(value), "%020lld", static_cast<long long>(token));
+  return value;
+}
+
+
+void AddCompare(const std::string& key,
+                etcdserverpb::Compare::CompareTarget target,
+                etcdserverpb::TxnRequest* txn, int64_t revision) {
+  etcdserverpb::Compare* const compare(txn->add_compare());
+  compare->set_key(key);
+  compare->set_target(target);
+  compare->set_result(etcdserverpb::Compare::EQUAL);
+  if (target == etcdserverpb::Compare::CREATE) {
+    compare->set_create_revision(revision);
+  } else {
+    CHECK_EQ(etcdserverpb::Compare::MOD, target);
+    compare->set_mod_revision(revision);
+  }
+}
+
+
+}  // namespace
+
+
+template <class Logged>
+EtcdV3ConsistentStore<Logged>::EtcdV3ConsistentStore(
+    libevent::Base* base, util::Executor* executor, EtcdV3Client* client,
+    const MasterElection* election, const std::string& root,
+    const std::string& node_id)
+    : EtcdConsistentStoreBase<Logged>(election, root, node_id,
+                                      etcd_v3_rejected_requests,
+                                      etcd_v3_fenced_writes),
+      client_(CHECK_NOTNULL(client)),
+      base_(CHECK_NOTNULL(base)),
+      executor_(CHECK_NOTNULL(executor)),
+      serving_sth_watch_task_(executor_),
+      cluster_config_watch_task_(executor_),
+      entry_count_task_(executor_) {
+  // Set up watches on things we're interested in...
+  WatchServingSTH(
+      std::bind(&EtcdV3ConsistentStore<Logged>::OnServingSTHUpdated, this,
+                std::placeholders::_1),
+      serving_sth_watch_task_.task());
+  WatchClusterConfig(
+      std::bind(&EtcdV3ConsistentStore<Logged>::OnClusterConfigUpdated, this,
+                std::placeholders::_1),
+      cluster_config_watch_task_.task());
+
+  StartEntryCountFetch();
+
+  // And wait for the initial updates to come back so that we've got a
+  // view on the current state before proceding...
+  WaitForInitialServingSTH();
+}
+
+
+template <class Logged>
+EtcdV3ConsistentStore<Logged>::~EtcdV3ConsistentStore() {
+  VLOG(1) << "Cancelling watch tasks.";
+  serving_sth_watch_task_.Cancel();
+  cluster_config_watch_task_.Cancel();
+  VLOG(1) << "Waiting for watch tasks to return.";
+  serving_sth_watch_task_.Wait();
+  cluster_config_watch_task_.Wait();
+  VLOG(1) << "Cancelling entry count task.";
+  entry_count_task_.Cancel();
+  entry_count_task_.Wait();
+}
+
+
+template <class Logged>
+util::StatusOr<int64_t>
+EtcdV3ConsistentStore<Logged>::NextAvailableSequenceNumber() const {
+  ScopedLatency scoped_latency(etcd_v3_latency_by_op_ms.GetScopedLatency(
+      "next_available_sequence_number"));
+
+  return GetNextSequenceNumber();
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::SetServingSTH(
+    const ct::SignedTreeHead& new_sth) {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("set_serving_sth"));
+
+  const std::string key(GetFullKey(kServingSthKey));
+  EntryHandle<ct::SignedTreeHead> handle(key, new_sth);
+  std::unique_lock<std::mutex> lock(mutex_);
+  const util::Status newer_status(CheckIsNewerThanServingSTH(lock, new_sth));
+  if (!newer_status.ok()) {
+    return newer_status;
+  }
+
+  // The watcher should have already populated serving_sth_ if etcd had one.
+  if (serving_sth_) {
+    handle.SetHandle(serving_sth_->Handle());
+  } else {
+    LOG(WARNING) << "Creating new " << key;
+  }
+
+  const util::Status status(WriteEntry(true /* master_only */, &handle));
+  if (!status.ok()) {
+    return status;
+  }
+  // No need to wait for the watch to see it, we know the revision it
+  // was written at.
+  UpdateLocalServingSTH(lock, handle);
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::AddPendingEntry(Logged* entry) {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("add_pending_entry"));
+
+  CHECK_NOTNULL(entry);
+  CHECK(!entry->has_sequence_number());
+
+  util::Status status(MaybeReject("add_pending_entry"));
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Either create the entry, or get the one with the same hash, in
+  // one go.
+  const std::string key(GetEntryKey(entry->Hash()));
+  etcdserverpb::TxnRequest txn;
+  AddCompare(key, etcdserverpb::Compare::CREATE, &txn, 0);
+  etcdserverpb::PutRequest* const put(
+      txn.add_success()->mutable_request_put());
+  put->set_key(key);
+  CHECK(entry->SerializeToString(put->mutable_value()));
+  txn.add_failure()->mutable_request_range()->set_key(key);
+
+  etcdserverpb::TxnResponse resp;
+  status = Txn(txn, &resp);
+  if (!status.ok() || resp.succeeded()) {
+    return status;
+  }
+
+  // Entry with that hash already exists.
+  const etcdserverpb::RangeResponse& existing(
+      resp.responses(0).response_range());
+  CHECK_EQ(1, existing.kvs_size()) << key;
+  Logged preexisting_entry;
+  CHECK(preexisting_entry.ParseFromString(existing.kvs(0).value()));
+
+  // Check the leaf certs are the same (we might be seeing the same cert
+  // submitted with a different chain.)
+  CHECK(LeafEntriesMatch(preexisting_entry, *entry));
+  *entry->mutable_sct() = preexisting_entry.sct();
+  return util::Status(util::error::ALREADY_EXISTS,
+                      "Pending entry already exists.");
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::GetPendingEntryForHash(
+    const std::string& hash, EntryHandle<Logged>* entry) const {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("get_pending_entry_for_hash"));
+
+  util::Status status(GetEntry(GetEntryKey(hash), entry));
+  if (status.ok()) {
+    CHECK(!entry->Entry().has_sequence_number());
+  }
+
+  return status;
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::GetPendingEntries(
+    std::vector<EntryHandle<Logged>>* entries) const {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("get_pending_entries"));
+
+  util::Status status(
+      GetAllEntriesWithPrefix(GetFullKey(kEntriesPrefix), entries));
+  if (status.ok()) {
+    for (const auto& entry : *entries) {
+      CHECK(!entry.Entry().has_sequence_number());
+    }
+  }
+  etcd_v3_total_entries->Set("entries", entries->size());
+  return status;
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::GetSequenceMapping(
+    EntryHandle<ct::SequenceMapping>* sequence_mapping) const {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("get_sequence_mapping"));
+
+  util::Status status(
+      GetEntry(GetFullKey(kSequenceMappingKey), sequence_mapping));
+  if (!status.ok()) {
+    return status;
+  }
+  CheckSequenceMapping(sequence_mapping->Entry());
+  etcd_v3_total_entries->Set("sequenced",
+                             sequence_mapping->Entry().mapping_size());
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::UpdateSequenceMapping(
+    EntryHandle<ct::SequenceMapping>* entry) {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("update_sequence_mapping"));
+
+  CHECK(entry->HasHandle());
+  CheckSequenceMapping(entry->Entry());
+  return WriteEntry(true /* master_only */, entry);
+}
+
+
+template <class Logged>
+util::StatusOr<ct::ClusterNodeState>
+EtcdV3ConsistentStore<Logged>::GetClusterNodeState() const {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("get_cluster_node_state"));
+
+  EntryHandle<ct::ClusterNodeState> handle;
+  util::Status status(GetEntry(GetNodeKey(node_id_), &handle));
+  if (!status.ok()) {
+    return status;
+  }
+  return handle.Entry();
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::SetClusterNodeState(
+    const ct::ClusterNodeState& state) {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("set_cluster_node_state"));
+
+  // Each state gets a new lease, which is what pushes back its expiry:
+  // keeping a lease alive takes the keep-alive stream, which can't go
+  // through a UrlFetcher. The previous lease expires on its own.
+  etcdserverpb::LeaseGrantRequest lease_req;
+  lease_req.set_ttl(FLAGS_node_state_ttl_seconds);
+  etcdserverpb::LeaseGrantResponse lease_resp;
+  util::SyncTask task(executor_);
+  client_->LeaseGrant(lease_req, &lease_resp, task.task());
+  task.Wait();
+  if (!task.status().ok()) {
+    return task.status();
+  }
+
+  ct::ClusterNodeState local_state(state);
+  local_state.set_node_id(node_id_);
+  EntryHandle<ct::ClusterNodeState> entry(GetNodeKey(node_id_), local_state);
+  return PutEntry(false /* master_only */, lease_resp.id(), &entry);
+}
+
+
+// static
+template <class Logged>
+template <class T, class CB>
+void EtcdV3ConsistentStore<Logged>::ConvertSingleUpdate(
+    const std::string& key, const CB& callback,
+    const std::vector<etcdserverpb::KeyValue>& updated,
+    const std::vector<std::string>& deleted) {
+  CHECK_LE(updated.size() + deleted.size(), 1U);
+  callback(TypedUpdate<T>(key, updated.empty() ? nullptr : &updated[0]));
+}
+
+
+// static
+template <class Logged>
+template <class T, class CB>
+void EtcdV3ConsistentStore<Logged>::ConvertMultipleUpdate(
+    const CB& callback, const std::vector<etcdserverpb::KeyValue>& updated,
+    const std::vector<std::string>& deleted) {
+  std::vector<Update<T>> updates;
+  updates.reserve(updated.size() + deleted.size());
+  for (const auto& kv : updated) {
+    updates.emplace_back(TypedUpdate<T>(kv.key(), &kv));
+  }
+  for (const auto& key : deleted) {
+    updates.emplace_back(TypedUpdate<T>(key, nullptr));
+  }
+  callback(updates);
+}
+
+
+// static
+template <class Logged>
+template <class T>
+Update<T> EtcdV3ConsistentStore<Logged>::TypedUpdate(
+    const std::string& key, const etcdserverpb::KeyValue* kv) {
+  T thing;
+  if (kv) {
+    CHECK(thing.ParseFromString(kv->value())) << key;
+  }
+  EntryHandle<T> handle(key, thing);
+  if (kv) {
+    handle.SetHandle(kv->mod_revision());
+  }
+  return Update<T>(handle, kv != nullptr);
+}
+
+
+template <class Logged>
+void EtcdV3ConsistentStore<Logged>::WatchServingSTH(
+    const typename ConsistentStore<Logged>::ServingSTHCallback& cb,
+    util::Task* task) {
+  const std::string key(GetFullKey(kServingSthKey));
+  EtcdV3Watch(
+      client_, base_, key, "",
+      std::bind(&ConvertSingleUpdate<
+                    ct::SignedTreeHead,
+                    typename ConsistentStore<Logged>::ServingSTHCallback>,
+                key, cb, std::placeholders::_1, std::placeholders::_2),
+      task);
+}
+
+
+template <class Logged>
+void EtcdV3ConsistentStore<Logged>::WatchClusterNodeStates(
+    const typename ConsistentStore<Logged>::ClusterNodeStateCallback& cb,
+    util::Task* task) {
+  const std::string prefix(GetFullKey(kNodesPrefix));
+  EtcdV3Watch(
+      client_, base_, prefix, EtcdV3PrefixEnd(prefix),
+      std::bind(
+          &ConvertMultipleUpdate<
+              ct::ClusterNodeState,
+              typename ConsistentStore<Logged>::ClusterNodeStateCallback>,
+          cb, std::placeholders::_1, std::placeholders::_2),
+      task);
+}
+
+
+template <class Logged>
+void EtcdV3ConsistentStore<Logged>::WatchClusterConfig(
+    const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
+    util::Task* task) {
+  const std::string key(GetFullKey(kClusterConfigKey));
+  EtcdV3Watch(
+      client_, base_, key, "",
+      std::bind(&ConvertSingleUpdate<
+                    ct::ClusterConfig,
+                    typename ConsistentStore<Logged>::ClusterConfigCallback>,
+                key, cb, std::placeholders::_1, std::placeholders::_2),
+      task);
+}
+
+
+template <class Logged>
+void EtcdV3ConsistentStore<Logged>::WatchPendingEntries(
+    const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+    util::Task* task) {
+  const std::string prefix(GetFullKey(kEntriesPrefix));
+  EtcdV3Watch(
+      client_, base_, prefix, EtcdV3PrefixEnd(prefix),
+      std::bind(&ConvertMultipleUpdate<
+                    Logged,
+                    typename ConsistentStore<Logged>::PendingEntriesCallback>,
+                cb, std::placeholders::_1, std::placeholders::_2),
+      task);
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::SetClusterConfig(
+    const ct::ClusterConfig& config) {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("set_cluster_config"));
+
+  EntryHandle<ct::ClusterConfig> entry(GetFullKey(kClusterConfigKey),
+                                       config);
+  return PutEntry(true /* master_only */, 0, &entry);
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::Range(
+    const etcdserverpb::RangeRequest& req,
+    etcdserverpb::RangeResponse* resp) const {
+  util::SyncTask task(executor_);
+  client_->Range(req, resp, task.task());
+  task.Wait();
+  return task.status();
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::Txn(
+    const etcdserverpb::TxnRequest& req,
+    etcdserverpb::TxnResponse* resp) const {
+  util::SyncTask task(executor_);
+  client_->Txn(req, resp, task.task());
+  task.Wait();
+  return task.status();
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::MasterTxn(
+    etcdserverpb::TxnRequest* txn, etcdserverpb::TxnResponse* resp) {
+  const int64_t token(election_->FencingToken());
+  if (token == 0) {
+    // We've never been master, so have no token to fence with, the caller
+    // must be relying on IsMaster() alone.
+    return Txn(*txn, resp);
+  }
+
+  // The last response of a failed transaction is the fencing token, to
+  // tell whether it, or the caller's conditions, failed.
+  const std::string key(GetFullKey(kFencingTokenKey));
+  const std::string value(FencingTokenValue(token));
+  etcdserverpb::Compare* const compare(txn->add_compare());
+  compare->set_key(key);
+  compare->set_target(etcdserverpb::Compare::VALUE);
+  compare->set_result(etcdserverpb::Compare::EQUAL);
+  compare->set_value(value);
+  txn->add_failure()->mutable_request_range()->set_key(key);
+
+  for (int attempt = 0; attempt < kMaxFencingTokenAttempts; ++attempt) {
+    resp->Clear();
+    util::Status status(Txn(*txn, resp));
+    if (!status.ok() || resp->succeeded()) {
+      return status;
+    }
+
+    const etcdserverpb::RangeResponse& current(
+        resp->responses(resp->responses_size() - 1).response_range());
+    if (current.kvs_size() > 0) {
+      const util::StatusOr<int64_t> recorded(
+          CheckRecordedFencingToken(current.kvs(0).value(), token));
+      if (!recorded.ok()) {
+        return recorded.status();
+      }
+      if (recorded.ValueOrDie() == token) {
+        // Our token is current, the caller's conditions failed.
+        return util::Status::OK;
+      }
+    }
+
+    status = RaiseFencingToken(token);
+    if (!status.ok()) {
+      return status;
+    }
+    // Someone else might have changed the token under our feet, so have
+    // another go.
+  }
+
+  return util::Status(util::error::ABORTED,
+                      "Couldn't record fencing token " +
+                          std::to_string(token));
+}
+
+
+template <class Logged>
+util::Status EtcdV3ConsistentStore<Logged>::RaiseFencingToken(int64_t token) {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("raise_fencing_token"));
+
+  const std::string key(GetFullKey(kFencingTokenKey));
+  const std::string value(FencingTokenValue(token));
+  etcdserverpb::RangeRequest range_req;
+  range_req.set_key(key);
+  etcdserverpb::RangeResponse range_resp;
+  util::Status status(Range(range_req, &range_resp));
+  if (!status.ok()) {
+    return status;
+  }
+
+  etcdserverpb::TxnRequest txn;
+  if (range_resp.kvs_size() == 0) {
+    AddCompare(key, etcdserverpb::Compare::CREATE, &txn, 0);
+  } else if (range_resp.kvs(0).value() < value) {
+    VLOG(1) << "Raising fencing token from " << range_resp.kvs(0).value()
+            << " to " << value;
+    AddCompare(key, etcdserverpb::Compare::MOD, &txn,
+               range_resp.kvs(0).mod_revision());
+  } else {
+    return util::Status::OK;
+  }
+  etcdserverpb::PutRequest* const put(
+      txn.add_success()->mutable_request_put());
+  put->set_key(key);
+  put->set_value(value);
+
+  // If this fails, someone else got there first, and our caller will
+  // have another look.
+  etcdserverpb::TxnResponse resp;
+  return Txn(txn, &resp);
+}
+
+
+template <class Logged>
+template <class T>
+util::Status EtcdV3ConsistentStore<Logged>::GetEntry(
+    const std::string& key, EntryHandle<T>* entry) const {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("get_entry"));
+
+  CHECK_NOTNULL(entry);
+  etcdserverpb::RangeRequest req;
+  req.set_key(key);
+  etcdserverpb::RangeResponse resp;
+  const util::Status status(Range(req, &resp));
+  if (!status.ok()) {
+    return status;
+  }
+  if (resp.kvs_size() == 0) {
+    return util::Status(util::error::NOT_FOUND, "Key not found: " + key);
+  }
+  T t;
+  CHECK(t.ParseFromString(resp.kvs(0).value())) << key;
+  entry->Set(key, t, resp.kvs(0).mod_revision());
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+template <class T>
+util::Status EtcdV3ConsistentStore<Logged>::GetAllEntriesWithPrefix(
+    const std::string& prefix, std::vector<EntryHandle<T>>* entries) const {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("get_all_entries_in_dir"));
+
+  CHECK_NOTNULL(entries);
+  CHECK_EQ(0, entries->size());
+  etcdserverpb::RangeRequest req;
+  req.set_key(prefix);
+  req.set_range_end(EtcdV3PrefixEnd(prefix));
+  std::vector<etcdserverpb::KeyValue> kvs;
+  int64_t revision;
+  util::SyncTask task(executor_);
+  EtcdV3RangeAll(client_, req, &kvs, &revision, task.task());
+  task.Wait();
+  if (!task.status().ok()) {
+    return task.status();
+  }
+
+  entries->reserve(kvs.size());
+  for (const auto& kv : kvs) {
+    T t;
+    CHECK(t.ParseFromString(kv.value())) << kv.key();
+    entries->emplace_back(EntryHandle<T>(kv.key(), t, kv.mod_revision()));
+  }
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+template <class T>
+util::Status EtcdV3ConsistentStore<Logged>::WriteEntry(bool master_only,
+                                                       EntryHandle<T>* entry) {
+  CHECK_NOTNULL(entry);
+  etcdserverpb::TxnRequest txn;
+  if (entry->HasHandle()) {
+    AddCompare(entry->Key(), etcdserverpb::Compare::MOD, &txn,
+               entry->Handle());
+  } else {
+    AddCompare(entry->Key(), etcdserverpb::Compare::CREATE, &txn, 0);
+  }
+  return RunPutTxn(master_only, 0, &txn, entry);
+}
+
+
+template <class Logged>
+template <class T>
+util::Status EtcdV3ConsistentStore<Logged>::PutEntry(bool master_only,
+                                                     int64_t lease,
+                                                     EntryHandle<T>* entry) {
+  CHECK_NOTNULL(entry);
+  // For now we check that |entry| wasn't fetched from the store (i.e. it's a
+  // new EntryHandle). If it had been, the calling code should be doing a
+  // WriteEntry() here since they have the handle.
+  CHECK(!entry->HasHandle());
+  etcdserverpb::TxnRequest txn;
+  return RunPutTxn(master_only, lease, &txn, entry);
+}
+
+
+template <class Logged>
+template <class T>
+util::Status EtcdV3ConsistentStore<Logged>::RunPutTxn(
+    bool master_only, int64_t lease, etcdserverpb::TxnRequest* txn,
+    EntryHandle<T>* entry) {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("put_entry"));
+
+  CHECK(entry->HasKey());
+  etcdserverpb::PutRequest* const put(
+      txn->add_success()->mutable_request_put());
+  put->set_key(entry->Key());
+  CHECK(entry->Entry().SerializeToString(put->mutable_value()));
+  put->set_lease(lease);
+
+  etcdserverpb::TxnResponse resp;
+  const util::Status status(master_only ? MasterTxn(txn, &resp)
+                                        : Txn(*txn, &resp));
+  if (!status.ok()) {
+    return status;
+  }
+  if (!resp.succeeded()) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        (entry->HasHandle() ? "Key modified: "
+                                            : "Key already exists: ") +
+                            entry->Key());
+  }
+  entry->SetHandle(resp.header().revision());
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::StatusOr<int64_t> EtcdV3ConsistentStore<Logged>::CleanupOldEntries() {
+  ScopedLatency scoped_latency(
+      etcd_v3_latency_by_op_ms.GetScopedLatency("cleanup_old_entries"));
+
+  if (!election_->IsMaster()) {
+    return util::Status(util::error::PERMISSION_DENIED,
+                        "Non-master node cannot run cleanups.");
+  }
+
+  std::vector<std::string> keys_to_delete;
+  util::Status status(GetEntryKeysToCleanup(&keys_to_delete));
+  if (!status.ok()) {
+    return status;
+  }
+
+  // As many deletions per transaction as etcd allows.
+  for (size_t begin = 0; begin < keys_to_delete.size(); begin += kMaxTxnOps) {
+    const size_t end(std::min(begin + kMaxTxnOps, keys_to_delete.size()));
+    etcdserverpb::TxnRequest txn;
+    for (size_t i = begin; i < end; ++i) {
+      txn.add_success()->mutable_request_delete_range()->set_key(
+          keys_to_delete[i]);
+    }
+    etcdserverpb::TxnResponse resp;
+    status = MasterTxn(&txn, &resp);
+    if (!status.ok()) {
+      LOG(WARNING) << "Deleting old entries failed: " << status;
+      return status;
+    }
+  }
+
+  return keys_to_delete.size();
+}
+
+
+template <class Logged>
+void EtcdV3ConsistentStore<Logged>::StartEntryCountFetch() {
+  if (entry_count_task_.task()->CancelRequested()) {
+    entry_count_task_.task()->Return(util::Status::CANCELLED);
+    return;
+  }
+  etcdserverpb::RangeRequest req;
+  req.set_key(GetFullKey("/"));
+  req.set_range_end(EtcdV3PrefixEnd(req.key()));
+  req.set_count_only(true);
+  etcdserverpb::RangeResponse* const response(
+      new etcdserverpb::RangeResponse);
+  client_->Range(
+      req, response,
+      entry_count_task_.task()->AddChild(
+          std::bind(&EtcdV3ConsistentStore<Logged>::EntryCountFetchDone, this,
+                    response, std::placeholders::_1)));
+}
+
+
+template <class Logged>
+void EtcdV3ConsistentStore<Logged>::EntryCountFetchDone(
+    etcdserverpb::RangeResponse* response, util::Task* task) {
+  CHECK_NOTNULL(response);
+  CHECK_NOTNULL(task);
+  std::unique_ptr<etcdserverpb::RangeResponse> response_deleter(response);
+  if (task->status().ok()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      num_etcd_entries_ = response->count();
+    }
+    etcd_v3_total_entries->Set("all", response->count());
+  } else {
+    LOG(WARNING) << "Etcd entry count fetch failed: " << task->status();
+  }
+
+  base_->Delay(
+      std::chrono::seconds(FLAGS_etcd_stats_collection_interval_seconds),
+      entry_count_task_.task()->AddChild(
+          std::bind(&EtcdV3ConsistentStore<Logged>::StartEntryCountFetch,
+                    this)));
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_ETCD_V3_CONSISTENT_STORE_INL_H_
@@ -0,0 +1,198 @@
+#ifndef CERT_TRANS_LOG_ETCD_V3_CONSISTENT_STORE_H_
+#define CERT_TRANS_LOG_ETCD_V3_CONSISTENT_STORE_H_
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/etcd_consistent_store_base.h"
+#include "proto/ct.pb.h"
+#include "util/etcd_v3.h"
+#include "util/executor.h"
+#include "util/libevent_wrapper.h"
+#include "util/status.h"
+#include "util/sync_task.h"
+
+namespace cert_trans {
+
+class MasterElection;
+
+
+// A ConsistentStore on the etcd v3 API. It keeps the same layout as
+// EtcdConsistentStore under |root| (but in a separate keyspace, since
+// v2 and v3 keys are distinct in etcd), with the values as raw
+// serialized protobufs rather than base64.
+//
+// Compared to the v2 store:
+//  - Each master-only write is a single transaction which also checks
+//    the fencing token, so a deposed master's write can never go
+//    through, instead of the check and write racing.
+//  - A pending entry is added (or found to already exist, along with
+//    its SCT) in a single transaction.
+//  - Pending entries are read in pages, all at the same revision.
+//  - The node states are attached to a lease.
+//  - Old entries are deleted many per transaction.
+template <class Logged>
+class EtcdV3ConsistentStore : public EtcdConsistentStoreBase<Logged> {
+ public:
+  // No change of ownership for |client|, |executor| must continue to be valid
+  // at least as long as this object is, and should not be the libevent::Base
+  // used by |client|.
+  EtcdV3ConsistentStore(libevent::Base* base, util::Executor* executor,
+                        EtcdV3Client* client, const MasterElection* election,
+                        const std::string& root, const std::string& node_id);
+
+  virtual ~EtcdV3ConsistentStore();
+
+  util::StatusOr<int64_t> NextAvailableSequenceNumber() const override;
+
+  util::Status SetServingSTH(const ct::SignedTreeHead& new_sth) override;
+
+  util::Status AddPendingEntry(Logged* entry) override;
+
+  util::Status GetPendingEntryForHash(
+      const std::string& hash, EntryHandle<Logged>* entry) const override;
+
+  util::Status GetPendingEntries(
+      std::vector<EntryHandle<Logged>>* entries) const override;
+
+  util::Status GetSequenceMapping(
+      EntryHandle<ct::SequenceMapping>* entry) const override;
+
+  util::Status UpdateSequenceMapping(
+      EntryHandle<ct::SequenceMapping>* entry) override;
+
+  util::StatusOr<ct::ClusterNodeState> GetClusterNodeState() const override;
+
+  util::Status SetClusterNodeState(const ct::ClusterNodeState& state) override;
+
+  void WatchServingSTH(
+      const typename ConsistentStore<Logged>::ServingSTHCallback& cb,
+      util::Task* task) override;
+
+  void WatchClusterNodeStates(
+      const typename ConsistentStore<Logged>::ClusterNodeStateCallback& cb,
+      util::Task* task) override;
+
+  void WatchClusterConfig(
+      const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
+      util::Task* task) override;
+
+  void WatchPendingEntries(
+      const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+      util::Task* task) override;
+
+  util::Status SetClusterConfig(const ct::ClusterConfig& config) override;
+
+  // Removes sequenced entries with sequence numbers covered by the current
+  // serving STH.
+  util::StatusOr<int64_t> CleanupOldEntries() override;
+
+ private:
+  util::Status Range(const etcdserverpb::RangeRequest& req,
+                     etcdserverpb::RangeResponse* resp) const;
+
+  util::Status Txn(const etcdserverpb::TxnRequest& req,
+                   etcdserverpb::TxnResponse* resp) const;
+
+  // Runs |txn|, which must only succeed if nobody newer than us (as
+  // per the fencing token of |election_|) has been master. Returns
+  // PERMISSION_DENIED if someone has, otherwise |resp| says whether
+  // the rest of |txn| succeeded.
+  util::Status MasterTxn(etcdserverpb::TxnRequest* txn,
+                         etcdserverpb::TxnResponse* resp);
+
+  // Raises the fencing token in the store to |token|, unless it's
+  // already there or higher.
+  util::Status RaiseFencingToken(int64_t token);
+
+  template <class T>
+  util::Status GetEntry(const std::string& key, EntryHandle<T>* entry) const;
+
+  template <class T>
+  util::Status GetAllEntriesWithPrefix(
+      const std::string& prefix, std::vector<EntryHandle<T>>* entries) const;
+
+  // Writes |entry| if its handle is still current (or, if it has
+  // none, if it does not exist yet). Returns FAILED_PRECONDITION
+  // otherwise.
+  template <class T>
+  util::Status WriteEntry(bool master_only, EntryHandle<T>* entry);
+
+  // Writes |entry| unconditionally, attached to |lease| if it's not
+  // zero. |entry| must not have a handle.
+  template <class T>
+  util::Status PutEntry(bool master_only, int64_t lease,
+                        EntryHandle<T>* entry);
+
+  template <class T>
+  util::Status RunPutTxn(bool master_only, int64_t lease,
+                         etcdserverpb::TxnRequest* txn,
+                         EntryHandle<T>* entry);
+
+  using EtcdConsistentStoreBase<Logged>::kMaxFencingTokenAttempts;
+  using EtcdConsistentStoreBase<Logged>::GetEntryKey;
+  using EtcdConsistentStoreBase<Logged>::GetNodeKey;
+  using EtcdConsistentStoreBase<Logged>::GetFullKey;
+  using EtcdConsistentStoreBase<Logged>::GetNextSequenceNumber;
+  using EtcdConsistentStoreBase<Logged>::CheckSequenceMapping;
+  using EtcdConsistentStoreBase<Logged>::CheckIsNewerThanServingSTH;
+  using EtcdConsistentStoreBase<Logged>::GetEntryKeysToCleanup;
+  using EtcdConsistentStoreBase<Logged>::CheckRecordedFencingToken;
+  using EtcdConsistentStoreBase<Logged>::LeafEntriesMatch;
+  using EtcdConsistentStoreBase<Logged>::UpdateLocalServingSTH;
+  using EtcdConsistentStoreBase<Logged>::OnServingSTHUpdated;
+  using EtcdConsistentStoreBase<Logged>::OnClusterConfigUpdated;
+  using EtcdConsistentStoreBase<Logged>::WaitForInitialServingSTH;
+  using EtcdConsistentStoreBase<Logged>::MaybeReject;
+  using EtcdConsistentStoreBase<Logged>::election_;
+  using EtcdConsistentStoreBase<Logged>::node_id_;
+  using EtcdConsistentStoreBase<Logged>::mutex_;
+  using EtcdConsistentStoreBase<Logged>::serving_sth_;
+  using EtcdConsistentStoreBase<Logged>::num_etcd_entries_;
+
+  // The following 3 methods are static just so that they have friend access to
+  // the private c'tor/setters of EntryHandle<>
+
+  // Calls |callback| with the Update<T> for a single key.
+  template <class T, class CB>
+  static void ConvertSingleUpdate(
+      const std::string& key, const CB& callback,
+      const std::vector<etcdserverpb::KeyValue>& updated,
+      const std::vector<std::string>& deleted);
+
+  // Calls |callback| with the Update<T> for each key that changed.
+  template <class T, class CB>
+  static void ConvertMultipleUpdate(
+      const CB& callback, const std::vector<etcdserverpb::KeyValue>& updated,
+      const std::vector<std::string>& deleted);
+
+  // Converts a KeyValue to an Update<T>, or to a deleted one if |kv|
+  // is NULL.
+  template <class T>
+  static Update<T> TypedUpdate(const std::string& key,
+                               const etcdserverpb::KeyValue* kv);
+
+  void StartEntryCountFetch();
+  void EntryCountFetchDone(etcdserverpb::RangeResponse* response,
+                           util::Task* task);
+
+  EtcdV3Client* const client_;            // We don't own this.
+  libevent::Base* const base_;            // We don't own this.
+  util::Executor* const executor_;        // We don't own this.
+  util::SyncTask serving_sth_watch_task_;
+  util::SyncTask cluster_config_watch_task_;
+  util::SyncTask entry_count_task_;
+
+  friend class EtcdV3ConsistentStoreTest;
+
+  DISALLOW_COPY_AND_ASSIGN(EtcdV3ConsistentStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_ETCD_V3_CONSISTENT_STORE_H_
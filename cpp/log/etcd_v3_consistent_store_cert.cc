@@ -0,0 +1,6 @@
+#include "log/etcd_v3_consistent_store-inl.h"
+#include "log/logged_certificate.h"
+
+namespace cert_trans {
+template class EtcdV3ConsistentStore<LoggedCertificate>;
+}  // namespace cert_trans
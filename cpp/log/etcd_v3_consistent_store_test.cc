@@ -0,0 +1,711 @@
+#include "log/etcd_v3_consistent_store.h"
+
+#include <functional>
+#include <gflags/gflags.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "base/notification.h"
+#include "log/logged_certificate.h"
+#include "proto/ct.pb.h"
+#include "util/fake_etcd_v3.h"
+#include "util/libevent_wrapper.h"
+#include "util/mock_masterelection.h"
+#include "util/status_test_util.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DECLARE_int32(node_state_ttl_seconds);
+DECLARE_int32(etcd_stats_collection_interval_seconds);
+DECLARE_int32(etcd_v3_range_page_size);
+DECLARE_int32(etcd_v3_watch_poll_interval_ms);
+
+namespace cert_trans {
+
+
+using ct::SequenceMapping;
+using ct::SignedTreeHead;
+using etcdserverpb::RangeRequest;
+using etcdserverpb::RangeResponse;
+using etcdserverpb::TxnRequest;
+using etcdserverpb::TxnResponse;
+using std::chrono::milliseconds;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using testing::AllOf;
+using testing::Contains;
+using testing::Return;
+using util::Status;
+using util::StatusOr;
+using util::SyncTask;
+using util::testing::StatusIs;
+
+
+const char kRoot[] = "/root";
+const char kNodeId[] = "node_id";
+const int kTimestamp = 9000;
+
+
+class EtcdV3ConsistentStoreTest : public ::testing::Test {
+ public:
+  EtcdV3ConsistentStoreTest()
+      : base_(make_shared<libevent::Base>()),
+        executor_(2),
+        event_pump_(base_) {
+  }
+
+ protected:
+  void SetUp() override {
+    FLAGS_etcd_stats_collection_interval_seconds = 1;
+    FLAGS_etcd_v3_watch_poll_interval_ms = 10;
+    store_.reset(new EtcdV3ConsistentStore<LoggedCertificate>(
+        base_.get(), &executor_, &client_, &election_, kRoot, kNodeId));
+    PutEntry("/root/sequence_mapping", SequenceMapping());
+  }
+
+  LoggedCertificate DefaultCert() {
+    return MakeCert(kTimestamp, "leaf");
+  }
+
+  LoggedCertificate MakeCert(int timestamp, const string& body) {
+    LoggedCertificate cert;
+    cert.mutable_sct()->set_timestamp(timestamp);
+    cert.mutable_entry()->set_type(ct::X509_ENTRY);
+    cert.mutable_entry()->mutable_x509_entry()->set_leaf_certificate(body);
+    return cert;
+  }
+
+  LoggedCertificate MakeSequencedCert(int timestamp, const string& body,
+                                      int seq) {
+    LoggedCertificate cert(MakeCert(timestamp, body));
+    cert.set_sequence_number(seq);
+    return cert;
+  }
+
+  string CertPath(const LoggedCertificate& cert) const {
+    return string(kRoot) + "/entries/" + util::HexString(cert.Hash());
+  }
+
+  void PopulateForCleanupTests(int num_seq, int num_pending,
+                               int starting_seq) {
+    int timestamp(345345);
+    int seq(starting_seq);
+    EntryHandle<SequenceMapping> mapping;
+    Status status(store_->GetSequenceMapping(&mapping));
+    CHECK_EQ(Status::OK, status);
+    for (int i = 0; i < num_seq; ++i) {
+      std::ostringstream ss;
+      ss << "sequenced body " << i;
+      LoggedCertificate lc(MakeCert(timestamp++, ss.str()));
+      CHECK(store_->AddPendingEntry(&lc).ok());
+      SequenceMapping::Mapping* m(mapping.MutableEntry()->add_mapping());
+      m->set_entry_hash(lc.Hash());
+      m->set_sequence_number(seq++);
+    }
+    CHECK_EQ(Status::OK, store_->UpdateSequenceMapping(&mapping));
+    for (int i = 0; i < num_pending; ++i) {
+      std::ostringstream ss;
+      ss << "pending body " << i;
+      LoggedCertificate lc(MakeCert(timestamp++, ss.str()));
+      CHECK(store_->AddPendingEntry(&lc).ok());
+    }
+  }
+
+  util::StatusOr<int64_t> CleanupOldEntries() {
+    return store_->CleanupOldEntries();
+  }
+
+  void AddSequenceMapping(int64_t seq, const string& hash) {
+    EntryHandle<SequenceMapping> mapping;
+    Status status(store_->GetSequenceMapping(&mapping));
+    CHECK_EQ(Status::OK, status);
+    SequenceMapping::Mapping* m(mapping.MutableEntry()->add_mapping());
+    m->set_sequence_number(seq);
+    m->set_entry_hash(hash);
+    CHECK_EQ(Status::OK, store_->UpdateSequenceMapping(&mapping));
+  }
+
+  void PutValue(const string& key, const string& value) {
+    TxnRequest req;
+    etcdserverpb::PutRequest* const put(
+        req.add_success()->mutable_request_put());
+    put->set_key(key);
+    put->set_value(value);
+    TxnResponse resp;
+    SyncTask task(base_.get());
+    client_.Txn(req, &resp, task.task());
+    task.Wait();
+    ASSERT_OK(task.status());
+  }
+
+  template <class T>
+  void PutEntry(const string& key, const T& thing) {
+    string flat;
+    ASSERT_TRUE(thing.SerializeToString(&flat));
+    PutValue(key, flat);
+  }
+
+  Status PeekValue(const string& key, string* value) {
+    RangeRequest req;
+    req.set_key(key);
+    RangeResponse resp;
+    SyncTask task(base_.get());
+    client_.Range(req, &resp, task.task());
+    task.Wait();
+    if (!task.status().ok()) {
+      return task.status();
+    }
+    if (resp.kvs_size() == 0) {
+      return Status(util::error::NOT_FOUND, key);
+    }
+    *value = resp.kvs(0).value();
+    return Status::OK;
+  }
+
+  template <class T>
+  void PeekEntry(const string& key, T* thing) {
+    string flat;
+    ASSERT_OK(PeekValue(key, &flat));
+    ASSERT_TRUE(thing->ParseFromString(flat));
+  }
+
+  ct::SignedTreeHead ServingSTH() {
+    return store_->serving_sth_->Entry();
+  }
+
+  int64_t GetNumEtcdEntries() const {
+    std::lock_guard<std::mutex> lock(store_->mutex_);
+    return store_->num_etcd_entries_;
+  }
+
+
+  shared_ptr<libevent::Base> base_;
+  ThreadPool executor_;
+  libevent::EventPumpThread event_pump_;
+  FakeEtcdV3Client client_;
+  MockMasterElection election_;
+  unique_ptr<EtcdV3ConsistentStore<LoggedCertificate>> store_;
+};
+
+
+typedef class EtcdV3ConsistentStoreTest EtcdV3ConsistentStoreDeathTest;
+
+
+TEST_F(EtcdV3ConsistentStoreTest,
+       TestNextAvailableSequenceNumberWhenNoSequencedEntriesOrServingSTH) {
+  util::StatusOr<int64_t> sequence_number(
+      store_->NextAvailableSequenceNumber());
+  ASSERT_OK(sequence_number.status());
+  EXPECT_EQ(0, sequence_number.ValueOrDie());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest,
+       TestNextAvailableSequenceNumberWhenSequencedEntriesExist) {
+  AddSequenceMapping(0, "zero");
+  AddSequenceMapping(1, "one");
+  util::StatusOr<int64_t> sequence_number(
+      store_->NextAvailableSequenceNumber());
+  ASSERT_OK(sequence_number.status());
+  EXPECT_EQ(2, sequence_number.ValueOrDie());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest,
+       TestNextAvailableSequenceNumberWhenNoSequencedEntriesExistButHaveSTH) {
+  ct::SignedTreeHead serving_sth;
+  serving_sth.set_timestamp(123);
+  serving_sth.set_tree_size(600);
+  EXPECT_OK(store_->SetServingSTH(serving_sth));
+
+  util::StatusOr<int64_t> sequence_number(
+      store_->NextAvailableSequenceNumber());
+  ASSERT_OK(sequence_number.status());
+  EXPECT_EQ(serving_sth.tree_size(), sequence_number.ValueOrDie());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestSetServingSTHOverwrites) {
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(234);
+  EXPECT_OK(store_->SetServingSTH(sth));
+
+  ct::SignedTreeHead sth2;
+  sth2.set_timestamp(sth.timestamp() + 1);
+  EXPECT_OK(store_->SetServingSTH(sth2));
+
+  ct::SignedTreeHead stored;
+  PeekEntry(string(kRoot) + "/serving_sth", &stored);
+  EXPECT_EQ(sth2.timestamp(), stored.timestamp());
+  EXPECT_EQ(sth2.timestamp(), ServingSTH().timestamp());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestSetServingSTHWontOverwriteWithOlder) {
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(234);
+  EXPECT_OK(store_->SetServingSTH(sth));
+
+  ct::SignedTreeHead sth2;
+  sth2.set_timestamp(sth.timestamp() - 1);
+  EXPECT_THAT(store_->SetServingSTH(sth2),
+              StatusIs(util::error::OUT_OF_RANGE));
+}
+
+
+TEST_F(EtcdV3ConsistentStoreDeathTest,
+       TestSetServingSTHChecksInconsistentSize) {
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(234);
+  sth.set_tree_size(10);
+  EXPECT_OK(store_->SetServingSTH(sth));
+
+  ct::SignedTreeHead sth2;
+  sth2.set_timestamp(sth.timestamp() + 1);
+  sth2.set_tree_size(sth.tree_size() - 1);
+  EXPECT_DEATH(store_->SetServingSTH(sth2), "tree_size");
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestSetServingSTHIsFenced) {
+  const string kFencingTokenPath(string(kRoot) + "/fencing_token");
+  EXPECT_CALL(election_, FencingToken()).WillRepeatedly(Return(10));
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(234);
+  sth.set_tree_size(10);
+  EXPECT_OK(store_->SetServingSTH(sth));
+  string token;
+  ASSERT_OK(PeekValue(kFencingTokenPath, &token));
+  EXPECT_EQ("00000000000000000010", token);
+
+  // A newer master takes over:
+  PutValue(kFencingTokenPath, "00000000000000000020");
+
+  sth.set_timestamp(sth.timestamp() + 1);
+  EXPECT_THAT(store_->SetServingSTH(sth),
+              StatusIs(util::error::PERMISSION_DENIED));
+  EXPECT_EQ(234, ServingSTH().timestamp());
+
+  // And an even newer one raises the token again:
+  EXPECT_CALL(election_, FencingToken()).WillRepeatedly(Return(300));
+  EXPECT_OK(store_->SetServingSTH(sth));
+  ASSERT_OK(PeekValue(kFencingTokenPath, &token));
+  EXPECT_EQ("00000000000000000300", token);
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestUpdateSequenceMappingIsFenced) {
+  EXPECT_CALL(election_, FencingToken()).WillRepeatedly(Return(2));
+  AddSequenceMapping(0, "zero");
+
+  EntryHandle<SequenceMapping> mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+  PutValue(string(kRoot) + "/fencing_token", "00000000000000000003");
+  mapping.MutableEntry()->add_mapping()->set_sequence_number(1);
+  EXPECT_THAT(store_->UpdateSequenceMapping(&mapping),
+              StatusIs(util::error::PERMISSION_DENIED));
+
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+  EXPECT_EQ(1, mapping.Entry().mapping_size());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestAddPendingEntryWorks) {
+  LoggedCertificate cert(DefaultCert());
+  ASSERT_OK(store_->AddPendingEntry(&cert));
+  LoggedCertificate stored;
+  PeekEntry(CertPath(cert), &stored);
+  EXPECT_EQ(cert, stored);
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest,
+       TestAddPendingEntryForExistingEntryReturnsSct) {
+  LoggedCertificate cert(DefaultCert());
+  LoggedCertificate other_cert(DefaultCert());
+  other_cert.mutable_sct()->set_timestamp(55555);
+  PutEntry(CertPath(cert), other_cert);
+
+  EXPECT_THAT(store_->AddPendingEntry(&cert),
+              StatusIs(util::error::ALREADY_EXISTS));
+  EXPECT_EQ(other_cert.timestamp(), cert.timestamp());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreDeathTest,
+       TestAddPendingEntryForExistingNonIdenticalEntry) {
+  LoggedCertificate cert(DefaultCert());
+  LoggedCertificate other_cert(MakeCert(2342, "something else"));
+  PutEntry(CertPath(cert), other_cert);
+
+  EXPECT_DEATH(store_->AddPendingEntry(&cert),
+               "Check failed: LeafEntriesMatch");
+}
+
+
+TEST_F(EtcdV3ConsistentStoreDeathTest,
+       TestAddPendingEntryDoesNotAcceptSequencedEntry) {
+  LoggedCertificate cert(DefaultCert());
+  cert.set_sequence_number(76);
+  EXPECT_DEATH(store_->AddPendingEntry(&cert),
+               "!entry\\->has_sequence_number");
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestGetPendingEntryForHash) {
+  const LoggedCertificate one(MakeCert(123, "one"));
+  PutEntry(CertPath(one), one);
+
+  EntryHandle<LoggedCertificate> handle;
+  EXPECT_OK(store_->GetPendingEntryForHash(one.Hash(), &handle));
+  EXPECT_EQ(one, handle.Entry());
+  EXPECT_TRUE(handle.HasHandle());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestGetPendingEntryForNonExistantHash) {
+  EntryHandle<LoggedCertificate> handle;
+  EXPECT_THAT(store_->GetPendingEntryForHash("Nah", &handle),
+              StatusIs(util::error::NOT_FOUND));
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestGetPendingEntries) {
+  const string kPath(string(kRoot) + "/entries/");
+  const LoggedCertificate one(MakeCert(123, "one"));
+  const LoggedCertificate two(MakeCert(456, "two"));
+  PutEntry(kPath + "one", one);
+  PutEntry(kPath + "two", two);
+  // Not an entry, but sharing the prefix with the directory name.
+  PutValue(string(kRoot) + "/entries", "nope");
+
+  vector<EntryHandle<LoggedCertificate>> entries;
+  EXPECT_OK(store_->GetPendingEntries(&entries));
+  EXPECT_EQ(2, entries.size());
+  vector<LoggedCertificate> certs;
+  for (const auto& e : entries) {
+    certs.push_back(e.Entry());
+  }
+  EXPECT_THAT(certs, AllOf(Contains(one), Contains(two)));
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestGetPendingEntriesInPages) {
+  FLAGS_etcd_v3_range_page_size = 3;
+  PopulateForCleanupTests(0, 10, 0);
+
+  vector<EntryHandle<LoggedCertificate>> entries;
+  EXPECT_OK(store_->GetPendingEntries(&entries));
+  EXPECT_EQ(10, entries.size());
+  FLAGS_etcd_v3_range_page_size = 1000;
+}
+
+
+TEST_F(EtcdV3ConsistentStoreDeathTest,
+       TestGetPendingEntriesBarfsWithSequencedEntry) {
+  const string kPath(string(kRoot) + "/entries/");
+  LoggedCertificate one(MakeSequencedCert(123, "one", 666));
+  PutEntry(kPath + "one", one);
+  vector<EntryHandle<LoggedCertificate>> entries;
+  EXPECT_DEATH(store_->GetPendingEntries(&entries), "has_sequence_number");
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestGetSequenceMapping) {
+  AddSequenceMapping(0, "zero");
+  AddSequenceMapping(1, "one");
+  EntryHandle<SequenceMapping> mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+
+  EXPECT_EQ(2, mapping.Entry().mapping_size());
+  EXPECT_EQ(0, mapping.Entry().mapping(0).sequence_number());
+  EXPECT_EQ("zero", mapping.Entry().mapping(0).entry_hash());
+  EXPECT_EQ(1, mapping.Entry().mapping(1).sequence_number());
+  EXPECT_EQ("one", mapping.Entry().mapping(1).entry_hash());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreDeathTest,
+       TestGetSequenceMappingBarfsOnGapsAboveTreeSize) {
+  SignedTreeHead sth;
+  sth.set_tree_size(0);
+  store_->SetServingSTH(sth);
+
+  SequenceMapping mapping;
+  mapping.add_mapping()->set_sequence_number(0);
+  mapping.add_mapping()->set_sequence_number(2);
+  PutEntry("/root/sequence_mapping", mapping);
+  EntryHandle<SequenceMapping> entry;
+  EXPECT_DEATH(store_->GetSequenceMapping(&entry), "mapped_seq \\+ 1");
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestUpdateSequenceMappingWithStaleHandle) {
+  EntryHandle<SequenceMapping> mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+  EntryHandle<SequenceMapping> stale(mapping);
+
+  mapping.MutableEntry()->add_mapping()->set_sequence_number(0);
+  EXPECT_OK(store_->UpdateSequenceMapping(&mapping));
+
+  stale.MutableEntry()->add_mapping()->set_sequence_number(1);
+  EXPECT_THAT(store_->UpdateSequenceMapping(&stale),
+              StatusIs(util::error::FAILED_PRECONDITION));
+
+  // The handle from the write is current.
+  mapping.MutableEntry()->add_mapping()->set_sequence_number(1);
+  EXPECT_OK(store_->UpdateSequenceMapping(&mapping));
+}
+
+
+TEST_F(EtcdV3ConsistentStoreDeathTest,
+       TestUpdateSequenceMappingBarfsWithOutOfOrderSequenceNumber) {
+  EntryHandle<SequenceMapping> mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&mapping));
+
+  SequenceMapping::Mapping* m1(mapping.MutableEntry()->add_mapping());
+  m1->set_sequence_number(2);
+  m1->set_entry_hash("two");
+  SequenceMapping::Mapping* m2(mapping.MutableEntry()->add_mapping());
+  m2->set_sequence_number(0);
+  m2->set_entry_hash("zero");
+  EXPECT_DEATH(store_->UpdateSequenceMapping(&mapping),
+               "sequence_number\\(\\) < mapping");
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestSetClusterNodeState) {
+  ct::ClusterNodeState state;
+  state.set_hostname("host");
+
+  EXPECT_OK(store_->SetClusterNodeState(state));
+
+  ct::ClusterNodeState set_state;
+  PeekEntry(string(kRoot) + "/nodes/" + kNodeId, &set_state);
+  EXPECT_EQ(kNodeId, set_state.node_id());
+  EXPECT_EQ("host", set_state.hostname());
+
+  const StatusOr<ct::ClusterNodeState> got(store_->GetClusterNodeState());
+  ASSERT_OK(got.status());
+  EXPECT_EQ(kNodeId, got.ValueOrDie().node_id());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestSetClusterNodeStateHasTTL) {
+  FLAGS_node_state_ttl_seconds = 1;
+  const string kPath(string(kRoot) + "/nodes/" + kNodeId);
+
+  ct::ClusterNodeState state;
+  EXPECT_OK(store_->SetClusterNodeState(state));
+
+  ct::ClusterNodeState set_state;
+  PeekEntry(kPath, &set_state);
+  EXPECT_EQ(kNodeId, set_state.node_id());
+
+  sleep(2);
+
+  string unused;
+  EXPECT_THAT(PeekValue(kPath, &unused), StatusIs(util::error::NOT_FOUND));
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, WatchServingSTH) {
+  Notification notify;
+
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(234234);
+
+  int call_count(0);
+  SyncTask task(&executor_);
+  store_->WatchServingSTH(
+      [&sth, &notify, &call_count](const Update<ct::SignedTreeHead>& update) {
+        switch (call_count) {
+          case 0:
+            // initial empty state
+            EXPECT_FALSE(update.exists_);
+            break;
+          case 1:
+            // notification of update
+            EXPECT_TRUE(update.exists_);
+            EXPECT_EQ(sth.DebugString(), update.handle_.Entry().DebugString());
+            notify.Notify();
+            break;
+          default:
+            CHECK(false);
+        }
+        ++call_count;
+      },
+      task.task());
+
+  EXPECT_OK(store_->SetServingSTH(sth));
+  EXPECT_TRUE(notify.WaitForNotificationWithTimeout(milliseconds(5000)));
+  EXPECT_EQ(ServingSTH().DebugString(), sth.DebugString());
+  task.Cancel();
+  task.Wait();
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, WatchClusterConfig) {
+  ct::ClusterConfig config;
+  config.set_minimum_serving_nodes(1);
+  config.set_minimum_serving_fraction(0.6);
+  Notification notification;
+
+  SyncTask task(&executor_);
+  store_->WatchClusterConfig(
+      [&config, &notification](const Update<ct::ClusterConfig>& update) {
+        if (!update.exists_) {
+          VLOG(1) << "Ignoring initial empty update.";
+          return;
+        }
+        EXPECT_EQ(update.handle_.Entry().DebugString(), config.DebugString());
+        notification.Notify();
+      },
+      task.task());
+  EXPECT_OK(store_->SetClusterConfig(config));
+  EXPECT_TRUE(notification.WaitForNotificationWithTimeout(milliseconds(5000)));
+  task.Cancel();
+  task.Wait();
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, WatchPendingEntries) {
+  LoggedCertificate cert(DefaultCert());
+  Notification added;
+  Notification deleted;
+
+  SyncTask task(&executor_);
+  store_->WatchPendingEntries(
+      [&cert, &added,
+       &deleted](const vector<Update<LoggedCertificate>>& updates) {
+        if (updates.empty()) {
+          VLOG(1) << "Ignoring initial empty update.";
+          return;
+        }
+        ASSERT_EQ(1, updates.size());
+        if (updates[0].exists_) {
+          EXPECT_EQ(cert.Hash(), updates[0].handle_.Entry().Hash());
+          added.Notify();
+        } else {
+          EXPECT_EQ(string(kRoot) + "/entries/" + util::HexString(cert.Hash()),
+                    updates[0].handle_.Key());
+          deleted.Notify();
+        }
+      },
+      task.task());
+  EXPECT_OK(store_->AddPendingEntry(&cert));
+  EXPECT_TRUE(added.WaitForNotificationWithTimeout(milliseconds(5000)));
+
+  // Clean it up.
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+  AddSequenceMapping(0, cert.Hash());
+  SignedTreeHead sth;
+  sth.set_timestamp(1);
+  sth.set_tree_size(1);
+  EXPECT_OK(store_->SetServingSTH(sth));
+  EXPECT_OK(CleanupOldEntries().status());
+  EXPECT_TRUE(deleted.WaitForNotificationWithTimeout(milliseconds(5000)));
+
+  task.Cancel();
+  task.Wait();
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestDoesNotCleanUpIfNotMaster) {
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(false));
+  EXPECT_THAT(CleanupOldEntries().status(),
+              StatusIs(util::error::PERMISSION_DENIED));
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestEmptyClean) {
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+  const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+  ASSERT_OK(num_cleaned.status());
+  EXPECT_EQ(0, num_cleaned.ValueOrDie());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestCleansUpToNewSTH) {
+  // More than fit in one transaction.
+  PopulateForCleanupTests(300, 4, 100);
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+
+  EntryHandle<SequenceMapping> orig_seq_mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&orig_seq_mapping));
+
+  SignedTreeHead sth;
+  sth.set_timestamp(345345);
+  sth.set_tree_size(103);
+  ASSERT_OK(store_->SetServingSTH(sth));
+  {
+    const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+    ASSERT_OK(num_cleaned.status());
+    EXPECT_EQ(3, num_cleaned.ValueOrDie());
+  }
+  EntryHandle<LoggedCertificate> unused;
+  EXPECT_THAT(store_->GetPendingEntryForHash(
+                  orig_seq_mapping.Entry().mapping(2).entry_hash(), &unused),
+              StatusIs(util::error::NOT_FOUND));
+  EXPECT_OK(store_->GetPendingEntryForHash(
+      orig_seq_mapping.Entry().mapping(3).entry_hash(), &unused));
+
+  sth.set_timestamp(sth.timestamp() + 1);
+  sth.set_tree_size(400);
+  ASSERT_OK(store_->SetServingSTH(sth));
+  {
+    const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+    ASSERT_OK(num_cleaned.status());
+    EXPECT_EQ(300, num_cleaned.ValueOrDie());
+  }
+
+  // Only the pending entries are left, and the mapping is untouched.
+  vector<EntryHandle<LoggedCertificate>> pending;
+  ASSERT_OK(store_->GetPendingEntries(&pending));
+  EXPECT_EQ(4, pending.size());
+  EntryHandle<SequenceMapping> seq_mapping;
+  ASSERT_OK(store_->GetSequenceMapping(&seq_mapping));
+  EXPECT_EQ(orig_seq_mapping.Entry().DebugString(),
+            seq_mapping.Entry().DebugString());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestStoreStatsFetcher) {
+  EXPECT_EQ(0, GetNumEtcdEntries());
+  PopulateForCleanupTests(100, 100, 100);
+  sleep(2 * FLAGS_etcd_stats_collection_interval_seconds);
+  EXPECT_LE(200, GetNumEtcdEntries());
+}
+
+
+TEST_F(EtcdV3ConsistentStoreTest, TestRejectsAddsWhenOverCapacity) {
+  ct::ClusterConfig config;
+  config.set_etcd_reject_add_pending_threshold(2);
+  ASSERT_OK(store_->SetClusterConfig(config));
+
+  PopulateForCleanupTests(3, 0, 1);
+  sleep(2 * FLAGS_etcd_stats_collection_interval_seconds);
+
+  EXPECT_LT(2, GetNumEtcdEntries());
+
+  LoggedCertificate cert(MakeCert(1000, "cert1000"));
+  EXPECT_THAT(store_->AddPendingEntry(&cert),
+              StatusIs(util::error::RESOURCE_EXHAUSTED));
+}
+
+
+}  // namespace cert_trans
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,191 @@
+#include "log/fair_sequencing_policy.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <glog/logging.h>
+#include <stdlib.h>
+#include <unordered_map>
+
+#include "util/util.h"
+
+using std::chrono::duration;
+using std::map;
+using std::sort;
+using std::string;
+using std::unordered_map;
+using std::vector;
+using util::Status;
+using util::StatusOr;
+
+namespace cert_trans {
+
+namespace {
+
+
+struct Share {
+  Share(const string& k, int64_t c, double w)
+      : key(k), count(c), weight(w), allocated(0) {
+  }
+
+  string key;
+  int64_t count;
+  double weight;
+  int64_t allocated;
+};
+
+
+bool IsHex(const string& str) {
+  for (const char c : str) {
+    if (!isxdigit(static_cast<unsigned char>(c))) {
+      return false;
+    }
+  }
+  return str.size() % 2 == 0;
+}
+
+
+}  // namespace
+
+
+FairSequencingPolicy::FairSequencingPolicy(int64_t budget,
+                                           const map<string, double>& weights,
+                                           double default_weight,
+                                           const duration<double>& max_deferral)
+    : budget_(budget),
+      weights_(weights),
+      default_weight_(default_weight),
+      max_deferral_(max_deferral) {
+  CHECK_GE(budget_, 0);
+  CHECK_GE(max_deferral_.count(), 0);
+  CHECK_GT(default_weight_, 0);
+  for (const auto& weight : weights_) {
+    CHECK_GT(weight.second, 0) << util::HexString(weight.first);
+  }
+}
+
+
+// static
+StatusOr<map<string, double>> FairSequencingPolicy::ParseWeights(
+    const string& spec) {
+  map<string, double> weights;
+  size_t begin(0);
+  while (begin < spec.size()) {
+    size_t end(spec.find(',', begin));
+    if (end == string::npos) {
+      end = spec.size();
+    }
+    const string item(spec.substr(begin, end - begin));
+    begin = end + 1;
+
+    const size_t colon(item.find(':'));
+    if (colon == string::npos) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "missing weight in \"" + item + "\"");
+    }
+    const string hex_key(item.substr(0, colon));
+    if (hex_key.empty() || !IsHex(hex_key)) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "invalid key in \"" + item + "\"");
+    }
+    const string weight_str(item.substr(colon + 1));
+    char* weight_end;
+    const double weight(strtod(weight_str.c_str(), &weight_end));
+    if (weight_str.empty() || *weight_end != '\0' || !(weight > 0)) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "invalid weight in \"" + item + "\"");
+    }
+    weights[util::BinaryString(hex_key)] = weight;
+  }
+
+  return weights;
+}
+
+
+vector<bool> FairSequencingPolicy::Select(const vector<string>& keys,
+                                          int64_t reserved) const {
+  CHECK_GE(reserved, 0);
+  const int64_t budget(std::max<int64_t>(budget_ - reserved, 0));
+  if (budget_ == 0 || static_cast<int64_t>(keys.size()) <= budget) {
+    return vector<bool>(keys.size(), true);
+  }
+  if (budget == 0) {
+    return vector<bool>(keys.size(), false);
+  }
+
+  unordered_map<string, int64_t> counts;
+  for (const auto& key : keys) {
+    ++counts[key];
+  }
+
+  vector<Share> shares;
+  double total_weight(0);
+  for (const auto& count : counts) {
+    shares.emplace_back(count.first, count.second, Weight(count.first));
+    total_weight += shares.back().weight;
+  }
+
+  // Serve the submitters needing less than their fair share first,
+  // and share what they leave between the others.
+  sort(shares.begin(), shares.end(), [](const Share& a, const Share& b) {
+    const double a_need(a.count / a.weight), b_need(b.count / b.weight);
+    return a_need != b_need ? a_need < b_need : a.key < b.key;
+  });
+
+  int64_t remaining(budget);
+  size_t i(0);
+  for (; i < shares.size(); ++i) {
+    if (shares[i].count > remaining * shares[i].weight / total_weight) {
+      break;
+    }
+    shares[i].allocated = shares[i].count;
+    remaining -= shares[i].count;
+    total_weight -= shares[i].weight;
+  }
+
+  // Everyone left wants more than their share, round it down, and
+  // hand out what rounding left over, heaviest first.
+  const int64_t to_share(remaining);
+  for (size_t j = i; j < shares.size(); ++j) {
+    shares[j].allocated = static_cast<int64_t>(
+        to_share * shares[j].weight / total_weight);
+    remaining -= shares[j].allocated;
+  }
+  sort(shares.begin() + i, shares.end(), [](const Share& a, const Share& b) {
+    return a.weight != b.weight ? a.weight > b.weight : a.key < b.key;
+  });
+  for (size_t j = i; remaining > 0 && j < shares.size(); ++j) {
+    if (shares[j].allocated < shares[j].count) {
+      ++shares[j].allocated;
+      --remaining;
+    }
+  }
+
+  unordered_map<string, int64_t> allowed;
+  for (const auto& share : shares) {
+    allowed[share.key] = share.allocated;
+  }
+
+  // Also enforce the budget overall, in case of floating point
+  // rounding above.
+  vector<bool> selected(keys.size(), false);
+  int64_t budget_left(budget);
+  for (size_t k = 0; k < keys.size() && budget_left > 0; ++k) {
+    int64_t* const left(&allowed[keys[k]]);
+    if (*left > 0) {
+      selected[k] = true;
+      --*left;
+      --budget_left;
+    }
+  }
+
+  return selected;
+}
+
+
+double FairSequencingPolicy::Weight(const string& key) const {
+  const auto it(weights_.find(key));
+  return it == weights_.end() ? default_weight_ : it->second;
+}
+
+
+}  // namespace cert_trans
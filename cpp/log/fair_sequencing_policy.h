@@ -0,0 +1,79 @@
+#ifndef CERT_TRANS_LOG_FAIR_SEQUENCING_POLICY_H_
+#define CERT_TRANS_LOG_FAIR_SEQUENCING_POLICY_H_
+
+#include <chrono>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/statusor.h"
+
+namespace cert_trans {
+
+
+// Decides which of the entries waiting to be sequenced make it into a
+// sequencing pass, when there are more of them than the per-pass
+// budget. The budget is shared between submitters (identified by a
+// key, typically the issuer of the certificate) in proportion to
+// their weights, and whatever a submitter doesn't need is shared
+// between the others (weighted max-min fairness). This way, a single
+// submitter flooding the log can only slow down its own entries.
+//
+// Entries must still make it into the log within its maximum merge
+// delay, so those that have been waiting for longer than
+// max_deferral() are not subject to the policy, and always go in.
+//
+// This class is thread-compatible.
+class FairSequencingPolicy {
+ public:
+  // A |budget| of 0 means that there is no limit. Submitters not in
+  // |weights| have a weight of |default_weight|. All the weights must
+  // be positive. A |max_deferral| of 0 means that entries can be
+  // deferred indefinitely.
+  FairSequencingPolicy(int64_t budget,
+                       const std::map<std::string, double>& weights,
+                       double default_weight = 1,
+                       const std::chrono::duration<double>& max_deferral =
+                           std::chrono::duration<double>::zero());
+
+  // Parses weights of the form "<key>:<weight>,<key>:<weight>,...",
+  // where keys are hex-encoded.
+  static util::StatusOr<std::map<std::string, double>> ParseWeights(
+      const std::string& spec);
+
+  int64_t budget() const {
+    return budget_;
+  }
+
+  // Whether an entry submitted |age| ago must be sequenced in this
+  // pass, whatever the budget.
+  bool IsOverdue(const std::chrono::duration<double>& age) const {
+    return max_deferral_ > std::chrono::duration<double>::zero() &&
+           age >= max_deferral_;
+  }
+
+  // |keys| has the key of each entry waiting to be sequenced, in
+  // order of preference (the entries of a submitter are taken in that
+  // order). Returns whether each of them should be sequenced in this
+  // pass, which is at most budget() of them, less the |reserved| ones
+  // already going in (such as overdue entries).
+  std::vector<bool> Select(const std::vector<std::string>& keys,
+                           int64_t reserved = 0) const;
+
+ private:
+  double Weight(const std::string& key) const;
+
+  const int64_t budget_;
+  const std::map<std::string, double> weights_;
+  const double default_weight_;
+  const std::chrono::duration<double> max_deferral_;
+
+  DISALLOW_COPY_AND_ASSIGN(FairSequencingPolicy);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_FAIR_SEQUENCING_POLICY_H_
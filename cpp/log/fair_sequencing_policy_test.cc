@@ -0,0 +1,224 @@
+#include "log/fair_sequencing_policy.h"
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::map;
+using std::string;
+using std::to_string;
+using std::vector;
+
+
+map<string, int64_t> CountSelected(const vector<string>& keys,
+                                   const vector<bool>& selected) {
+  map<string, int64_t> counts;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (selected[i]) {
+      ++counts[keys[i]];
+    }
+  }
+  return counts;
+}
+
+
+TEST(FairSequencingPolicyTest, NoBudget) {
+  const FairSequencingPolicy policy(0, map<string, double>());
+  const vector<string> keys(1000, "flood");
+  EXPECT_EQ(vector<bool>(keys.size(), true), policy.Select(keys));
+}
+
+
+TEST(FairSequencingPolicyTest, UnderBudget) {
+  const FairSequencingPolicy policy(10, map<string, double>());
+  const vector<string> keys{"a", "b", "a"};
+  EXPECT_EQ(vector<bool>(keys.size(), true), policy.Select(keys));
+}
+
+
+TEST(FairSequencingPolicyTest, SharesEqually) {
+  const FairSequencingPolicy policy(10, map<string, double>());
+  vector<string> keys(20, "a");
+  keys.insert(keys.end(), 20, "b");
+
+  const vector<bool> selected(policy.Select(keys));
+  const map<string, int64_t> counts(CountSelected(keys, selected));
+  EXPECT_EQ(5, counts.at("a"));
+  EXPECT_EQ(5, counts.at("b"));
+
+  // The entries of each submitter are taken in order.
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(i < 5, selected[i]) << i;
+    EXPECT_EQ(i < 5, selected[20 + i]) << i;
+  }
+}
+
+
+TEST(FairSequencingPolicyTest, RedistributesUnusedShare) {
+  const FairSequencingPolicy policy(10, map<string, double>());
+  vector<string> keys(2, "small");
+  keys.insert(keys.end(), 20, "big1");
+  keys.insert(keys.end(), 20, "big2");
+
+  const map<string, int64_t> counts(CountSelected(keys, policy.Select(keys)));
+  EXPECT_EQ(2, counts.at("small"));
+  EXPECT_EQ(4, counts.at("big1"));
+  EXPECT_EQ(4, counts.at("big2"));
+}
+
+
+TEST(FairSequencingPolicyTest, Weights) {
+  const FairSequencingPolicy policy(12, {{"heavy", 3}});
+  vector<string> keys(20, "heavy");
+  keys.insert(keys.end(), 20, "light");
+
+  const map<string, int64_t> counts(CountSelected(keys, policy.Select(keys)));
+  EXPECT_EQ(9, counts.at("heavy"));
+  EXPECT_EQ(3, counts.at("light"));
+}
+
+
+TEST(FairSequencingPolicyTest, RoundingUsesWholeBudget) {
+  const FairSequencingPolicy policy(10, map<string, double>());
+  vector<string> keys;
+  for (const string& key : {"a", "b", "c"}) {
+    keys.insert(keys.end(), 10, key);
+  }
+
+  const vector<bool> selected(policy.Select(keys));
+  int64_t total(0);
+  for (const auto& count : CountSelected(keys, selected)) {
+    EXPECT_LE(3, count.second);
+    EXPECT_GE(4, count.second);
+    total += count.second;
+  }
+  EXPECT_EQ(10, total);
+}
+
+
+TEST(FairSequencingPolicyTest, Reserved) {
+  const FairSequencingPolicy policy(10, map<string, double>());
+  vector<string> keys(20, "a");
+  keys.insert(keys.end(), 20, "b");
+
+  const map<string, int64_t> counts(
+      CountSelected(keys, policy.Select(keys, 4)));
+  EXPECT_EQ(3, counts.at("a"));
+  EXPECT_EQ(3, counts.at("b"));
+
+  EXPECT_EQ(vector<bool>(keys.size(), false), policy.Select(keys, 10));
+  EXPECT_EQ(vector<bool>(keys.size(), false), policy.Select(keys, 15));
+}
+
+
+TEST(FairSequencingPolicyTest, IsOverdue) {
+  const FairSequencingPolicy no_limit(10, map<string, double>());
+  EXPECT_FALSE(no_limit.IsOverdue(std::chrono::hours(1000)));
+
+  const FairSequencingPolicy policy(10, map<string, double>(), 1,
+                                    std::chrono::hours(1));
+  EXPECT_FALSE(policy.IsOverdue(std::chrono::minutes(59)));
+  EXPECT_TRUE(policy.IsOverdue(std::chrono::hours(1)));
+}
+
+
+TEST(FairSequencingPolicyTest, ParseWeights) {
+  const util::StatusOr<map<string, double>> weights(
+      FairSequencingPolicy::ParseWeights("0aff:2.5,01:1"));
+  ASSERT_TRUE(weights.ok()) << weights.status();
+  EXPECT_EQ(2U, weights.ValueOrDie().size());
+  EXPECT_EQ(2.5, weights.ValueOrDie().at(string("\x0a\xff")));
+  EXPECT_EQ(1, weights.ValueOrDie().at(string("\x01")));
+
+  EXPECT_TRUE(FairSequencingPolicy::ParseWeights("").ok());
+  EXPECT_FALSE(FairSequencingPolicy::ParseWeights("0aff").ok());
+  EXPECT_FALSE(FairSequencingPolicy::ParseWeights("0af:1").ok());
+  EXPECT_FALSE(FairSequencingPolicy::ParseWeights("zz:1").ok());
+  EXPECT_FALSE(FairSequencingPolicy::ParseWeights("0a:0").ok());
+  EXPECT_FALSE(FairSequencingPolicy::ParseWeights("0a:x").ok());
+}
+
+
+// One submitter floods the log while a few others submit a handful
+// of entries, and each pass sequences at most its budget. Sequencing
+// in arrival order makes the others wait for the whole flood, whereas
+// the fair policy sequences them in the first pass.
+TEST(FairSequencingPolicyTest, Flood) {
+  const int kBudget(100);
+  const int kFloodSize(10000);
+  const int kOthers(10);
+  const int kOtherSize(5);
+
+  vector<string> pending(kFloodSize, "flood");
+  for (int i = 0; i < kOthers; ++i) {
+    pending.insert(pending.end(), kOtherSize, "other" + to_string(i));
+  }
+
+  const FairSequencingPolicy policy(kBudget, map<string, double>());
+  for (const bool use_policy : {false, true}) {
+    vector<string> queue(pending);
+    int passes(0);
+    int others_done_pass(-1);
+    while (!queue.empty()) {
+      ++passes;
+      vector<bool> selected(queue.size(), false);
+      if (use_policy) {
+        selected = policy.Select(queue);
+      } else {
+        // Arrival order, with the same budget per pass.
+        for (size_t i = 0; i < queue.size() && i < kBudget; ++i) {
+          selected[i] = true;
+        }
+      }
+
+      vector<string> left;
+      int selected_count(0);
+      for (size_t i = 0; i < queue.size(); ++i) {
+        if (selected[i]) {
+          ++selected_count;
+        } else {
+          left.push_back(queue[i]);
+        }
+      }
+      EXPECT_LE(selected_count, kBudget);
+      queue.swap(left);
+
+      bool others_left(false);
+      for (const auto& key : queue) {
+        others_left |= key != "flood";
+      }
+      if (!others_left && others_done_pass < 0) {
+        others_done_pass = passes;
+      }
+    }
+
+    LOG(INFO) << (use_policy ? "fair" : "arrival order")
+              << ": other submitters done after " << others_done_pass
+              << " of " << passes << " passes";
+    if (use_policy) {
+      EXPECT_EQ(1, others_done_pass);
+    } else {
+      EXPECT_EQ(passes, others_done_pass);
+    }
+    // Either way, the whole backlog takes as many passes.
+    EXPECT_EQ((kFloodSize + kOthers * kOtherSize + kBudget - 1) / kBudget,
+              passes);
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
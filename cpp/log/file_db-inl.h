@@ -67,7 +67,7 @@ FileDB<Logged>::~FileDB() {
 
 template <class Logged>
 typename Database<Logged>::WriteResult FileDB<Logged>::CreateSequencedEntry_(
-    const Logged& logged) {
+    const Logged& logged, const std::string& leaf_hash) {
   CHECK(logged.has_sequence_number());
   CHECK_GE(logged.sequence_number(), 0);
   cert_trans::ScopedLatency latency(
@@ -93,7 +93,7 @@ typename Database<Logged>::WriteResult FileDB<Logged>::CreateSequencedEntry_(
   }
   CHECK_EQ(status, util::Status::OK);
 
-  InsertEntryMapping(logged.sequence_number(), logged.Hash());
+  InsertEntryMapping(logged.sequence_number(), logged.Hash(), leaf_hash);
 
   return this->OK;
 }
@@ -153,6 +153,27 @@ typename Database<Logged>::LookupResult FileDB<Logged>::LookupByIndex(
 }
 
 
+template <class Logged>
+typename Database<Logged>::LookupResult FileDB<Logged>::LookupLeafHashRange(
+    int64_t start, int64_t end, std::vector<std::string>* leaf_hashes) const {
+  CHECK_GE(start, 0);
+  CHECK_NOTNULL(leaf_hashes);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("lookup_leaf_hash_range"));
+  std::lock_guard<std::mutex> lock(lock_);
+
+  for (int64_t i = start; i < end; ++i) {
+    if (i >= static_cast<int64_t>(leaf_hashes_.size()) ||
+        leaf_hashes_[i].empty()) {
+      return this->NOT_FOUND;
+    }
+    leaf_hashes->push_back(leaf_hashes_[i]);
+  }
+
+  return this->LOOKUP_OK;
+}
+
+
 template <class Logged>
 typename Database<Logged>::WriteResult FileDB<Logged>::WriteTreeHead_(
     const ct::SignedTreeHead& sth) {
@@ -292,7 +313,8 @@ void FileDB<Logged>::BuildIndex() {
     CHECK_EQ(logged.sequence_number(), seq)
         << "Entry has a negative sequence_number(): " << seq;
 
-    InsertEntryMapping(logged.sequence_number(), logged.Hash());
+    InsertEntryMapping(logged.sequence_number(), logged.Hash(),
+                       this->ComputeLeafHash(logged));
   }
 
   // Now read the STH entries.
@@ -328,7 +350,13 @@ typename Database<Logged>::LookupResult FileDB<Logged>::LatestTreeHeadNoLock(
 // This must be called with "lock_" held.
 template <class Logged>
 void FileDB<Logged>::InsertEntryMapping(int64_t sequence_number,
-                                        const std::string& hash) {
+                                        const std::string& hash,
+                                        const std::string& leaf_hash) {
+  if (sequence_number >= static_cast<int64_t>(leaf_hashes_.size())) {
+    leaf_hashes_.resize(sequence_number + 1);
+  }
+  leaf_hashes_[sequence_number] = leaf_hash;
+
   if (!id_by_hash_.insert(std::make_pair(hash, sequence_number)).second) {
     // This is a duplicate hash under a new sequence number.
     // Make sure we track the entry with the lowest sequence number:
@@ -44,7 +44,7 @@ class FileDB : public Database<Logged> {
 
   // Implement abstract functions, see database.h for comments.
   typename Database<Logged>::WriteResult CreateSequencedEntry_(
-      const Logged& logged) override;
+      const Logged& logged, const std::string& leaf_hash) override;
 
   typename Database<Logged>::LookupResult LookupByHash(
       const std::string& hash, Logged* result) const override;
@@ -52,6 +52,10 @@ class FileDB : public Database<Logged> {
   typename Database<Logged>::LookupResult LookupByIndex(
       int64_t sequence_number, Logged* result) const override;
 
+  typename Database<Logged>::LookupResult LookupLeafHashRange(
+      int64_t start, int64_t end,
+      std::vector<std::string>* leaf_hashes) const override;
+
   typename Database<Logged>::WriteResult WriteTreeHead_(
       const ct::SignedTreeHead& sth) override;
 
@@ -75,7 +79,8 @@ class FileDB : public Database<Logged> {
   void BuildIndex();
   typename Database<Logged>::LookupResult LatestTreeHeadNoLock(
       ct::SignedTreeHead* result) const;
-  void InsertEntryMapping(int64_t sequence_number, const std::string& hash);
+  void InsertEntryMapping(int64_t sequence_number, const std::string& hash,
+                          const std::string& leaf_hash);
 
   const std::unique_ptr<cert_trans::FileStorage> cert_storage_;
   // Store all tree heads, but currently only support looking up the latest
@@ -95,6 +100,11 @@ class FileDB : public Database<Logged> {
   // contiguous with the head of the tree they'll be removed.
   std::set<int64_t> sparse_entries_;
 
+  // Merkle tree leaf hashes, by sequence number (empty for missing
+  // entries). They are computed from the entries when building the
+  // index, which reads them all anyway.
+  std::vector<std::string> leaf_hashes_;
+
   uint64_t latest_tree_timestamp_;
   // The same as a string;
   std::string latest_timestamp_key_;
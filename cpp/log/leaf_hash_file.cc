@@ -0,0 +1,205 @@
+#include "log/leaf_hash_file.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+// How much to copy at a time when rewriting the file.
+const size_t kCopyChunkSize = 1 << 20;
+
+
+void WriteFully(int fd, const char* data, size_t size, off_t offset,
+                const string& path) {
+  size_t done(0);
+  while (done < size) {
+    const ssize_t ret(pwrite(fd, data + done, size - done, offset + done));
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    PCHECK(ret > 0) << "pwrite " << path;
+    done += ret;
+  }
+}
+
+
+}  // namespace
+
+const size_t LeafHashFile::kHashSize;
+
+
+LeafHashFile::LeafHashFile(const string& path)
+    : path_(path), fd_(open(path.c_str(), O_RDWR | O_CREAT, 0644)), size_(0) {
+  PCHECK(fd_ >= 0) << "Could not open " << path_;
+
+  struct stat st;
+  PCHECK(fstat(fd_, &st) == 0) << "Could not stat " << path_;
+  size_ = st.st_size / kHashSize;
+  if (st.st_size % kHashSize != 0) {
+    LOG(WARNING) << path_ << " ends with a partial hash, discarding it";
+    PCHECK(ftruncate(fd_, size_ * kHashSize) == 0) << "ftruncate " << path_;
+  }
+}
+
+
+LeafHashFile::~LeafHashFile() {
+  Sync();
+  close(fd_);
+}
+
+
+void LeafHashFile::Append(const string& hash) {
+  CHECK_EQ(kHashSize, hash.size());
+  buffer_.append(hash);
+  ++size_;
+}
+
+
+string LeafHashFile::Get(int64_t index) const {
+  CHECK_GE(index, 0);
+  CHECK_LT(index, size_);
+
+  const int64_t written(size_ - buffer_.size() / kHashSize);
+  if (index >= written) {
+    return buffer_.substr((index - written) * kHashSize, kHashSize);
+  }
+
+  string retval(kHashSize, '\0');
+  const ssize_t ret(pread(fd_, &retval[0], kHashSize, index * kHashSize));
+  PCHECK(ret == static_cast<ssize_t>(kHashSize)) << "pread " << path_;
+  return retval;
+}
+
+
+void LeafHashFile::Truncate(int64_t size) {
+  CHECK_GE(size, 0);
+  if (size >= size_) {
+    return;
+  }
+
+  const int64_t written(size_ - buffer_.size() / kHashSize);
+  if (size >= written) {
+    buffer_.resize((size - written) * kHashSize);
+  } else {
+    buffer_.clear();
+    RewritePrefix(size);
+  }
+  size_ = size;
+}
+
+
+void LeafHashFile::RewritePrefix(int64_t size) {
+  // Shrinking the file would make replicas which mapped the discarded
+  // hashes crash (with SIGBUS) when reading them, so copy the ones we
+  // keep to a new file instead, which replaces this one. Existing
+  // mappings keep the old one, until the replicas notice the change.
+  const string tmp_path(path_ + ".tmp");
+  const int tmp_fd(open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644));
+  PCHECK(tmp_fd >= 0) << "Could not open " << tmp_path;
+
+  string chunk;
+  const off_t length(size * kHashSize);
+  for (off_t offset = 0; offset < length; offset += chunk.size()) {
+    chunk.resize(std::min<off_t>(kCopyChunkSize, length - offset));
+    const ssize_t ret(pread(fd_, &chunk[0], chunk.size(), offset));
+    if (ret < 0 && errno == EINTR) {
+      chunk.clear();
+      continue;
+    }
+    PCHECK(ret > 0) << "pread " << path_;
+    chunk.resize(ret);
+    WriteFully(tmp_fd, chunk.data(), chunk.size(), offset, tmp_path);
+  }
+  PCHECK(fdatasync(tmp_fd) == 0) << "fdatasync " << tmp_path;
+
+  PCHECK(rename(tmp_path.c_str(), path_.c_str()) == 0)
+      << "rename " << tmp_path;
+  close(fd_);
+  fd_ = tmp_fd;
+}
+
+
+void LeafHashFile::Sync() {
+  if (buffer_.empty()) {
+    return;
+  }
+
+  const int64_t written(size_ - buffer_.size() / kHashSize);
+  WriteFully(fd_, buffer_.data(), buffer_.size(), written * kHashSize, path_);
+  PCHECK(fdatasync(fd_) == 0) << "fdatasync " << path_;
+  buffer_.clear();
+}
+
+
+MappedLeafHashFile::MappedLeafHashFile(const string& path)
+    : path_(path), data_(nullptr), size_(0) {
+}
+
+
+MappedLeafHashFile::~MappedLeafHashFile() {
+  Unmap();
+}
+
+
+bool MappedLeafHashFile::Refresh() {
+  const int fd(open(path_.c_str(), O_RDONLY));
+  if (fd < 0) {
+    PLOG(WARNING) << "Could not open " << path_;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    PLOG(WARNING) << "Could not stat " << path_;
+    close(fd);
+    return false;
+  }
+
+  // Only map whole hashes, the last one might still be being written.
+  const int64_t size(st.st_size / LeafHashFile::kHashSize);
+  if (size == size_) {
+    close(fd);
+    return true;
+  }
+
+  void* data(nullptr);
+  if (size > 0) {
+    data = mmap(nullptr, size * LeafHashFile::kHashSize, PROT_READ,
+                MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      PLOG(WARNING) << "Could not map " << path_;
+      close(fd);
+      return false;
+    }
+  }
+  // The mapping stays valid after closing the file.
+  close(fd);
+
+  Unmap();
+  data_ = static_cast<const char*>(data);
+  size_ = size;
+  return true;
+}
+
+
+void MappedLeafHashFile::Unmap() {
+  if (data_) {
+    PCHECK(munmap(const_cast<char*>(data_),
+                  size_ * LeafHashFile::kHashSize) == 0)
+        << "munmap " << path_;
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,102 @@
+#ifndef CERT_TRANS_LOG_LEAF_HASH_FILE_H_
+#define CERT_TRANS_LOG_LEAF_HASH_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// The leaf hashes of a log, in sequence order, stored as a flat file
+// of 32-byte SHA-256 hashes (entry N is at offset 32 * N). This is
+// all that is needed to serve proofs, and is written by the signer
+// for the benefit of proof-serving replicas (see
+// MappedLeafHashFile).
+//
+// This class is thread-compatible.
+class LeafHashFile {
+ public:
+  static const size_t kHashSize = 32;
+
+  // Opens (or creates) the file at |path|. A partial hash at the end
+  // of the file (e.g. left by a crash in the middle of a write) is
+  // discarded.
+  explicit LeafHashFile(const std::string& path);
+  ~LeafHashFile();
+
+  // Number of hashes in the file, including those not yet written by
+  // Sync().
+  int64_t size() const {
+    return size_;
+  }
+
+  // Appends |hash|, which must be |kHashSize| bytes long. It is
+  // buffered until the next call to Sync().
+  void Append(const std::string& hash);
+
+  // Returns the hash at |index|, which must be less than size().
+  std::string Get(int64_t index) const;
+
+  // Discards all the hashes after the first |size| ones. Replicas
+  // might have mapped them, so this should only be done to get rid
+  // of invalid hashes, and the file is replaced rather than shrunk
+  // (leaving a "<path>.tmp" behind if interrupted).
+  void Truncate(int64_t size);
+
+  // Writes out the buffered hashes, and flushes them to disk.
+  void Sync();
+
+ private:
+  // Replaces the file with a copy of its first |size| hashes.
+  void RewritePrefix(int64_t size);
+
+  const std::string path_;
+  int fd_;
+  int64_t size_;
+  std::string buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafHashFile);
+};
+
+
+// A read-only memory mapping of a file written by LeafHashFile,
+// which can be refreshed as the file grows.
+//
+// This class is thread-compatible. Refresh() invalidates pointers
+// returned by data().
+class MappedLeafHashFile {
+ public:
+  explicit MappedLeafHashFile(const std::string& path);
+  ~MappedLeafHashFile();
+
+  // Maps the hashes appended to the file since the last call. Returns
+  // false if the file could not be mapped, in which case the previous
+  // mapping (if any) is kept.
+  bool Refresh();
+
+  // The hashes, |size()| * LeafHashFile::kHashSize bytes.
+  const char* data() const {
+    return data_;
+  }
+
+  int64_t size() const {
+    return size_;
+  }
+
+ private:
+  void Unmap();
+
+  const std::string path_;
+  const char* data_;
+  int64_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedLeafHashFile);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_LEAF_HASH_FILE_H_
@@ -0,0 +1,184 @@
+#include "log/leaf_hash_file.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <unistd.h>
+
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::to_string;
+
+
+string Hash(int i) {
+  string retval(to_string(i));
+  retval.resize(LeafHashFile::kHashSize, '.');
+  return retval;
+}
+
+
+class LeafHashFileTest : public ::testing::Test {
+ protected:
+  LeafHashFileTest() : path_(tmp_.TmpStorageDir() + "/leaf_hashes") {
+  }
+
+  TmpStorage tmp_;
+  const string path_;
+};
+
+
+TEST_F(LeafHashFileTest, AppendAndGet) {
+  LeafHashFile file(path_);
+  EXPECT_EQ(0, file.size());
+
+  for (int i = 0; i < 10; ++i) {
+    file.Append(Hash(i));
+    if (i == 4) {
+      file.Sync();
+    }
+  }
+  EXPECT_EQ(10, file.size());
+
+  // Both written and buffered hashes.
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(Hash(i), file.Get(i));
+  }
+}
+
+
+TEST_F(LeafHashFileTest, Reopen) {
+  {
+    LeafHashFile file(path_);
+    file.Append(Hash(0));
+    file.Append(Hash(1));
+    file.Sync();
+    // Destruction syncs too.
+    file.Append(Hash(2));
+  }
+
+  LeafHashFile file(path_);
+  ASSERT_EQ(3, file.size());
+  EXPECT_EQ(Hash(2), file.Get(2));
+}
+
+
+TEST_F(LeafHashFileTest, DiscardsPartialHash) {
+  {
+    LeafHashFile file(path_);
+    file.Append(Hash(0));
+  }
+  const int fd(open(path_.c_str(), O_WRONLY | O_APPEND));
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(3, write(fd, "abc", 3));
+  close(fd);
+
+  LeafHashFile file(path_);
+  EXPECT_EQ(1, file.size());
+  file.Append(Hash(1));
+  file.Sync();
+  EXPECT_EQ(Hash(1), file.Get(1));
+}
+
+
+TEST_F(LeafHashFileTest, Truncate) {
+  LeafHashFile file(path_);
+  for (int i = 0; i < 6; ++i) {
+    file.Append(Hash(i));
+  }
+  file.Sync();
+  file.Append(Hash(6));
+
+  // Only buffered hashes.
+  file.Truncate(6);
+  EXPECT_EQ(6, file.size());
+  // Written hashes.
+  file.Truncate(3);
+  EXPECT_EQ(3, file.size());
+  file.Append(Hash(30));
+  file.Sync();
+  EXPECT_EQ(4, file.size());
+  EXPECT_EQ(Hash(2), file.Get(2));
+  EXPECT_EQ(Hash(30), file.Get(3));
+
+  // Truncating to a larger size does nothing.
+  file.Truncate(10);
+  EXPECT_EQ(4, file.size());
+}
+
+
+TEST_F(LeafHashFileTest, TruncateKeepsExistingMappings) {
+  LeafHashFile file(path_);
+  // Over several pages.
+  const int kNumHashes(1000);
+  for (int i = 0; i < kNumHashes; ++i) {
+    file.Append(Hash(i));
+  }
+  file.Sync();
+  MappedLeafHashFile mapped(path_);
+  ASSERT_TRUE(mapped.Refresh());
+  ASSERT_EQ(kNumHashes, mapped.size());
+
+  file.Truncate(10);
+  EXPECT_EQ(10, file.size());
+  // Still readable through the old mapping.
+  EXPECT_EQ(Hash(kNumHashes - 1),
+            string(mapped.data() +
+                       (kNumHashes - 1) * LeafHashFile::kHashSize,
+                   LeafHashFile::kHashSize));
+
+  file.Append(Hash(100));
+  file.Sync();
+  EXPECT_EQ(Hash(9), file.Get(9));
+  EXPECT_EQ(Hash(100), file.Get(10));
+
+  MappedLeafHashFile remapped(path_);
+  ASSERT_TRUE(remapped.Refresh());
+  EXPECT_EQ(11, remapped.size());
+  EXPECT_NE(0, access((path_ + ".tmp").c_str(), F_OK));
+}
+
+
+TEST_F(LeafHashFileTest, Mapped) {
+  MappedLeafHashFile mapped(path_);
+  // The file does not exist yet.
+  EXPECT_FALSE(mapped.Refresh());
+  EXPECT_EQ(0, mapped.size());
+
+  LeafHashFile file(path_);
+  EXPECT_TRUE(mapped.Refresh());
+  EXPECT_EQ(0, mapped.size());
+
+  file.Append(Hash(0));
+  file.Append(Hash(1));
+  // Not visible until synced.
+  EXPECT_TRUE(mapped.Refresh());
+  EXPECT_EQ(0, mapped.size());
+
+  file.Sync();
+  EXPECT_TRUE(mapped.Refresh());
+  ASSERT_EQ(2, mapped.size());
+  EXPECT_EQ(Hash(0) + Hash(1),
+            string(mapped.data(), 2 * LeafHashFile::kHashSize));
+
+  file.Append(Hash(2));
+  file.Sync();
+  EXPECT_TRUE(mapped.Refresh());
+  ASSERT_EQ(3, mapped.size());
+  EXPECT_EQ(Hash(2), string(mapped.data() + 2 * LeafHashFile::kHashSize,
+                            LeafHashFile::kHashSize));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
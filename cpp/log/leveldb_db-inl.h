@@ -5,6 +5,7 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <leveldb/write_batch.h>
 #include <map>
 #include <stdint.h>
 #include <string>
@@ -30,6 +31,7 @@ static cert_trans::Latency<std::chrono::milliseconds, std::string>
 
 const char kMetaNodeIdKey[] = "metadata";
 const char kEntryPrefix[] = "entry-";
+const char kLeafHashPrefix[] = "leafhash-";
 const char kTreeHeadPrefix[] = "sth-";
 const char kMetaPrefix[] = "meta-";
 
@@ -50,7 +52,7 @@ std::unique_ptr<const leveldb::FilterPolicy> BuildFilterPolicy() {
 
 // WARNING: Do NOT change the type of "index" from int64_t, or you'll
 // break existing databases!
-std::string IndexToKey(int64_t index) {
+std::string IndexToKey(int64_t index, const char* prefix = kEntryPrefix) {
   const char nibble[] = "0123456789abcdef";
   std::string index_str(sizeof(index) * 2, nibble[0]);
   for (int i = sizeof(index) * 2; i > 0 && index > 0; --i) {
@@ -58,7 +60,7 @@ std::string IndexToKey(int64_t index) {
     index = index >> 4;
   }
 
-  return kEntryPrefix + index_str;
+  return prefix + index_str;
 }
 
 
@@ -116,7 +118,7 @@ LevelDB<Logged>::LevelDB(const std::string& dbfile)
 
 template <class Logged>
 typename Database<Logged>::WriteResult LevelDB<Logged>::CreateSequencedEntry_(
-    const Logged& logged) {
+    const Logged& logged, const std::string& leaf_hash) {
   CHECK(logged.has_sequence_number());
   CHECK_GE(logged.sequence_number(), 0);
   cert_trans::ScopedLatency latency(
@@ -133,7 +135,13 @@ typename Database<Logged>::WriteResult LevelDB<Logged>::CreateSequencedEntry_(
   leveldb::Status status(
       db_->Get(leveldb::ReadOptions(), key, &existing_data));
   if (status.IsNotFound()) {
-    status = db_->Put(leveldb::WriteOptions(), key, data);
+    // The leaf hash is stored under its own key, so that it can be read
+    // back without reading the whole entry.
+    leveldb::WriteBatch batch;
+    batch.Put(key, data);
+    batch.Put(IndexToKey(logged.sequence_number(), kLeafHashPrefix),
+              leaf_hash);
+    status = db_->Write(leveldb::WriteOptions(), &batch);
     CHECK(status.ok()) << "Failed to write sequenced entry (seq: "
                        << logged.sequence_number()
                        << "): " << status.ToString();
@@ -209,6 +217,42 @@ typename Database<Logged>::LookupResult LevelDB<Logged>::LookupByIndex(
 }
 
 
+template <class Logged>
+typename Database<Logged>::LookupResult LevelDB<Logged>::LookupLeafHashRange(
+    int64_t start, int64_t end, std::vector<std::string>* leaf_hashes) const {
+  CHECK_GE(start, 0);
+  CHECK_NOTNULL(leaf_hashes);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("lookup_leaf_hash_range"));
+
+  std::unique_ptr<leveldb::Iterator> it(
+      db_->NewIterator(leveldb::ReadOptions()));
+  CHECK(it);
+  it->Seek(IndexToKey(start, kLeafHashPrefix));
+
+  for (int64_t i = start; i < end; ++i) {
+    const std::string key(IndexToKey(i, kLeafHashPrefix));
+    if (it->Valid() && it->key() == key) {
+      leaf_hashes->push_back(it->value().ToString());
+      it->Next();
+      continue;
+    }
+
+    // Entries created before leaf hashes were stored have to be hashed
+    // here.
+    Logged logged;
+    if (LookupByIndex(i, &logged) != this->LOOKUP_OK) {
+      return this->NOT_FOUND;
+    }
+    leaf_hashes->push_back(this->ComputeLeafHash(logged));
+  }
+  CHECK(it->status().ok()) << "Failed to read leaf hashes: "
+                           << it->status().ToString();
+
+  return this->LOOKUP_OK;
+}
+
+
 template <class Logged>
 typename Database<Logged>::WriteResult LevelDB<Logged>::WriteTreeHead_(
     const ct::SignedTreeHead& sth) {
@@ -34,7 +34,7 @@ class LevelDB : public Database<Logged> {
 
   // Implement abstract functions, see database.h for comments.
   typename Database<Logged>::WriteResult CreateSequencedEntry_(
-      const Logged& logged) override;
+      const Logged& logged, const std::string& leaf_hash) override;
 
   typename Database<Logged>::LookupResult LookupByHash(
       const std::string& hash, Logged* result) const override;
@@ -42,6 +42,10 @@ class LevelDB : public Database<Logged> {
   typename Database<Logged>::LookupResult LookupByIndex(
       int64_t sequence_number, Logged* result) const override;
 
+  typename Database<Logged>::LookupResult LookupLeafHashRange(
+      int64_t start, int64_t end,
+      std::vector<std::string>* leaf_hashes) const override;
+
   typename Database<Logged>::WriteResult WriteTreeHead_(
       const ct::SignedTreeHead& sth) override;
 
@@ -4,8 +4,12 @@
 
 #include "log/log_lookup.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <glog/logging.h>
 #include <map>
+#include <memory>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string>
@@ -15,20 +19,60 @@
 #include "base/time_support.h"
 #include "merkletree/merkle_tree.h"
 #include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/parallel.h"
 
 
 static const int kCtimeBufSize = 26;
 
+namespace {
+
+
+// Number of leaf hashes read from the database by each task of an
+// update.
+const size_t kLeafHashesPerTask = 1 << 16;
+
+static cert_trans::Gauge<>* log_lookup_update_leaves =
+    cert_trans::Gauge<>::New("log_lookup_update_leaves",
+                             "Number of leaves added to the in-memory tree "
+                             "by the latest update.");
+
+static cert_trans::Gauge<>* log_lookup_update_leaves_read =
+    cert_trans::Gauge<>::New("log_lookup_update_leaves_read",
+                             "Number of leaf hashes of the latest update "
+                             "read from the database so far.");
+
+static cert_trans::Gauge<>* log_lookup_update_eta_seconds =
+    cert_trans::Gauge<>::New("log_lookup_update_eta_seconds",
+                             "Estimated time left reading the leaf hashes "
+                             "of the latest update, in seconds.");
+
+
+}  // namespace
+
+
+template <class Logged>
+LogLookup<Logged>::Snapshot::Snapshot()
+    : cert_tree(new Sha256Hasher) {
+}
+
 
 template <class Logged>
-LogLookup<Logged>::LogLookup(ReadOnlyDatabase<Logged>* db)
+LogLookup<Logged>::LogLookup(ReadOnlyDatabase<Logged>* db,
+                             util::Executor* executor)
     : db_(CHECK_NOTNULL(db)),
-      cert_tree_(new Sha256Hasher),
-      latest_tree_head_(),
+      executor_(executor),
+      spare_released_(true),
+      published_(new Snapshot),
+      spare_(new Snapshot),
       update_from_sth_cb_(std::bind(&LogLookup<Logged>::UpdateFromSTH, this,
                                     std::placeholders::_1)) {
+  {
+    std::lock_guard<std::mutex> lock(update_lock_);
+    Publish(published_.get());
+  }
   db_->AddNotifySTHCallback(&update_from_sth_cb_);
 }
 
@@ -39,74 +83,162 @@ LogLookup<Logged>::~LogLookup() {
 }
 
 
+template <class Logged>
+std::shared_ptr<const typename LogLookup<Logged>::Snapshot>
+LogLookup<Logged>::GetSnapshot() const {
+  std::lock_guard<std::mutex> lock(snapshot_lock_);
+  return current_;
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::Publish(Snapshot* snapshot) {
+  std::shared_ptr<const Snapshot> previous;
+  {
+    std::lock_guard<std::mutex> lock(snapshot_lock_);
+    // The previously published snapshot becomes the spare, and
+    // |previous| might not be the last reference to it.
+    spare_released_ = !current_;
+    previous.swap(current_);
+    current_.reset(snapshot,
+                   std::bind(&LogLookup<Logged>::SnapshotReleased, this,
+                             std::placeholders::_1));
+  }
+  // Released without holding |snapshot_lock_|, as this might call
+  // SnapshotReleased().
+  previous.reset();
+}
+
+
+template <class Logged>
+void LogLookup<Logged>::SnapshotReleased(const Snapshot* snapshot) {
+  std::lock_guard<std::mutex> lock(snapshot_lock_);
+  spare_released_ = true;
+  spare_released_cv_.notify_all();
+}
+
+
 template <class Logged>
 void LogLookup<Logged>::UpdateFromSTH(const ct::SignedTreeHead& sth) {
-  std::lock_guard<std::mutex> lock(lock_);
+  std::lock_guard<std::mutex> lock(update_lock_);
+  const ct::SignedTreeHead& latest_tree_head(published_->sth);
+  const int64_t leaf_count(published_->cert_tree.LeafCount());
 
   CHECK_EQ(ct::V1, sth.version())
       << "Tree head signed with an unknown version";
 
-  if (sth.timestamp() == latest_tree_head_.timestamp())
+  if (sth.timestamp() == latest_tree_head.timestamp())
     return;
 
-  if (sth.timestamp() <= latest_tree_head_.timestamp() ||
-      sth.tree_size() < cert_tree_.LeafCount()) {
+  if (sth.timestamp() <= latest_tree_head.timestamp() ||
+      sth.tree_size() < leaf_count) {
     LOG(WARNING) << "Database replied with an STH that is older than ours: "
-                 << "Our STH:\n" << latest_tree_head_.DebugString()
+                 << "Our STH:\n" << latest_tree_head.DebugString()
                  << "Database STH:\n" << sth.DebugString();
     return;
   }
 
-  // Record the new hashes: append all of them, die on any error.
-  // TODO(ekasper): make tree signer write leaves out to the database,
-  // so that we don't have to read the entries in.
-  std::string leaf_hash;
-  for (int64_t sequence_number = cert_tree_.LeafCount();
-       sequence_number < sth.tree_size(); ++sequence_number) {
-    Logged logged;
-    // TODO(ekasper): perhaps some of these errors can/should be
-    // handled more gracefully. E.g. we could retry a failed update
-    // a number of times -- but until we know under which conditions
-    // the database might fail (database busy?), just die.
-    CHECK_EQ(Database<Logged>::LOOKUP_OK,
-             db_->LookupByIndex(sequence_number, &logged))
-        << "Latest STH has " << sth.tree_size() << "entries but we failed to "
-        << "retrieve entry number " << sequence_number;
-    CHECK(logged.has_sequence_number())
-        << "Logged entry has no sequence number";
-    CHECK_EQ(sequence_number, logged.sequence_number());
-
-    leaf_hash = LeafHash(logged);
-    // TODO(ekasper): plug in the log public key so that we can verify the STH.
-    CHECK_EQ(sequence_number + 1, cert_tree_.AddLeafHash(leaf_hash));
-    // Duplicate leaves shouldn't really happen but are not a problem either:
-    // we just return the Merkle proof of the first occurrence.
-    leaf_index_.insert(
-        std::pair<std::string, int64_t>(leaf_hash, sequence_number));
+  // Fetch the new hashes first, while lookups are still being served
+  // from the published snapshot.
+  std::vector<std::string> new_hashes(sth.tree_size() - leaf_count);
+  ReadLeafHashes(leaf_count, &new_hashes);
+
+  // Readers of the previous snapshot only hold it for the duration of
+  // a single lookup, so this should not take long.
+  {
+    std::unique_lock<std::mutex> snapshot_lock(snapshot_lock_);
+    spare_released_cv_.wait(snapshot_lock,
+                            [this]() { return spare_released_; });
+  }
+
+  // Bring the spare snapshot up to date with the published one, and
+  // then with the new STH.
+  for (const std::vector<std::string>* hashes :
+       {&spare_missing_hashes_, &new_hashes}) {
+    for (const auto& leaf_hash : *hashes) {
+      const int64_t sequence_number(spare_->cert_tree.LeafCount());
+      // TODO(ekasper): plug in the log public key so that we can verify
+      // the STH.
+      CHECK_EQ(sequence_number + 1, spare_->cert_tree.AddLeafHash(leaf_hash));
+      // Duplicate leaves shouldn't really happen but are not a problem
+      // either: we just return the Merkle proof of the first occurrence.
+      spare_->leaf_index.insert(
+          std::pair<std::string, int64_t>(leaf_hash, sequence_number));
+    }
   }
-  CHECK_EQ(cert_tree_.CurrentRoot(), sth.sha256_root_hash())
+  spare_->cert_tree.Evaluate(executor_);
+  CHECK_EQ(spare_->cert_tree.CurrentRoot(), sth.sha256_root_hash())
       << "Computed root hash and stored STH root hash do not match";
-  LOG(INFO) << "Found " << sth.tree_size() - latest_tree_head_.tree_size()
+  LOG(INFO) << "Found " << sth.tree_size() - latest_tree_head.tree_size()
             << " new log entries";
-  latest_tree_head_.CopyFrom(sth);
+  spare_->sth.CopyFrom(sth);
+
+  Publish(spare_.get());
+  published_.swap(spare_);
+  spare_missing_hashes_.swap(new_hashes);
 
   const time_t last_update(static_cast<time_t>(
-      latest_tree_head_.timestamp() / cert_trans::kNumMillisPerSecond));
+      sth.timestamp() / cert_trans::kNumMillisPerSecond));
   char buf[kCtimeBufSize];
   LOG(INFO) << "Tree successfully updated at " << ctime_r(&last_update, buf);
 }
 
 
+template <class Logged>
+void LogLookup<Logged>::ReadLeafHashes(
+    int64_t start, std::vector<std::string>* hashes) const {
+  const int64_t count(hashes->size());
+  const std::chrono::steady_clock::time_point started(
+      std::chrono::steady_clock::now());
+  std::atomic<int64_t> read(0);
+  log_lookup_update_leaves->Set(count);
+  log_lookup_update_leaves_read->Set(0);
+
+  util::ParallelFor(
+      executor_, count, kLeafHashesPerTask,
+      [this, start, count, started, hashes, &read](size_t begin, size_t end) {
+        std::vector<std::string> chunk;
+        chunk.reserve(end - begin);
+        // TODO(ekasper): perhaps some of these errors can/should be
+        // handled more gracefully. E.g. we could retry a failed update
+        // a number of times -- but until we know under which conditions
+        // the database might fail (database busy?), just die.
+        CHECK_EQ(Database<Logged>::LOOKUP_OK,
+                 db_->LookupLeafHashRange(start + begin, start + end, &chunk))
+            << "Failed to retrieve the leaf hash of entry number "
+            << start + begin + chunk.size();
+        std::move(chunk.begin(), chunk.end(), hashes->begin() + begin);
+
+        const int64_t done(read += end - begin);
+        const double elapsed(std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - started)
+                                 .count());
+        const double eta(elapsed * (count - done) / done);
+        log_lookup_update_leaves_read->Set(done);
+        log_lookup_update_eta_seconds->Set(eta);
+        // Only large updates take long enough to be worth logging.
+        if (count > static_cast<int64_t>(kLeafHashesPerTask) &&
+            done * 10 / count != (done - (end - begin)) * 10 / count) {
+          LOG(INFO) << "Read " << done << " of " << count
+                    << " leaf hashes, about " << static_cast<int64_t>(eta)
+                    << " seconds left";
+        }
+      });
+}
+
+
 template <class Logged>
 typename LogLookup<Logged>::LookupResult LogLookup<Logged>::GetIndex(
     const std::string& merkle_leaf_hash, int64_t* index) {
-  std::unique_lock<std::mutex> lock(lock_);
-  const int64_t myindex(GetIndexInternal(lock, merkle_leaf_hash));
+  const std::shared_ptr<const Snapshot> snapshot(GetSnapshot());
+  const std::map<std::string, int64_t>::const_iterator it(
+      snapshot->leaf_index.find(merkle_leaf_hash));
 
-  if (myindex < 0) {
+  if (it == snapshot->leaf_index.end()) {
     return NOT_FOUND;
   } else {
-    *index = myindex;
+    CHECK_GE(it->second, 0);
+    *index = it->second;
     return OK;
   }
 }
@@ -116,28 +248,29 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::GetIndex(
 template <class Logged>
 typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
     const std::string& merkle_leaf_hash, ct::MerkleAuditProof* proof) {
-  std::unique_lock<std::mutex> lock(lock_);
+  const std::shared_ptr<const Snapshot> snapshot(GetSnapshot());
 
-  const int64_t leaf_index(GetIndexInternal(lock, merkle_leaf_hash));
-  if (leaf_index < 0) {
+  const std::map<std::string, int64_t>::const_iterator it(
+      snapshot->leaf_index.find(merkle_leaf_hash));
+  if (it == snapshot->leaf_index.end()) {
     return NOT_FOUND;
   }
+  const int64_t leaf_index(it->second);
 
   CHECK_GE(leaf_index, 0);
   proof->set_version(ct::V1);
-  proof->set_tree_size(cert_tree_.LeafCount());
-  proof->set_timestamp(latest_tree_head_.timestamp());
+  proof->set_tree_size(snapshot->cert_tree.LeafCount());
+  proof->set_timestamp(snapshot->sth.timestamp());
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
   std::vector<std::string> audit_path =
-      cert_tree_.PathToCurrentRoot(leaf_index + 1);
+      snapshot->cert_tree.PathToCurrentRoot(leaf_index + 1);
   for (size_t i = 0; i < audit_path.size(); ++i)
     proof->add_path_node(audit_path[i]);
 
-  proof->mutable_id()->CopyFrom(latest_tree_head_.id());
-  proof->mutable_tree_head_signature()->CopyFrom(
-      latest_tree_head_.signature());
+  proof->mutable_id()->CopyFrom(snapshot->sth.id());
+  proof->mutable_tree_head_signature()->CopyFrom(snapshot->sth.signature());
   return OK;
 }
 
@@ -145,13 +278,13 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
 template <class Logged>
 typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
     int64_t leaf_index, size_t tree_size, ct::ShortMerkleAuditProof* proof) {
-  std::lock_guard<std::mutex> lock(lock_);
+  const std::shared_ptr<const Snapshot> snapshot(GetSnapshot());
 
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
   std::vector<std::string> audit_path =
-      cert_tree_.PathToRootAtSnapshot(leaf_index + 1, tree_size);
+      snapshot->cert_tree.PathToRootAtSnapshot(leaf_index + 1, tree_size);
   for (size_t i = 0; i < audit_path.size(); ++i)
     proof->add_path_node(audit_path[i]);
 
@@ -172,37 +305,48 @@ typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProof(
   return AuditProof(leaf_index, tree_size, proof);
 }
 
+
+template <class Logged>
+typename LogLookup<Logged>::LookupResult LogLookup<Logged>::AuditProofs(
+    const std::vector<int64_t>& indices, size_t tree_size,
+    std::vector<ct::ShortMerkleAuditProof>* proofs) {
+  const std::shared_ptr<const Snapshot> snapshot(GetSnapshot());
+
+  std::vector<size_t> leaves;
+  leaves.reserve(indices.size());
+  for (const auto& index : indices) {
+    CHECK_GE(index, 0);
+    leaves.push_back(index + 1);
+  }
+  const std::vector<std::vector<std::string>> audit_paths(
+      snapshot->cert_tree.PathsToRootAtSnapshot(leaves, tree_size));
+
+  proofs->clear();
+  proofs->resize(indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    (*proofs)[i].set_leaf_index(indices[i]);
+    for (const auto& node : audit_paths[i])
+      (*proofs)[i].add_path_node(node);
+  }
+
+  return OK;
+}
+
 template <class Logged>
 std::string LogLookup<Logged>::LeafHash(const Logged& logged) const {
   std::string serialized_leaf;
   CHECK(logged.SerializeForLeaf(&serialized_leaf));
-  // We do not need to take the lock for this call into cert_tree_, as
-  // this is merely a const forwarder (to another const, thread-safe
-  // method).
-  return cert_tree_.LeafHash(serialized_leaf);
+  // This is merely a const forwarder (to another const, thread-safe
+  // method), so any snapshot will do.
+  return GetSnapshot()->cert_tree.LeafHash(serialized_leaf);
 }
 
 template <class Logged>
 std::unique_ptr<CompactMerkleTree> LogLookup<Logged>::GetCompactMerkleTree(
     SerialHasher* hasher) {
-  std::lock_guard<std::mutex> lock(lock_);
+  const std::shared_ptr<const Snapshot> snapshot(GetSnapshot());
   return std::unique_ptr<CompactMerkleTree>(
-      new CompactMerkleTree(cert_tree_, hasher));
-}
-
-template <class Logged>
-int64_t LogLookup<Logged>::GetIndexInternal(
-    const std::unique_lock<std::mutex>& lock,
-    const std::string& merkle_leaf_hash) const {
-  CHECK(lock.owns_lock());
-
-  const std::map<std::string, int64_t>::const_iterator it(
-      leaf_index_.find(merkle_leaf_hash));
-  if (it == leaf_index_.end())
-    return -1;
-
-  CHECK_GE(it->second, 0);
-  return it->second;
+      new CompactMerkleTree(snapshot->cert_tree, hasher));
 }
 
 
@@ -2,10 +2,13 @@
 #ifndef LOG_LOOKUP_H
 #define LOG_LOOKUP_H
 
+#include <condition_variable>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
@@ -13,13 +16,28 @@
 #include "merkletree/merkle_tree.h"
 #include "proto/ct.pb.h"
 
+namespace util {
+class Executor;
+}  // namespace util
+
 // Lookups into the database. Read-only, so could also be a mirror.
 // Keeps the entire Merkle Tree in memory to serve audit proofs.
+//
+// Lookups never wait for updates: new STHs are incorporated into a
+// separate copy of the tree and leaf index, which is then published
+// atomically. Both copies are kept, so that the next update can reuse
+// the one it replaced, which doubles the memory used. Each copy takes
+// about 160 bytes per entry (32 for the tree, 128 for the leaf index),
+// so about 320 bytes per entry in total.
 template <class Logged>
 class LogLookup {
  public:
-  // The constructor loads the content from the database.
-  explicit LogLookup(ReadOnlyDatabase<Logged>* db);
+  // The constructor loads the content from the database. If
+  // |executor| is not NULL, large updates (such as this initial load)
+  // read the leaf hashes and hash the tree concurrently on it, so it
+  // must not be the executor calling the STH callbacks of |db|.
+  explicit LogLookup(ReadOnlyDatabase<Logged>* db,
+                     util::Executor* executor = nullptr);
   ~LogLookup();
 
   enum LookupResult {
@@ -44,15 +62,29 @@ class LogLookup {
   LookupResult AuditProof(const std::string& merkle_leaf_hash,
                           size_t tree_size, ct::ShortMerkleAuditProof* proof);
 
+  // Look up by indices of several logged items and tree_size, which is
+  // cheaper than looking them up one at a time. The proofs are
+  // returned in the same order as |indices|.
+  LookupResult AuditProofs(const std::vector<int64_t>& indices,
+                           size_t tree_size,
+                           std::vector<ct::ShortMerkleAuditProof>* proofs);
+
+  // Get the proof that the logged items with indices |first| to
+  // |last| are in the tree of size |tree_size|. See
+  // MerkleTree::RangeProof().
+  std::vector<std::string> RangeProof(int64_t first, int64_t last,
+                                      size_t tree_size) {
+    return GetSnapshot()->cert_tree.RangeProof(first + 1, last + 1,
+                                               tree_size);
+  }
+
   // Get a consitency proof between two tree heads
   std::vector<std::string> ConsistencyProof(size_t first, size_t second) {
-    std::lock_guard<std::mutex> lock(lock_);
-    return cert_tree_.SnapshotConsistency(first, second);
+    return GetSnapshot()->cert_tree.SnapshotConsistency(first, second);
   }
 
-  const ct::SignedTreeHead& GetSTH() const {
-    std::lock_guard<std::mutex> lock(lock_);
-    return latest_tree_head_;
+  ct::SignedTreeHead GetSTH() const {
+    return GetSnapshot()->sth;
   }
 
   std::string LeafHash(const Logged& logged) const;
@@ -63,20 +95,57 @@ class LogLookup {
       SerialHasher* hasher);
 
  private:
-  void UpdateFromSTH(const ct::SignedTreeHead& sth);
-  int64_t GetIndexInternal(const std::unique_lock<std::mutex>& lock,
-                           const std::string& merkle_leaf_hash) const;
+  // The state of the log at a given STH, which does not change once
+  // published. Readers keep a reference to it for as long as they need
+  // it, instead of holding a lock.
+  struct Snapshot {
+    Snapshot();
+
+    ct::SignedTreeHead sth;
+    // Always fully evaluated, so that its const query methods, which
+    // can be called concurrently, see all of it.
+    MerkleTree cert_tree;
+    // We keep a hash -> index mapping in memory so that we can quickly
+    // serve Merkle proofs without having to query the database at all.
+    // Note that 32 bytes is an overkill and we can optimize this to use
+    // a shorter prefix (possibly with a multimap).
+    std::map<std::string, int64_t> leaf_index;
+  };
 
-  mutable std::mutex lock_;
-  // We keep a hash -> index mapping in memory so that we can quickly serve
-  // Merkle proofs without having to query the database at all.
-  // Note that 32 bytes is an overkill and we can optimize this to use
-  // a shorter prefix (possibly with a multimap).
-  std::map<std::string, int64_t> leaf_index_;
+  std::shared_ptr<const Snapshot> GetSnapshot() const;
+  // Makes |snapshot| the current one, which readers get from
+  // GetSnapshot(). Must be called with |update_lock_| held.
+  void Publish(Snapshot* snapshot);
+  // Called once the last reference to a snapshot handed out by
+  // GetSnapshot() is gone.
+  void SnapshotReleased(const Snapshot* snapshot);
+  void UpdateFromSTH(const ct::SignedTreeHead& sth);
+  // Reads the leaf hashes of the entries from |start| onwards into
+  // |hashes|, which is already sized to hold them.
+  void ReadLeafHashes(int64_t start, std::vector<std::string>* hashes) const;
 
   ReadOnlyDatabase<Logged>* const db_;
-  MerkleTree cert_tree_;
-  ct::SignedTreeHead latest_tree_head_;
+  util::Executor* const executor_;
+
+  // Protects |current_| and |spare_released_|, and is only held
+  // briefly.
+  mutable std::mutex snapshot_lock_;
+  std::condition_variable spare_released_cv_;
+  // Whether the last reader of |spare_| is done with it.
+  bool spare_released_;
+  // Refers to |published_|, but does not own it: once the last copy of
+  // it is gone, SnapshotReleased() is called instead.
+  std::shared_ptr<const Snapshot> current_;
+
+  // Serialises updates, and protects the members below.
+  std::mutex update_lock_;
+  // The snapshot referred to by |current_|.
+  std::unique_ptr<Snapshot> published_;
+  // The previously published snapshot, to be reused for the next
+  // update once readers are done with it, and the leaf hashes it is
+  // missing compared to |published_|.
+  std::unique_ptr<Snapshot> spare_;
+  std::vector<std::string> spare_missing_hashes_;
 
   const typename Database<Logged>::NotifySTHCallback update_from_sth_cb_;
 
@@ -1,7 +1,10 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <atomic>
 #include <gtest/gtest.h>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "log/etcd_consistent_store.h"
 #include "log/file_db.h"
@@ -35,6 +38,7 @@ using cert_trans::MockMasterElection;
 using cert_trans::ThreadPool;
 using cert_trans::TreeSigner;
 using ct::MerkleAuditProof;
+using ct::ShortMerkleAuditProof;
 using ct::SequenceMapping;
 using std::make_shared;
 using std::string;
@@ -223,6 +227,98 @@ TYPED_TEST(LogLookupTest, VerifyWithPath) {
 }
 
 
+TYPED_TEST(LogLookupTest, AuditProofs) {
+  LoggedCertificate logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  LL lookup(this->db());
+  const std::vector<int64_t> indices{12, 0, 5, 5, 11};
+  for (size_t tree_size = 1; tree_size <= 13; ++tree_size) {
+    std::vector<ShortMerkleAuditProof> proofs;
+    EXPECT_EQ(LL::OK, lookup.AuditProofs(indices, tree_size, &proofs));
+    ASSERT_EQ(indices.size(), proofs.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+      ShortMerkleAuditProof proof;
+      EXPECT_EQ(LL::OK, lookup.AuditProof(indices[i], tree_size, &proof));
+      EXPECT_EQ(proof.DebugString(), proofs[i].DebugString());
+    }
+  }
+}
+
+
+TYPED_TEST(LogLookupTest, RangeProof) {
+  LoggedCertificate logged_certs[13];
+  std::vector<string> leaves;
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+    leaves.emplace_back();
+    ASSERT_TRUE(logged_certs[i].SerializeForLeaf(&leaves.back()));
+  }
+  this->UpdateTree();
+
+  LL lookup(this->db());
+  MerkleVerifier verifier(new Sha256Hasher);
+  for (int first = 0; first < 13; ++first) {
+    for (int last = first; last < 13; ++last) {
+      const std::vector<string> range(leaves.begin() + first,
+                                      leaves.begin() + last + 1);
+      EXPECT_TRUE(verifier.VerifyRangeProof(
+          first + 1, 13, range, lookup.RangeProof(first, last, 13),
+          lookup.GetSTH().sha256_root_hash()));
+    }
+  }
+}
+
+
+// Lookups are served from the previous tree while it is being updated.
+TYPED_TEST(LogLookupTest, VerifyDuringUpdates) {
+  LoggedCertificate logged_certs[40];
+  for (int i = 0; i < 10; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  LL lookup(this->db());
+  std::atomic<bool> done(false);
+  std::thread reader([this, &lookup, &logged_certs, &done]() {
+    while (!done.load()) {
+      for (int i = 0; i < 10; ++i) {
+        MerkleAuditProof proof;
+        EXPECT_EQ(LL::OK, lookup.AuditProof(
+                              logged_certs[i].merkle_leaf_hash(), &proof));
+        EXPECT_EQ(LogVerifier::VERIFY_OK,
+                  this->verifier_.VerifyMerkleAuditProof(
+                      logged_certs[i].entry(), logged_certs[i].sct(), proof));
+      }
+    }
+  });
+
+  for (int i = 10; i < 40; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+    if (i % 10 == 9) {
+      this->UpdateTree();
+      EXPECT_EQ(i + 1, lookup.GetSTH().tree_size());
+    }
+  }
+  done.store(true);
+  reader.join();
+
+  for (int i = 0; i < 40; ++i) {
+    int64_t index;
+    EXPECT_EQ(LL::OK,
+              lookup.GetIndex(logged_certs[i].merkle_leaf_hash(), &index));
+    EXPECT_EQ(i, index);
+  }
+}
+
+
 }  // namespace
 
 
@@ -4,6 +4,8 @@
 #define LOGGED_CERTIFICATE_H
 
 #include <glog/logging.h>
+#include <memory>
+#include <string>
 
 #include "client/async_log_client.h"
 #include "merkletree/serial_hasher.h"
@@ -15,8 +17,60 @@ namespace cert_trans {
 
 class LoggedCertificate : public ct::LoggedCertificatePB {
  public:
-  std::string Hash() const {
-    return Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry()));
+  // The hash of the entry, which identifies it. This is memoized, as
+  // it is used a lot when sequencing, and is invalidated by the
+  // mutators below, and when parsing, copying or swapping into this
+  // object. Changes made through an entry pointer obtained before
+  // calling this are not noticed. This can be called concurrently on
+  // the same object, as long as it is not being modified.
+  const std::string& Hash() const {
+    std::shared_ptr<const std::string> hash(std::atomic_load(&hash_));
+    if (!hash) {
+      std::shared_ptr<const std::string> expected;
+      hash = std::make_shared<const std::string>(
+          Sha256Hasher::Sha256Digest(Serializer::LeafCertificate(entry())));
+      // If another thread got there first, use its (identical) hash,
+      // so that the one returned stays alive as long as this object
+      // is not modified.
+      if (!std::atomic_compare_exchange_strong(&hash_, &expected, hash)) {
+        hash = expected;
+      }
+    }
+    return *hash;
+  }
+
+  // Returns true if the hashes of both entries have already been
+  // computed, and they differ. This never computes a hash.
+  bool KnownHashDiffers(const LoggedCertificate& other) const {
+    const std::shared_ptr<const std::string> hash(std::atomic_load(&hash_));
+    const std::shared_ptr<const std::string> other_hash(
+        std::atomic_load(&other.hash_));
+    return hash && other_hash && *hash != *other_hash;
+  }
+
+  bool ParseFromString(const std::string& src) {
+    hash_.reset();
+    return ct::LoggedCertificatePB::ParseFromString(src);
+  }
+
+  void CopyFrom(const ct::LoggedCertificatePB& from) {
+    hash_.reset();
+    ct::LoggedCertificatePB::CopyFrom(from);
+  }
+
+  void Swap(LoggedCertificate* other) {
+    ct::LoggedCertificatePB::Swap(other);
+    hash_.swap(other->hash_);
+  }
+
+  ct::LoggedCertificatePB_Contents* mutable_contents() {
+    hash_.reset();
+    return ct::LoggedCertificatePB::mutable_contents();
+  }
+
+  void clear_contents() {
+    hash_.reset();
+    ct::LoggedCertificatePB::clear_contents();
   }
 
   uint64_t timestamp() const {
@@ -27,8 +81,9 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
     return contents().sct();
   }
 
+  // The SCT is not part of the hash, so this leaves it be.
   ct::SignedCertificateTimestamp* mutable_sct() {
-    return mutable_contents()->mutable_sct();
+    return ct::LoggedCertificatePB::mutable_contents()->mutable_sct();
   }
 
   const ct::LogEntry& entry() const {
@@ -114,35 +169,118 @@ class LoggedCertificate : public ct::LoggedCertificatePB {
       }
     }
   }
+
+ private:
+  // Clear() cannot be overridden (it is final in the generated code),
+  // and would leave the memoized hash behind, so assign a
+  // default-constructed LoggedCertificate instead.
+  using ct::LoggedCertificatePB::Clear;
+
+  // Shared by copies, and only ever replaced by the mutators, or set
+  // once by Hash().
+  mutable std::shared_ptr<const std::string> hash_;
 };
 
 
-inline bool operator==(const LoggedCertificate& lhs,
-                       const LoggedCertificate& rhs) {
-  // TODO(alcutter): Do this properly
-  std::string l_str, r_str;
-  CHECK(lhs.SerializeToString(&l_str));
-  CHECK(rhs.SerializeToString(&r_str));
-  return l_str == r_str;
+// The operators below compare field by field, without serializing
+// or allocating, and return as soon as a field differs. As with
+// comparing the serialized messages, a field that is set to its
+// default value differs from one that is not set.
+inline bool SameRepeatedBytes(
+    const google::protobuf::RepeatedPtrField<std::string>& lhs,
+    const google::protobuf::RepeatedPtrField<std::string>& rhs) {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (int i = 0; i < lhs.size(); ++i) {
+    if (lhs.Get(i) != rhs.Get(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+inline bool operator==(const ct::DigitallySigned& lhs,
+                       const ct::DigitallySigned& rhs) {
+  return lhs.has_hash_algorithm() == rhs.has_hash_algorithm() &&
+         lhs.hash_algorithm() == rhs.hash_algorithm() &&
+         lhs.has_sig_algorithm() == rhs.has_sig_algorithm() &&
+         lhs.sig_algorithm() == rhs.sig_algorithm() &&
+         lhs.has_signature() == rhs.has_signature() &&
+         lhs.signature() == rhs.signature();
+}
+
+
+inline bool operator==(const ct::X509ChainEntry& lhs,
+                       const ct::X509ChainEntry& rhs) {
+  return lhs.has_leaf_certificate() == rhs.has_leaf_certificate() &&
+         lhs.leaf_certificate() == rhs.leaf_certificate() &&
+         SameRepeatedBytes(lhs.certificate_chain(), rhs.certificate_chain());
+}
+
+
+inline bool operator==(const ct::PreCert& lhs, const ct::PreCert& rhs) {
+  return lhs.has_issuer_key_hash() == rhs.has_issuer_key_hash() &&
+         lhs.issuer_key_hash() == rhs.issuer_key_hash() &&
+         lhs.has_tbs_certificate() == rhs.has_tbs_certificate() &&
+         lhs.tbs_certificate() == rhs.tbs_certificate();
+}
+
+
+inline bool operator==(const ct::PrecertChainEntry& lhs,
+                       const ct::PrecertChainEntry& rhs) {
+  return lhs.has_pre_certificate() == rhs.has_pre_certificate() &&
+         lhs.pre_certificate() == rhs.pre_certificate() &&
+         SameRepeatedBytes(lhs.precertificate_chain(),
+                           rhs.precertificate_chain()) &&
+         lhs.has_pre_cert() == rhs.has_pre_cert() &&
+         (!lhs.has_pre_cert() || lhs.pre_cert() == rhs.pre_cert());
 }
 
 
 inline bool operator==(const ct::LogEntry& lhs, const ct::LogEntry& rhs) {
-  // TODO(alcutter): Do this properly
-  std::string l_str, r_str;
-  CHECK(lhs.SerializeToString(&l_str));
-  CHECK(rhs.SerializeToString(&r_str));
-  return l_str == r_str;
+  return lhs.has_type() == rhs.has_type() && lhs.type() == rhs.type() &&
+         lhs.has_x509_entry() == rhs.has_x509_entry() &&
+         lhs.has_precert_entry() == rhs.has_precert_entry() &&
+         (!lhs.has_x509_entry() || lhs.x509_entry() == rhs.x509_entry()) &&
+         (!lhs.has_precert_entry() ||
+          lhs.precert_entry() == rhs.precert_entry());
 }
 
 
 inline bool operator==(const ct::SignedCertificateTimestamp& lhs,
                        const ct::SignedCertificateTimestamp& rhs) {
-  // TODO(alcutter): Do this properly
-  std::string l_str, r_str;
-  CHECK(lhs.SerializeToString(&l_str));
-  CHECK(rhs.SerializeToString(&r_str));
-  return l_str == r_str;
+  return lhs.has_version() == rhs.has_version() &&
+         lhs.version() == rhs.version() &&
+         lhs.has_timestamp() == rhs.has_timestamp() &&
+         lhs.timestamp() == rhs.timestamp() &&
+         lhs.has_id() == rhs.has_id() &&
+         (!lhs.has_id() ||
+          (lhs.id().has_key_id() == rhs.id().has_key_id() &&
+           lhs.id().key_id() == rhs.id().key_id())) &&
+         lhs.has_extensions() == rhs.has_extensions() &&
+         lhs.extensions() == rhs.extensions() &&
+         lhs.has_signature() == rhs.has_signature() &&
+         (!lhs.has_signature() || lhs.signature() == rhs.signature());
+}
+
+
+inline bool operator==(const LoggedCertificate& lhs,
+                       const LoggedCertificate& rhs) {
+  // Entries with different memoized hashes differ, which is the
+  // common case when looking for duplicates.
+  if (lhs.KnownHashDiffers(rhs)) {
+    return false;
+  }
+  return lhs.has_sequence_number() == rhs.has_sequence_number() &&
+         lhs.sequence_number() == rhs.sequence_number() &&
+         lhs.has_merkle_leaf_hash() == rhs.has_merkle_leaf_hash() &&
+         lhs.merkle_leaf_hash() == rhs.merkle_leaf_hash() &&
+         lhs.has_contents() == rhs.has_contents() &&
+         lhs.contents().has_sct() == rhs.contents().has_sct() &&
+         lhs.contents().has_entry() == rhs.contents().has_entry() &&
+         lhs.sct() == rhs.sct() && lhs.entry() == rhs.entry();
 }
 
 
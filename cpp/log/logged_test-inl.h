@@ -63,6 +63,77 @@ TYPED_TEST(LoggedTest, SerializationPreservesHash) {
   EXPECT_EQ(l1.Hash(), l2.Hash());
 }
 
+TYPED_TEST(LoggedTest, MutationChangesHash) {
+  TypeParam l1;
+  l1.RandomForTest();
+  const std::string h1(l1.Hash());
+
+  TypeParam l2;
+  l2.RandomForTest();
+  const std::string h2(l2.Hash());
+
+  l1.mutable_entry()->CopyFrom(l2.entry());
+  EXPECT_EQ(h2, l1.Hash());
+
+  l2.RandomForTest();
+  EXPECT_NE(h2, l2.Hash());
+
+  std::string s1;
+  EXPECT_TRUE(l1.SerializeForDatabase(&s1));
+  EXPECT_TRUE(l2.ParseFromDatabase(s1));
+  EXPECT_EQ(h2, l2.Hash());
+}
+
+TYPED_TEST(LoggedTest, SwapSwapsHash) {
+  TypeParam l1;
+  l1.RandomForTest();
+  const std::string h1(l1.Hash());
+
+  TypeParam l2;
+  l2.RandomForTest();
+  const std::string h2(l2.Hash());
+
+  l1.Swap(&l2);
+  EXPECT_EQ(h2, l1.Hash());
+  EXPECT_EQ(h1, l2.Hash());
+
+  // Swapping with an entry whose hash was never computed.
+  TypeParam l3;
+  l3.RandomForTest();
+  l3.Swap(&l1);
+  EXPECT_EQ(h2, l3.Hash());
+  EXPECT_NE(h2, l1.Hash());
+}
+
+TYPED_TEST(LoggedTest, Equality) {
+  TypeParam l1;
+  l1.RandomForTest();
+  TypeParam l2(l1);
+  EXPECT_TRUE(l1 == l2);
+
+  l2.set_sequence_number(42);
+  EXPECT_FALSE(l1 == l2);
+  l1.set_sequence_number(42);
+  EXPECT_TRUE(l1 == l2);
+
+  l2.mutable_sct()->set_timestamp(l1.timestamp() + 1);
+  EXPECT_FALSE(l1 == l2);
+  l2.mutable_sct()->set_timestamp(l1.timestamp());
+  EXPECT_TRUE(l1 == l2);
+
+  // Set to the default value is not the same as unset.
+  l2.mutable_sct()->mutable_signature();
+  EXPECT_FALSE(l1 == l2);
+
+  TypeParam l3;
+  l3.RandomForTest();
+  l3.set_sequence_number(42);
+  EXPECT_FALSE(l1 == l3);
+  // And with the hashes known.
+  EXPECT_NE(l1.Hash(), l3.Hash());
+  EXPECT_FALSE(l1 == l3);
+}
+
 TYPED_TEST(LoggedTest, SerializationPreservesMerkleSerialization) {
   TypeParam l1;
   l1.RandomForTest();
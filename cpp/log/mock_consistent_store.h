@@ -55,6 +55,11 @@ class MockConsistentStore : public ConsistentStore<Logged> {
       void(const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
            util::Task* task));
 
+  MOCK_METHOD2_T(
+      WatchPendingEntries,
+      void(const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+           util::Task* task));
+
   MOCK_METHOD1(SetClusterConfig, util::Status(const ct::ClusterConfig&));
 
   MOCK_METHOD0(CleanupOldEntries, util::StatusOr<int64_t>());
@@ -70,7 +70,8 @@ sqlite3* SQLiteOpen(const std::string& dbfile) {
                            nullptr));
   CHECK_EQ(SQLITE_OK, sqlite3_exec(retval,
                                    "CREATE TABLE leaves(hash BLOB, "
-                                   "entry BLOB, sequence INTEGER UNIQUE)",
+                                   "entry BLOB, sequence INTEGER UNIQUE, "
+                                   "leaf_hash BLOB)",
                                    nullptr, nullptr, nullptr));
   CHECK_EQ(SQLITE_OK, sqlite3_exec(retval,
                                    "CREATE INDEX leaves_hash_idx ON "
@@ -92,6 +93,30 @@ sqlite3* SQLiteOpen(const std::string& dbfile) {
 }
 
 
+// Databases created before leaf hashes were stored do not have a column
+// for them. Their existing entries are left with a NULL leaf hash, which
+// is recomputed from the entry when looked up.
+void SQLiteAddLeafHashColumn(sqlite3* db) {
+  {
+    sqlite::Statement statement(db, "PRAGMA table_info(leaves)");
+    int ret;
+    while ((ret = statement.Step()) == SQLITE_ROW) {
+      std::string name;
+      statement.GetBlob(1, &name);
+      if (name == "leaf_hash") {
+        return;
+      }
+    }
+    CHECK_EQ(SQLITE_DONE, ret);
+  }
+
+  CHECK_EQ(SQLITE_OK,
+           sqlite3_exec(db, "ALTER TABLE leaves ADD COLUMN leaf_hash BLOB",
+                        nullptr, nullptr, nullptr));
+  LOG(INFO) << "Added leaf_hash column to SQLite database";
+}
+
+
 }  // namespace
 
 
@@ -133,6 +158,8 @@ SQLiteDB<Logged>::SQLiteDB(const std::string& dbfile)
     CHECK_EQ(SQLITE_DONE, statement.Step());
   }
 
+  SQLiteAddLeafHashColumn(db_);
+
   BeginTransaction(lock);
 }
 
@@ -145,7 +172,7 @@ SQLiteDB<Logged>::~SQLiteDB() {
 
 template <class Logged>
 typename Database<Logged>::WriteResult SQLiteDB<Logged>::CreateSequencedEntry_(
-    const Logged& logged) {
+    const Logged& logged, const std::string& leaf_hash) {
   cert_trans::ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
   std::unique_lock<std::mutex> lock(lock_);
@@ -153,8 +180,8 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::CreateSequencedEntry_(
   MaybeStartNewTransaction(lock);
 
   sqlite::Statement statement(db_,
-                              "INSERT INTO leaves(hash, entry, sequence) "
-                              "VALUES(?, ?, ?)");
+                              "INSERT INTO leaves(hash, entry, sequence, "
+                              "leaf_hash) VALUES(?, ?, ?, ?)");
   const std::string hash(logged.Hash());
   statement.BindBlob(0, hash);
 
@@ -165,6 +192,8 @@ typename Database<Logged>::WriteResult SQLiteDB<Logged>::CreateSequencedEntry_(
   CHECK(logged.has_sequence_number());
   statement.BindUInt64(2, logged.sequence_number());
 
+  statement.BindBlob(3, leaf_hash);
+
   int ret = statement.Step();
   if (ret == SQLITE_CONSTRAINT) {
     // Check whether we're trying to store a hash/sequence pair which already
@@ -268,6 +297,53 @@ typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupByIndex(
 }
 
 
+template <class Logged>
+typename Database<Logged>::LookupResult SQLiteDB<Logged>::LookupLeafHashRange(
+    int64_t start, int64_t end, std::vector<std::string>* leaf_hashes) const {
+  CHECK_GE(start, 0);
+  CHECK_NOTNULL(leaf_hashes);
+  cert_trans::ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("lookup_leaf_hash_range"));
+  std::lock_guard<std::mutex> lock(lock_);
+
+  sqlite::Statement statement(db_,
+                              "SELECT sequence, leaf_hash FROM leaves "
+                              "WHERE sequence >= ? AND sequence < ? "
+                              "ORDER BY sequence");
+  statement.BindUInt64(0, start);
+  statement.BindUInt64(1, end);
+
+  int64_t next(start);
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    if (static_cast<int64_t>(statement.GetUInt64(0)) != next) {
+      return this->NOT_FOUND;
+    }
+
+    if (statement.GetType(1) == SQLITE_NULL) {
+      // Entries created before leaf hashes were stored have to be
+      // hashed here.
+      sqlite::Statement s2(db_, "SELECT entry FROM leaves WHERE sequence = ?");
+      s2.BindUInt64(0, next);
+      CHECK_EQ(SQLITE_ROW, s2.Step());
+      std::string data;
+      s2.GetBlob(0, &data);
+      Logged logged;
+      CHECK(logged.ParseFromDatabase(data));
+      logged.set_sequence_number(next);
+      leaf_hashes->push_back(this->ComputeLeafHash(logged));
+    } else {
+      leaf_hashes->emplace_back();
+      statement.GetBlob(1, &leaf_hashes->back());
+    }
+    ++next;
+  }
+  CHECK_EQ(SQLITE_DONE, ret);
+
+  return next < end ? this->NOT_FOUND : this->LOOKUP_OK;
+}
+
+
 template <class Logged>
 typename Database<Logged>::WriteResult SQLiteDB<Logged>::WriteTreeHead_(
     const ct::SignedTreeHead& sth) {
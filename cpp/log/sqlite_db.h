@@ -4,6 +4,7 @@
 
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
@@ -20,7 +21,8 @@ class SQLiteDB : public Database<Logged> {
   typedef typename Database<Logged>::WriteResult WriteResult;
   typedef typename Database<Logged>::LookupResult LookupResult;
 
-  WriteResult CreateSequencedEntry_(const Logged& logged) override;
+  WriteResult CreateSequencedEntry_(const Logged& logged,
+                                    const std::string& leaf_hash) override;
 
   LookupResult LookupByHash(const std::string& hash,
                             Logged* result) const override;
@@ -28,6 +30,10 @@ class SQLiteDB : public Database<Logged> {
   LookupResult LookupByIndex(int64_t sequence_number,
                              Logged* result) const override;
 
+  LookupResult LookupLeafHashRange(
+      int64_t start, int64_t end,
+      std::vector<std::string>* leaf_hashes) const override;
+
   WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override;
 
   LookupResult LatestTreeHead(ct::SignedTreeHead* result) const override;
@@ -88,6 +88,12 @@ class StrictConsistentStore : public ConsistentStore<Logged> {
     return peer_->WatchClusterConfig(cb, task);
   }
 
+  void WatchPendingEntries(
+      const typename ConsistentStore<Logged>::PendingEntriesCallback& cb,
+      util::Task* task) override {
+    return peer_->WatchPendingEntries(cb, task);
+  }
+
  private:
   const MasterElection* const election_;  // Not owned by us
   const std::unique_ptr<ConsistentStore<Logged>> peer_;
@@ -0,0 +1,171 @@
+#include "log/temporal_shards.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <set>
+
+using std::set;
+using std::sort;
+using std::string;
+using std::upper_bound;
+using std::vector;
+using util::Status;
+using util::StatusOr;
+
+namespace cert_trans {
+
+const char kShardPlaceholder[] = "{shard}";
+
+namespace {
+
+
+const uint64_t kMillisPerDay = 24 * 60 * 60 * 1000;
+
+
+bool IsValidShardName(const string& name) {
+  if (name.empty()) {
+    return false;
+  }
+  for (const char c : name) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Number of days from 1970-01-01 to the given date of the proleptic
+// Gregorian calendar.
+int64_t DaysFromCivil(int64_t year, int month, int day) {
+  year -= month <= 2;
+  const int64_t era((year >= 0 ? year : year - 399) / 400);
+  const int64_t year_of_era(year - era * 400);
+  const int64_t day_of_year((153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 +
+                            day - 1);
+  const int64_t day_of_era(year_of_era * 365 + year_of_era / 4 -
+                           year_of_era / 100 + day_of_year);
+  return era * 146097 + day_of_era - 719468;
+}
+
+
+bool ParseDate(const string& date, uint64_t* millis) {
+  if (date.size() != 10 || date[4] != '-' || date[7] != '-') {
+    return false;
+  }
+  for (size_t i = 0; i < date.size(); ++i) {
+    if (i != 4 && i != 7 && !isdigit(static_cast<unsigned char>(date[i]))) {
+      return false;
+    }
+  }
+  const int year(stoi(date.substr(0, 4)));
+  const int month(stoi(date.substr(5, 2)));
+  const int day(stoi(date.substr(8, 2)));
+  if (year < 1970 || month < 1 || month > 12 || day < 1 ||
+      DaysFromCivil(year, month, day) >=
+          DaysFromCivil(year + month / 12, month % 12 + 1, 1)) {
+    return false;
+  }
+  *millis = DaysFromCivil(year, month, day) * kMillisPerDay;
+  return true;
+}
+
+
+}  // namespace
+
+
+StatusOr<vector<TemporalShard>> ParseTemporalShards(const string& spec) {
+  vector<TemporalShard> shards;
+  set<string> names;
+  size_t begin(0);
+  while (begin < spec.size()) {
+    size_t end(spec.find(',', begin));
+    if (end == string::npos) {
+      end = spec.size();
+    }
+    const string item(spec.substr(begin, end - begin));
+    begin = end + 1;
+
+    const size_t first_colon(item.find(':'));
+    const size_t second_colon(first_colon == string::npos
+                                  ? string::npos
+                                  : item.find(':', first_colon + 1));
+    if (second_colon == string::npos) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "expected <name>:<start>:<limit> in \"" + item + "\"");
+    }
+
+    TemporalShard shard;
+    shard.name = item.substr(0, first_colon);
+    if (!IsValidShardName(shard.name)) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "invalid shard name in \"" + item + "\"");
+    }
+    if (!names.insert(shard.name).second) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "duplicate shard name \"" + shard.name + "\"");
+    }
+    if (!ParseDate(item.substr(first_colon + 1,
+                               second_colon - first_colon - 1),
+                   &shard.not_after_start) ||
+        !ParseDate(item.substr(second_colon + 1), &shard.not_after_limit)) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "invalid date in \"" + item + "\"");
+    }
+    if (shard.not_after_start >= shard.not_after_limit) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "empty window in \"" + item + "\"");
+    }
+    shards.push_back(shard);
+  }
+
+  sort(shards.begin(), shards.end(),
+       [](const TemporalShard& a, const TemporalShard& b) {
+         return a.not_after_start < b.not_after_start;
+       });
+  for (size_t i = 1; i < shards.size(); ++i) {
+    if (shards[i].not_after_start < shards[i - 1].not_after_limit) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "shards \"" + shards[i - 1].name + "\" and \"" +
+                        shards[i].name + "\" overlap");
+    }
+  }
+
+  return shards;
+}
+
+
+int FindTemporalShard(const vector<TemporalShard>& shards,
+                      uint64_t not_after) {
+  // The first shard starting after |not_after|, so that the one before
+  // it is the only candidate.
+  const auto it(upper_bound(shards.begin(), shards.end(), not_after,
+                            [](uint64_t value, const TemporalShard& shard) {
+                              return value < shard.not_after_start;
+                            }));
+  if (it == shards.begin() || not_after >= (it - 1)->not_after_limit) {
+    return -1;
+  }
+  return it - 1 - shards.begin();
+}
+
+
+string ExpandShardPattern(const string& pattern, const string& shard_name) {
+  const string placeholder(kShardPlaceholder);
+  string result;
+  size_t begin(0);
+  while (true) {
+    const size_t found(pattern.find(placeholder, begin));
+    if (found == string::npos) {
+      break;
+    }
+    result.append(pattern, begin, found - begin);
+    result.append(shard_name);
+    begin = found + placeholder.size();
+  }
+  result.append(pattern, begin, string::npos);
+  return result;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,60 @@
+#ifndef CERT_TRANS_LOG_TEMPORAL_SHARDS_H_
+#define CERT_TRANS_LOG_TEMPORAL_SHARDS_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "util/statusor.h"
+
+namespace cert_trans {
+
+
+// A log which only accepts certificates expiring within a window of
+// time, so that the submissions can be spread over several logs (one
+// per window), each with its own sequencer.
+struct TemporalShard {
+  // Used in the paths of the shard (in etcd, on disk and in URLs).
+  std::string name;
+  // The shard accepts certificates whose notAfter is in
+  // [not_after_start, not_after_limit), in milliseconds since the
+  // epoch.
+  uint64_t not_after_start;
+  uint64_t not_after_limit;
+
+  // Returns whether the shard accepts certificates expiring at
+  // |not_after|.
+  bool Accepts(uint64_t not_after) const {
+    return not_after >= not_after_start && not_after < not_after_limit;
+  }
+};
+
+
+// The placeholder replaced by the name of the shard in per-shard
+// settings (see ExpandShardPattern()).
+extern const char kShardPlaceholder[];
+
+
+// Parses shards of the form "<name>:<start>:<limit>,...", where
+// <start> and <limit> are dates in the YYYY-MM-DD format (midnight
+// UTC). Returns them sorted by their window, which must not overlap.
+util::StatusOr<std::vector<TemporalShard>> ParseTemporalShards(
+    const std::string& spec);
+
+
+// Returns the index in |shards| (as returned by ParseTemporalShards())
+// of the shard accepting certificates expiring at |not_after|, or -1
+// if none of them does.
+int FindTemporalShard(const std::vector<TemporalShard>& shards,
+                      uint64_t not_after);
+
+
+// Returns |pattern| with every kShardPlaceholder replaced by
+// |shard_name|.
+std::string ExpandShardPattern(const std::string& pattern,
+                               const std::string& shard_name);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_TEMPORAL_SHARDS_H_
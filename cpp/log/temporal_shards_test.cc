@@ -0,0 +1,114 @@
+#include "log/temporal_shards.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+// 2016-01-01 and 2017-01-01, in milliseconds since the epoch.
+const uint64_t k2016 = 1451606400000ULL;
+const uint64_t k2017 = 1483228800000ULL;
+const uint64_t kOneDay = 24 * 60 * 60 * 1000;
+
+
+TEST(TemporalShardsTest, Parse) {
+  const util::StatusOr<vector<TemporalShard>> shards(ParseTemporalShards(
+      "y2017:2017-01-01:2018-01-01,y2016:2016-01-01:2017-01-01"));
+  ASSERT_TRUE(shards.ok()) << shards.status();
+  ASSERT_EQ(2U, shards.ValueOrDie().size());
+
+  // Sorted by window.
+  EXPECT_EQ("y2016", shards.ValueOrDie()[0].name);
+  EXPECT_EQ(k2016, shards.ValueOrDie()[0].not_after_start);
+  EXPECT_EQ(k2017, shards.ValueOrDie()[0].not_after_limit);
+  EXPECT_EQ("y2017", shards.ValueOrDie()[1].name);
+  EXPECT_EQ(k2017, shards.ValueOrDie()[1].not_after_start);
+}
+
+
+TEST(TemporalShardsTest, ParseEmpty) {
+  const util::StatusOr<vector<TemporalShard>> shards(ParseTemporalShards(""));
+  ASSERT_TRUE(shards.ok()) << shards.status();
+  EXPECT_TRUE(shards.ValueOrDie().empty());
+}
+
+
+TEST(TemporalShardsTest, ParseErrors) {
+  EXPECT_FALSE(ParseTemporalShards("a").ok());
+  EXPECT_FALSE(ParseTemporalShards("a:2016-01-01").ok());
+  EXPECT_FALSE(ParseTemporalShards(":2016-01-01:2017-01-01").ok());
+  EXPECT_FALSE(ParseTemporalShards("a/b:2016-01-01:2017-01-01").ok());
+  EXPECT_FALSE(ParseTemporalShards("a:2016-1-1:2017-01-01").ok());
+  EXPECT_FALSE(ParseTemporalShards("a:2016-13-01:2017-01-01").ok());
+  EXPECT_FALSE(ParseTemporalShards("a:2015-02-29:2017-01-01").ok());
+  EXPECT_TRUE(ParseTemporalShards("a:2016-02-29:2017-01-01").ok());
+  // Empty window.
+  EXPECT_FALSE(ParseTemporalShards("a:2016-01-01:2016-01-01").ok());
+  // Duplicate name.
+  EXPECT_FALSE(ParseTemporalShards(
+                   "a:2016-01-01:2017-01-01,a:2017-01-01:2018-01-01")
+                   .ok());
+  // Overlapping windows.
+  EXPECT_FALSE(ParseTemporalShards(
+                   "a:2016-01-01:2017-01-02,b:2017-01-01:2018-01-01")
+                   .ok());
+}
+
+
+TEST(TemporalShardsTest, Find) {
+  const util::StatusOr<vector<TemporalShard>> shards(ParseTemporalShards(
+      "a:2016-01-01:2017-01-01,b:2017-01-01:2017-06-01,"
+      "c:2018-01-01:2019-01-01"));
+  ASSERT_TRUE(shards.ok()) << shards.status();
+
+  EXPECT_EQ(-1, FindTemporalShard(shards.ValueOrDie(), 0));
+  EXPECT_EQ(-1, FindTemporalShard(shards.ValueOrDie(), k2016 - 1));
+  EXPECT_EQ(0, FindTemporalShard(shards.ValueOrDie(), k2016));
+  EXPECT_EQ(0, FindTemporalShard(shards.ValueOrDie(), k2017 - 1));
+  EXPECT_EQ(1, FindTemporalShard(shards.ValueOrDie(), k2017));
+  EXPECT_EQ(1, FindTemporalShard(shards.ValueOrDie(), k2017 + kOneDay));
+  // In the gap between "b" and "c".
+  EXPECT_EQ(-1, FindTemporalShard(shards.ValueOrDie(), k2017 + 200 * kOneDay));
+  EXPECT_EQ(2, FindTemporalShard(shards.ValueOrDie(), k2017 + 400 * kOneDay));
+  EXPECT_EQ(-1, FindTemporalShard(shards.ValueOrDie(), k2017 + 800 * kOneDay));
+  EXPECT_EQ(-1, FindTemporalShard(vector<TemporalShard>(), k2016));
+}
+
+
+TEST(TemporalShardsTest, Accepts) {
+  const util::StatusOr<vector<TemporalShard>> shards(
+      ParseTemporalShards("a:2016-01-01:2017-01-01"));
+  ASSERT_TRUE(shards.ok()) << shards.status();
+  const TemporalShard& shard(shards.ValueOrDie()[0]);
+
+  EXPECT_FALSE(shard.Accepts(k2016 - 1));
+  EXPECT_TRUE(shard.Accepts(k2016));
+  EXPECT_TRUE(shard.Accepts(k2017 - 1));
+  EXPECT_FALSE(shard.Accepts(k2017));
+}
+
+
+TEST(TemporalShardsTest, ExpandShardPattern) {
+  EXPECT_EQ("/logs/y2016", ExpandShardPattern("/logs/{shard}", "y2016"));
+  EXPECT_EQ("y2016/y2016.db",
+            ExpandShardPattern("{shard}/{shard}.db", "y2016"));
+  EXPECT_EQ("/logs/root", ExpandShardPattern("/logs/root", "y2016"));
+  EXPECT_EQ("{shard", ExpandShardPattern("{shard", "y2016"));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
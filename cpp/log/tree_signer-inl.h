@@ -7,12 +7,21 @@
 #include <algorithm>
 #include <chrono>
 #include <glog/logging.h>
+#include <map>
+#include <mutex>
 #include <set>
 #include <stdint.h>
 #include <unordered_map>
+#include <vector>
 
+#include "log/cert.h"
 #include "log/database.h"
+#include "log/fair_sequencing_policy.h"
+#include "log/leaf_hash_file.h"
 #include "log/log_signer.h"
+#include "monitoring/counter.h"
+#include "monitoring/gauge.h"
+#include "monitoring/latency.h"
 #include "proto/serializer.h"
 #include "util/status.h"
 #include "util/util.h"
@@ -24,6 +33,102 @@ namespace cert_trans {
 namespace {
 
 
+// Upper bounds of the inclusion latency histogram buckets, in
+// milliseconds.
+const int64_t kInclusionLatencyBucketsMs[] = {1000,   5000,   10000,
+                                              30000,  60000,  120000,
+                                              300000, 600000, 3600000};
+
+static Counter<std::string>* tree_signer_inclusion_latency_ms_bucket(
+    Counter<std::string>::New(
+        "tree_signer_inclusion_latency_ms_bucket", "le",
+        "Cumulative histogram of the time from the SCT timestamp of an "
+        "entry sequenced by this node to the first tree head it signed "
+        "including it."));
+static Gauge<>* tree_signer_deferred_entries(Gauge<>::New(
+    "tree_signer_deferred_entries",
+    "Number of entries left for a later sequencing pass by the fair "
+    "sequencing policy in the latest pass."));
+static Latency<std::chrono::milliseconds> tree_signer_inclusion_latency_ms(
+    "tree_signer_inclusion_latency_ms",
+    "Time from the SCT timestamp of an entry sequenced by this node to the "
+    "first tree head it signed including it.");
+
+
+const size_t kNumInclusionLatencyBuckets(
+    sizeof(kInclusionLatencyBucketsMs) / sizeof(kInclusionLatencyBucketsMs[0]));
+
+
+// The "le" label of each bucket, and "+Inf" last.
+const std::vector<std::string>& InclusionLatencyBucketLabels() {
+  static const std::vector<std::string>* const labels([]() {
+    std::vector<std::string>* const retval(new std::vector<std::string>);
+    for (const int64_t bound : kInclusionLatencyBucketsMs) {
+      retval->emplace_back(std::to_string(bound));
+    }
+    retval->emplace_back("+Inf");
+    return retval;
+  }());
+  return *labels;
+}
+
+
+void RecordInclusionLatencies(const std::vector<uint64_t>& sct_timestamps,
+                              uint64_t sth_timestamp) {
+  if (sct_timestamps.empty()) {
+    return;
+  }
+
+  std::vector<int64_t> counts(kNumInclusionLatencyBuckets, 0);
+  for (const uint64_t sct_timestamp : sct_timestamps) {
+    const int64_t latency_ms(sth_timestamp > sct_timestamp
+                                 ? sth_timestamp - sct_timestamp
+                                 : 0);
+    tree_signer_inclusion_latency_ms.RecordLatency(
+        std::chrono::milliseconds(latency_ms));
+    for (size_t i = 0; i < kNumInclusionLatencyBuckets; ++i) {
+      if (latency_ms <= kInclusionLatencyBucketsMs[i]) {
+        ++counts[i];
+      }
+    }
+  }
+
+  const std::vector<std::string>& labels(InclusionLatencyBucketLabels());
+  for (size_t i = 0; i < kNumInclusionLatencyBuckets; ++i) {
+    if (counts[i] > 0) {
+      tree_signer_inclusion_latency_ms_bucket->IncrementBy(labels[i],
+                                                           counts[i]);
+    }
+  }
+  tree_signer_inclusion_latency_ms_bucket->IncrementBy(
+      labels.back(), sct_timestamps.size());
+}
+
+
+// The issuer an entry is attributed to for fair sequencing, which is
+// the SHA-256 hash of the issuer's SubjectPublicKeyInfo, like the
+// issuer key hash of precertificates. X.509 entries without a usable
+// issuing certificate are all attributed to the empty key.
+template <class Logged>
+std::string IssuerKeyHash(const Logged& logged) {
+  const ct::LogEntry& entry(logged.entry());
+  if (entry.type() == ct::PRECERT_ENTRY) {
+    return entry.precert_entry().pre_cert().issuer_key_hash();
+  }
+
+  std::string key_hash;
+  if (entry.x509_entry().certificate_chain_size() > 0) {
+    Cert issuer;
+    if (issuer.LoadFromDerString(entry.x509_entry().certificate_chain(0)) !=
+            Cert::TRUE ||
+        issuer.SPKISha256Digest(&key_hash) != Cert::TRUE) {
+      key_hash.clear();
+    }
+  }
+  return key_hash;
+}
+
+
 bool LessThanBySequence(const ct::SequenceMapping::Mapping& lhs,
                         const ct::SequenceMapping::Mapping& rhs) {
   CHECK(lhs.has_sequence_number());
@@ -63,14 +168,34 @@ template <class Logged>
 TreeSigner<Logged>::TreeSigner(
     const std::chrono::duration<double>& guard_window, Database<Logged>* db,
     std::unique_ptr<CompactMerkleTree>&& merkle_tree,
-    cert_trans::ConsistentStore<Logged>* consistent_store, LogSigner* signer)
+    cert_trans::ConsistentStore<Logged>* consistent_store, LogSigner* signer,
+    LeafHashFile* leaf_hashes, const FairSequencingPolicy* sequencing_policy)
     : guard_window_(guard_window),
       db_(db),
       consistent_store_(consistent_store),
       signer_(signer),
+      leaf_hashes_(leaf_hashes),
+      sequencing_policy_(sequencing_policy),
       cert_tree_(std::move(merkle_tree)),
       latest_tree_head_() {
   CHECK(cert_tree_);
+  if (leaf_hashes_) {
+    const int64_t tree_size(cert_tree_->LeafCount());
+    if (leaf_hashes_->size() > tree_size) {
+      LOG(WARNING) << "Leaf hash file has " << leaf_hashes_->size()
+                   << " entries, but the tree only " << tree_size;
+      leaf_hashes_->Truncate(tree_size);
+    }
+    // Catch up with entries sequenced while the file was not in use.
+    std::vector<std::string> missing_hashes;
+    CHECK_EQ(Database<Logged>::LOOKUP_OK,
+             db_->LookupLeafHashRange(leaf_hashes_->size(), tree_size,
+                                      &missing_hashes));
+    for (const auto& leaf_hash : missing_hashes) {
+      leaf_hashes_->Append(leaf_hash);
+    }
+    leaf_hashes_->Sync();
+  }
   // Try to get any STH previously published by this node.
   const util::StatusOr<ct::ClusterNodeState> node_state(
       consistent_store_->GetClusterNodeState());
@@ -132,6 +257,64 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
   VLOG(1) << "Sequencing " << pending_entries.size() << " entr"
           << (pending_entries.size() == 1 ? "y" : "ies");
 
+  // Let the sequencing policy pick which of the new entries out of
+  // the guard window go in this pass, if there are too many.
+  std::vector<bool> deferred(pending_entries.size(), false);
+  if (sequencing_policy_ && sequencing_policy_->budget() > 0) {
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < pending_entries.size(); ++i) {
+      const Logged& entry(pending_entries[i].Entry());
+      const std::chrono::system_clock::time_point cert_time(
+          std::chrono::milliseconds(entry.timestamp()));
+      if (now - cert_time >= guard_window_ &&
+          sequenced_hashes.find(entry.Hash()) == sequenced_hashes.end()) {
+        candidates.push_back(i);
+      }
+    }
+
+    int64_t num_deferred(0);
+    if (static_cast<int64_t>(candidates.size()) >
+        sequencing_policy_->budget()) {
+      // Entries getting close to the MMD go in regardless, the others
+      // share what they leave of the budget.
+      std::vector<size_t> fair_candidates;
+      std::vector<std::string> keys;
+      std::unordered_map<std::string, std::string> issuer_key_hashes;
+      int64_t num_overdue(0);
+      for (const size_t i : candidates) {
+        const Logged& entry(pending_entries[i].Entry());
+        const std::chrono::system_clock::time_point cert_time(
+            std::chrono::milliseconds(entry.timestamp()));
+        if (sequencing_policy_->IsOverdue(now - cert_time)) {
+          ++num_overdue;
+          continue;
+        }
+        // Parsing the issuer is expensive, and deferred entries come
+        // back in the next pass, so remember it from one to the next.
+        const auto cached(issuer_key_hashes_.find(entry.Hash()));
+        keys.push_back(cached != issuer_key_hashes_.end()
+                           ? cached->second
+                           : IssuerKeyHash(entry));
+        issuer_key_hashes.emplace(entry.Hash(), keys.back());
+        fair_candidates.push_back(i);
+      }
+      // Only keep those still pending.
+      issuer_key_hashes_.swap(issuer_key_hashes);
+
+      const std::vector<bool> selected(
+          sequencing_policy_->Select(keys, num_overdue));
+      for (size_t j = 0; j < fair_candidates.size(); ++j) {
+        if (!selected[j]) {
+          deferred[fair_candidates[j]] = true;
+          ++num_deferred;
+        }
+      }
+      VLOG(1) << "Sequencing " << num_overdue << " overdue entries, "
+              << "deferring " << num_deferred << " entries to a later pass.";
+    }
+    tree_signer_deferred_entries->Set(num_deferred);
+  }
+
   // We're going to update the sequence mapping based on the following rules:
   // 1) existing sequence mappings whose corresponding PendingEntry still
   //    exists will remain in the mappings file.
@@ -141,8 +324,15 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
   //    removed from the sequence mapping file.
   google::protobuf::RepeatedPtrField<ct::SequenceMapping_Mapping> new_mapping;
   std::map<int64_t, const Logged*> seq_to_entry;
+  // Sequence number and SCT timestamp of the entries sequenced by this
+  // pass.
+  std::vector<std::pair<int64_t, uint64_t>> newly_sequenced;
   int num_sequenced(0);
-  for (auto& pending_entry : pending_entries) {
+  for (size_t i = 0; i < pending_entries.size(); ++i) {
+    if (deferred[i]) {
+      continue;
+    }
+    auto& pending_entry(pending_entries[i]);
     const std::string& pending_hash(pending_entry.Entry().Hash());
     const std::chrono::system_clock::time_point cert_time(
         std::chrono::milliseconds(pending_entry.Entry().timestamp()));
@@ -162,6 +352,8 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
       seq_mapping->set_sequence_number(next_sequence_number);
       seq_mapping->set_entry_hash(pending_entry.Entry().Hash());
       pending_entry.MutableEntry()->set_sequence_number(next_sequence_number);
+      newly_sequenced.emplace_back(next_sequence_number,
+                                   pending_entry.Entry().timestamp());
       ++num_sequenced;
       ++next_sequence_number;
     } else {
@@ -211,6 +403,12 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
     return status;
   }
 
+  {
+    std::lock_guard<std::mutex> lock(awaiting_inclusion_lock_);
+    awaiting_inclusion_.insert(newly_sequenced.begin(),
+                               newly_sequenced.end());
+  }
+
   // Now add the sequenced entries to our local DB so that the local signer can
   // incorporate them.
   for (auto it(seq_to_entry.find(db_->TreeSize())); it != seq_to_entry.end();
@@ -236,22 +434,29 @@ typename TreeSigner<Logged>::UpdateResult TreeSigner<Logged>::UpdateTree() {
   // That'll get handled by the Serving STH selection code.
   uint64_t min_timestamp = LastUpdateTime() + 1;
 
-  // Sequence any new sequenced entries from our local DB.
-  for (int64_t i(cert_tree_->LeafCount());; ++i) {
+  // Sequence any new sequenced entries from our local DB. Their leaf
+  // hashes were stored when they were sequenced, but the entries are
+  // still needed for their timestamps.
+  std::vector<std::string> new_hashes;
+  CHECK_EQ(Database<Logged>::LOOKUP_OK,
+           db_->LookupLeafHashRange(cert_tree_->LeafCount(), db_->TreeSize(),
+                                    &new_hashes));
+  for (const auto& leaf_hash : new_hashes) {
+    const int64_t i(cert_tree_->LeafCount());
     Logged logged;
-    typename Database<Logged>::LookupResult result(
-        db_->LookupByIndex(i, &logged));
-    if (result == Database<Logged>::NOT_FOUND) {
-      break;
-    }
-    CHECK_EQ(Database<Logged>::LOOKUP_OK, result);
+    CHECK_EQ(Database<Logged>::LOOKUP_OK, db_->LookupByIndex(i, &logged));
     CHECK_EQ(logged.sequence_number(), i);
-    AppendToTree(logged);
+    AppendToTree(leaf_hash);
     min_timestamp = std::max(min_timestamp, logged.sct().timestamp());
   }
   int64_t next_seq(cert_tree_->LeafCount());
   CHECK_GE(next_seq, 0);
 
+  // Replicas must have every leaf before they see an STH covering it.
+  if (leaf_hashes_) {
+    leaf_hashes_->Sync();
+  }
+
   // Our tree is consistent with the database, i.e., each leaf in the tree has
   // a matching sequence number in the database (at least assuming overwriting
   // the sequence number is not allowed).
@@ -263,6 +468,20 @@ typename TreeSigner<Logged>::UpdateResult TreeSigner<Logged>::UpdateTree() {
   // pushed out to this node's ClusterNodeState so that it becomes a candidate
   // for the cluster-wide Serving STH.)
   latest_tree_head_.CopyFrom(new_sth);
+
+  // Only the node that sequenced an entry reports its inclusion
+  // latency, so that each entry is only counted once in the cluster.
+  std::vector<uint64_t> included_timestamps;
+  {
+    std::lock_guard<std::mutex> lock(awaiting_inclusion_lock_);
+    const auto end(awaiting_inclusion_.lower_bound(new_sth.tree_size()));
+    for (auto it(awaiting_inclusion_.begin()); it != end; ++it) {
+      included_timestamps.push_back(it->second);
+    }
+    awaiting_inclusion_.erase(awaiting_inclusion_.begin(), end);
+  }
+  RecordInclusionLatencies(included_timestamps, new_sth.timestamp());
+
   return OK;
 }
 
@@ -274,9 +493,10 @@ bool TreeSigner<Logged>::Append(const Logged& logged) {
   CHECK(logged.SerializeForLeaf(&serialized_leaf));
 
   CHECK_EQ(logged.sequence_number(), cert_tree_->LeafCount());
+  const std::string hash(cert_tree_->LeafHash(serialized_leaf));
   // Commit the sequence number of this certificate locally
   typename Database<Logged>::WriteResult db_result =
-      db_->CreateSequencedEntry(logged);
+      db_->CreateSequencedEntry(logged, hash);
 
   if (db_result != Database<Logged>::OK) {
     CHECK_EQ(Database<Logged>::SEQUENCE_NUMBER_ALREADY_IN_USE, db_result);
@@ -286,19 +506,29 @@ bool TreeSigner<Logged>::Append(const Logged& logged) {
   }
 
   // Update in-memory tree.
-  cert_tree_->AddLeaf(serialized_leaf);
+  AppendToTree(hash);
   return true;
 }
 
 
 template <class Logged>
-void TreeSigner<Logged>::AppendToTree(const Logged& logged) {
-  // Serialize for inclusion in the tree.
-  std::string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
-
+void TreeSigner<Logged>::AppendToTree(const std::string& leaf_hash) {
   // Update in-memory tree.
-  cert_tree_->AddLeaf(serialized_leaf);
+  RecordLeafHash(cert_tree_->LeafCount(), leaf_hash);
+  cert_tree_->AddLeafHash(leaf_hash);
+}
+
+
+template <class Logged>
+void TreeSigner<Logged>::RecordLeafHash(int64_t index,
+                                        const std::string& hash) {
+  if (!leaf_hashes_) {
+    return;
+  }
+
+  // The constructor brought the file in line with the tree.
+  CHECK_EQ(index, leaf_hashes_->size());
+  leaf_hashes_->Append(hash);
 }
 
 
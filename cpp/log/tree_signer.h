@@ -2,7 +2,11 @@
 #define TREE_SIGNER_H
 
 #include <chrono>
+#include <map>
+#include <mutex>
 #include <stdint.h>
+#include <string>
+#include <unordered_map>
 
 #include "log/cluster_state_controller.h"
 #include "log/consistent_store.h"
@@ -21,6 +25,9 @@ class LogSigner;
 
 namespace cert_trans {
 
+class FairSequencingPolicy;
+class LeafHashFile;
+
 
 // Signer for appending new entries to the log.
 // This is the single authority that assigns sequence numbers to new entries,
@@ -33,11 +40,19 @@ class TreeSigner {
  public:
   // No transfer of ownership for params other than merkle_tree whose contents
   // is moved into this object.
+  // If |leaf_hashes| is not NULL, the leaf hash of every entry in the
+  // tree is written to it, and synced before each new tree head is
+  // signed, for the benefit of proof-serving replicas.
+  // If |sequencing_policy| is not NULL, it decides which new entries
+  // are sequenced by each call to SequenceNewEntries() when there are
+  // more than its budget, sharing it between issuers. Entries older
+  // than its max_deferral() are always sequenced.
   TreeSigner(const std::chrono::duration<double>& guard_window,
              Database<Logged>* db,
              std::unique_ptr<CompactMerkleTree>&& merkle_tree,
              cert_trans::ConsistentStore<Logged>* consistent_store,
-             LogSigner* signer);
+             LogSigner* signer, LeafHashFile* leaf_hashes = nullptr,
+             const FairSequencingPolicy* sequencing_policy = nullptr);
 
   enum UpdateResult {
     OK,
@@ -65,16 +80,28 @@ class TreeSigner {
 
  private:
   bool Append(const Logged& logged);
-  void AppendToTree(const Logged& logged_cert);
+  void AppendToTree(const std::string& leaf_hash);
+  void RecordLeafHash(int64_t index, const std::string& hash);
   void TimestampAndSign(uint64_t min_timestamp, ct::SignedTreeHead* sth);
 
   const std::chrono::duration<double> guard_window_;
   Database<Logged>* const db_;
   cert_trans::ConsistentStore<Logged>* const consistent_store_;
   LogSigner* const signer_;
+  LeafHashFile* const leaf_hashes_;
+  const FairSequencingPolicy* const sequencing_policy_;
+  // Issuer key hash of the entries |sequencing_policy_| chose from in
+  // the last pass that needed it, by entry hash.
+  std::unordered_map<std::string, std::string> issuer_key_hashes_;
   const std::unique_ptr<CompactMerkleTree> cert_tree_;
   ct::SignedTreeHead latest_tree_head_;
 
+  // SequenceNewEntries() and UpdateTree() run on different threads.
+  std::mutex awaiting_inclusion_lock_;
+  // SCT timestamp of the entries sequenced by this node that are not
+  // in a tree head signed by it yet, by sequence number.
+  std::map<int64_t, uint64_t> awaiting_inclusion_;
+
   template <class T>
   friend class TreeSignerTest;
 };
@@ -1,11 +1,15 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <algorithm>
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
 #include <memory>
 #include <stdint.h>
 #include <string>
 
 #include "log/etcd_consistent_store-inl.h"
+#include "log/fair_sequencing_policy.h"
 #include "log/file_db.h"
+#include "log/leaf_hash_file.h"
 #include "log/log_signer.h"
 #include "log/log_verifier.h"
 #include "log/sqlite_db.h"
@@ -13,6 +17,7 @@
 #include "log/test_signer.h"
 #include "log/tree_signer-inl.h"
 #include "log/tree_signer.h"
+#include "merkletree/leaf_hash_tree.h"
 #include "merkletree/merkle_verifier.h"
 #include "proto/ct.pb.h"
 #include "util/fake_etcd.h"
@@ -22,6 +27,10 @@
 #include "util/thread_pool.h"
 #include "util/util.h"
 
+DEFINE_int32(pending_entries_order_benchmark_size, 10000,
+             "Number of pending entries to sort in the PendingEntriesOrder "
+             "benchmark.");
+
 namespace cert_trans {
 
 using cert_trans::EntryHandle;
@@ -31,6 +40,7 @@ using ct::ClusterNodeState;
 using ct::SequenceMapping;
 using ct::SignedTreeHead;
 using std::make_shared;
+using std::map;
 using std::move;
 using std::shared_ptr;
 using std::string;
@@ -110,11 +120,11 @@ class TreeSignerTest : public ::testing::Test {
   }
 
 
-  TS* GetSimilar() {
+  TS* GetSimilar(LeafHashFile* leaf_hashes = nullptr) {
     return new TS(std::chrono::duration<double>(0), db(),
                   unique_ptr<CompactMerkleTree>(new CompactMerkleTree(
                       *tree_signer_->cert_tree_, new Sha256Hasher)),
-                  store_.get(), TestSigner::DefaultLogSigner());
+                  store_.get(), TestSigner::DefaultLogSigner(), leaf_hashes);
   }
 
   T* db() const {
@@ -170,6 +180,58 @@ TYPED_TEST(TreeSignerTest, PendingEntriesOrder) {
 }
 
 
+// The comparator sequencing used before LoggedCertificate::Hash() was
+// memoized, which hashes both entries on every comparison.
+struct UnmemoizedPendingEntriesOrder {
+  bool operator()(const EntryHandle<LoggedCertificate>& x,
+                  const EntryHandle<LoggedCertificate>& y) const {
+    const uint64_t x_time(x.Entry().timestamp());
+    const uint64_t y_time(y.Entry().timestamp());
+    if (x_time != y_time) {
+      return x_time < y_time;
+    }
+    return Sha256Hasher::Sha256Digest(
+               Serializer::LeafCertificate(x.Entry().entry())) <
+           Sha256Hasher::Sha256Digest(
+               Serializer::LeafCertificate(y.Entry().entry()));
+  }
+};
+
+
+TEST(PendingEntriesOrderBenchmark, Sort) {
+  TestSigner test_signer;
+  vector<EntryHandle<LoggedCertificate>> pending;
+  for (int i = 0; i < FLAGS_pending_entries_order_benchmark_size; ++i) {
+    LoggedCertificate logged_cert;
+    test_signer.CreateUnique(&logged_cert);
+    // Entries sequenced together often share their timestamp, which
+    // makes the hash the tie-breaker.
+    logged_cert.mutable_sct()->set_timestamp(i / 100);
+    pending.push_back(H(logged_cert));
+  }
+  std::random_shuffle(pending.begin(), pending.end());
+
+  vector<EntryHandle<LoggedCertificate>> unmemoized(pending);
+  uint64_t realtime_before(util::TimeInMilliseconds());
+  std::sort(unmemoized.begin(), unmemoized.end(),
+            UnmemoizedPendingEntriesOrder());
+  const uint64_t unmemoized_ms(util::TimeInMilliseconds() - realtime_before);
+
+  realtime_before = util::TimeInMilliseconds();
+  std::sort(pending.begin(), pending.end(),
+            PendingEntriesOrder<LoggedCertificate>());
+  const uint64_t memoized_ms(util::TimeInMilliseconds() - realtime_before);
+
+  for (size_t i = 0; i < pending.size(); ++i) {
+    EXPECT_EQ(unmemoized[i].Entry().Hash(), pending[i].Entry().Hash());
+  }
+
+  LOG(INFO) << "Sorting " << pending.size() << " pending entries took "
+            << unmemoized_ms << " ms hashing on every comparison, and "
+            << memoized_ms << " ms with memoized hashes";
+}
+
+
 // TODO(ekasper): KAT tests.
 TYPED_TEST(TreeSignerTest, Sign) {
   LoggedCertificate logged_cert;
@@ -287,6 +349,36 @@ TYPED_TEST(TreeSignerTest, SignEmpty) {
 }
 
 
+TYPED_TEST(TreeSignerTest, WritesLeafHashes) {
+  LoggedCertificate logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->AddSequencedEntry(&logged_cert, 0);
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+
+  // Entries already in the tree are written out on start up.
+  TmpStorage tmp;
+  const string path(tmp.TmpStorageDir() + "/leaf_hashes");
+  LeafHashFile leaf_hashes(path);
+  unique_ptr<TS> signer2(this->GetSimilar(&leaf_hashes));
+  EXPECT_EQ(1, leaf_hashes.size());
+
+  LoggedCertificate logged_cert2;
+  this->test_signer_.CreateUnique(&logged_cert2);
+  this->AddSequencedEntry(&logged_cert2, 1);
+  EXPECT_EQ(TS::OK, signer2->UpdateTree());
+  const SignedTreeHead sth(signer2->LatestSTH());
+  ASSERT_EQ(2U, sth.tree_size());
+
+  // By the time the STH is out, a replica can serve it.
+  MappedLeafHashFile mapped(path);
+  ASSERT_TRUE(mapped.Refresh());
+  ASSERT_EQ(2, mapped.size());
+  LeafHashTree tree(new Sha256Hasher);
+  tree.Update(mapped.data(), mapped.size());
+  EXPECT_EQ(sth.sha256_root_hash(), tree.RootAtSnapshot(2));
+}
+
+
 TYPED_TEST(TreeSignerTest, SequenceNewEntriesCleansUpOldSequenceMappings) {
   LoggedCertificate logged_cert;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -327,6 +419,64 @@ TYPED_TEST(TreeSignerTest, SequenceNewEntriesCleansUpOldSequenceMappings) {
 }
 
 
+TYPED_TEST(TreeSignerTest, SequencingPolicyLimitsEntriesPerPass) {
+  const FairSequencingPolicy policy(1, map<string, double>());
+  TS tree_signer(std::chrono::duration<double>(0), this->db(),
+                 unique_ptr<CompactMerkleTree>(
+                     new CompactMerkleTree(new Sha256Hasher)),
+                 this->store_.get(), TestSigner::DefaultLogSigner(), nullptr,
+                 &policy);
+
+  for (int i = 0; i < 3; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->AddPendingEntry(&logged_cert);
+  }
+
+  for (int i = 1; i <= 3; ++i) {
+    EXPECT_EQ(Status::OK, tree_signer.SequenceNewEntries());
+    EntryHandle<SequenceMapping> mapping;
+    CHECK_EQ(Status::OK, this->store_->GetSequenceMapping(&mapping));
+    EXPECT_EQ(i, mapping.Entry().mapping_size());
+  }
+}
+
+
+TYPED_TEST(TreeSignerTest, SequencingPolicyAlwaysSequencesOverdueEntries) {
+  const FairSequencingPolicy policy(1, map<string, double>(), 1,
+                                    std::chrono::hours(1));
+  TS tree_signer(std::chrono::duration<double>(0), this->db(),
+                 unique_ptr<CompactMerkleTree>(
+                     new CompactMerkleTree(new Sha256Hasher)),
+                 this->store_.get(), TestSigner::DefaultLogSigner(), nullptr,
+                 &policy);
+
+  const uint64_t two_hours_ago(util::TimeInMilliseconds() - 2 * 3600 * 1000);
+  for (int i = 0; i < 3; ++i) {
+    LoggedCertificate logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    logged_cert.mutable_sct()->set_timestamp(two_hours_ago + i);
+    this->AddPendingEntry(&logged_cert);
+  }
+  LoggedCertificate recent_cert;
+  this->test_signer_.CreateUnique(&recent_cert);
+  this->AddPendingEntry(&recent_cert);
+
+  // The overdue entries go in despite the budget, and use it up.
+  EXPECT_EQ(Status::OK, tree_signer.SequenceNewEntries());
+  EntryHandle<SequenceMapping> mapping;
+  CHECK_EQ(Status::OK, this->store_->GetSequenceMapping(&mapping));
+  EXPECT_EQ(3, mapping.Entry().mapping_size());
+  for (const auto& m : mapping.Entry().mapping()) {
+    EXPECT_NE(recent_cert.Hash(), m.entry_hash());
+  }
+
+  EXPECT_EQ(Status::OK, tree_signer.SequenceNewEntries());
+  CHECK_EQ(Status::OK, this->store_->GetSequenceMapping(&mapping));
+  EXPECT_EQ(4, mapping.Entry().mapping_size());
+}
+
+
 }  // namespace cert_trans
 
 
@@ -10,6 +10,15 @@
 using cert_trans::MerkleTreeInterface;
 using std::string;
 
+namespace {
+
+const MerkleTree& Evaluated(MerkleTree* model) {
+  model->CurrentRoot();
+  return *model;
+}
+
+}  // namespace
+
 CompactMerkleTree::CompactMerkleTree(SerialHasher* hasher)
     : MerkleTreeInterface(),
       treehasher_(hasher),
@@ -20,6 +29,11 @@ CompactMerkleTree::CompactMerkleTree(SerialHasher* hasher)
 }
 
 CompactMerkleTree::CompactMerkleTree(MerkleTree& model, SerialHasher* hasher)
+    : CompactMerkleTree(Evaluated(&model), hasher) {
+}
+
+CompactMerkleTree::CompactMerkleTree(const MerkleTree& model,
+                                     SerialHasher* hasher)
     : MerkleTreeInterface(),
       tree_(std::max(0L, int64_t(model.LevelCount()) - 1)),
       treehasher_(hasher),
@@ -30,6 +30,9 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // (non-compact) MerkleTree |model|.
   // Takes ownership of |hasher|.
   CompactMerkleTree(MerkleTree& model, SerialHasher* hasher);
+  // As above, but |model| must be fully evaluated already (see
+  // MerkleTree::CurrentRoot()), as it will not be modified.
+  CompactMerkleTree(const MerkleTree& model, SerialHasher* hasher);
 
   virtual ~CompactMerkleTree();
 
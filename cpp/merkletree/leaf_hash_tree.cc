@@ -0,0 +1,256 @@
+#include "merkletree/leaf_hash_tree.h"
+
+#include <algorithm>
+#include <glog/logging.h>
+#include <iterator>
+#include <string.h>
+
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+// The largest power of two smaller than |size|, which must be at
+// least 2.
+int64_t SplitPoint(int64_t size) {
+  int64_t retval(1);
+  while ((retval << 1) < size) {
+    retval <<= 1;
+  }
+  return retval;
+}
+
+
+uint64_t HashPrefix(const char* hash) {
+  uint64_t retval(0);
+  for (int i = 0; i < 8; ++i) {
+    retval = (retval << 8) | static_cast<uint8_t>(hash[i]);
+  }
+  return retval;
+}
+
+
+}  // namespace
+
+const int LeafHashTree::kMinCachedLevel;
+
+
+LeafHashTree::LeafHashTree(SerialHasher* hasher)
+    : LeafHashTree(new TreeHasher(hasher)) {
+}
+
+
+LeafHashTree::LeafHashTree(TreeHasher* treehasher)
+    : treehasher_(treehasher), leaves_(nullptr), leaf_count_(0) {
+  CHECK_GE(NodeSize(), sizeof(uint64_t));
+}
+
+
+void LeafHashTree::Update(const char* hashes, int64_t count) {
+  CHECK_GE(count, leaf_count_);
+  CHECK(hashes || count == 0);
+
+  const vector<pair<uint64_t, int64_t>> added(
+      IndexLeaves(hashes, leaf_count_, count));
+  const size_t old_index_size(index_.size());
+  index_.insert(index_.end(), added.begin(), added.end());
+  std::inplace_merge(index_.begin(), index_.begin() + old_index_size,
+                     index_.end());
+
+  SetLeaves(hashes, count);
+}
+
+
+unique_ptr<LeafHashTree> LeafHashTree::Extend(const char* hashes,
+                                              int64_t count) const {
+  CHECK_GE(count, leaf_count_);
+  CHECK(hashes || count == 0);
+  unique_ptr<LeafHashTree> retval(new LeafHashTree(treehasher_->Clone()));
+
+  const vector<pair<uint64_t, int64_t>> added(
+      IndexLeaves(hashes, leaf_count_, count));
+  retval->index_.reserve(index_.size() + added.size());
+  std::merge(index_.begin(), index_.end(), added.begin(), added.end(),
+             std::back_inserter(retval->index_));
+
+  retval->levels_ = levels_;
+  retval->SetLeaves(hashes, count);
+
+  return retval;
+}
+
+
+bool LeafHashTree::IsPrefixOf(const char* hashes, int64_t count) const {
+  if (count < leaf_count_) {
+    return false;
+  }
+  return leaf_count_ == 0 ||
+         memcmp(hashes + (leaf_count_ - 1) * NodeSize(), last_leaf_.data(),
+                NodeSize()) == 0;
+}
+
+
+vector<pair<uint64_t, int64_t>> LeafHashTree::IndexLeaves(
+    const char* hashes, int64_t start, int64_t count) const {
+  vector<pair<uint64_t, int64_t>> retval;
+  retval.reserve(count - start);
+  for (int64_t i = start; i < count; ++i) {
+    retval.emplace_back(HashPrefix(hashes + i * NodeSize()), i);
+  }
+  std::sort(retval.begin(), retval.end());
+  return retval;
+}
+
+
+void LeafHashTree::SetLeaves(const char* hashes, int64_t count) {
+  leaves_ = hashes;
+  leaf_count_ = count;
+  if (count > 0) {
+    last_leaf_ = Leaf(count - 1);
+  }
+
+  for (size_t level = 0;; ++level) {
+    const int64_t size(int64_t(1) << (kMinCachedLevel + level));
+    const int64_t num_nodes(count / size);
+    if (num_nodes == 0) {
+      break;
+    }
+    if (levels_.size() <= level) {
+      levels_.emplace_back();
+    }
+    for (int64_t i = levels_[level].size() / NodeSize(); i < num_nodes; ++i) {
+      if (level == 0) {
+        levels_[level].append(SubtreeHash(i * size, size));
+      } else {
+        const string& below(levels_[level - 1]);
+        levels_[level].append(treehasher_->HashChildren(
+            below.substr(2 * i * NodeSize(), NodeSize()),
+            below.substr((2 * i + 1) * NodeSize(), NodeSize())));
+      }
+    }
+  }
+}
+
+
+int64_t LeafHashTree::GetIndex(const string& hash) const {
+  if (hash.size() != NodeSize()) {
+    return -1;
+  }
+
+  const uint64_t prefix(HashPrefix(hash.data()));
+  for (auto it(std::lower_bound(index_.begin(), index_.end(),
+                                pair<uint64_t, int64_t>(prefix, 0)));
+       it != index_.end() && it->first == prefix; ++it) {
+    if (memcmp(leaves_ + it->second * NodeSize(), hash.data(), NodeSize()) ==
+        0) {
+      return it->second;
+    }
+  }
+
+  return -1;
+}
+
+
+string LeafHashTree::RootAtSnapshot(int64_t snapshot) const {
+  if (snapshot == 0) {
+    return treehasher_->HashEmpty();
+  }
+  if (snapshot < 0 || snapshot > leaf_count_) {
+    return string();
+  }
+  return SubtreeHash(0, snapshot);
+}
+
+
+vector<string> LeafHashTree::PathToRootAtSnapshot(int64_t leaf,
+                                                  int64_t snapshot) const {
+  vector<string> path;
+  if (leaf <= 0 || leaf > snapshot || snapshot > leaf_count_) {
+    return path;
+  }
+  Path(leaf - 1, 0, snapshot, &path);
+  return path;
+}
+
+
+vector<string> LeafHashTree::SnapshotConsistency(int64_t snapshot1,
+                                                 int64_t snapshot2) const {
+  vector<string> proof;
+  if (snapshot1 <= 0 || snapshot1 >= snapshot2 || snapshot2 > leaf_count_) {
+    return proof;
+  }
+  SubProof(snapshot1, 0, snapshot2, true, &proof);
+  return proof;
+}
+
+
+string LeafHashTree::Leaf(int64_t index) const {
+  return string(leaves_ + index * NodeSize(), NodeSize());
+}
+
+
+string LeafHashTree::SubtreeHash(int64_t start, int64_t size) const {
+  DCHECK_GT(size, 0);
+  if (size == 1) {
+    return Leaf(start);
+  }
+
+  // Complete subtrees might have been cached by Update().
+  if ((size & (size - 1)) == 0 && start % size == 0 &&
+      size >= (int64_t(1) << kMinCachedLevel)) {
+    const size_t level(__builtin_ctzll(size) - kMinCachedLevel);
+    const size_t index(start / size);
+    if (level < levels_.size() &&
+        index < levels_[level].size() / NodeSize()) {
+      return levels_[level].substr(index * NodeSize(), NodeSize());
+    }
+  }
+
+  const int64_t split(SplitPoint(size));
+  return treehasher_->HashChildren(SubtreeHash(start, split),
+                                  SubtreeHash(start + split, size - split));
+}
+
+
+void LeafHashTree::Path(int64_t leaf, int64_t start, int64_t size,
+                        vector<string>* path) const {
+  if (size == 1) {
+    return;
+  }
+
+  const int64_t split(SplitPoint(size));
+  if (leaf < split) {
+    Path(leaf, start, split, path);
+    path->emplace_back(SubtreeHash(start + split, size - split));
+  } else {
+    Path(leaf - split, start + split, size - split, path);
+    path->emplace_back(SubtreeHash(start, split));
+  }
+}
+
+
+void LeafHashTree::SubProof(int64_t snapshot1, int64_t start, int64_t size,
+                            bool complete, vector<string>* proof) const {
+  if (snapshot1 == size) {
+    if (!complete) {
+      proof->emplace_back(SubtreeHash(start, size));
+    }
+    return;
+  }
+
+  const int64_t split(SplitPoint(size));
+  if (snapshot1 <= split) {
+    SubProof(snapshot1, start, split, complete, proof);
+    proof->emplace_back(SubtreeHash(start + split, size - split));
+  } else {
+    SubProof(snapshot1 - split, start + split, size - split, false, proof);
+    proof->emplace_back(SubtreeHash(start, split));
+  }
+}
+
+
+}  // namespace cert_trans
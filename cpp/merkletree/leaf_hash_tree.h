@@ -0,0 +1,112 @@
+#ifndef CERT_TRANS_MERKLETREE_LEAF_HASH_TREE_H_
+#define CERT_TRANS_MERKLETREE_LEAF_HASH_TREE_H_
+
+#include <stddef.h>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "merkletree/tree_hasher.h"
+
+class SerialHasher;
+
+namespace cert_trans {
+
+
+// A Merkle Hash Tree over leaf hashes owned by someone else (usually a
+// MappedLeafHashFile), which can answer the same queries as MerkleTree
+// but without copying every leaf into its own storage.
+//
+// Only the roots of the complete subtrees of at least 2^kMinCachedLevel
+// leaves are kept, everything else is recomputed from the leaves on
+// demand, so that the tree takes a small fraction of the memory of the
+// leaves themselves.
+//
+// This class is thread-compatible: the const methods (including
+// Extend()) can be called concurrently, but not while Update() is
+// running.
+class LeafHashTree {
+ public:
+  // Takes ownership of the hasher.
+  explicit LeafHashTree(SerialHasher* hasher);
+
+  size_t NodeSize() const {
+    return treehasher_->DigestSize();
+  }
+
+  int64_t LeafCount() const {
+    return leaf_count_;
+  }
+
+  // Use the |count| leaf hashes at |hashes| (|count| * NodeSize()
+  // bytes), which must start with the leaves previously passed in. The
+  // hashes must remain valid until the next call to Update().
+  void Update(const char* hashes, int64_t count);
+
+  // Returns a new tree, as if Update(hashes, count) had been called on
+  // a copy of this one. This tree is left unchanged, so it can keep
+  // answering queries while the new one is built.
+  std::unique_ptr<LeafHashTree> Extend(const char* hashes,
+                                       int64_t count) const;
+
+  // Whether the |count| leaf hashes at |hashes| still start with the
+  // leaves of this tree. Only the last leaf is compared, against a
+  // copy of it, as the leaves might have been rewritten in place.
+  bool IsPrefixOf(const char* hashes, int64_t count) const;
+
+  // Returns the index (starting from 0) of the leaf with hash |hash|,
+  // or -1 if there is none.
+  int64_t GetIndex(const std::string& hash) const;
+
+  // The following have the same semantics as the MerkleTree methods of
+  // the same name (leaves are indexed starting from 1, and invalid
+  // arguments result in empty return values).
+  std::string RootAtSnapshot(int64_t snapshot) const;
+  std::vector<std::string> PathToRootAtSnapshot(int64_t leaf,
+                                                int64_t snapshot) const;
+  std::vector<std::string> SnapshotConsistency(int64_t snapshot1,
+                                               int64_t snapshot2) const;
+
+ private:
+  static const int kMinCachedLevel = 8;
+
+  // Takes ownership of |treehasher|.
+  explicit LeafHashTree(TreeHasher* treehasher);
+
+  // The sorted (leaf hash prefix, leaf index) pairs of the leaves from
+  // |start| to |count| of |hashes|.
+  std::vector<std::pair<uint64_t, int64_t>> IndexLeaves(
+      const char* hashes, int64_t start, int64_t count) const;
+  // Points to the |count| leaf hashes at |hashes|, and caches the
+  // complete subtrees that were not already in |levels_|.
+  void SetLeaves(const char* hashes, int64_t count);
+  std::string Leaf(int64_t index) const;
+  // The root of the |size| leaves starting at |start|.
+  std::string SubtreeHash(int64_t start, int64_t size) const;
+  // The PATH and SUBPROOF functions of RFC 6962, section 2.1.
+  void Path(int64_t leaf, int64_t start, int64_t size,
+            std::vector<std::string>* path) const;
+  void SubProof(int64_t snapshot1, int64_t start, int64_t size,
+                bool complete, std::vector<std::string>* proof) const;
+
+  const std::unique_ptr<TreeHasher> treehasher_;
+  const char* leaves_;
+  int64_t leaf_count_;
+  // A copy of the last leaf, for IsPrefixOf().
+  std::string last_leaf_;
+  // levels_[i] has the roots of the complete, aligned subtrees of
+  // 2^(kMinCachedLevel + i) leaves, concatenated.
+  std::vector<std::string> levels_;
+  // Pairs of (leaf hash prefix, leaf index), sorted.
+  std::vector<std::pair<uint64_t, int64_t>> index_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafHashTree);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_LEAF_HASH_TREE_H_
@@ -0,0 +1,161 @@
+#include "merkletree/leaf_hash_tree.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::to_string;
+using std::vector;
+
+// Large enough to have a few levels of cached subtrees.
+const int kNumLeaves = 1100;
+
+
+class LeafHashTreeTest : public ::testing::Test {
+ protected:
+  LeafHashTreeTest()
+      : reference_(new Sha256Hasher), tree_(new Sha256Hasher) {
+    for (int i = 0; i < kNumLeaves; ++i) {
+      reference_.AddLeaf("leaf " + to_string(i));
+      hashes_.append(reference_.LeafHash(i + 1));
+    }
+  }
+
+  MerkleTree reference_;
+  LeafHashTree tree_;
+  string hashes_;
+};
+
+
+TEST_F(LeafHashTreeTest, Empty) {
+  tree_.Update(nullptr, 0);
+  EXPECT_EQ(0, tree_.LeafCount());
+  EXPECT_EQ(reference_.RootAtSnapshot(0), tree_.RootAtSnapshot(0));
+  EXPECT_EQ("", tree_.RootAtSnapshot(1));
+  EXPECT_EQ(-1, tree_.GetIndex(reference_.LeafHash(1)));
+}
+
+
+TEST_F(LeafHashTreeTest, MatchesMerkleTree) {
+  // Grow the tree in uneven steps, checking everything in between.
+  for (int count = 1; count <= kNumLeaves; count += 1 + count / 3) {
+    tree_.Update(hashes_.data(), count);
+    ASSERT_EQ(count, tree_.LeafCount());
+
+    // |reference_| has all the leaves, so it only gives the expected
+    // results for snapshots up to |count|.
+    for (int snapshot = 0; snapshot <= count; ++snapshot) {
+      EXPECT_EQ(reference_.RootAtSnapshot(snapshot),
+                tree_.RootAtSnapshot(snapshot))
+          << snapshot;
+    }
+    EXPECT_EQ("", tree_.RootAtSnapshot(count + 1));
+
+    for (int leaf = 0; leaf <= count + 1; leaf += 1 + leaf / 2) {
+      EXPECT_EQ(reference_.PathToRootAtSnapshot(leaf, count),
+                tree_.PathToRootAtSnapshot(leaf, count))
+          << leaf << " " << count;
+      EXPECT_EQ(reference_.PathToRootAtSnapshot(leaf, (leaf + count) / 2),
+                tree_.PathToRootAtSnapshot(leaf, (leaf + count) / 2))
+          << leaf << " " << count;
+      EXPECT_TRUE(tree_.PathToRootAtSnapshot(leaf, count + 1).empty());
+    }
+
+    for (int snapshot1 = 0; snapshot1 <= count; snapshot1 += 1 + snapshot1) {
+      EXPECT_EQ(reference_.SnapshotConsistency(snapshot1, count),
+                tree_.SnapshotConsistency(snapshot1, count))
+          << snapshot1 << " " << count;
+      EXPECT_EQ(reference_.SnapshotConsistency(count, snapshot1),
+                tree_.SnapshotConsistency(count, snapshot1))
+          << snapshot1 << " " << count;
+      EXPECT_TRUE(tree_.SnapshotConsistency(snapshot1, count + 1).empty());
+    }
+  }
+}
+
+
+TEST_F(LeafHashTreeTest, FollowsMovingLeaves) {
+  tree_.Update(hashes_.data(), 600);
+  const string root(tree_.RootAtSnapshot(600));
+
+  // As happens when a file is mapped again after growing.
+  const string copy(hashes_);
+  tree_.Update(copy.data(), kNumLeaves);
+  EXPECT_EQ(root, tree_.RootAtSnapshot(600));
+  EXPECT_EQ(reference_.RootAtSnapshot(kNumLeaves),
+            tree_.RootAtSnapshot(kNumLeaves));
+  EXPECT_EQ(kNumLeaves - 1,
+            tree_.GetIndex(reference_.LeafHash(kNumLeaves)));
+}
+
+
+TEST_F(LeafHashTreeTest, Extend) {
+  tree_.Update(hashes_.data(), 600);
+  const string copy(hashes_);
+  const std::unique_ptr<LeafHashTree> extended(
+      tree_.Extend(copy.data(), kNumLeaves));
+
+  // The original is unchanged.
+  EXPECT_EQ(600, tree_.LeafCount());
+  EXPECT_EQ(-1, tree_.GetIndex(reference_.LeafHash(kNumLeaves)));
+
+  EXPECT_EQ(kNumLeaves, extended->LeafCount());
+  for (int count = 1; count <= kNumLeaves; count += 99) {
+    EXPECT_EQ(reference_.RootAtSnapshot(count),
+              extended->RootAtSnapshot(count));
+  }
+  for (int i = 0; i < kNumLeaves; ++i) {
+    EXPECT_EQ(i, extended->GetIndex(reference_.LeafHash(i + 1)));
+  }
+}
+
+
+TEST_F(LeafHashTreeTest, IsPrefixOf) {
+  EXPECT_TRUE(tree_.IsPrefixOf(nullptr, 0));
+  tree_.Update(hashes_.data(), 600);
+  EXPECT_TRUE(tree_.IsPrefixOf(hashes_.data(), 600));
+  EXPECT_TRUE(tree_.IsPrefixOf(hashes_.data(), kNumLeaves));
+  EXPECT_FALSE(tree_.IsPrefixOf(hashes_.data(), 599));
+
+  // The leaves are rewritten in place.
+  string rewritten(hashes_);
+  rewritten[599 * tree_.NodeSize()] ^= 1;
+  EXPECT_FALSE(tree_.IsPrefixOf(rewritten.data(), kNumLeaves));
+}
+
+
+TEST_F(LeafHashTreeTest, GetIndex) {
+  tree_.Update(hashes_.data(), 500);
+  tree_.Update(hashes_.data(), kNumLeaves);
+  for (int i = 0; i < kNumLeaves; ++i) {
+    EXPECT_EQ(i, tree_.GetIndex(reference_.LeafHash(i + 1)));
+  }
+
+  EXPECT_EQ(-1, tree_.GetIndex(reference_.LeafHash("not a leaf")));
+  EXPECT_EQ(-1, tree_.GetIndex(""));
+
+  // Same prefix as a leaf, but not the same hash.
+  string almost(reference_.LeafHash(1));
+  almost[almost.size() - 1] ^= 1;
+  EXPECT_EQ(-1, tree_.GetIndex(almost));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,14 +1,27 @@
 #include "merkletree/merkle_tree.h"
 
+#include <algorithm>
 #include <glog/logging.h>
+#include <memory>
 #include <stddef.h>
+#include <string.h>
 #include <string>
 #include <vector>
 
 #include "merkletree/merkle_tree_math.h"
+#include "util/parallel.h"
 
 using cert_trans::MerkleTreeInterface;
 using std::string;
+using std::unique_ptr;
+
+namespace {
+
+// Number of parent nodes hashed by each task of Evaluate(). Levels
+// with fewer new nodes than this are hashed in the calling thread.
+const size_t kParentsPerTask = 1 << 14;
+
+}  // namespace
 
 MerkleTree::MerkleTree(SerialHasher* hasher)
     : MerkleTreeInterface(),
@@ -41,19 +54,31 @@ size_t MerkleTree::AddLeafHash(const string& hash) {
   return leaf_count;
 }
 
+void MerkleTree::Evaluate(util::Executor* executor) {
+  if (LeafCount() > leaves_processed_)
+    UpdateToSnapshot(LeafCount(), executor);
+}
+
 string MerkleTree::CurrentRoot() {
   return RootAtSnapshot(LeafCount());
 }
 
+string MerkleTree::CurrentRoot() const {
+  return RootAtSnapshot(LeafCount());
+}
+
 string MerkleTree::RootAtSnapshot(size_t snapshot) {
+  EvaluateToSnapshot(snapshot);
+  return static_cast<const MerkleTree*>(this)->RootAtSnapshot(snapshot);
+}
+
+string MerkleTree::RootAtSnapshot(size_t snapshot) const {
   if (snapshot == 0)
     return treehasher_.HashEmpty();
-  size_t leaf_count = LeafCount();
-  if (snapshot > leaf_count)
+  if (snapshot > leaves_processed_)
     return string();
-  if (snapshot >= leaves_processed_)
-    return UpdateToSnapshot(snapshot);
-  // snapshot < leaves_processed_: recompute the snapshot root.
+  if (snapshot == 1)
+    return Node(0, 0);
   return RecomputePastSnapshot(snapshot, 0, NULL);
 }
 
@@ -61,20 +86,85 @@ std::vector<string> MerkleTree::PathToCurrentRoot(size_t leaf) {
   return PathToRootAtSnapshot(leaf, LeafCount());
 }
 
+std::vector<string> MerkleTree::PathToCurrentRoot(size_t leaf) const {
+  return PathToRootAtSnapshot(leaf, LeafCount());
+}
+
 std::vector<string> MerkleTree::PathToRootAtSnapshot(size_t leaf,
                                                      size_t snapshot) {
+  EvaluateToSnapshot(snapshot);
+  return static_cast<const MerkleTree*>(this)->PathToRootAtSnapshot(leaf,
+                                                                    snapshot);
+}
+
+std::vector<string> MerkleTree::PathToRootAtSnapshot(size_t leaf,
+                                                     size_t snapshot) const {
   std::vector<string> path;
-  size_t leaf_count = LeafCount();
-  if (leaf > snapshot || snapshot > leaf_count || leaf == 0)
+  if (leaf > snapshot || snapshot > leaves_processed_ || leaf == 0)
     return path;
   return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot);
 }
 
+std::vector<std::vector<string>> MerkleTree::PathsToRootAtSnapshot(
+    const std::vector<size_t>& leaves, size_t snapshot) {
+  EvaluateToSnapshot(snapshot);
+  return static_cast<const MerkleTree*>(this)->PathsToRootAtSnapshot(leaves,
+                                                                     snapshot);
+}
+
+std::vector<std::vector<string>> MerkleTree::PathsToRootAtSnapshot(
+    const std::vector<size_t>& leaves, size_t snapshot) const {
+  std::vector<std::vector<string>> paths(leaves.size());
+  if (snapshot > leaves_processed_)
+    return paths;
+
+  const std::vector<string> last_nodes(LastNodesAtSnapshot(snapshot));
+  for (size_t i = 0; i < leaves.size(); ++i) {
+    if (leaves[i] > snapshot || leaves[i] == 0)
+      continue;
+    paths[i] =
+        PathFromNodeToRootAtSnapshot(leaves[i] - 1, 0, snapshot, &last_nodes);
+  }
+  return paths;
+}
+
+std::vector<string> MerkleTree::RangeProof(size_t first, size_t last,
+                                           size_t snapshot) {
+  EvaluateToSnapshot(snapshot);
+  return static_cast<const MerkleTree*>(this)->RangeProof(first, last,
+                                                          snapshot);
+}
+
+std::vector<string> MerkleTree::RangeProof(size_t first, size_t last,
+                                           size_t snapshot) const {
+  std::vector<string> proof;
+  if (first == 0 || first > last || last > snapshot ||
+      snapshot > leaves_processed_)
+    return proof;
+
+  // The root is the only node at the first level that can hold all the
+  // leaves of the snapshot.
+  size_t level = 0;
+  while ((static_cast<size_t>(1) << level) < snapshot)
+    ++level;
+
+  RangeProofFromNode(0, level, first - 1, last - 1, snapshot,
+                     LastNodesAtSnapshot(snapshot), &proof);
+  return proof;
+}
+
 std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
                                                     size_t snapshot2) {
+  EvaluateToSnapshot(snapshot2);
+  return static_cast<const MerkleTree*>(this)->SnapshotConsistency(snapshot1,
+                                                                   snapshot2);
+}
+
+std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
+                                                    size_t snapshot2) const {
   std::vector<string> proof;
-  size_t leaf_count = LeafCount();
-  if (snapshot1 == 0 || snapshot1 >= snapshot2 || snapshot2 > leaf_count)
+  if (snapshot1 == 0 || snapshot1 >= snapshot2 ||
+      snapshot2 > leaves_processed_)
     return proof;
 
   size_t level = 0;
@@ -87,11 +177,6 @@ std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
     ++level;
   }
 
-  if (snapshot2 > leaves_processed_) {
-    // Bring the tree sufficiently up to date.
-    UpdateToSnapshot(snapshot2);
-  }
-
   // Record the node, unless we already reached the root of snapshot1.
   if (node)
     proof.push_back(Node(level, node));
@@ -103,7 +188,13 @@ std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
   return proof;
 }
 
-string MerkleTree::UpdateToSnapshot(size_t snapshot) {
+void MerkleTree::EvaluateToSnapshot(size_t snapshot) {
+  if (snapshot > leaves_processed_ && snapshot <= LeafCount())
+    UpdateToSnapshot(snapshot);
+}
+
+string MerkleTree::UpdateToSnapshot(size_t snapshot,
+                                    util::Executor* executor) {
   if (snapshot == 0)
     return treehasher_.HashEmpty();
   if (snapshot == 1)
@@ -134,10 +225,9 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
 
     // Compute the parents of new nodes at the current level.
     // Start with a left sibling and parse an even number of nodes.
-    for (size_t j = first_node & ~1; j < last_node; j += 2) {
-      PushBack(level + 1,
-               treehasher_.HashChildren(Node(level, j), Node(level, j + 1)));
-    }
+    const size_t first_sibling = first_node & ~1;
+    PushBackParents(level, first_sibling, (last_node - first_sibling + 1) / 2,
+                    executor);
     // If the last node at the current level is a left sibling,
     // dummy-propagate it one level up.
     if (!MerkleTreeMath::IsRightChild(last_node))
@@ -153,7 +243,7 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
 }
 
 string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
-                                         string* node) {
+                                         string* node) const {
   size_t level = 0;
   // Index of the rightmost node at the current level for this snapshot.
   size_t last_node = snapshot - 1;
@@ -207,22 +297,18 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
   return subtree_root;
 }
 
-std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
-                                                             size_t level,
-                                                             size_t snapshot) {
+std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(
+    size_t node, size_t level, size_t snapshot,
+    const std::vector<string>* last_nodes) const {
   std::vector<string> path;
   if (snapshot == 0)
     return path;
   // Index of the last node.
   size_t last_node = (snapshot - 1) >> level;
-  if (level >= level_count_ || node > last_node || snapshot > LeafCount())
+  if (level >= level_count_ || node > last_node ||
+      snapshot > leaves_processed_)
     return path;
 
-  if (snapshot > leaves_processed_) {
-    // Bring the tree sufficiently up to date.
-    UpdateToSnapshot(snapshot);
-  }
-
   // Move up, recording the sibling of the current node at each level.
   while (last_node) {
     size_t sibling = MerkleTreeMath::Sibling(node);
@@ -233,9 +319,13 @@ std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
     } else if (sibling == last_node) {
       // The sibling is the last node of the level in the snapshot tree,
       // so we get its value for the snapshot. Get the root in the same pass.
-      string recompute_node;
-      RecomputePastSnapshot(snapshot, level, &recompute_node);
-      path.push_back(recompute_node);
+      if (last_nodes) {
+        path.push_back(last_nodes->at(level));
+      } else {
+        string recompute_node;
+        RecomputePastSnapshot(snapshot, level, &recompute_node);
+        path.push_back(recompute_node);
+      }
     }
     // Else sibling > last_node so the sibling does not exist. Do nothing.
     // Continue moving up in the tree, ignoring dummy copies.
@@ -248,6 +338,53 @@ std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
   return path;
 }
 
+std::vector<string> MerkleTree::LastNodesAtSnapshot(size_t snapshot) const {
+  std::vector<string> nodes;
+  if (snapshot == 0)
+    return nodes;
+  for (size_t level = 0, last_node = snapshot - 1; last_node;
+       ++level, last_node = MerkleTreeMath::Parent(last_node)) {
+    nodes.emplace_back();
+    RecomputePastSnapshot(snapshot, level, &nodes.back());
+  }
+  return nodes;
+}
+
+void MerkleTree::RangeProofFromNode(size_t node, size_t level, size_t first,
+                                    size_t last, size_t snapshot,
+                                    const std::vector<string>& last_nodes,
+                                    std::vector<string>* proof) const {
+  // The leaves below this node in the snapshot tree are [begin, end).
+  const size_t begin = node << level;
+  const size_t end = std::min((node + 1) << level, snapshot);
+
+  if (end <= first || begin > last) {
+    // None of the leaves of the range are below this node. If it is
+    // not complete, it is the last node of its level in the snapshot
+    // tree, which we have to get the value of for the snapshot.
+    if (end - begin == static_cast<size_t>(1) << level) {
+      proof->push_back(Node(level, node));
+    } else {
+      proof->push_back(last_nodes[level]);
+    }
+    return;
+  }
+
+  if (first <= begin && end - 1 <= last) {
+    // All the leaves below this node are in the range.
+    return;
+  }
+
+  // Otherwise, this cannot be a leaf. Its right child does not exist
+  // if the left one is the last node of its level in the snapshot tree,
+  // in which case this is a dummy copy of the left one.
+  RangeProofFromNode(2 * node, level - 1, first, last, snapshot, last_nodes,
+                     proof);
+  if (((2 * node + 1) << (level - 1)) < snapshot)
+    RangeProofFromNode(2 * node + 1, level - 1, first, last, snapshot,
+                       last_nodes, proof);
+}
+
 string MerkleTree::Node(size_t level, size_t index) const {
   CHECK_GT(NodeCount(level), index);
   return tree_[level].substr(index * treehasher_.DigestSize(),
@@ -280,6 +417,42 @@ void MerkleTree::PushBack(size_t level, string node) {
   tree_[level].append(node);
 }
 
+void MerkleTree::PushBackParents(size_t level, size_t first, size_t count,
+                                 util::Executor* executor) {
+  CHECK_GT(LazyLevelCount(), level + 1);
+  CHECK_GE(NodeCount(level), first + 2 * count);
+  if (!executor || count < kParentsPerTask) {
+    for (size_t i = 0; i < count; ++i) {
+      PushBack(level + 1,
+               treehasher_.HashChildren(Node(level, first + 2 * i),
+                                        Node(level, first + 2 * i + 1)));
+    }
+    return;
+  }
+
+  // Make room for all the parents first, so that they can be written
+  // concurrently without moving the level around.
+  const size_t digest_size = treehasher_.DigestSize();
+  string* const parents = &tree_[level + 1];
+  const size_t offset = parents->size();
+  parents->resize(offset + count * digest_size);
+
+  util::ParallelFor(executor, count, kParentsPerTask,
+                    [this, level, first, parents, offset,
+                     digest_size](size_t begin, size_t end) {
+                      const unique_ptr<TreeHasher> hasher(
+                          treehasher_.Clone());
+                      for (size_t i = begin; i < end; ++i) {
+                        const string parent(hasher->HashChildren(
+                            Node(level, first + 2 * i),
+                            Node(level, first + 2 * i + 1)));
+                        CHECK_EQ(digest_size, parent.size());
+                        memcpy(&(*parents)[offset + i * digest_size],
+                               parent.data(), digest_size);
+                      }
+                    });
+}
+
 void MerkleTree::AddLevel() {
   tree_.push_back(string());
 }
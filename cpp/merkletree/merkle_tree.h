@@ -11,6 +11,10 @@
 
 class SerialHasher;
 
+namespace util {
+class Executor;
+}  // namespace util
+
 // Class for manipulating Merkle Hash Trees, as specified in the
 // Certificate Transparency specificationdoc/sunlight.xml
 // Implement binary Merkle Hash Trees, using an arbitrary hash function
@@ -19,7 +23,8 @@ class SerialHasher;
 // does domain separation for leaves and nodes, and thus ensures collision
 // resistance.
 //
-// This class is thread-compatible, but not thread-safe.
+// This class is thread-compatible, but not thread-safe. See below for
+// the const query methods, which can be used concurrently.
 class MerkleTree : public cert_trans::MerkleTreeInterface {
  public:
   // The constructor takes a pointer to some concrete hash function
@@ -80,6 +85,21 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param hash leaf hash
   virtual size_t AddLeafHash(const std::string& hash);
 
+  // Evaluate the tree up to its current root, like the non-const query
+  // methods below do when needed, but hash the new nodes of each level
+  // concurrently on |executor|. This is only worth it after adding a
+  // large number of leaves, e.g. when loading the tree on startup.
+  // Must not be called from one of the threads of |executor|.
+  void Evaluate(util::Executor* executor);
+
+  // The query methods below come in two flavours. The non-const ones
+  // first bring the lazily evaluated tree up to date as far as needed,
+  // so they see every leaf added so far. The const ones never modify
+  // the tree, and only see the leaves that were evaluated by an
+  // earlier non-const call (e.g. CurrentRoot()): any other leaf is
+  // treated as being in the future. Multiple threads may call the const
+  // methods concurrently, as long as no thread calls a non-const one.
+
   // Get the current root of the tree.
   // Update the root to reflect the current shape of the tree,
   // and return the tree digest.
@@ -87,6 +107,7 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // Returns the hash of an empty string if the tree has no leaves
   // (and hence, no root).
   virtual std::string CurrentRoot();
+  std::string CurrentRoot() const;
 
   // Get the root of the tree for a previous snapshot,
   // where snapshot 0 is an empty tree, snapshot 1 is the tree with
@@ -97,6 +118,7 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   //
   // @param snapshot point in time (= number of leaves at that point).
   std::string RootAtSnapshot(size_t snapshot);
+  std::string RootAtSnapshot(size_t snapshot) const;
 
   // Get the Merkle path from leaf to root.
   //
@@ -108,6 +130,7 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   //
   // @param leaf the index of the leaf the path is for.
   std::vector<std::string> PathToCurrentRoot(size_t leaf);
+  std::vector<std::string> PathToCurrentRoot(size_t leaf) const;
 
   // Get the Merkle path from leaf to the root of a previous snapshot.
   //
@@ -120,6 +143,37 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param leaf the index of the leaf the path is for.
   // @param snapshot point in time (= number of leaves at that point)
   std::vector<std::string> PathToRootAtSnapshot(size_t leaf, size_t snapshot);
+  std::vector<std::string> PathToRootAtSnapshot(size_t leaf,
+                                                size_t snapshot) const;
+
+  // Get the Merkle paths from several leaves to the root of a previous
+  // snapshot, in the same order as |leaves|. This is equivalent to
+  // calling PathToRootAtSnapshot() for each of them, but the nodes on
+  // the right edge of the snapshot tree, which may have to be
+  // recomputed, are only computed once.
+  //
+  // @param leaves the indices of the leaves the paths are for.
+  // @param snapshot point in time (= number of leaves at that point)
+  std::vector<std::vector<std::string>> PathsToRootAtSnapshot(
+      const std::vector<size_t>& leaves, size_t snapshot);
+  std::vector<std::vector<std::string>> PathsToRootAtSnapshot(
+      const std::vector<size_t>& leaves, size_t snapshot) const;
+
+  // Get the proof that a range of consecutive leaves is in a previous
+  // snapshot: the roots of the largest subtrees that do not contain
+  // any of these leaves, ordered left to right. See
+  // MerkleVerifier::RootFromRangeProof() for how they combine with the
+  // leaves. Returns an empty vector if the range is empty or starts at
+  // leaf 0, or the snapshot requested is in the future or not large
+  // enough.
+  //
+  // @param first the index of the first leaf in the range.
+  // @param last the index of the last leaf in the range.
+  // @param snapshot point in time (= number of leaves at that point)
+  std::vector<std::string> RangeProof(size_t first, size_t last,
+                                      size_t snapshot);
+  std::vector<std::string> RangeProof(size_t first, size_t last,
+                                      size_t snapshot) const;
 
   // Get the Merkle consistency proof between two snapshots.
   // Returns a vector of node hashes, ordered according to levels.
@@ -130,20 +184,38 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param snapshot2 the second point in time
   std::vector<std::string> SnapshotConsistency(size_t snapshot1,
                                                size_t snapshot2);
+  std::vector<std::string> SnapshotConsistency(size_t snapshot1,
+                                               size_t snapshot2) const;
 
  private:
-  // Update to a given snapshot, return the root.
-  std::string UpdateToSnapshot(size_t snapshot);
+  // Update to a given snapshot, return the root. If |executor| is not
+  // NULL, large levels are hashed on it.
+  std::string UpdateToSnapshot(size_t snapshot,
+                               util::Executor* executor = NULL);
+  // Update to a given snapshot, if it is not in the future and has
+  // not been evaluated yet.
+  void EvaluateToSnapshot(size_t snapshot);
   // Return the root of a past snapshot.
   // If node is not NULL, additionally record the rightmost node
   // for the given snapshot and node_level.
   std::string RecomputePastSnapshot(size_t snapshot, size_t node_level,
-                                    std::string* node);
+                                    std::string* node) const;
   // Path from a node at a given level (both indexed starting with 0)
-  // to the root at a given snapshot.
-  std::vector<std::string> PathFromNodeToRootAtSnapshot(size_t node_index,
-                                                        size_t level,
-                                                        size_t snapshot);
+  // to the root at a given snapshot. If |last_nodes| is not NULL, it
+  // holds the last node of each level of the snapshot tree, as
+  // returned by LastNodesAtSnapshot(), which are otherwise recomputed.
+  std::vector<std::string> PathFromNodeToRootAtSnapshot(
+      size_t node_index, size_t level, size_t snapshot,
+      const std::vector<std::string>* last_nodes = NULL) const;
+  // The last node of each level of the snapshot tree, up to (but
+  // excluding) the root.
+  std::vector<std::string> LastNodesAtSnapshot(size_t snapshot) const;
+  // Append to |proof| the range proof for the leaves |first| to |last|
+  // (indexed starting with 0) below the node at a given level.
+  void RangeProofFromNode(size_t node_index, size_t level, size_t first,
+                          size_t last, size_t snapshot,
+                          const std::vector<std::string>& last_nodes,
+                          std::vector<std::string>* proof) const;
   // Get the |index|-th node at level |level|. Indexing starts at 0;
   // caller is responsible for ensuring tree is sufficiently up to date.
   std::string Node(size_t level, size_t index) const;
@@ -165,6 +237,11 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // Append a node to the level.
   void PushBack(size_t level, std::string node);
 
+  // Append the parents of |count| pairs of siblings of the level,
+  // starting with the left sibling |first|, to the level above it.
+  void PushBackParents(size_t level, size_t first, size_t count,
+                       util::Executor* executor);
+
   // Start a new level.
   void AddLevel();
 
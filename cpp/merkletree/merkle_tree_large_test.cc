@@ -1,9 +1,13 @@
+#include <algorithm>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string>
 #include <sys/resource.h>
+#include <thread>
 #include <vector>
 
 #include "merkletree/merkle_tree.h"
@@ -11,9 +15,15 @@
 #include "util/testing.h"
 #include "util/util.h"
 
+DEFINE_int32(proof_tree_size, 1 << 20,
+             "Number of leaves in the tree used by ConcurrentProofs.");
+DEFINE_int32(proofs_per_thread, 100000,
+             "Number of proofs each thread fetches in ConcurrentProofs.");
+
 namespace {
 
 using std::string;
+using std::thread;
 
 class MerkleTreeLargeTest : public ::testing::Test {
  protected:
@@ -58,6 +68,52 @@ TEST_F(MerkleTreeLargeTest, BuildLargeTree) {
   }
 }
 
+TEST_F(MerkleTreeLargeTest, ConcurrentProofs) {
+  MerkleTree tree(new Sha256Hasher());
+  for (int i = 0; i < FLAGS_proof_tree_size; ++i)
+    tree.AddLeaf(std::to_string(i));
+  tree.CurrentRoot();
+  const MerkleTree& const_tree(tree);
+
+  // Audit paths to random leaves in random snapshots, half of them
+  // being for the latest snapshot, which is the common case.
+  const auto fetch_proofs = [&const_tree](unsigned seed, size_t* nodes) {
+    for (int i = 0; i < FLAGS_proofs_per_thread; ++i) {
+      const size_t snapshot(i % 2 ? const_tree.LeafCount()
+                                  : rand_r(&seed) % const_tree.LeafCount() +
+                                        1);
+      const size_t leaf(rand_r(&seed) % snapshot + 1);
+      *nodes += const_tree.PathToRootAtSnapshot(leaf, snapshot).size();
+    }
+  };
+
+  int original_log_level = FLAGS_minloglevel;
+  for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+    std::vector<size_t> nodes(num_threads, 0);
+    std::vector<thread> threads;
+    const uint64_t time_before = util::TimeInMilliseconds();
+    // All threads fetch the same proofs, so that we can check they got
+    // the same results.
+    for (int i = 0; i < num_threads; ++i)
+      threads.emplace_back(fetch_proofs, 42, &nodes[i]);
+    for (auto& t : threads)
+      t.join();
+    const uint64_t time_after = util::TimeInMilliseconds();
+
+    for (int i = 1; i < num_threads; ++i)
+      EXPECT_EQ(nodes[0], nodes[i]);
+
+    FLAGS_minloglevel = 0;
+    LOG(INFO) << num_threads << " thread(s) fetched "
+              << num_threads * FLAGS_proofs_per_thread << " proofs in "
+              << time_after - time_before << " ms ("
+              << num_threads * FLAGS_proofs_per_thread * 1000 /
+                     std::max<uint64_t>(time_after - time_before, 1)
+              << " proofs/s)";
+    FLAGS_minloglevel = original_log_level;
+  }
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
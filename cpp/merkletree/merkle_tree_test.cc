@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <stddef.h>
@@ -13,6 +14,7 @@
 #include "merkletree/serial_hasher.h"
 #include "merkletree/tree_hasher.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 namespace {
@@ -213,6 +215,33 @@ TEST_F(MerkleTreeFuzzTest, PathFuzz) {
   }
 }
 
+// Make random batches of path queries and check against the reference
+// implementation.
+TEST_F(MerkleTreeFuzzTest, PathsFuzz) {
+  for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+    MerkleTree tree(new Sha256Hasher());
+    for (size_t j = 0; j < tree_size; ++j)
+      tree.AddLeaf(data_[j]);
+
+    for (size_t j = 0; j < 8; ++j) {
+      // A snapshot in the range 0... length.
+      const size_t snapshot = rand() % (tree_size + 1);
+      // Leaves in the range 0... snapshot + 1, so that some are invalid.
+      std::vector<size_t> leaves;
+      for (size_t k = 0; k < 4; ++k)
+        leaves.push_back(rand() % (snapshot + 2));
+      const std::vector<std::vector<string>> paths(
+          tree.PathsToRootAtSnapshot(leaves, snapshot));
+      ASSERT_EQ(leaves.size(), paths.size());
+      for (size_t k = 0; k < leaves.size(); ++k) {
+        EXPECT_EQ(ReferenceMerklePath(data_.data(), snapshot, leaves[k],
+                                      &tree_hasher_),
+                  paths[k]);
+      }
+    }
+  }
+}
+
 // Make random proof queries and check against the reference implementation.
 TEST_F(MerkleTreeFuzzTest, ConsistencyFuzz) {
   for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
@@ -577,6 +606,73 @@ TEST_F(MerkleTreeTest, AddLeafHash) {
   EXPECT_EQ(kHashValue, tree.LeafHash(index));
 }
 
+// The const queries only see the evaluated part of the tree.
+TEST_F(MerkleTreeTest, ConstQueries) {
+  MerkleTree tree(new Sha256Hasher());
+  const MerkleTree& const_tree(tree);
+  for (size_t i = 0; i < 8; ++i)
+    tree.AddLeaf(data_[i]);
+  tree.RootAtSnapshot(5);
+  for (size_t i = 8; i < 13; ++i)
+    tree.AddLeaf(data_[i]);
+
+  for (size_t snapshot = 0; snapshot <= 5; ++snapshot) {
+    EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), snapshot, &tree_hasher_),
+              const_tree.RootAtSnapshot(snapshot));
+    for (size_t leaf = 0; leaf <= snapshot; ++leaf) {
+      EXPECT_EQ(ReferenceMerklePath(data_.data(), snapshot, leaf,
+                                    &tree_hasher_),
+                const_tree.PathToRootAtSnapshot(leaf, snapshot));
+    }
+    for (size_t snapshot1 = 0; snapshot1 <= snapshot; ++snapshot1) {
+      EXPECT_EQ(ReferenceSnapshotConsistency(data_.data(), snapshot,
+                                             snapshot1, &tree_hasher_, true),
+                const_tree.SnapshotConsistency(snapshot1, snapshot));
+    }
+  }
+  EXPECT_TRUE(const_tree.RootAtSnapshot(6).empty());
+  EXPECT_TRUE(const_tree.PathToRootAtSnapshot(1, 6).empty());
+  EXPECT_TRUE(const_tree.SnapshotConsistency(1, 6).empty());
+  EXPECT_TRUE(const_tree.CurrentRoot().empty());
+
+  EXPECT_EQ(ReferenceMerkleTreeHash(data_.data(), 13, &tree_hasher_),
+            tree.CurrentRoot());
+  EXPECT_EQ(tree.CurrentRoot(), const_tree.CurrentRoot());
+  EXPECT_EQ(ReferenceMerklePath(data_.data(), 13, 6, &tree_hasher_),
+            const_tree.PathToCurrentRoot(6));
+}
+
+TEST_F(MerkleTreeTest, EvaluateInParallel) {
+  cert_trans::ThreadPool pool(4);
+  MerkleTree serial_tree(new Sha256Hasher());
+  MerkleTree parallel_tree(new Sha256Hasher());
+  const MerkleTree& const_tree(parallel_tree);
+
+  // Large enough for the lower levels to be split between tasks, and
+  // the second batch of leaves updates the last node of each level.
+  size_t leaves = 0;
+  for (size_t batch : {70001, 40000}) {
+    for (size_t i = 0; i < batch; ++i, ++leaves) {
+      const string hash(Sha256Hasher::Sha256Digest(std::to_string(leaves)));
+      serial_tree.AddLeafHash(hash);
+      parallel_tree.AddLeafHash(hash);
+    }
+    parallel_tree.Evaluate(&pool);
+
+    EXPECT_EQ(serial_tree.CurrentRoot(), const_tree.CurrentRoot());
+    for (size_t snapshot : {1, 2, 70000, 70001, 80123}) {
+      if (snapshot > leaves)
+        continue;
+      EXPECT_EQ(serial_tree.RootAtSnapshot(snapshot),
+                const_tree.RootAtSnapshot(snapshot));
+    }
+    for (size_t leaf : {1, 40000, 65537, 70001}) {
+      EXPECT_EQ(serial_tree.PathToCurrentRoot(leaf),
+                const_tree.PathToCurrentRoot(leaf));
+    }
+  }
+}
+
 TEST_F(CompactMerkleTreeTest, TestCloneEmptyTreeProducesWorkingTree) {
   MerkleTree tree(new Sha256Hasher);
   CompactMerkleTree compact(tree, new Sha256Hasher);
@@ -779,6 +875,68 @@ TEST_F(MerkleVerifierTest, VerifyPath) {
   }
 }
 
+// Generate range proofs for random ranges, and check that they verify
+// against the reference root, and that tampering with them does not.
+TEST_F(MerkleVerifierTest, VerifyRangeProofFuzz) {
+  srand(time(NULL));
+  for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+    MerkleTree tree(new Sha256Hasher());
+    for (size_t j = 0; j < tree_size; ++j)
+      tree.AddLeaf(data_[j]);
+
+    for (size_t j = 0; j < 8; ++j) {
+      // A snapshot in the range 1... length.
+      const size_t snapshot = rand() % tree_size + 1;
+      // A range in the range 1... snapshot.
+      const size_t first = rand() % snapshot + 1;
+      const size_t last = first + rand() % (snapshot - first + 1);
+      const std::vector<string> range(data_.begin() + first - 1,
+                                      data_.begin() + last);
+      const string root(
+          ReferenceMerkleTreeHash(data_.data(), snapshot, &tree_hasher_));
+
+      const std::vector<string> proof(tree.RangeProof(first, last, snapshot));
+      EXPECT_EQ(H(root), H(verifier_.RootFromRangeProof(first, snapshot,
+                                                        range, proof)));
+      EXPECT_TRUE(
+          verifier_.VerifyRangeProof(first, snapshot, range, proof, root));
+
+      // Proofs for single leaves are audit paths, in a different order.
+      if (first == last) {
+        std::vector<string> path(tree.PathToRootAtSnapshot(first, snapshot));
+        std::sort(path.begin(), path.end());
+        std::vector<string> sorted_proof(proof);
+        std::sort(sorted_proof.begin(), sorted_proof.end());
+        EXPECT_EQ(path, sorted_proof);
+      }
+
+      if (first > 1) {
+        EXPECT_FALSE(verifier_.VerifyRangeProof(first - 1, snapshot, range,
+                                                proof, root));
+      }
+      EXPECT_FALSE(
+          verifier_.VerifyRangeProof(first, snapshot * 2, range, proof, root));
+
+      std::vector<string> wrong_proof;
+      for (size_t k = 0; k < proof.size(); ++k) {
+        wrong_proof = proof;
+        wrong_proof[k] = S(kSHA256EmptyTreeHash);
+        EXPECT_FALSE(verifier_.VerifyRangeProof(first, snapshot, range,
+                                                wrong_proof, root));
+      }
+      wrong_proof = proof;
+      wrong_proof.push_back(root);
+      EXPECT_FALSE(verifier_.VerifyRangeProof(first, snapshot, range,
+                                              wrong_proof, root));
+
+      std::vector<string> wrong_range(range);
+      wrong_range.back() = data_[(last + 1) % data_.size()];
+      EXPECT_FALSE(verifier_.VerifyRangeProof(first, snapshot, wrong_range,
+                                              proof, root));
+    }
+  }
+}
+
 TEST_F(MerkleVerifierTest, VerifyConsistencyProof) {
   std::vector<string> proof;
   string root1, root2;
@@ -1,5 +1,6 @@
 #include "merkletree/merkle_verifier.h"
 
+#include <algorithm>
 #include <stddef.h>
 #include <vector>
 
@@ -62,6 +63,79 @@ string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
   return node_hash;
 }
 
+string MerkleVerifier::RootFromRangeProof(
+    size_t first, size_t tree_size, const std::vector<string>& data,
+    const std::vector<string>& proof) {
+  if (first == 0 || data.empty() || first - 1 + data.size() > tree_size)
+    // No valid proof exists.
+    return string();
+
+  size_t level = 0;
+  while ((static_cast<size_t>(1) << level) < tree_size)
+    ++level;
+
+  string root;
+  std::vector<string>::const_iterator it = proof.begin();
+  if (!NodeFromRangeProof(0, level, first - 1, tree_size, data, &it,
+                          proof.end(), &root))
+    return string();
+
+  // Check that we've reached the end.
+  if (it != proof.end())
+    return string();
+  return root;
+}
+
+bool MerkleVerifier::VerifyRangeProof(size_t first, size_t tree_size,
+                                      const std::vector<string>& data,
+                                      const std::vector<string>& proof,
+                                      const string& root) {
+  string proof_root = RootFromRangeProof(first, tree_size, data, proof);
+  if (proof_root.empty())
+    return false;
+  return proof_root == root;
+}
+
+bool MerkleVerifier::NodeFromRangeProof(
+    size_t node, size_t level, size_t first, size_t tree_size,
+    const std::vector<string>& data,
+    std::vector<string>::const_iterator* proof_it,
+    std::vector<string>::const_iterator proof_end, string* value) {
+  // The leaves below this node are [begin, end).
+  const size_t begin = node << level;
+  const size_t end = std::min((node + 1) << level, tree_size);
+
+  if (end <= first || begin >= first + data.size()) {
+    // None of the leaves of the range are below this node.
+    if (*proof_it == proof_end)
+      return false;
+    *value = *(*proof_it)++;
+    return true;
+  }
+
+  if (level == 0) {
+    *value = LeafHash(data[begin - first]);
+    return true;
+  }
+
+  string left;
+  if (!NodeFromRangeProof(2 * node, level - 1, first, tree_size, data,
+                          proof_it, proof_end, &left))
+    return false;
+  if (((2 * node + 1) << (level - 1)) >= tree_size) {
+    // The right child does not exist and this is a dummy copy.
+    value->swap(left);
+    return true;
+  }
+
+  string right;
+  if (!NodeFromRangeProof(2 * node + 1, level - 1, first, tree_size, data,
+                          proof_it, proof_end, &right))
+    return false;
+  *value = treehasher_.HashChildren(left, right);
+  return true;
+}
+
 bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
                                        const string& root1,
                                        const string& root2,
@@ -43,6 +43,26 @@ class MerkleVerifier {
                            const std::vector<std::string>& path,
                            const std::string& data);
 
+  // Compute the root corresponding to a range proof, as returned by
+  // MerkleTree::RangeProof(). Returns an empty string if the proof is
+  // not valid.
+  //
+  // @param first index of the first leaf in the range.
+  // @param tree_size number of leaves in the tree.
+  // @param data the leaf data of each leaf in the range, in order.
+  // @param proof the roots of the largest subtrees that do not contain
+  // any leaf of the range, ordered left to right.
+  std::string RootFromRangeProof(size_t first, size_t tree_size,
+                                 const std::vector<std::string>& data,
+                                 const std::vector<std::string>& proof);
+
+  // Verify a range proof. Return true iff the range is not empty, and
+  // |proof| and |data| together yield |root|.
+  bool VerifyRangeProof(size_t first, size_t tree_size,
+                        const std::vector<std::string>& data,
+                        const std::vector<std::string>& proof,
+                        const std::string& root);
+
   bool VerifyConsistency(size_t snapshot1, size_t snapshot2,
                          const std::string& root1, const std::string& root2,
                          const std::vector<std::string>& proof);
@@ -51,6 +71,16 @@ class MerkleVerifier {
   std::string LeafHash(const std::string& data);
 
  private:
+  // Compute the value of the node at a given level (both indexed
+  // starting with 0) for RootFromRangeProof(), consuming the proof
+  // nodes it needs. Returns false if there are not enough of them.
+  bool NodeFromRangeProof(size_t node, size_t level, size_t first,
+                          size_t tree_size,
+                          const std::vector<std::string>& data,
+                          std::vector<std::string>::const_iterator* proof_it,
+                          std::vector<std::string>::const_iterator proof_end,
+                          std::string* value);
+
   TreeHasher treehasher_;
 };
 
@@ -4,9 +4,11 @@
 
 #include "merkletree/serial_hasher.h"
 
-using std::lock_guard;
 using std::mutex;
 using std::string;
+using std::try_to_lock;
+using std::unique_lock;
+using std::unique_ptr;
 
 namespace {
 
@@ -18,6 +20,22 @@ std::string EmptyHash(SerialHasher* hasher) {
   return hasher->Final();
 }
 
+string HashLeafWith(SerialHasher* hasher, const string& data) {
+  hasher->Reset();
+  hasher->Update(string(1, kLeafPrefix));
+  hasher->Update(data);
+  return hasher->Final();
+}
+
+string HashChildrenWith(SerialHasher* hasher, const string& left_child,
+                        const string& right_child) {
+  hasher->Reset();
+  hasher->Update(string(1, kNodePrefix));
+  hasher->Update(left_child);
+  hasher->Update(right_child);
+  return hasher->Final();
+}
+
 }  // namespace
 
 TreeHasher::TreeHasher(SerialHasher* hasher)
@@ -25,19 +43,26 @@ TreeHasher::TreeHasher(SerialHasher* hasher)
 }
 
 string TreeHasher::HashLeaf(const string& data) const {
-  lock_guard<mutex> lock(lock_);
-  hasher_->Reset();
-  hasher_->Update(string(1, kLeafPrefix));
-  hasher_->Update(data);
-  return hasher_->Final();
+  unique_lock<mutex> lock(lock_, try_to_lock);
+  if (!lock.owns_lock()) {
+    // Creating a hasher is cheaper than waiting for another thread,
+    // when there are several readers hashing concurrently.
+    const unique_ptr<SerialHasher> hasher(hasher_->Create());
+    return HashLeafWith(hasher.get(), data);
+  }
+  return HashLeafWith(hasher_.get(), data);
 }
 
 string TreeHasher::HashChildren(const string& left_child,
                                 const string& right_child) const {
-  lock_guard<mutex> lock(lock_);
-  hasher_->Reset();
-  hasher_->Update(string(1, kNodePrefix));
-  hasher_->Update(left_child);
-  hasher_->Update(right_child);
-  return hasher_->Final();
+  unique_lock<mutex> lock(lock_, try_to_lock);
+  if (!lock.owns_lock()) {
+    const unique_ptr<SerialHasher> hasher(hasher_->Create());
+    return HashChildrenWith(hasher.get(), left_child, right_child);
+  }
+  return HashChildrenWith(hasher_.get(), left_child, right_child);
+}
+
+TreeHasher* TreeHasher::Clone() const {
+  return new TreeHasher(hasher_->Create());
 }
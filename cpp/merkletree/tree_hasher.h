@@ -30,6 +30,11 @@ class TreeHasher {
   std::string HashChildren(const std::string& left_child,
                            const std::string& right_child) const;
 
+  // Returns a new TreeHasher using the same hash function, for a
+  // thread doing a lot of hashing, which would otherwise contend with
+  // the other users of this one. The caller takes ownership.
+  TreeHasher* Clone() const;
+
  private:
   mutable std::mutex lock_;
   const std::unique_ptr<SerialHasher> hasher_;
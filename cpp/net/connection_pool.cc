@@ -3,66 +3,134 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "monitoring/monitoring.h"
+
 using std::bind;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::lock_guard;
 using std::move;
 using std::mutex;
 using std::pair;
 using std::string;
+using std::unique_ptr;
+using std::vector;
 
 DEFINE_int32(url_fetcher_max_conn_per_host_port, 4,
              "maximum number of URL fetcher connections per host:port");
+DEFINE_int32(url_fetcher_idle_timeout_seconds, 30,
+             "idle URL fetcher connections that have not been used for this "
+             "long are closed rather than reused");
 
 namespace cert_trans {
 namespace internal {
+namespace {
+
+
+static Counter<string>* connection_pool_events(Counter<string>::New(
+    "url_fetcher_connection_pool_events", "event",
+    "Number of URL fetcher connection pool events, by type (created, "
+    "reused, evicted_error, evicted_idle, evicted_overflow)."));
+
+
+}  // namespace
+
+
+ConnectionPool::Connection::Connection(evhttp_connection_unique_ptr&& conn,
+                                       const HostPortPair& other_end)
+    : conn_(move(conn)), other_end_(other_end), num_requests_(0) {
+}
+
 
 ConnectionPool::ConnectionPool(libevent::Base* base)
     : base_(CHECK_NOTNULL(base)), cleanup_scheduled_(false) {
 }
 
 
-evhttp_connection_unique_ptr ConnectionPool::Get(const URL& url) {
+unique_ptr<ConnectionPool::Connection> ConnectionPool::Get(const URL& url) {
   // TODO(pphaneuf): Add support for other protocols.
   CHECK_EQ(url.Protocol(), "http");
   const HostPortPair key(url.Host(), url.Port() != 0 ? url.Port() : 80);
   lock_guard<mutex> lock(lock_);
 
   auto it(conns_.find(key));
+  if (it != conns_.end() && !it->second.empty() &&
+      steady_clock::now() - it->second.back()->last_used_ >
+          seconds(FLAGS_url_fetcher_idle_timeout_seconds)) {
+    // The connections are in LIFO order, so if the warmest one has
+    // been idle for too long, so have all the others.
+    EvictLocked(key, "evicted_idle");
+  }
+
   if (it == conns_.end() || it->second.empty()) {
     VLOG(1) << "new evhttp_connection for " << key.first << ":" << key.second;
-    return evhttp_connection_unique_ptr(
-        base_->HttpConnectionNew(key.first, key.second));
+    connection_pool_events->Increment("created");
+    return unique_ptr<Connection>(
+        new Connection(evhttp_connection_unique_ptr(
+                           base_->HttpConnectionNew(key.first, key.second)),
+                       key));
   }
 
   VLOG(1) << "cached evhttp_connection for " << key.first << ":" << key.second;
-  evhttp_connection_unique_ptr retval(move(it->second.back()));
+  connection_pool_events->Increment("reused");
+  unique_ptr<Connection> retval(move(it->second.back()));
   it->second.pop_back();
 
   return retval;
 }
 
 
-void ConnectionPool::Put(evhttp_connection_unique_ptr&& conn) {
+void ConnectionPool::Put(unique_ptr<Connection>&& conn, bool healthy) {
   if (!conn) {
     VLOG(1) << "returned null evhttp_connection";
     return;
   }
 
-  char* host;
-  uint16_t port;
-  evhttp_connection_get_peer(conn.get(), &host, &port);
-  const HostPortPair key(host, port);
+  const HostPortPair key(conn->other_end_);
+  VLOG(1) << "returned " << (healthy ? "healthy" : "broken")
+          << " evhttp_connection for " << key.first << ":" << key.second;
+  conn->last_used_ = steady_clock::now();
+  ++conn->num_requests_;
 
-  VLOG(1) << "returned evhttp_connection for " << key.first << ":"
-          << key.second;
   lock_guard<mutex> lock(lock_);
-  auto& entry(conns_[key]);
+  if (!healthy) {
+    connection_pool_events->Increment("evicted_error");
+    evicted_.emplace_back(move(conn));
+    EvictLocked(key, "evicted_error");
+    ScheduleCleanupLocked();
+    return;
+  }
 
+  auto& entry(conns_[key]);
   CHECK_GE(FLAGS_url_fetcher_max_conn_per_host_port, 0);
   entry.emplace_back(move(conn));
-  if (!cleanup_scheduled_ &&
-      entry.size() >
-          static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port)) {
+  if (entry.size() >
+      static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port)) {
+    ScheduleCleanupLocked();
+  }
+}
+
+
+void ConnectionPool::EvictLocked(const HostPortPair& key,
+                                 const string& reason) {
+  auto it(conns_.find(key));
+  if (it == conns_.end() || it->second.empty()) {
+    return;
+  }
+
+  VLOG(1) << "evicting " << it->second.size() << " idle connection(s) to "
+          << key.first << ":" << key.second << " (" << reason << ")";
+  connection_pool_events->IncrementBy(reason, it->second.size());
+  for (auto& conn : it->second) {
+    evicted_.emplace_back(move(conn));
+  }
+  it->second.clear();
+  ScheduleCleanupLocked();
+}
+
+
+void ConnectionPool::ScheduleCleanupLocked() {
+  if (!cleanup_scheduled_) {
     cleanup_scheduled_ = true;
     base_->Add(bind(&ConnectionPool::Cleanup, this));
   }
@@ -70,17 +138,23 @@ void ConnectionPool::Put(evhttp_connection_unique_ptr&& conn) {
 
 
 void ConnectionPool::Cleanup() {
-  lock_guard<mutex> lock(lock_);
-  cleanup_scheduled_ = false;
-
-  // std::map<HostPortPair, std::deque<evhttp_connection_unique_ptr>> conns_;
-  for (auto& entry : conns_) {
-    while (entry.second.size() >
-           static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port)) {
-      entry.second.pop_front();
+  vector<unique_ptr<Connection>> evicted;
+  {
+    lock_guard<mutex> lock(lock_);
+    cleanup_scheduled_ = false;
+    evicted.swap(evicted_);
+
+    for (auto& entry : conns_) {
+      while (entry.second.size() >
+             static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port)) {
+        connection_pool_events->Increment("evicted_overflow");
+        evicted.emplace_back(move(entry.second.front()));
+        entry.second.pop_front();
+      }
     }
   }
 
+  // The evicted connections get freed here, outside of the lock.
 }
 
 
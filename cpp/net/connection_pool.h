@@ -1,12 +1,14 @@
 #ifndef CERT_TRANS_NET_CONNECTION_POOL_H_
 #define CERT_TRANS_NET_CONNECTION_POOL_H_
 
+#include <chrono>
 #include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "net/url.h"
@@ -29,22 +31,68 @@ typedef std::unique_ptr<evhttp_connection, evhttp_connection_deleter>
 
 class ConnectionPool {
  public:
+  typedef std::pair<std::string, uint16_t> HostPortPair;
+
+  class Connection {
+   public:
+    evhttp_connection* connection() const {
+      return conn_.get();
+    }
+
+    const HostPortPair& other_end() const {
+      return other_end_;
+    }
+
+    // Whether this connection was used for a previous request (and is
+    // thus likely to be already connected).
+    bool reused() const {
+      return num_requests_ > 0;
+    }
+
+   private:
+    friend class ConnectionPool;
+
+    Connection(evhttp_connection_unique_ptr&& conn,
+               const HostPortPair& other_end);
+
+    const evhttp_connection_unique_ptr conn_;
+    const HostPortPair other_end_;
+    std::chrono::steady_clock::time_point last_used_;
+    int64_t num_requests_;
+
+    DISALLOW_COPY_AND_ASSIGN(Connection);
+  };
+
   ConnectionPool(libevent::Base* base);
 
-  evhttp_connection_unique_ptr Get(const URL& url);
-  void Put(evhttp_connection_unique_ptr&& conn);
+  // Returns the most recently used idle connection to the host:port
+  // of |url|, or a new one if there are none that are still warm.
+  std::unique_ptr<Connection> Get(const URL& url);
 
- private:
-  typedef std::pair<std::string, uint16_t> HostPortPair;
+  // Returns a connection to the pool. If |healthy| is false (the
+  // request failed at the connection level), the connection is
+  // dropped, along with the other idle connections to the same peer,
+  // which likely suffer from the same problem.
+  void Put(std::unique_ptr<Connection>&& conn, bool healthy);
 
+ private:
+  // Moves the idle connections to |key| out of the pool, to be freed
+  // by the next Cleanup().
+  void EvictLocked(const HostPortPair& key, const std::string& reason);
+  void ScheduleCleanupLocked();
   void Cleanup();
 
   libevent::Base* const base_;
 
   std::mutex lock_;
   // We get and put connections from the back of the deque, and when
-  // there are too many, we prune them from the front (LIFO).
-  std::map<HostPortPair, std::deque<evhttp_connection_unique_ptr>> conns_;
+  // there are too many, we prune them from the front (LIFO). This
+  // means that the front has the coldest connections, and the back
+  // the warmest.
+  std::map<HostPortPair, std::deque<std::unique_ptr<Connection>>> conns_;
+  // Evicted connections are freed from the event loop, since we might
+  // be called from within a callback of the connection itself.
+  std::vector<std::unique_ptr<Connection>> evicted_;
   bool cleanup_scheduled_;
 
   DISALLOW_COPY_AND_ASSIGN(ConnectionPool);
@@ -0,0 +1,111 @@
+#include "net/connection_pool.h"
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+
+#include "util/libevent_wrapper.h"
+#include "util/testing.h"
+
+DECLARE_int32(url_fetcher_max_conn_per_host_port);
+DECLARE_int32(url_fetcher_idle_timeout_seconds);
+
+namespace cert_trans {
+namespace internal {
+
+using std::move;
+using std::unique_ptr;
+
+const char kUrl[] = "http://example.com:8080/foo";
+
+
+class ConnectionPoolTest : public ::testing::Test {
+ protected:
+  ConnectionPoolTest() : pool_(&base_) {
+    FLAGS_url_fetcher_max_conn_per_host_port = 4;
+    FLAGS_url_fetcher_idle_timeout_seconds = 30;
+  }
+
+  libevent::Base base_;
+  ConnectionPool pool_;
+};
+
+
+TEST_F(ConnectionPoolTest, NewConnection) {
+  unique_ptr<ConnectionPool::Connection> conn(pool_.Get(URL(kUrl)));
+  ASSERT_TRUE(conn);
+  EXPECT_FALSE(conn->reused());
+  EXPECT_EQ("example.com", conn->other_end().first);
+  EXPECT_EQ(8080, conn->other_end().second);
+}
+
+
+TEST_F(ConnectionPoolTest, ReusesWarmestConnection) {
+  unique_ptr<ConnectionPool::Connection> conn1(pool_.Get(URL(kUrl)));
+  unique_ptr<ConnectionPool::Connection> conn2(pool_.Get(URL(kUrl)));
+  evhttp_connection* const evconn2(conn2->connection());
+  pool_.Put(move(conn1), true);
+  pool_.Put(move(conn2), true);
+
+  unique_ptr<ConnectionPool::Connection> conn(pool_.Get(URL(kUrl)));
+  EXPECT_TRUE(conn->reused());
+  EXPECT_EQ(evconn2, conn->connection());
+}
+
+
+TEST_F(ConnectionPoolTest, DoesNotMixPeers) {
+  pool_.Put(pool_.Get(URL(kUrl)), true);
+
+  unique_ptr<ConnectionPool::Connection> conn(
+      pool_.Get(URL("http://example.com:8081/foo")));
+  EXPECT_FALSE(conn->reused());
+}
+
+
+TEST_F(ConnectionPoolTest, EvictsPeerOnError) {
+  unique_ptr<ConnectionPool::Connection> conn1(pool_.Get(URL(kUrl)));
+  unique_ptr<ConnectionPool::Connection> conn2(pool_.Get(URL(kUrl)));
+  pool_.Put(move(conn1), true);
+  pool_.Put(move(conn2), false);
+  base_.DispatchOnce();
+
+  unique_ptr<ConnectionPool::Connection> conn(pool_.Get(URL(kUrl)));
+  EXPECT_FALSE(conn->reused());
+}
+
+
+TEST_F(ConnectionPoolTest, EvictsIdleConnections) {
+  FLAGS_url_fetcher_idle_timeout_seconds = 0;
+  pool_.Put(pool_.Get(URL(kUrl)), true);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  unique_ptr<ConnectionPool::Connection> conn(pool_.Get(URL(kUrl)));
+  EXPECT_FALSE(conn->reused());
+}
+
+
+TEST_F(ConnectionPoolTest, PrunesColdestOnOverflow) {
+  FLAGS_url_fetcher_max_conn_per_host_port = 1;
+  unique_ptr<ConnectionPool::Connection> conn1(pool_.Get(URL(kUrl)));
+  unique_ptr<ConnectionPool::Connection> conn2(pool_.Get(URL(kUrl)));
+  evhttp_connection* const evconn2(conn2->connection());
+  pool_.Put(move(conn1), true);
+  pool_.Put(move(conn2), true);
+  base_.DispatchOnce();
+
+  unique_ptr<ConnectionPool::Connection> conn(pool_.Get(URL(kUrl)));
+  EXPECT_TRUE(conn->reused());
+  EXPECT_EQ(evconn2, conn->connection());
+  EXPECT_FALSE(pool_.Get(URL(kUrl))->reused());
+}
+
+
+}  // namespace internal
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
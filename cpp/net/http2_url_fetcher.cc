@@ -0,0 +1,594 @@
+#include "net/http2_url_fetcher.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <glog/logging.h>
+#include <map>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <nghttp2/nghttp2.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+#include "monitoring/monitoring.h"
+#include "util/libevent_wrapper.h"
+
+using std::bind;
+using std::function;
+using std::make_pair;
+using std::map;
+using std::move;
+using std::pair;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::Task;
+using util::TaskHold;
+
+namespace cert_trans {
+namespace {
+
+
+static Gauge<>* http2_sessions(
+    Gauge<>::New("http2_url_fetcher_sessions",
+                 "Number of open HTTP/2 URL fetcher connections."));
+static Gauge<>* http2_active_streams(
+    Gauge<>::New("http2_url_fetcher_active_streams",
+                 "Number of HTTP/2 URL fetcher requests in flight."));
+static Counter<>* http2_total_connects(
+    Counter<>::New("http2_url_fetcher_total_connects",
+                   "Number of HTTP/2 URL fetcher connections opened."));
+static Counter<>* http2_total_streams(
+    Counter<>::New("http2_url_fetcher_total_streams",
+                   "Number of HTTP/2 URL fetcher requests submitted."));
+
+
+typedef pair<string, uint16_t> HostPortPair;
+
+
+const char* VerbToMethod(UrlFetcher::Verb verb) {
+  switch (verb) {
+    case UrlFetcher::Verb::GET:
+      return "GET";
+
+    case UrlFetcher::Verb::POST:
+      return "POST";
+
+    case UrlFetcher::Verb::PUT:
+      return "PUT";
+
+    case UrlFetcher::Verb::DELETE:
+      return "DELETE";
+  }
+
+  LOG(FATAL) << "unknown UrlFetcher::Verb: " << static_cast<int>(verb);
+}
+
+
+string ToLower(const string& in) {
+  string retval(in);
+  for (auto& c : retval) {
+    c = tolower(c);
+  }
+  return retval;
+}
+
+
+// Headers which are either replaced by pseudo-headers, or forbidden
+// in HTTP/2 (RFC 7540, section 8.1.2.2).
+bool IsConnectionSpecificHeader(const string& lower_name) {
+  return lower_name == "host" || lower_name == "connection" ||
+         lower_name == "keep-alive" || lower_name == "proxy-connection" ||
+         lower_name == "transfer-encoding" || lower_name == "upgrade";
+}
+
+
+struct State {
+  State(const UrlFetcher::Request& request, UrlFetcher::Response* response,
+        Task* task)
+      : request_(request),
+        response_(CHECK_NOTNULL(response)),
+        task_(CHECK_NOTNULL(task)),
+        body_offset_(0) {
+    if (request_.url.Path().empty()) {
+      request_.url.SetPath("/");
+    }
+  }
+
+  HostPortPair Peer() const {
+    return make_pair(request_.url.Host(),
+                     request_.url.Port() != 0 ? request_.url.Port() : 80);
+  }
+
+  UrlFetcher::Request request_;
+  UrlFetcher::Response* const response_;
+  Task* const task_;
+  size_t body_offset_;
+};
+
+
+// One HTTP/2 connection to a peer, with all the streams currently
+// multiplexed over it. All the methods must be called on the libevent
+// dispatch thread.
+class Session {
+ public:
+  Session(libevent::Base* base, const HostPortPair& peer,
+          const function<void(Session*)>& on_closed);
+  ~Session();
+
+  bool closed() const {
+    return closed_;
+  }
+
+  // Starts connecting to the peer. Requests can be submitted before
+  // the connection is established, they will be sent once it is.
+  void Connect();
+
+  // Starts a new stream for |state|. If this fails, the task of
+  // |state| will have been returned.
+  void Submit(State* state);
+
+ private:
+  static void ReadCallback(bufferevent* bev, void* userdata);
+  static void WriteCallback(bufferevent* bev, void* userdata);
+  static void EventCallback(bufferevent* bev, short events, void* userdata);
+
+  static ssize_t SendCallback(nghttp2_session* session, const uint8_t* data,
+                              size_t length, int flags, void* userdata);
+  static int OnHeaderCallback(nghttp2_session* session,
+                              const nghttp2_frame* frame, const uint8_t* name,
+                              size_t namelen, const uint8_t* value,
+                              size_t valuelen, uint8_t flags, void* userdata);
+  static int OnDataChunkRecvCallback(nghttp2_session* session, uint8_t flags,
+                                     int32_t stream_id, const uint8_t* data,
+                                     size_t len, void* userdata);
+  static int OnStreamCloseCallback(nghttp2_session* session,
+                                   int32_t stream_id, uint32_t error_code,
+                                   void* userdata);
+  static ssize_t ReadBodyCallback(nghttp2_session* session, int32_t stream_id,
+                                  uint8_t* buf, size_t length,
+                                  uint32_t* data_flags,
+                                  nghttp2_data_source* source, void* userdata);
+
+  // Hands whatever nghttp2 has queued up to the bufferevent, and
+  // closes the session if nghttp2 says it is done.
+  void Flush();
+  // Fails all the streams in flight, and arranges for |on_closed_|
+  // to be called (which will normally delete us).
+  void Close(const Status& status);
+  // Returns the tasks of all the streams in flight with |status|.
+  void FailStreams(const Status& status);
+
+  libevent::Base* const base_;
+  const HostPortPair peer_;
+  const function<void(Session*)> on_closed_;
+  bufferevent* const bev_;
+  nghttp2_session* session_;
+  bool closed_;
+  map<int32_t, State*> streams_;
+
+  DISALLOW_COPY_AND_ASSIGN(Session);
+};
+
+
+Session::Session(libevent::Base* base, const HostPortPair& peer,
+                 const function<void(Session*)>& on_closed)
+    : base_(CHECK_NOTNULL(base)),
+      peer_(peer),
+      on_closed_(on_closed),
+      bev_(base_->BufferEventSocketNew(-1, BEV_OPT_CLOSE_ON_FREE)),
+      session_(nullptr),
+      closed_(false) {
+  CHECK(libevent::Base::OnEventThread());
+  nghttp2_session_callbacks* callbacks;
+  CHECK_EQ(nghttp2_session_callbacks_new(&callbacks), 0);
+  nghttp2_session_callbacks_set_send_callback(callbacks, &SendCallback);
+  nghttp2_session_callbacks_set_on_header_callback(callbacks,
+                                                   &OnHeaderCallback);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+      callbacks, &OnDataChunkRecvCallback);
+  nghttp2_session_callbacks_set_on_stream_close_callback(
+      callbacks, &OnStreamCloseCallback);
+  CHECK_EQ(nghttp2_session_client_new(&session_, callbacks, this), 0);
+  nghttp2_session_callbacks_del(callbacks);
+
+  const nghttp2_settings_entry settings[] = {
+      {NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+  };
+  CHECK_EQ(nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings,
+                                   sizeof(settings) / sizeof(settings[0])),
+           0);
+
+  bufferevent_setcb(bev_, &ReadCallback, &WriteCallback, &EventCallback,
+                    this);
+  bufferevent_enable(bev_, EV_READ | EV_WRITE);
+}
+
+
+Session::~Session() {
+  // Not Close(), as |on_closed_| would be called on a deleted session.
+  if (!closed_) {
+    closed_ = true;
+    FailStreams(Status(util::error::CANCELLED, "HTTP/2 session destroyed"));
+  }
+  nghttp2_session_del(session_);
+  bufferevent_free(bev_);
+}
+
+
+void Session::Connect() {
+  CHECK(libevent::Base::OnEventThread());
+  VLOG(1) << "new HTTP/2 connection to " << peer_.first << ":"
+          << peer_.second;
+  http2_total_connects->Increment();
+  if (bufferevent_socket_connect_hostname(bev_, base_->GetDns(), AF_UNSPEC,
+                                          peer_.first.c_str(),
+                                          peer_.second) != 0) {
+    Close(Status(util::error::UNAVAILABLE, "could not connect"));
+  }
+}
+
+
+void Session::Submit(State* state) {
+  CHECK(libevent::Base::OnEventThread());
+  if (closed_) {
+    state->task_->Return(Status(util::error::UNAVAILABLE,
+                                "HTTP/2 connection is closed"));
+    return;
+  }
+
+  const UrlFetcher::Request& req(state->request_);
+  const string method(VerbToMethod(req.verb));
+  const string authority(req.url.Port() != 0
+                             ? req.url.Host() + ":" + to_string(req.url.Port())
+                             : req.url.Host());
+  const string path(req.url.PathQuery());
+
+  // nghttp2 copies the names and values when the request is
+  // submitted, so these only have to survive this method.
+  vector<pair<string, string>> headers;
+  headers.reserve(req.headers.size() + 4);
+  headers.emplace_back(":method", method);
+  headers.emplace_back(":scheme", "http");
+  headers.emplace_back(":authority", authority);
+  headers.emplace_back(":path", path);
+  for (const auto& header : req.headers) {
+    const string name(ToLower(header.first));
+    if (!IsConnectionSpecificHeader(name)) {
+      headers.emplace_back(name, header.second);
+    }
+  }
+
+  vector<nghttp2_nv> nva;
+  nva.reserve(headers.size());
+  for (const auto& header : headers) {
+    nva.push_back(nghttp2_nv{
+        reinterpret_cast<uint8_t*>(const_cast<char*>(header.first.data())),
+        reinterpret_cast<uint8_t*>(const_cast<char*>(header.second.data())),
+        header.first.size(), header.second.size(), NGHTTP2_NV_FLAG_NONE});
+  }
+
+  nghttp2_data_provider body;
+  body.source.ptr = state;
+  body.read_callback = &ReadBodyCallback;
+
+  const int32_t stream_id(nghttp2_submit_request(
+      session_, nullptr, nva.data(), nva.size(),
+      req.body.empty() ? nullptr : &body, state));
+  if (stream_id < 0) {
+    VLOG(1) << "nghttp2_submit_request error: "
+            << nghttp2_strerror(stream_id);
+    state->task_->Return(
+        Status(util::error::INTERNAL, "nghttp2_submit_request error"));
+    return;
+  }
+
+  VLOG(1) << "HTTP/2 stream " << stream_id << " to " << peer_.first << ":"
+          << peer_.second << ": " << method << " " << path;
+  streams_.insert(make_pair(stream_id, state));
+  http2_total_streams->Increment();
+  http2_active_streams->Set(http2_active_streams->Get() + 1);
+
+  Flush();
+}
+
+
+void Session::Flush() {
+  if (closed_) {
+    return;
+  }
+
+  const int ret(nghttp2_session_send(session_));
+  if (ret != 0) {
+    VLOG(1) << "nghttp2_session_send error: " << nghttp2_strerror(ret);
+    Close(Status(util::error::INTERNAL, "HTTP/2 protocol error"));
+    return;
+  }
+
+  if (!nghttp2_session_want_read(session_) &&
+      !nghttp2_session_want_write(session_) &&
+      evbuffer_get_length(bufferevent_get_output(bev_)) == 0) {
+    Close(Status(util::error::UNAVAILABLE, "HTTP/2 connection is done"));
+  }
+}
+
+
+void Session::Close(const Status& status) {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  bufferevent_disable(bev_, EV_READ | EV_WRITE);
+
+  VLOG(1) << "closing HTTP/2 connection to " << peer_.first << ":"
+          << peer_.second << ": " << status;
+  FailStreams(status);
+
+  // We might be deep in a callback from nghttp2 or libevent, so do
+  // not let the owner delete us right away.
+  base_->Add(bind(on_closed_, this));
+}
+
+
+void Session::FailStreams(const Status& status) {
+  map<int32_t, State*> streams;
+  streams.swap(streams_);
+  http2_active_streams->Set(http2_active_streams->Get() - streams.size());
+  for (const auto& stream : streams) {
+    stream.second->task_->Return(status);
+  }
+}
+
+
+// static
+void Session::ReadCallback(bufferevent* bev, void* userdata) {
+  Session* const self(static_cast<Session*>(CHECK_NOTNULL(userdata)));
+  evbuffer* const input(bufferevent_get_input(bev));
+  const size_t length(evbuffer_get_length(input));
+  const ssize_t ret(nghttp2_session_mem_recv(self->session_,
+                                             evbuffer_pullup(input, -1),
+                                             length));
+  if (ret < 0) {
+    VLOG(1) << "nghttp2_session_mem_recv error: " << nghttp2_strerror(ret);
+    self->Close(Status(util::error::INTERNAL, "HTTP/2 protocol error"));
+    return;
+  }
+  CHECK_EQ(evbuffer_drain(input, length), 0);
+
+  self->Flush();
+}
+
+
+// static
+void Session::WriteCallback(bufferevent* bev, void* userdata) {
+  static_cast<Session*>(CHECK_NOTNULL(userdata))->Flush();
+}
+
+
+// static
+void Session::EventCallback(bufferevent* bev, short events, void* userdata) {
+  Session* const self(static_cast<Session*>(CHECK_NOTNULL(userdata)));
+
+  if (events & BEV_EVENT_CONNECTED) {
+    const int one(1);
+    setsockopt(bufferevent_getfd(bev), IPPROTO_TCP, TCP_NODELAY, &one,
+               sizeof(one));
+    VLOG(1) << "HTTP/2 connection to " << self->peer_.first << ":"
+            << self->peer_.second << " established";
+    self->Flush();
+    return;
+  }
+
+  if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT)) {
+    self->Close(Status(util::error::UNAVAILABLE,
+                       (events & BEV_EVENT_EOF)
+                           ? "HTTP/2 connection closed by peer"
+                           : "HTTP/2 connection error"));
+  }
+}
+
+
+// static
+ssize_t Session::SendCallback(nghttp2_session* session, const uint8_t* data,
+                              size_t length, int flags, void* userdata) {
+  Session* const self(static_cast<Session*>(CHECK_NOTNULL(userdata)));
+  if (bufferevent_write(self->bev_, data, length) != 0) {
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  }
+  return length;
+}
+
+
+// static
+int Session::OnHeaderCallback(nghttp2_session* session,
+                              const nghttp2_frame* frame, const uint8_t* name,
+                              size_t namelen, const uint8_t* value,
+                              size_t valuelen, uint8_t flags,
+                              void* userdata) {
+  Session* const self(static_cast<Session*>(CHECK_NOTNULL(userdata)));
+  // Trailers (a HEADERS frame after the response one) are merged into
+  // the response headers, gRPC sends its status in them.
+  if (frame->hd.type != NGHTTP2_HEADERS ||
+      (frame->headers.cat != NGHTTP2_HCAT_RESPONSE &&
+       frame->headers.cat != NGHTTP2_HCAT_HEADERS)) {
+    return 0;
+  }
+
+  const auto it(self->streams_.find(frame->hd.stream_id));
+  if (it == self->streams_.end()) {
+    return 0;
+  }
+
+  const string header_name(reinterpret_cast<const char*>(name), namelen);
+  const string header_value(reinterpret_cast<const char*>(value), valuelen);
+  if (header_name == ":status") {
+    it->second->response_->status_code = atoi(header_value.c_str());
+  } else {
+    it->second->response_->headers.insert(
+        make_pair(header_name, header_value));
+  }
+
+  return 0;
+}
+
+
+// static
+int Session::OnDataChunkRecvCallback(nghttp2_session* session, uint8_t flags,
+                                     int32_t stream_id, const uint8_t* data,
+                                     size_t len, void* userdata) {
+  Session* const self(static_cast<Session*>(CHECK_NOTNULL(userdata)));
+  const auto it(self->streams_.find(stream_id));
+  if (it != self->streams_.end()) {
+    it->second->response_->body.append(reinterpret_cast<const char*>(data),
+                                       len);
+  }
+
+  return 0;
+}
+
+
+// static
+int Session::OnStreamCloseCallback(nghttp2_session* session,
+                                   int32_t stream_id, uint32_t error_code,
+                                   void* userdata) {
+  Session* const self(static_cast<Session*>(CHECK_NOTNULL(userdata)));
+  const auto it(self->streams_.find(stream_id));
+  if (it == self->streams_.end()) {
+    return 0;
+  }
+  State* const state(it->second);
+  self->streams_.erase(it);
+  http2_active_streams->Set(http2_active_streams->Get() - 1);
+
+  if (error_code != NGHTTP2_NO_ERROR) {
+    VLOG(1) << "HTTP/2 stream " << stream_id << " reset: "
+            << nghttp2_http2_strerror(error_code);
+    state->task_->Return(
+        Status(util::error::UNAVAILABLE, "HTTP/2 stream was reset"));
+    return 0;
+  }
+
+  if (state->response_->status_code < 100) {
+    VLOG(1) << "HTTP/2 stream " << stream_id
+            << " closed without a valid status code";
+    state->task_->Return(
+        Status(util::error::INTERNAL, "response had no valid status code"));
+    return 0;
+  }
+
+  state->task_->Return();
+  return 0;
+}
+
+
+// static
+ssize_t Session::ReadBodyCallback(nghttp2_session* session, int32_t stream_id,
+                                  uint8_t* buf, size_t length,
+                                  uint32_t* data_flags,
+                                  nghttp2_data_source* source,
+                                  void* userdata) {
+  State* const state(static_cast<State*>(CHECK_NOTNULL(source->ptr)));
+  const string& body(state->request_.body);
+  const size_t count(
+      std::min(length, body.size() - state->body_offset_));
+  memcpy(buf, body.data() + state->body_offset_, count);
+  state->body_offset_ += count;
+  if (state->body_offset_ == body.size()) {
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  }
+
+  return count;
+}
+
+
+}  // namespace
+
+
+struct Http2UrlFetcher::Impl {
+  Impl(libevent::Base* base) : base_(CHECK_NOTNULL(base)) {
+  }
+
+  // The following methods must only be called on the libevent
+  // dispatch thread.
+  void StartRequest(State* state);
+  void SessionClosed(Session* session);
+
+  libevent::Base* const base_;
+  map<HostPortPair, unique_ptr<Session>> sessions_;
+};
+
+
+void Http2UrlFetcher::Impl::StartRequest(State* state) {
+  CHECK(libevent::Base::OnEventThread());
+  const HostPortPair peer(state->Peer());
+
+  auto it(sessions_.find(peer));
+  if (it == sessions_.end() || it->second->closed()) {
+    unique_ptr<Session> session(
+        new Session(base_, peer, bind(&Impl::SessionClosed, this,
+                                      std::placeholders::_1)));
+    if (it == sessions_.end()) {
+      it = sessions_.insert(make_pair(peer, move(session))).first;
+      http2_sessions->Set(sessions_.size());
+    } else {
+      // The old session will be deleted when SessionClosed() is
+      // called for it, since it will not find itself in the map.
+      it->second.release();
+      it->second = move(session);
+    }
+    it->second->Connect();
+  }
+
+  it->second->Submit(state);
+}
+
+
+void Http2UrlFetcher::Impl::SessionClosed(Session* session) {
+  CHECK(libevent::Base::OnEventThread());
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+    if (it->second.get() == session) {
+      sessions_.erase(it);
+      http2_sessions->Set(sessions_.size());
+      return;
+    }
+  }
+
+  // It was replaced by a newer session already.
+  delete session;
+}
+
+
+Http2UrlFetcher::Http2UrlFetcher(libevent::Base* base)
+    : impl_(new Impl(CHECK_NOTNULL(base))) {
+}
+
+
+Http2UrlFetcher::~Http2UrlFetcher() {
+}
+
+
+void Http2UrlFetcher::Fetch(const Request& req, Response* resp, Task* task) {
+  TaskHold hold(task);
+
+  if (req.url.Protocol() != "http") {
+    VLOG(1) << "unsupported protocol: " << req.url.Protocol();
+    task->Return(Status(util::error::INVALID_ARGUMENT,
+                        "Http2UrlFetcher: unsupported protocol: " +
+                            req.url.Protocol()));
+    return;
+  }
+
+  State* const state(new State(req, resp, task));
+  task->DeleteWhenDone(state);
+
+  impl_->base_->Add(bind(&Impl::StartRequest, impl_.get(), state));
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,38 @@
+#ifndef CERT_TRANS_NET_HTTP2_URL_FETCHER_H_
+#define CERT_TRANS_NET_HTTP2_URL_FETCHER_H_
+
+#include <memory>
+
+#include "base/macros.h"
+#include "net/url_fetcher.h"
+
+namespace cert_trans {
+
+
+// A UrlFetcher that speaks HTTP/2 (with prior knowledge, over
+// cleartext TCP), using nghttp2. Instead of a pool of HTTP/1.1
+// connections, it keeps a single connection per host:port, and
+// multiplexes all the concurrent requests to that peer over it, up to
+// the peer's SETTINGS_MAX_CONCURRENT_STREAMS (nghttp2 queues the
+// excess internally).
+//
+// The peer must support HTTP/2 without upgrade (h2c "prior
+// knowledge"), there is no fallback to HTTP/1.1.
+class Http2UrlFetcher : public UrlFetcher {
+ public:
+  Http2UrlFetcher(libevent::Base* base);
+  ~Http2UrlFetcher() override;
+
+  void Fetch(const Request& req, Response* resp, util::Task* task) override;
+
+ private:
+  struct Impl;
+  const std::unique_ptr<Impl> impl_;
+
+  DISALLOW_COPY_AND_ASSIGN(Http2UrlFetcher);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_NET_HTTP2_URL_FETCHER_H_
@@ -0,0 +1,466 @@
+#include "net/http2_url_fetcher.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <nghttp2/nghttp2.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "util/libevent_wrapper.h"
+#include "util/status_test_util.h"
+#include "util/sync_task.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using std::atomic;
+using std::make_pair;
+using std::make_shared;
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::SyncTask;
+using util::testing::StatusIs;
+
+
+// A minimal in-process h2c server, running on its own event loop. It
+// answers every request with a 200, echoing back the path in an
+// "x-path" header, and the request body (or the path, if there was no
+// body) as the response body. Requests for "/trailers" also get an
+// "x-trailer" trailer, and requests for "/hang" are never answered.
+class TestHttp2Server {
+ public:
+  TestHttp2Server()
+      : base_(CHECK_NOTNULL(event_base_new())),
+        listener_(nullptr),
+        port_(0),
+        num_connections_(0) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    listener_ = CHECK_NOTNULL(evconnlistener_new_bind(
+        base_, &AcceptCallback, this, LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE,
+        -1, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+
+    socklen_t addr_len(sizeof(addr));
+    CHECK_EQ(getsockname(evconnlistener_get_fd(listener_),
+                         reinterpret_cast<sockaddr*>(&addr), &addr_len),
+             0);
+    port_ = ntohs(addr.sin_port);
+
+    thread_ = thread([this]() { event_base_dispatch(base_); });
+  }
+
+  ~TestHttp2Server() {
+    event_base_loopbreak(base_);
+    thread_.join();
+    evconnlistener_free(listener_);
+    for (Connection* conn : connections_) {
+      delete conn;
+    }
+    event_base_free(base_);
+  }
+
+  uint16_t port() const {
+    return port_;
+  }
+
+  int num_connections() const {
+    return num_connections_.load();
+  }
+
+ private:
+  struct Stream {
+    string path;
+    string body;
+    string response_body;
+    size_t offset = 0;
+  };
+
+  static const char kTrailer[];
+
+  struct Connection {
+    Connection(TestHttp2Server* server, evutil_socket_t fd);
+    ~Connection() {
+      for (const auto& stream : streams) {
+        delete stream.second;
+      }
+      nghttp2_session_del(session);
+      bufferevent_free(bev);
+    }
+
+    void Flush() {
+      nghttp2_session_send(session);
+    }
+
+    bufferevent* const bev;
+    nghttp2_session* session;
+    map<int32_t, Stream*> streams;
+  };
+
+  static void AcceptCallback(evconnlistener* listener, evutil_socket_t fd,
+                             sockaddr* addr, int addr_len, void* userdata) {
+    TestHttp2Server* const self(static_cast<TestHttp2Server*>(userdata));
+    ++self->num_connections_;
+    self->connections_.push_back(new Connection(self, fd));
+  }
+
+  static void ReadCallback(bufferevent* bev, void* userdata) {
+    Connection* const conn(static_cast<Connection*>(userdata));
+    evbuffer* const input(bufferevent_get_input(bev));
+    const size_t length(evbuffer_get_length(input));
+    CHECK_GE(nghttp2_session_mem_recv(conn->session,
+                                      evbuffer_pullup(input, -1), length),
+             0);
+    evbuffer_drain(input, length);
+    conn->Flush();
+  }
+
+  static void EventCallback(bufferevent* bev, short events, void* userdata) {
+    if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+      bufferevent_disable(bev, EV_READ | EV_WRITE);
+    }
+  }
+
+  static ssize_t SendCallback(nghttp2_session* session, const uint8_t* data,
+                              size_t length, int flags, void* userdata) {
+    Connection* const conn(static_cast<Connection*>(userdata));
+    bufferevent_write(conn->bev, data, length);
+    return length;
+  }
+
+  static int OnBeginHeadersCallback(nghttp2_session* session,
+                                    const nghttp2_frame* frame,
+                                    void* userdata) {
+    Connection* const conn(static_cast<Connection*>(userdata));
+    if (frame->hd.type == NGHTTP2_HEADERS &&
+        frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+      conn->streams[frame->hd.stream_id] = new Stream;
+    }
+    return 0;
+  }
+
+  static int OnHeaderCallback(nghttp2_session* session,
+                              const nghttp2_frame* frame, const uint8_t* name,
+                              size_t namelen, const uint8_t* value,
+                              size_t valuelen, uint8_t flags,
+                              void* userdata) {
+    Connection* const conn(static_cast<Connection*>(userdata));
+    const auto it(conn->streams.find(frame->hd.stream_id));
+    if (it != conn->streams.end() &&
+        string(reinterpret_cast<const char*>(name), namelen) == ":path") {
+      it->second->path.assign(reinterpret_cast<const char*>(value), valuelen);
+    }
+    return 0;
+  }
+
+  static int OnDataChunkRecvCallback(nghttp2_session* session, uint8_t flags,
+                                     int32_t stream_id, const uint8_t* data,
+                                     size_t len, void* userdata) {
+    Connection* const conn(static_cast<Connection*>(userdata));
+    const auto it(conn->streams.find(stream_id));
+    if (it != conn->streams.end()) {
+      it->second->body.append(reinterpret_cast<const char*>(data), len);
+    }
+    return 0;
+  }
+
+  static int OnFrameRecvCallback(nghttp2_session* session,
+                                 const nghttp2_frame* frame, void* userdata) {
+    Connection* const conn(static_cast<Connection*>(userdata));
+    if ((frame->hd.type != NGHTTP2_HEADERS &&
+         frame->hd.type != NGHTTP2_DATA) ||
+        !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+      return 0;
+    }
+    const auto it(conn->streams.find(frame->hd.stream_id));
+    if (it == conn->streams.end()) {
+      return 0;
+    }
+
+    Stream* const stream(it->second);
+    if (stream->path == "/hang") {
+      return 0;
+    }
+    stream->response_body =
+        stream->body.empty() ? stream->path : stream->body;
+    const string status("200");
+    nghttp2_nv nva[] = {
+        {reinterpret_cast<uint8_t*>(const_cast<char*>(":status")),
+         reinterpret_cast<uint8_t*>(const_cast<char*>(status.data())), 7,
+         status.size(), NGHTTP2_NV_FLAG_NONE},
+        {reinterpret_cast<uint8_t*>(const_cast<char*>("x-path")),
+         reinterpret_cast<uint8_t*>(const_cast<char*>(stream->path.data())),
+         6, stream->path.size(), NGHTTP2_NV_FLAG_NONE},
+    };
+    nghttp2_data_provider body;
+    body.source.ptr = stream;
+    body.read_callback = &ReadBodyCallback;
+    CHECK_EQ(nghttp2_submit_response(session, frame->hd.stream_id, nva,
+                                     sizeof(nva) / sizeof(nva[0]), &body),
+             0);
+    return 0;
+  }
+
+  static int OnStreamCloseCallback(nghttp2_session* session,
+                                   int32_t stream_id, uint32_t error_code,
+                                   void* userdata) {
+    Connection* const conn(static_cast<Connection*>(userdata));
+    const auto it(conn->streams.find(stream_id));
+    if (it != conn->streams.end()) {
+      delete it->second;
+      conn->streams.erase(it);
+    }
+    return 0;
+  }
+
+  static ssize_t ReadBodyCallback(nghttp2_session* session, int32_t stream_id,
+                                  uint8_t* buf, size_t length,
+                                  uint32_t* data_flags,
+                                  nghttp2_data_source* source,
+                                  void* userdata) {
+    Stream* const stream(static_cast<Stream*>(source->ptr));
+    const size_t count(
+        std::min(length, stream->response_body.size() - stream->offset));
+    memcpy(buf, stream->response_body.data() + stream->offset, count);
+    stream->offset += count;
+    if (stream->offset == stream->response_body.size()) {
+      *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+      if (stream->path == "/trailers") {
+        *data_flags |= NGHTTP2_DATA_FLAG_NO_END_STREAM;
+        nghttp2_nv nv{
+            reinterpret_cast<uint8_t*>(const_cast<char*>("x-trailer")),
+            reinterpret_cast<uint8_t*>(const_cast<char*>(kTrailer)), 9,
+            strlen(kTrailer), NGHTTP2_NV_FLAG_NONE};
+        CHECK_EQ(nghttp2_submit_trailer(session, stream_id, &nv, 1), 0);
+      }
+    }
+    return count;
+  }
+
+  event_base* const base_;
+  evconnlistener* listener_;
+  uint16_t port_;
+  atomic<int> num_connections_;
+  vector<Connection*> connections_;
+  thread thread_;
+};
+
+
+const char TestHttp2Server::kTrailer[] = "trailer value";
+
+
+TestHttp2Server::Connection::Connection(TestHttp2Server* server,
+                                        evutil_socket_t fd)
+    : bev(CHECK_NOTNULL(bufferevent_socket_new(server->base_, fd,
+                                                BEV_OPT_CLOSE_ON_FREE))),
+      session(nullptr) {
+  nghttp2_session_callbacks* callbacks;
+  CHECK_EQ(nghttp2_session_callbacks_new(&callbacks), 0);
+  nghttp2_session_callbacks_set_send_callback(callbacks, &SendCallback);
+  nghttp2_session_callbacks_set_on_begin_headers_callback(
+      callbacks, &OnBeginHeadersCallback);
+  nghttp2_session_callbacks_set_on_header_callback(callbacks,
+                                                   &OnHeaderCallback);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+      callbacks, &OnDataChunkRecvCallback);
+  nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                       &OnFrameRecvCallback);
+  nghttp2_session_callbacks_set_on_stream_close_callback(
+      callbacks, &OnStreamCloseCallback);
+  CHECK_EQ(nghttp2_session_server_new(&session, callbacks, this), 0);
+  nghttp2_session_callbacks_del(callbacks);
+
+  const nghttp2_settings_entry settings[] = {
+      {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100},
+  };
+  CHECK_EQ(nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings, 1),
+           0);
+
+  bufferevent_setcb(bev, &ReadCallback, nullptr, &EventCallback, this);
+  bufferevent_enable(bev, EV_READ | EV_WRITE);
+  Flush();
+}
+
+
+class Http2UrlFetcherTest : public ::testing::Test {
+ protected:
+  Http2UrlFetcherTest()
+      : base_(make_shared<libevent::Base>()),
+        event_pump_(base_),
+        fetcher_(base_.get()) {
+  }
+
+  URL ServerUrl(const string& path) const {
+    return URL("http://127.0.0.1:" + to_string(server_.port()) + path);
+  }
+
+  TestHttp2Server server_;
+  shared_ptr<libevent::Base> base_;
+  libevent::EventPumpThread event_pump_;
+  Http2UrlFetcher fetcher_;
+};
+
+
+TEST_F(Http2UrlFetcherTest, Get) {
+  UrlFetcher::Request req(ServerUrl("/ct/v1/get-sth?foo=bar"));
+  UrlFetcher::Response resp;
+  SyncTask task(base_.get());
+  fetcher_.Fetch(req, &resp, task.task());
+  task.Wait();
+
+  ASSERT_OK(task.status());
+  EXPECT_EQ(200, resp.status_code);
+  EXPECT_EQ("/ct/v1/get-sth?foo=bar", resp.body);
+  ASSERT_EQ(1, resp.headers.count("x-path"));
+  EXPECT_EQ("/ct/v1/get-sth?foo=bar", resp.headers.find("x-path")->second);
+}
+
+
+TEST_F(Http2UrlFetcherTest, PostBody) {
+  UrlFetcher::Request req(ServerUrl("/ct/v1/add-chain"));
+  req.verb = UrlFetcher::Verb::POST;
+  req.headers.insert(make_pair("Content-Type", "application/json"));
+  req.body = string(100000, 'x');
+  UrlFetcher::Response resp;
+  SyncTask task(base_.get());
+  fetcher_.Fetch(req, &resp, task.task());
+  task.Wait();
+
+  ASSERT_OK(task.status());
+  EXPECT_EQ(200, resp.status_code);
+  EXPECT_EQ(req.body, resp.body);
+}
+
+
+TEST_F(Http2UrlFetcherTest, Trailers) {
+  UrlFetcher::Request req(ServerUrl("/trailers"));
+  UrlFetcher::Response resp;
+  SyncTask task(base_.get());
+  fetcher_.Fetch(req, &resp, task.task());
+  task.Wait();
+
+  ASSERT_OK(task.status());
+  EXPECT_EQ(200, resp.status_code);
+  EXPECT_EQ("/trailers", resp.body);
+  ASSERT_EQ(1, resp.headers.count("x-trailer"));
+  EXPECT_EQ("trailer value", resp.headers.find("x-trailer")->second);
+}
+
+
+TEST_F(Http2UrlFetcherTest, ConcurrentRequestsShareOneConnection) {
+  const int kNumRequests(250);
+  vector<unique_ptr<UrlFetcher::Response>> responses;
+  vector<unique_ptr<SyncTask>> tasks;
+  for (int i = 0; i < kNumRequests; ++i) {
+    responses.emplace_back(new UrlFetcher::Response);
+    tasks.emplace_back(new SyncTask(base_.get()));
+    fetcher_.Fetch(UrlFetcher::Request(ServerUrl("/" + to_string(i))),
+                   responses.back().get(), tasks.back()->task());
+  }
+
+  for (int i = 0; i < kNumRequests; ++i) {
+    tasks[i]->Wait();
+    EXPECT_OK(tasks[i]->status());
+    EXPECT_EQ(200, responses[i]->status_code);
+    EXPECT_EQ("/" + to_string(i), responses[i]->body);
+  }
+
+  // More requests than SETTINGS_MAX_CONCURRENT_STREAMS, but still
+  // only one connection.
+  EXPECT_EQ(1, server_.num_connections());
+}
+
+
+TEST_F(Http2UrlFetcherTest, ConnectionRefused) {
+  const uint16_t port(server_.port());
+  {
+    // Find a port nobody is listening on, by binding one and closing
+    // it right away.
+    const int sock(socket(AF_INET, SOCK_STREAM, 0));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    socklen_t addr_len(sizeof(addr));
+    ASSERT_EQ(0, getsockname(sock, reinterpret_cast<sockaddr*>(&addr),
+                             &addr_len));
+    ASSERT_NE(port, ntohs(addr.sin_port));
+    close(sock);
+
+    UrlFetcher::Request req(
+        URL("http://127.0.0.1:" + to_string(ntohs(addr.sin_port)) + "/"));
+    UrlFetcher::Response resp;
+    SyncTask task(base_.get());
+    fetcher_.Fetch(req, &resp, task.task());
+    task.Wait();
+    EXPECT_THAT(task.status(), StatusIs(util::error::UNAVAILABLE));
+  }
+
+  // The fetcher still works for other peers.
+  UrlFetcher::Response resp;
+  SyncTask task(base_.get());
+  fetcher_.Fetch(UrlFetcher::Request(ServerUrl("/")), &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task.status());
+  EXPECT_EQ(200, resp.status_code);
+}
+
+
+TEST_F(Http2UrlFetcherTest, DeletingFetcherCancelsRequestsInFlight) {
+  unique_ptr<Http2UrlFetcher> fetcher(new Http2UrlFetcher(base_.get()));
+  UrlFetcher::Response resp;
+  SyncTask task(base_.get());
+  fetcher->Fetch(UrlFetcher::Request(ServerUrl("/hang")), &resp, task.task());
+
+  // The request is started on the event loop, so delete the fetcher
+  // there too, after it.
+  SyncTask deleted(base_.get());
+  base_->Add([&fetcher, &deleted]() {
+    fetcher.reset();
+    deleted.task()->Return();
+  });
+  deleted.Wait();
+
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::CANCELLED));
+}
+
+
+TEST_F(Http2UrlFetcherTest, UnsupportedProtocol) {
+  UrlFetcher::Response resp;
+  SyncTask task(base_.get());
+  fetcher_.Fetch(UrlFetcher::Request(URL("https://127.0.0.1/")), &resp,
+                 task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::INVALID_ARGUMENT));
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -4,16 +4,20 @@
 #include <event2/keyvalq_struct.h>
 #include <glog/logging.h>
 
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
 #include "net/connection_pool.h"
 
 using cert_trans::internal::ConnectionPool;
-using cert_trans::internal::evhttp_connection_unique_ptr;
 using std::bind;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::endl;
 using std::make_pair;
 using std::move;
 using std::ostream;
 using std::string;
+using std::unique_ptr;
 using util::Status;
 using util::Task;
 using util::TaskHold;
@@ -33,6 +37,12 @@ struct UrlFetcher::Impl {
 namespace {
 
 
+static Latency<milliseconds, bool> url_fetcher_request_latency_ms(
+    "url_fetcher_request_latency_ms", "reused_connection",
+    "Latency of URL fetcher requests, by whether they were sent over a "
+    "reused connection.");
+
+
 evhttp_cmd_type VerbToCmdType(UrlFetcher::Verb verb) {
   switch (verb) {
     case UrlFetcher::Verb::GET:
@@ -70,7 +80,8 @@ struct State {
   UrlFetcher::Response* const response_;
   Task* const task_;
 
-  evhttp_connection_unique_ptr conn_;
+  unique_ptr<ConnectionPool::Connection> conn_;
+  steady_clock::time_point start_time_;
 };
 
 
@@ -129,16 +140,18 @@ void State::MakeRequest() {
   }
 
   conn_ = pool_->Get(request_.url);
+  start_time_ = steady_clock::now();
 
   const evhttp_cmd_type verb(VerbToCmdType(request_.verb));
-  VLOG(1) << "evhttp_make_request(" << conn_.get() << ", " << http_req << ", "
-          << verb << ", \"" << request_.url.PathQuery() << "\")";
-  if (evhttp_make_request(conn_.get(), http_req, verb,
+  VLOG(1) << "evhttp_make_request(" << conn_->connection() << ", "
+          << http_req << ", " << verb << ", \"" << request_.url.PathQuery()
+          << "\")";
+  if (evhttp_make_request(conn_->connection(), http_req, verb,
                           request_.url.PathQuery().c_str()) != 0) {
     VLOG(1) << "evhttp_make_request error";
     // Put back the connection, RequestDone is not going to get
     // called.
-    pool_->Put(move(conn_));
+    pool_->Put(move(conn_), false /* healthy */);
     task_->Return(Status(util::error::INTERNAL, "evhttp_make_request error"));
     return;
   }
@@ -148,7 +161,12 @@ void State::MakeRequest() {
 void State::RequestDone(evhttp_request* req) {
   CHECK(libevent::Base::OnEventThread());
   CHECK(conn_);
-  pool_->Put(move(conn_));
+  url_fetcher_request_latency_ms.RecordLatency(
+      conn_->reused(), steady_clock::now() - start_time_);
+  // A null request or a missing status code means that something went
+  // wrong with the connection itself, so do not reuse it.
+  pool_->Put(move(conn_),
+             req && evhttp_request_get_response_code(req) >= 100);
 
   if (!req) {
     // TODO(pphaneuf): The dreaded null request... These are fairly
@@ -1,24 +1,52 @@
+#include <chrono>
+#include <errno.h>
 #include <gflags/gflags.h>
 #include <iostream>
 #include <ldns/ldns.h>
+#include <memory>
+#include <signal.h>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "log/log_lookup.h"
 #include "log/logged_certificate.h"
 #include "log/sqlite_db.h"
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
 #include "proto/ct.pb.h"
-#include "server/event.h"
-
+#include "server/dns_response_cache.h"
+#include "server/dns_wire.h"
+#include "server/udp_engine.h"
+
+using cert_trans::Counter;
+using cert_trans::DnsResponseCache;
+using cert_trans::DnsTxtQuery;
+using cert_trans::Latency;
 using cert_trans::LoggedCertificate;
+using cert_trans::UdpEngine;
 using ct::SignedTreeHead;
 using google::RegisterFlagValidator;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::string;
 using std::stringstream;
+using std::unique_ptr;
 
 DEFINE_int32(port, 0, "Server port");
 DEFINE_string(domain, "", "Domain");
 DEFINE_string(db, "", "Database for certificate and tree storage");
+DEFINE_int32(dns_threads, std::thread::hardware_concurrency(),
+             "Number of threads answering queries. Each has its own socket "
+             "and database handle.");
+DEFINE_int32(dns_latency_sample_rate, 64,
+             "Record the latency of one query out of this many.");
+DEFINE_int32(dns_response_cache_entries, 100000,
+             "Maximum number of replies cached by each thread.");
+DEFINE_int32(dns_sth_refresh_ms, 1000,
+             "How often to check for a new STH, which invalidates the "
+             "cached replies.");
 
 // Basic sanity checks on flag values.
 static bool ValidatePort(const char* flagname, int32_t port) {
@@ -39,33 +67,176 @@ static bool NonEmptyString(const char* flagname, const string& str) {
 static const bool domain_dummy =
     RegisterFlagValidator(&FLAGS_domain, &NonEmptyString);
 
-class CTUDPDNSServer : public UDPServer {
+static bool ValidatePositive(const char* flagname, int32_t value) {
+  if (value <= 0) {
+    std::cerr << flagname << " must be positive" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool threads_dummy =
+    RegisterFlagValidator(&FLAGS_dns_threads, &ValidatePositive);
+
+static const bool sample_rate_dummy =
+    RegisterFlagValidator(&FLAGS_dns_latency_sample_rate, &ValidatePositive);
+
+static const bool cache_entries_dummy = RegisterFlagValidator(
+    &FLAGS_dns_response_cache_entries, &ValidatePositive);
+
+static Counter<string>* dns_server_queries = Counter<string>::New(
+    "dns_server_queries", "result",
+    "Number of DNS packets received by ct-dns-server, by result.");
+
+static Latency<microseconds> dns_server_query_latency_us(
+    "dns_server_query_latency_us",
+    "Latency of a sample of the DNS queries answered by ct-dns-server, in "
+    "microseconds.");
+
+// Answers DNS queries. Every UdpEngine thread has its own instance,
+// with its own database handle and reply buffers, so there is no
+// locking between them. The in-memory tree in |lookup| is shared by
+// all of them, and kept up to date by main().
+class CTDNSHandler : public UdpEngine::Handler {
  public:
-  CTUDPDNSServer(const string& domain, SQLiteDB<LoggedCertificate>* db,
-                 EventLoop* loop, int fd)
-      : UDPServer(loop, fd), domain_(domain), lookup_(db), db_(db) {
+  CTDNSHandler(const string& domain, const string& db_file,
+               LogLookup<LoggedCertificate>* lookup)
+      : domain_(domain),
+        db_(new SQLiteDB<LoggedCertificate>(db_file)),
+        lookup_(CHECK_NOTNULL(lookup)),
+        cache_(FLAGS_dns_response_cache_entries),
+        queries_until_sample_(FLAGS_dns_latency_sample_rate) {
+    for (int i = 0; i < NUM_RESULTS; ++i) {
+      results_[i] = 0;
+    }
   }
 
-  virtual void PacketRead(const sockaddr_in& from, const char* buf,
-                          size_t len) {
+  void HandlePacket(const sockaddr_in& from, const char* buf, size_t len,
+                    string* reply) override {
+    if (--queries_until_sample_ > 0) {
+      ++results_[Answer(buf, len, reply)];
+      return;
+    }
+
+    queries_until_sample_ = FLAGS_dns_latency_sample_rate;
+    const steady_clock::time_point start(steady_clock::now());
+    ++results_[Answer(buf, len, reply)];
+    dns_server_query_latency_us.RecordLatency(steady_clock::now() - start);
+  }
+
+  // Per-query logging and metrics would dominate the cost of
+  // answering, so the results are only published once per batch.
+  void BatchDone() override {
+    for (int i = 0; i < NUM_RESULTS; ++i) {
+      if (results_[i] > 0) {
+        dns_server_queries->IncrementBy(kResultNames[i], results_[i]);
+        results_[i] = 0;
+      }
+    }
+  }
+
+ private:
+  enum Result {
+    ANSWERED,
+    ANSWERED_FROM_CACHE,
+    BAD_PACKET,
+    NOT_A_QUERY,
+    BAD_OPCODE,
+    ENCODING_FAILED,
+    NUM_RESULTS,
+  };
+
+  static const char* const kResultNames[NUM_RESULTS];
+  static const uint32_t kTtl = 123;
+
+  Result Answer(const char* buf, size_t len, string* reply) {
+    MaybeRefreshSTH();
+
+    if (cache_.Lookup(buf, len, reply)) {
+      return ANSWERED_FROM_CACHE;
+    }
+
+    const Result result(BuildAnswer(buf, len, reply));
+    if (result == ANSWERED) {
+      cache_.Insert(buf, len, *reply);
+    }
+    return result;
+  }
+
+  // Every answer might depend on the STH (even "not found" ones), so
+  // the cache is cleared whenever it changes. Cache hits do not touch
+  // the lookup, so check for a new one periodically.
+  void MaybeRefreshSTH() {
+    const steady_clock::time_point now(steady_clock::now());
+    if (now < next_sth_refresh_) {
+      return;
+    }
+    next_sth_refresh_ = now + milliseconds(FLAGS_dns_sth_refresh_ms);
+
+    const SignedTreeHead sth(lookup_->GetSTH());
+    if (sth.tree_size() != cached_tree_size_ ||
+        sth.timestamp() != cached_timestamp_) {
+      VLOG(1) << "New STH of size " << sth.tree_size()
+              << ", clearing the response cache";
+      cache_.Clear();
+      cached_tree_size_ = sth.tree_size();
+      cached_timestamp_ = sth.timestamp();
+    }
+  }
+
+  // Queries are almost always of the same simple shape, which is
+  // handled directly, without the allocations and string conversions
+  // of going through ldns.
+  Result BuildAnswer(const char* buf, size_t len, string* reply) {
+    if (cert_trans::ParseDnsTxtQuery(buf, len, &query_)) {
+      const bool answered(TxtAnswer(query_.name, &response_));
+      if (cert_trans::EncodeDnsTxtResponse(query_,
+                                           answered ? &response_ : NULL,
+                                           kTtl, reply)) {
+        return ANSWERED;
+      }
+      // Otherwise, let ldns deal with it.
+    }
+
+    return BuildAnswerWithLdns(buf, len, reply);
+  }
+
+  // Sets |response| to the TXT answer for |owner_name| (in
+  // presentation format), if it is in our domain.
+  bool TxtAnswer(const string& owner_name, string* response) {
+    VLOG(1) << "Question is TXT of " << owner_name;
+
+    if (owner_name.length() <= domain_.length() ||
+        owner_name.compare(owner_name.length() - domain_.length(),
+                           domain_.length(), domain_) != 0) {
+      VLOG(1) << "Question is not for our domain";
+      return false;
+    }
+
+    *response = Response(
+        owner_name.substr(0, owner_name.length() - domain_.length() - 1));
+    return true;
+  }
+
+  Result BuildAnswerWithLdns(const char* buf, size_t len, string* reply) {
     ldns_pkt* packet = NULL;
 
     ldns_status ret = ldns_wire2pkt(&packet, (const uint8_t*)buf, len);
     if (ret != LDNS_STATUS_OK) {
-      LOG(INFO) << "Bad DNS packet";
-      return;
+      VLOG(1) << "Bad DNS packet";
+      return BAD_PACKET;
     }
 
-    //ldns_pkt_print(stdout, packet);
-
     if (ldns_pkt_qr(packet) != 0) {
-      LOG(INFO) << "Packet is not a query";
-      return;
+      VLOG(1) << "Packet is not a query";
+      ldns_pkt_free(packet);
+      return NOT_A_QUERY;
     }
 
     if (ldns_pkt_get_opcode(packet) != LDNS_PACKET_QUERY) {
-      LOG(INFO) << "Packet has bad opcode";
-      return;
+      VLOG(1) << "Packet has bad opcode";
+      ldns_pkt_free(packet);
+      return BAD_OPCODE;
     }
 
     ldns_pkt* answers = ldns_pkt_new();
@@ -81,20 +252,21 @@ class CTUDPDNSServer : public UDPServer {
       ldns_rr* question = ldns_rr_list_rr(questions, n);
 
       if (ldns_rr_get_type(question) != LDNS_RR_TYPE_TXT) {
-        LOG(INFO) << "Question is not TXT";
+        VLOG(1) << "Question is not TXT";
         // FIXME(benl): set error response?
         continue;
       }
 
       ldns_rdf* owner = ldns_rr_owner(question);
       if (ldns_rdf_get_type(owner) != LDNS_RDF_TYPE_DNAME) {
-        LOG(INFO) << "Owner is not a dname";
+        VLOG(1) << "Owner is not a dname";
         continue;
       }
 
       ldns_buffer* dname = ldns_buffer_new(512);
       if (ldns_rdf2buffer_str_dname(dname, owner) != LDNS_STATUS_OK) {
-        LOG(INFO) << "Can't decode owner";
+        VLOG(1) << "Can't decode owner";
+        ldns_buffer_free(dname);
         continue;
       }
 
@@ -105,45 +277,42 @@ class CTUDPDNSServer : public UDPServer {
       ldns_buffer_free(dname);
       dname = NULL;
 
-      LOG(INFO) << "Question is TXT of " << owner_name;
-
-      if (owner_name.length() <= domain_.length() ||
-          owner_name.compare(owner_name.length() - domain_.length(),
-                             domain_.length(), domain_) != 0) {
-        LOG(INFO) << "Question is not for our domain";
+      std::string response;
+      if (!TxtAnswer(owner_name, &response)) {
         continue;
       }
 
-      std::string response = Response(
-          owner_name.substr(0, owner_name.length() - domain_.length() - 1));
-
       ldns_rr* answer = ldns_rr_new();
       ldns_rr_set_owner(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_DNAME,
                                                      owner_name.c_str()));
       ldns_rr_set_type(answer, LDNS_RR_TYPE_TXT);
-      ldns_rr_set_ttl(answer, 123);
+      ldns_rr_set_ttl(answer, kTtl);
       ldns_rr_push_rdf(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_STR,
                                                     response.c_str()));
       ldns_pkt_safe_push_rr(answers, LDNS_SECTION_ANSWER, answer);
     }
     ldns_pkt_free(packet);
 
-    char* answer_str = ldns_pkt2str(answers);
-    LOG(INFO) << "Answer is " << answer_str;
-    free(answer_str);
+    if (VLOG_IS_ON(2)) {
+      char* answer_str = ldns_pkt2str(answers);
+      VLOG(2) << "Answer is " << answer_str;
+      free(answer_str);
+    }
 
     uint8_t* wire_answer;
     size_t answer_size;
     if (ldns_pkt2wire(&wire_answer, answers, &answer_size) != LDNS_STATUS_OK) {
       LOG(ERROR) << "Can't make wire answer";
-      return;
+      ldns_pkt_free(answers);
+      return ENCODING_FAILED;
     }
-    QueuePacket(from, wire_answer, answer_size);
+    reply->assign(reinterpret_cast<const char*>(wire_answer), answer_size);
     free(wire_answer);
     ldns_pkt_free(answers);
+
+    return ANSWERED;
   }
 
- private:
   string Response(string question) {
     if (question == "sth")
       return STH();
@@ -154,7 +323,7 @@ class CTUDPDNSServer : public UDPServer {
 
     string head = question.substr(0, dot);
     string tail = question.substr(dot + 1);
-    LOG(INFO) << "head = " << head << ", tail = " << tail;
+    VLOG(1) << "head = " << head << ", tail = " << tail;
     if (tail == "tree")
       return Tree(head);
     else if (tail == "hash")
@@ -170,15 +339,15 @@ class CTUDPDNSServer : public UDPServer {
     LoggedCertificate cert;
     if (db_->LookupByIndex(index, &cert) != db_->LOOKUP_OK)
       return "No such index";
-    return util::ToBase64(lookup_.LeafHash(cert));
+    return util::ToBase64(lookup_->LeafHash(cert));
   }
 
+  // The STH is kept up to date by MaybeRefreshSTH(), so that replies
+  // are consistent with it.
   string Hash(const string& hash) {
-    db_->ForceNotifySTH();
-
     // FIXME: decode hash!
     int64_t index;
-    if (lookup_.GetIndex(hash, &index) != lookup_.OK)
+    if (lookup_->GetIndex(hash, &index) != lookup_->OK)
       return "No such hash";
 
     stringstream ss;
@@ -199,12 +368,12 @@ class CTUDPDNSServer : public UDPServer {
     string index = question.substr(dot + 1, dot2 - dot - 1);
     string size = question.substr(dot2 + 1);
 
-    LOG(INFO) << "level = " << level << ", index = " << index
-              << ", size = " << size;
+    VLOG(1) << "level = " << level << ", index = " << index
+            << ", size = " << size;
 
     ct::ShortMerkleAuditProof proof;
-    if (lookup_.AuditProof(atoi(index.c_str()), atoi(size.c_str()), &proof) !=
-        lookup_.OK)
+    if (lookup_->AuditProof(atoi(index.c_str()), atoi(size.c_str()),
+                            &proof) != lookup_->OK)
       return "Lookup of node " + index + "." + size + " failed";
 
     int l = atoi(level.c_str());
@@ -216,9 +385,7 @@ class CTUDPDNSServer : public UDPServer {
   }
 
   string STH() {
-    db_->ForceNotifySTH();
-
-    const SignedTreeHead& sth = lookup_.GetSTH();
+    const SignedTreeHead& sth = lookup_->GetSTH();
 
     std::string signature;
     CHECK_EQ(Serializer::SerializeDigitallySigned(sth.signature(), &signature),
@@ -232,58 +399,70 @@ class CTUDPDNSServer : public UDPServer {
     return ss.str();
   }
 
-  string domain_;
-  LogLookup<LoggedCertificate> lookup_;
-  SQLiteDB<LoggedCertificate>* const db_;
+  const string domain_;
+  const unique_ptr<SQLiteDB<LoggedCertificate>> db_;
+  LogLookup<LoggedCertificate>* const lookup_;
+  DnsResponseCache cache_;
+  // Reused for every query, to avoid allocations.
+  DnsTxtQuery query_;
+  string response_;
+  // The STH the cached replies were built from.
+  int64_t cached_tree_size_ = -1;
+  uint64_t cached_timestamp_ = 0;
+  steady_clock::time_point next_sth_refresh_;
+  int queries_until_sample_;
+  int results_[NUM_RESULTS];
 };
 
-class Keyboard : public Server {
- public:
-  Keyboard(EventLoop* loop) : Server(loop, 0) {
-  }
 
-  void BytesRead(std::string* rbuffer) {
-    while (!rbuffer->empty()) {
-      ProcessKey(rbuffer->at(0));
-      rbuffer->erase(0, 1);
-    }
-  }
-
- private:
-  void ProcessKey(char key) {
-    switch (key) {
-      case 'q':
-        loop()->Stop();
-        break;
-
-      case '\n':
-        break;
-
-      default:
-        std::cout << "Don't understand " << key << std::endl;
-        break;
-    }
-  }
+const char* const CTDNSHandler::kResultNames[NUM_RESULTS] = {
+    "answered",    "answered_from_cache", "bad_packet",
+    "not_a_query", "bad_opcode",          "encoding_failed",
 };
 
+
 int main(int argc, char* argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
 
+  // Block the termination signals before starting any thread, so that
+  // only sigwait() below sees them, and we can exit cleanly (mostly
+  // for valgrind etc).
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  PCHECK(pthread_sigmask(SIG_BLOCK, &signals, NULL) == 0);
+
   // TODO(pphaneuf): This current *has* to be SQLite, because it
   // depends on sharing the database with a ct-server that will
   // populate it (which FileDB does not support).
-  SQLiteDB<LoggedCertificate> db(FLAGS_db);
-
-  EventLoop loop;
-
-  // Mostly so we can have a clean exit for valgrind etc.
-  Keyboard keyboard(&loop);
-
-  int dns_fd;
-  CHECK(Services::InitServer(&dns_fd, FLAGS_port, NULL, SOCK_DGRAM));
-  CTUDPDNSServer dns(FLAGS_domain, &db, &loop, dns_fd);
-
-  LOG(INFO) << "Server listening on port " << FLAGS_port;
-  loop.Forever();
+  //
+  // The tree is the bulk of the memory used, so there is only one,
+  // for all the threads.
+  SQLiteDB<LoggedCertificate> lookup_db(FLAGS_db);
+  LogLookup<LoggedCertificate> lookup(&lookup_db);
+
+  UdpEngine engine(FLAGS_port, FLAGS_dns_threads, [&lookup]() {
+    return unique_ptr<UdpEngine::Handler>(
+        new CTDNSHandler(FLAGS_domain, FLAGS_db, &lookup));
+  });
+
+  LOG(INFO) << "Server listening on port " << FLAGS_port << " with "
+            << FLAGS_dns_threads << " threads";
+
+  // Check for a new STH while waiting for a signal. The lookup is
+  // updated in the background, and the threads pick it up on their
+  // next refresh.
+  const timespec refresh_interval{FLAGS_dns_sth_refresh_ms / 1000,
+                                  (FLAGS_dns_sth_refresh_ms % 1000) *
+                                      1000000L};
+  int signal_number;
+  while ((signal_number = sigtimedwait(&signals, NULL, &refresh_interval)) <
+         0) {
+    PCHECK(errno == EAGAIN || errno == EINTR);
+    lookup_db.ForceNotifySTH();
+  }
+  LOG(INFO) << "Exiting on signal " << signal_number;
+  engine.Stop();
 }
@@ -19,6 +19,7 @@
 
 #include "config.h"
 #include "client/async_log_client.h"
+#include "client/response_cache.h"
 #include "fetcher/continuous_fetcher.h"
 #include "fetcher/remote_peer.h"
 #include "fetcher/peer_group.h"
@@ -34,6 +35,9 @@
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
 #include "monitoring/registry.h"
+#ifdef HAVE_NGHTTP2
+#include "net/http2_url_fetcher.h"
+#endif
 #include "server/handler.h"
 #include "server/json_output.h"
 #include "server/metrics.h"
@@ -85,6 +89,19 @@ DEFINE_string(
     "PEM-encoded server public key file of the log we're mirroring.");
 DEFINE_int32(local_sth_update_frequency_seconds, 30,
              "Number of seconds between local checks for updated tree data.");
+DEFINE_string(response_cache_dir, "",
+              "If set, entries retrieved from the target log are cached in "
+              "this directory, so that they need not be fetched again after "
+              "a restart.");
+DEFINE_int64(response_cache_max_bytes, 1LL << 30,
+             "Maximum total size of the responses kept in "
+             "--response_cache_dir.");
+#ifdef HAVE_NGHTTP2
+DEFINE_bool(url_fetcher_http2, false,
+            "Use HTTP/2 (cleartext, with prior knowledge) for outgoing "
+            "requests, multiplexing them over one connection per peer. All "
+            "the peers (etcd and other nodes) must support it.");
+#endif
 
 namespace libevent = cert_trans::libevent;
 
@@ -107,6 +124,7 @@ using cert_trans::PeriodicClosure;
 using cert_trans::Proxy;
 using cert_trans::ReadPublicKey;
 using cert_trans::RemotePeer;
+using cert_trans::ResponseCache;
 using cert_trans::Server;
 using cert_trans::ScopedLatency;
 using cert_trans::StrictConsistentStore;
@@ -288,12 +306,20 @@ int main(int argc, char* argv[]) {
 
   const bool stand_alone_mode(FLAGS_etcd_host.empty());
   const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
-  UrlFetcher url_fetcher(event_base.get());
+#ifdef HAVE_NGHTTP2
+  const unique_ptr<UrlFetcher> url_fetcher(
+      FLAGS_url_fetcher_http2
+          ? new cert_trans::Http2UrlFetcher(event_base.get())
+          : new UrlFetcher(event_base.get()));
+#else
+  const unique_ptr<UrlFetcher> url_fetcher(new UrlFetcher(event_base.get()));
+#endif
 
   const std::unique_ptr<EtcdClient> etcd_client(
       stand_alone_mode
           ? new FakeEtcdClient(event_base.get())
-          : new EtcdClient(&url_fetcher, FLAGS_etcd_host, FLAGS_etcd_port));
+          : new EtcdClient(url_fetcher.get(), FLAGS_etcd_host,
+                           FLAGS_etcd_port));
 
   Server<LoggedCertificate>::Options options;
   options.server = FLAGS_server;
@@ -302,7 +328,7 @@ int main(int argc, char* argv[]) {
   options.num_http_server_threads = FLAGS_num_http_server_threads;
 
   Server<LoggedCertificate> server(options, event_base, db, etcd_client.get(),
-                                   &url_fetcher, nullptr, nullptr);
+                                   url_fetcher.get(), nullptr, nullptr);
   server.Initialise(true /* is_mirror */);
 
   if (stand_alone_mode) {
@@ -358,9 +384,16 @@ int main(int argc, char* argv[]) {
         queue.insert(make_pair(sth.tree_size(), sth));
       });
 
+  unique_ptr<ResponseCache> response_cache;
+  if (!FLAGS_response_cache_dir.empty()) {
+    response_cache.reset(new ResponseCache(FLAGS_response_cache_dir,
+                                           FLAGS_response_cache_max_bytes));
+  }
+
   const shared_ptr<RemotePeer> peer(make_shared<RemotePeer>(
-      unique_ptr<AsyncLogClient>(
-          new AsyncLogClient(&pool, &url_fetcher, FLAGS_target_log_uri)),
+      unique_ptr<AsyncLogClient>(new AsyncLogClient(
+          &pool, url_fetcher.get(), response_cache.get(),
+          FLAGS_target_log_uri)),
       unique_ptr<LogVerifier>(
           new LogVerifier(new LogSigVerifier(pubkey.ValueOrDie()),
                           new MerkleVerifier(new Sha256Hasher))),
@@ -0,0 +1,175 @@
+/* -*- indent-tabs-mode: nil -*- */
+
+// A proof-serving replica, which answers get-sth, get-proof-by-hash
+// and get-sth-consistency requests using only the leaf hash file
+// written by a ct-server signer (with --leaf_hash_file), and the STHs
+// of the log it belongs to.
+
+#include <chrono>
+#include <event2/thread.h>
+#include <functional>
+#include <gflags/gflags.h>
+#include <iostream>
+#include <memory>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <signal.h>
+#include <string>
+#include <unistd.h>
+
+#include "client/async_log_client.h"
+#include "fetcher/remote_peer.h"
+#include "log/log_verifier.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+#include "net/url_fetcher.h"
+#include "server/json_output.h"
+#include "server/metrics.h"
+#include "server/proof_replica.h"
+#include "util/libevent_wrapper.h"
+#include "util/periodic_closure.h"
+#include "util/read_key.h"
+#include "util/status.h"
+#include "util/sync_task.h"
+#include "util/thread_pool.h"
+
+DEFINE_int32(port, 9999, "Server port");
+DEFINE_string(leaf_hash_file, "",
+              "Leaf hash file written by the signer of the log, see "
+              "--leaf_hash_file in ct-server.");
+DEFINE_string(target_log_uri, "http://localhost:8888",
+              "URI of the log whose STHs to serve.");
+DEFINE_string(target_public_key, "",
+              "PEM-encoded public key file of the log whose STHs to serve.");
+DEFINE_int32(leaf_hash_refresh_ms, 1000,
+             "How often to look for new leaf hashes and STHs to serve.");
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::AsyncLogClient;
+using cert_trans::JsonOutput;
+using cert_trans::PeriodicClosure;
+using cert_trans::ProofReplica;
+using cert_trans::ReadPublicKey;
+using cert_trans::RemotePeer;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
+using google::RegisterFlagValidator;
+using std::bind;
+using std::chrono::milliseconds;
+using std::make_shared;
+using std::placeholders::_1;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using util::StatusOr;
+using util::SyncTask;
+using util::Task;
+
+
+namespace {
+
+
+static bool ValidatePort(const char* flagname, int port) {
+  if (port <= 0 || port > 65535) {
+    std::cout << "Port value " << port << " is invalid. " << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool port_dummy =
+    RegisterFlagValidator(&FLAGS_port, &ValidatePort);
+
+static bool ValidateRead(const char* flagname, const string& path) {
+  if (access(path.c_str(), R_OK) != 0) {
+    std::cout << "Cannot access " << flagname << " at " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool pubkey_dummy =
+    RegisterFlagValidator(&FLAGS_target_public_key, &ValidateRead);
+
+static const bool leaf_hash_file_dummy =
+    RegisterFlagValidator(&FLAGS_leaf_hash_file, &ValidateRead);
+
+static bool ValidateIsPositive(const char* flagname, int value) {
+  if (value <= 0) {
+    std::cout << flagname << " must be greater than 0" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool refresh_dummy =
+    RegisterFlagValidator(&FLAGS_leaf_hash_refresh_ms, &ValidateIsPositive);
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  // Ignore various signals whilst we start up.
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_IGN);
+
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  OpenSSL_add_all_algorithms();
+  ERR_load_crypto_strings();
+  evthread_use_pthreads();
+
+  const StatusOr<EVP_PKEY*> pubkey(ReadPublicKey(FLAGS_target_public_key));
+  CHECK(pubkey.ok()) << "Failed to read target log's public key file: "
+                     << pubkey.status();
+
+  const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
+  UrlFetcher url_fetcher(event_base.get());
+  ThreadPool pool(4);
+  SyncTask fetcher_task(&pool);
+
+  JsonOutput json_output(event_base.get());
+  ProofReplica replica(&json_output, FLAGS_leaf_hash_file);
+  CHECK(replica.Refresh()) << "Could not read " << FLAGS_leaf_hash_file;
+
+  libevent::HttpServer http_server(*event_base);
+  http_server.AddHandler("/metrics",
+                         bind(&cert_trans::ExportPrometheusMetrics, _1));
+  replica.Add(&http_server);
+  http_server.Bind(nullptr, FLAGS_port);
+
+  // The STHs are only taken from the log itself, after checking their
+  // signature, and are served once the leaf hash file catches up with
+  // them.
+  const shared_ptr<RemotePeer> peer(make_shared<RemotePeer>(
+      unique_ptr<AsyncLogClient>(new AsyncLogClient(
+          &pool, &url_fetcher, FLAGS_target_log_uri)),
+      unique_ptr<LogVerifier>(
+          new LogVerifier(new LogSigVerifier(pubkey.ValueOrDie()),
+                          new MerkleVerifier(new Sha256Hasher))),
+      bind(&ProofReplica::NewSTH, &replica, _1),
+      fetcher_task.task()->AddChild(
+          [](Task* task) { LOG(INFO) << "RemotePeer exited."; })));
+
+  const PeriodicClosure refresher(event_base,
+                                  milliseconds(FLAGS_leaf_hash_refresh_ms),
+                                  [&replica]() {
+                                    if (!replica.Refresh()) {
+                                      LOG(WARNING) << "Could not refresh "
+                                                      "the leaf hashes";
+                                    }
+                                  });
+
+  event_base->Dispatch();
+
+  fetcher_task.task()->Return();
+  fetcher_task.Wait();
+
+  return 0;
+}
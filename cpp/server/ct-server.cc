@@ -1,8 +1,11 @@
 /* -*- indent-tabs-mode: nil -*- */
 
+#include <algorithm>
+#include <condition_variable>
 #include <event2/thread.h>
 #include <gflags/gflags.h>
 #include <iostream>
+#include <map>
 #include <openssl/err.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -10,22 +13,30 @@
 #include <unistd.h>
 
 
+#include "base/notification.h"
 #include "config.h"
 #include "log/cert_checker.h"
 #include "log/cert_submission_handler.h"
 #include "log/cluster_state_controller.h"
 #include "log/etcd_consistent_store.h"
+#include "log/fair_sequencing_policy.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/leaf_hash_file.h"
 #include "log/leveldb_db.h"
 #include "log/log_signer.h"
 #include "log/sqlite_db.h"
 #include "log/strict_consistent_store.h"
+#include "log/temporal_shards.h"
 #include "log/tree_signer.h"
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
 #include "monitoring/registry.h"
+#ifdef HAVE_NGHTTP2
+#include "net/http2_url_fetcher.h"
+#endif
 #include "server/handler.h"
+#include "server/json_output.h"
 #include "server/metrics.h"
 #include "server/server.h"
 #include "util/etcd.h"
@@ -33,7 +44,9 @@
 #include "util/libevent_wrapper.h"
 #include "util/read_key.h"
 #include "util/status.h"
+#include "util/sync_task.h"
 #include "util/thread_pool.h"
+#include "util/util.h"
 #include "util/uuid.h"
 
 DEFINE_string(server, "localhost", "Server host");
@@ -63,7 +76,13 @@ DEFINE_int32(log_stats_frequency_seconds, 3600,
              "Must be greater than 0.");
 DEFINE_int32(sequencing_frequency_seconds, 10,
              "How often should new entries be sequenced. The sequencing runs "
-             "in parallel with the tree signing and cleanup.");
+             "in parallel with the tree signing and cleanup. The sequencer "
+             "also runs as soon as new entries in etcd are old enough to be "
+             "sequenced (see --guard_window_seconds), so this is only the "
+             "longest time between runs.");
+DEFINE_int32(sequencing_coalesce_ms, 100,
+             "Minimum time between the starts of two sequencing runs, so "
+             "that entries arriving in bursts are sequenced together.");
 DEFINE_int32(cleanup_frequency_seconds, 10,
              "How often should new entries be cleanedup. The cleanup runs in "
              "in parallel with the tree signing and sequencing.");
@@ -73,6 +92,25 @@ DEFINE_int32(tree_signing_frequency_seconds, 600,
              "server select loop, at least this period has elapsed since the "
              "last signing. Set this well below the MMD to ensure we sign in "
              "a timely manner. Must be greater than 0.");
+DEFINE_int32(max_entries_per_sequencing_pass, 0,
+             "If greater than 0, the maximum number of new entries to "
+             "sequence per run. When more are waiting, this is shared "
+             "fairly between issuers, so that no single issuer can hold up "
+             "the others.");
+DEFINE_string(sequencing_issuer_weights, "",
+              "Comma-separated list of <issuer key hash, in hex>:<weight>, "
+              "to give some issuers a bigger share of "
+              "--max_entries_per_sequencing_pass. Unlisted issuers have a "
+              "weight of 1.");
+DEFINE_int32(sequencing_max_deferral_seconds, 3600,
+             "Entries waiting for longer than this are always sequenced, "
+             "whatever --max_entries_per_sequencing_pass. Set this well "
+             "below the MMD, leaving time to sign a tree head including "
+             "them. 0 means that entries can be deferred indefinitely.");
+DEFINE_bool(sign_after_sequencing, false,
+            "Also sign a new tree head as soon as the sequencer has put new "
+            "entries in the local database, rather than only every "
+            "--tree_signing_frequency_seconds.");
 DEFINE_double(guard_window_seconds, 60,
               "Unsequenced entries newer than this "
               "number of seconds will not be sequenced.");
@@ -81,9 +119,28 @@ DEFINE_int32(etcd_port, 0, "Port of the etcd server.");
 DEFINE_string(etcd_root, "/root", "Root of cluster entries in etcd.");
 DEFINE_int32(num_http_server_threads, 16,
              "Number of threads for servicing the incoming HTTP requests.");
+DEFINE_string(leaf_hash_file, "",
+              "If set, the signer writes the leaf hash of every entry to "
+              "this file, for ct-proof-replica to serve proofs from.");
 DEFINE_bool(i_know_stand_alone_mode_can_lose_data, false,
             "Set this to allow stand-alone mode, even though it will lost "
             "submissions in the case of a crash.");
+DEFINE_string(temporal_shards, "",
+              "Comma-separated list of <name>:<start>:<limit>, to run one "
+              "log per window of notAfter dates (from <start> included to "
+              "<limit> excluded, as YYYY-MM-DD) in this process, sharing the "
+              "HTTP server. Each log serves its API under /<name>, and the "
+              "submissions to the unprefixed add-chain and add-pre-chain are "
+              "routed by the notAfter of their leaf. --key, --etcd_root, "
+              "--leaf_hash_file and the database flags must then contain "
+              "\"{shard}\", which is replaced by the name of each log.");
+#ifdef HAVE_NGHTTP2
+DEFINE_bool(url_fetcher_http2, false,
+            "Use HTTP/2 (cleartext, with prior knowledge) for outgoing "
+            "requests, multiplexing them over one connection per peer. All "
+            "the peers (etcd and other nodes) must support it.");
+#endif
+DECLARE_int32(master_lease_ttl_seconds);
 
 namespace libevent = cert_trans::libevent;
 
@@ -94,18 +151,25 @@ using cert_trans::Counter;
 using cert_trans::Gauge;
 using cert_trans::EtcdClient;
 using cert_trans::EtcdConsistentStore;
+using cert_trans::FairSequencingPolicy;
 using cert_trans::FakeEtcdClient;
 using cert_trans::FileStorage;
 using cert_trans::HttpHandler;
+using cert_trans::JsonOutput;
 using cert_trans::Latency;
+using cert_trans::LeafHashFile;
 using cert_trans::LoggedCertificate;
+using cert_trans::MasterElection;
+using cert_trans::Notification;
 using cert_trans::ReadPrivateKey;
 using cert_trans::Server;
 using cert_trans::ScopedLatency;
+using cert_trans::TemporalShard;
 using cert_trans::ThreadPool;
 using cert_trans::TreeSigner;
 using cert_trans::Update;
 using cert_trans::UrlFetcher;
+using cert_trans::kShardPlaceholder;
 using ct::ClusterNodeState;
 using ct::SignedTreeHead;
 using google::RegisterFlagValidator;
@@ -115,14 +179,18 @@ using std::chrono::duration_cast;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
+using std::condition_variable;
 using std::function;
+using std::lock_guard;
 using std::make_shared;
 using std::mutex;
 using std::placeholders::_1;
 using std::shared_ptr;
 using std::string;
 using std::thread;
+using std::unique_lock;
 using std::unique_ptr;
+using std::vector;
 
 
 namespace {
@@ -158,8 +226,14 @@ static bool ValidatePort(const char* flagname, int port) {
 static const bool port_dummy =
     RegisterFlagValidator(&FLAGS_port, &ValidatePort);
 
+// Paths with a kShardPlaceholder are checked once expanded, by the
+// code using them.
+bool IsPerShard(const string& path) {
+  return path.find(kShardPlaceholder) != string::npos;
+}
+
 static bool ValidateRead(const char* flagname, const string& path) {
-  if (access(path.c_str(), R_OK) != 0) {
+  if (!IsPerShard(path) && access(path.c_str(), R_OK) != 0) {
     std::cout << "Cannot access " << flagname << " at " << path << std::endl;
     return false;
   }
@@ -172,7 +246,7 @@ static const bool cert_dummy =
     RegisterFlagValidator(&FLAGS_trusted_cert_file, &ValidateRead);
 
 static bool ValidateWrite(const char* flagname, const string& path) {
-  if (path != "" && access(path.c_str(), W_OK) != 0) {
+  if (path != "" && !IsPerShard(path) && access(path.c_str(), W_OK) != 0) {
     std::cout << "Cannot modify " << flagname << " at " << path << std::endl;
     return false;
   }
@@ -214,6 +288,153 @@ static const bool sign_dummy =
     RegisterFlagValidator(&FLAGS_tree_signing_frequency_seconds,
                           &ValidateIsPositive);
 
+static const bool coalesce_dummy =
+    RegisterFlagValidator(&FLAGS_sequencing_coalesce_ms,
+                          &ValidateIsNonNegative);
+
+static const bool pass_dummy =
+    RegisterFlagValidator(&FLAGS_max_entries_per_sequencing_pass,
+                          &ValidateIsNonNegative);
+
+static const bool deferral_dummy =
+    RegisterFlagValidator(&FLAGS_sequencing_max_deferral_seconds,
+                          &ValidateIsNonNegative);
+
+
+// Lets a thread sleep until a deadline, or until an earlier time
+// requested by other threads. Requests made while the thread is not
+// waiting are coalesced into its next wait, so however many there are,
+// they result in a single wake up.
+class Wakeup {
+ public:
+  Wakeup() : requested_(steady_clock::time_point::max()) {
+  }
+
+  // Has the waiting thread wake up at |when|, unless an earlier time
+  // was requested already.
+  void RequestAt(const steady_clock::time_point& when) {
+    lock_guard<mutex> lock(lock_);
+    if (when < requested_) {
+      requested_ = when;
+      cv_.notify_one();
+    }
+  }
+
+  // Returns true if it woke up because of a request, or false if
+  // |deadline| was reached first.
+  bool WaitUntil(const steady_clock::time_point& deadline) {
+    unique_lock<mutex> lock(lock_);
+    while (true) {
+      const steady_clock::time_point now(steady_clock::now());
+      if (requested_ <= now) {
+        requested_ = steady_clock::time_point::max();
+        return true;
+      }
+      if (deadline <= now) {
+        return false;
+      }
+      cv_.wait_until(lock, std::min(deadline, requested_));
+    }
+  }
+
+ private:
+  mutex lock_;
+  condition_variable cv_;
+  steady_clock::time_point requested_;
+
+  DISALLOW_COPY_AND_ASSIGN(Wakeup);
+};
+
+
+// Wakes the sequencer when the earliest of the new pending entries
+// gets out of the guard window.
+void PendingEntriesUpdated(Wakeup* sequencer_wakeup,
+                           const vector<Update<LoggedCertificate>>& updates) {
+  const uint64_t now_ms(util::TimeInMilliseconds());
+  const int64_t guard_window_ms(FLAGS_guard_window_seconds * 1000);
+  int64_t earliest_delay_ms(-1);
+  for (const auto& update : updates) {
+    const LoggedCertificate& entry(update.handle_.Entry());
+    if (!update.exists_ || entry.has_sequence_number()) {
+      continue;
+    }
+    const int64_t eligible_ms(entry.timestamp() + guard_window_ms);
+    const int64_t delay_ms(
+        std::max<int64_t>(0, eligible_ms - static_cast<int64_t>(now_ms)));
+    if (earliest_delay_ms < 0 || delay_ms < earliest_delay_ms) {
+      earliest_delay_ms = delay_ms;
+    }
+  }
+
+  if (earliest_delay_ms >= 0) {
+    sequencer_wakeup->RequestAt(steady_clock::now() +
+                                milliseconds(earliest_delay_ms));
+  }
+}
+
+
+// Watches the pending entries while this node is master, to wake up
+// the sequencer. Other nodes do not sequence, and would only add to
+// the load on etcd, as each watch fetches all the pending entries when
+// it starts.
+class PendingEntriesWatch {
+ public:
+  PendingEntriesWatch(libevent::Base* base,
+                      ConsistentStore<LoggedCertificate>* store,
+                      Wakeup* sequencer_wakeup)
+      : base_(CHECK_NOTNULL(base)),
+        store_(CHECK_NOTNULL(store)),
+        sequencer_wakeup_(CHECK_NOTNULL(sequencer_wakeup)) {
+  }
+
+  ~PendingEntriesWatch() {
+    Stop();
+  }
+
+  // Starts the watch if |is_master| (or restarts it, if it failed),
+  // and stops it otherwise.
+  void Update(bool is_master) {
+    lock_guard<mutex> lock(lock_);
+    if (task_ && task_->IsDone()) {
+      LOG(WARNING) << "Pending entries watch ended: " << task_->status();
+      task_.reset();
+    }
+    if (is_master && !task_) {
+      VLOG(1) << "Starting the pending entries watch";
+      task_.reset(new util::SyncTask(base_));
+      store_->WatchPendingEntries(bind(&PendingEntriesUpdated,
+                                       sequencer_wakeup_, _1),
+                                  task_->task());
+    } else if (!is_master && task_) {
+      VLOG(1) << "Stopping the pending entries watch";
+      StopLocked();
+    }
+  }
+
+  void Stop() {
+    lock_guard<mutex> lock(lock_);
+    if (task_) {
+      StopLocked();
+    }
+  }
+
+ private:
+  void StopLocked() {
+    task_->Cancel();
+    task_->Wait();
+    task_.reset();
+  }
+
+  libevent::Base* const base_;
+  ConsistentStore<LoggedCertificate>* const store_;
+  Wakeup* const sequencer_wakeup_;
+  mutex lock_;
+  unique_ptr<util::SyncTask> task_;
+
+  DISALLOW_COPY_AND_ASSIGN(PendingEntriesWatch);
+};
+
+
 void CleanUpEntries(ConsistentStore<LoggedCertificate>* store,
                     const function<bool()>& is_master) {
   CHECK_NOTNULL(store);
@@ -250,45 +471,64 @@ void CleanUpEntries(ConsistentStore<LoggedCertificate>* store,
 }
 
 void SequenceEntries(TreeSigner<LoggedCertificate>* tree_signer,
-                     const function<bool()>& is_master) {
+                     const function<bool()>& is_master, Wakeup* wakeup,
+                     Wakeup* signer_wakeup, PendingEntriesWatch* watch) {
   CHECK_NOTNULL(tree_signer);
   CHECK(is_master);
+  CHECK_NOTNULL(wakeup);
+  CHECK_NOTNULL(signer_wakeup);
+  CHECK_NOTNULL(watch);
   const steady_clock::duration period(
       (seconds(FLAGS_sequencing_frequency_seconds)));
   steady_clock::time_point target_run_time(steady_clock::now());
 
   while (true) {
-    if (is_master()) {
+    const steady_clock::time_point run_start(steady_clock::now());
+    const bool master(is_master());
+    watch->Update(master);
+    if (master) {
       const ScopedLatency sequencer_sequence_latency(
           sequencer_sequence_latency_ms.GetScopedLatency());
       util::Status status(tree_signer->SequenceNewEntries());
       if (!status.ok()) {
         LOG(WARNING) << "Problem sequencing new entries: " << status;
+      } else if (FLAGS_sign_after_sequencing) {
+        signer_wakeup->RequestAt(steady_clock::now());
       }
       sequencer_total_runs->Increment(status.ok());
     }
 
+    // Entries arriving while we're sequencing or sleeping here are
+    // picked up by the next run.
+    std::this_thread::sleep_until(run_start +
+                                  milliseconds(FLAGS_sequencing_coalesce_ms));
+
     const steady_clock::time_point now(steady_clock::now());
     while (target_run_time <= now) {
       target_run_time += period;
     }
 
-    std::this_thread::sleep_for(target_run_time - now);
+    wakeup->WaitUntil(target_run_time);
   }
 }
 
 void SignMerkleTree(TreeSigner<LoggedCertificate>* tree_signer,
                     ConsistentStore<LoggedCertificate>* store,
-                    ClusterStateController<LoggedCertificate>* controller) {
+                    ClusterStateController<LoggedCertificate>* controller,
+                    const Database<LoggedCertificate>* db, Wakeup* wakeup) {
   CHECK_NOTNULL(tree_signer);
   CHECK_NOTNULL(store);
   CHECK_NOTNULL(controller);
+  CHECK_NOTNULL(db);
+  CHECK_NOTNULL(wakeup);
   const steady_clock::duration period(
       (seconds(FLAGS_tree_signing_frequency_seconds)));
   steady_clock::time_point target_run_time(steady_clock::now());
+  bool woken_up(false);
 
   while (true) {
-    {
+    // When woken up by the sequencer, only sign if it added entries.
+    if (!woken_up || db->TreeSize() > tree_signer->LatestSTH().tree_size()) {
       ScopedLatency signer_run_latency(
           signer_run_latency_ms.GetScopedLatency());
       const TreeSigner<LoggedCertificate>::UpdateResult result(
@@ -315,18 +555,100 @@ void SignMerkleTree(TreeSigner<LoggedCertificate>* tree_signer,
     while (target_run_time <= now) {
       target_run_time += period;
     }
-    std::this_thread::sleep_for(target_run_time - now);
+    woken_up = wakeup->WaitUntil(target_run_time);
+  }
+}
+
+
+// Waits for one of |signals|, and then leaves the master elections before
+// exiting, which hands mastership over to the next candidate straight away
+// (rather than once our proposal expires). This is the only way the server
+// exits, so it does so anyway if leaving takes longer than it would for our
+// proposals to expire (e.g. because etcd is unreachable).
+void LeaveElectionOnSignal(sigset_t signals,
+                           const vector<MasterElection*>& elections) {
+  int signal_number;
+  CHECK_EQ(0, sigwait(&signals, &signal_number));
+  LOG(WARNING) << "Exiting on signal " << signal_number;
+  const shared_ptr<Notification> left(make_shared<Notification>());
+  thread([elections, left]() {
+    for (MasterElection* const election : elections) {
+      election->StopElection();
+    }
+    left->Notify();
+  }).detach();
+  if (!left->WaitForNotificationWithTimeout(
+          seconds(2 * FLAGS_master_lease_ttl_seconds))) {
+    LOG(WARNING) << "Timed out leaving the master election, exiting anyway";
   }
+  google::FlushLogFiles(google::GLOG_INFO);
+  _exit(EXIT_SUCCESS);
 }
 
+
+// Returns the value of a per-log flag for the log of temporal shard
+// |shard_name| (which is empty without sharding).
+string ForShard(const char* flagname, const string& value,
+                const string& shard_name) {
+  CHECK(value.empty() || IsPerShard(value) == !shard_name.empty())
+      << "--" << flagname << " must contain \"" << kShardPlaceholder
+      << "\" if and only if --temporal_shards is set";
+  return cert_trans::ExpandShardPattern(value, shard_name);
+}
+
+
+Database<LoggedCertificate>* OpenDatabase(const string& shard_name) {
+  const string sqlite_db(ForShard("sqlite_db", FLAGS_sqlite_db, shard_name));
+  const string leveldb_db(
+      ForShard("leveldb_db", FLAGS_leveldb_db, shard_name));
+  if (!sqlite_db.empty()) {
+    return new SQLiteDB<LoggedCertificate>(sqlite_db);
+  } else if (!leveldb_db.empty()) {
+    return new LevelDB<LoggedCertificate>(leveldb_db);
+  }
+
+  return new FileDB<LoggedCertificate>(
+      new FileStorage(ForShard("cert_dir", FLAGS_cert_dir, shard_name),
+                      FLAGS_cert_storage_depth),
+      new FileStorage(ForShard("tree_dir", FLAGS_tree_dir, shard_name),
+                      FLAGS_tree_storage_depth),
+      new FileStorage(ForShard("meta_dir", FLAGS_meta_dir, shard_name), 0));
+}
+
+
+// Everything running one log, of which there is one per temporal
+// shard (or just the one, without sharding).
+struct Log {
+  Log() : db(nullptr) {
+  }
+
+  string name;
+  unique_ptr<LogSigner> log_signer;
+  Database<LoggedCertificate>* db;
+  unique_ptr<Server<LoggedCertificate>> server;
+  unique_ptr<LeafHashFile> leaf_hashes;
+  unique_ptr<TreeSigner<LoggedCertificate>> tree_signer;
+  Wakeup sequencer_wakeup;
+  Wakeup signer_wakeup;
+  unique_ptr<PendingEntriesWatch> pending_entries_watch;
+  vector<thread> threads;
+
+  DISALLOW_COPY_AND_ASSIGN(Log);
+};
+
 }  // namespace
 
 
 int main(int argc, char* argv[]) {
-  // Ignore various signals whilst we start up.
+  // Ignore various signals whilst we start up. The termination signals are
+  // blocked before starting any thread, so that only the thread leaving the
+  // election on exit sees them.
   signal(SIGHUP, SIG_IGN);
-  signal(SIGINT, SIG_IGN);
-  signal(SIGTERM, SIG_IGN);
+  sigset_t termination_signals;
+  sigemptyset(&termination_signals);
+  sigaddset(&termination_signals, SIGINT);
+  sigaddset(&termination_signals, SIGTERM);
+  PCHECK(pthread_sigmask(SIG_BLOCK, &termination_signals, NULL) == 0);
 
   google::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
@@ -334,9 +656,16 @@ int main(int argc, char* argv[]) {
 
   Server<LoggedCertificate>::StaticInit();
 
-  util::StatusOr<EVP_PKEY*> pkey(ReadPrivateKey(FLAGS_key));
-  CHECK_EQ(pkey.status(), util::Status::OK);
-  LogSigner log_signer(pkey.ValueOrDie());
+  const util::StatusOr<vector<TemporalShard>> shards(
+      cert_trans::ParseTemporalShards(FLAGS_temporal_shards));
+  CHECK(shards.ok()) << "Invalid --temporal_shards: " << shards.status();
+  vector<string> log_names;
+  for (const TemporalShard& shard : shards.ValueOrDie()) {
+    log_names.push_back(shard.name);
+  }
+  if (log_names.empty()) {
+    log_names.push_back(string());
+  }
 
   CertChecker checker;
   CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
@@ -354,21 +683,15 @@ int main(int argc, char* argv[]) {
         << "Certificate directory and tree directory must differ";
   }
 
-  Database<LoggedCertificate>* db;
-
-  if (!FLAGS_sqlite_db.empty()) {
-    db = new SQLiteDB<LoggedCertificate>(FLAGS_sqlite_db);
-  } else if (!FLAGS_leveldb_db.empty()) {
-    db = new LevelDB<LoggedCertificate>(FLAGS_leveldb_db);
-  } else {
-    db = new FileDB<LoggedCertificate>(
-        new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
-        new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
-        new FileStorage(FLAGS_meta_dir, 0));
-  }
-
   shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
-  UrlFetcher url_fetcher(event_base.get());
+#ifdef HAVE_NGHTTP2
+  const unique_ptr<UrlFetcher> url_fetcher(
+      FLAGS_url_fetcher_http2
+          ? new cert_trans::Http2UrlFetcher(event_base.get())
+          : new UrlFetcher(event_base.get()));
+#else
+  const unique_ptr<UrlFetcher> url_fetcher(new UrlFetcher(event_base.get()));
+#endif
 
   const bool stand_alone_mode(FLAGS_etcd_host.empty());
   if (stand_alone_mode && !FLAGS_i_know_stand_alone_mode_can_lose_data) {
@@ -377,83 +700,148 @@ int main(int argc, char* argv[]) {
   }
   LOG(INFO) << "Running in "
             << (stand_alone_mode ? "STAND-ALONE" : "CLUSTERED") << " mode.";
+  if (!stand_alone_mode) {
+    CHECK(!FLAGS_server.empty());
+  }
 
   std::unique_ptr<EtcdClient> etcd_client(
       stand_alone_mode
           ? new FakeEtcdClient(event_base.get())
-          : new EtcdClient(&url_fetcher, FLAGS_etcd_host, FLAGS_etcd_port));
-
-  Server<LoggedCertificate>::Options options;
-  options.server = FLAGS_server;
-  options.port = FLAGS_port;
-  options.etcd_root = FLAGS_etcd_root;
-  options.num_http_server_threads = FLAGS_num_http_server_threads;
-
-  Server<LoggedCertificate> server(options, event_base, db, etcd_client.get(),
-                                   &url_fetcher, &log_signer, &checker);
-  server.Initialise(false /* is_mirror */);
-
-  TreeSigner<LoggedCertificate> tree_signer(
-      std::chrono::duration<double>(FLAGS_guard_window_seconds), db,
-      server.log_lookup()->GetCompactMerkleTree(new Sha256Hasher),
-      server.consistent_store(), &log_signer);
-
-  if (stand_alone_mode) {
-    // Set up a simple single-node environment.
-    //
-    // Put a sensible single-node config into FakeEtcd. For a real clustered
-    // log
-    // we'd expect a ClusterConfig already to be present within etcd as part of
-    // the provisioning of the log.
-    //
-    // TODO(alcutter): Note that we're currently broken wrt to restarting the
-    // log server when there's data in the log.  It's a temporary thing though,
-    // so fear ye not.
-    ct::ClusterConfig config;
-    config.set_minimum_serving_nodes(1);
-    config.set_minimum_serving_fraction(1);
-    LOG(INFO) << "Setting default single-node ClusterConfig:\n"
-              << config.DebugString();
-    server.consistent_store()->SetClusterConfig(config);
-
-    // Since we're a single node cluster, we'll settle that we're the
-    // master here, so that we can populate the initial STH
-    // (StrictConsistentStore won't allow us to do so unless we're master.)
-    server.election()->StartElection();
-    server.election()->WaitToBecomeMaster();
-
-    {
-      EtcdClient::Response resp;
-      util::SyncTask task(event_base.get());
-      etcd_client->Create("/root/sequence_mapping", "", &resp, task.task());
-      task.Wait();
-      CHECK_EQ(util::Status::OK, task.status());
+          : new EtcdClient(url_fetcher.get(), FLAGS_etcd_host,
+                           FLAGS_etcd_port));
+
+  const util::StatusOr<std::map<string, double>> issuer_weights(
+      FairSequencingPolicy::ParseWeights(FLAGS_sequencing_issuer_weights));
+  CHECK(issuer_weights.ok()) << "Invalid --sequencing_issuer_weights: "
+                             << issuer_weights.status();
+  const FairSequencingPolicy sequencing_policy(
+      FLAGS_max_entries_per_sequencing_pass, issuer_weights.ValueOrDie(), 1,
+      seconds(FLAGS_sequencing_max_deferral_seconds));
+
+  // The first log owns the HTTP server (and runs the event loop), the
+  // others only add their handlers to it.
+  vector<unique_ptr<Log>> logs;
+  for (size_t i = 0; i < log_names.size(); ++i) {
+    logs.emplace_back(new Log);
+    Log* const log(logs.back().get());
+    log->name = log_names[i];
+
+    const string key(ForShard("key", FLAGS_key, log->name));
+    util::StatusOr<EVP_PKEY*> pkey(ReadPrivateKey(key));
+    CHECK_EQ(pkey.status(), util::Status::OK) << key;
+    log->log_signer.reset(new LogSigner(pkey.ValueOrDie()));
+
+    log->db = OpenDatabase(log->name);
+
+    Server<LoggedCertificate>::Options options;
+    options.server = FLAGS_server;
+    options.port = FLAGS_port;
+    options.etcd_root = ForShard("etcd_root", FLAGS_etcd_root, log->name);
+    options.path_prefix = log->name.empty() ? string() : "/" + log->name;
+    options.temporal_shard =
+        shards.ValueOrDie().empty() ? nullptr : &shards.ValueOrDie()[i];
+    options.num_http_server_threads = FLAGS_num_http_server_threads;
+
+    log->server.reset(new Server<LoggedCertificate>(
+        options, event_base, log->db, etcd_client.get(), url_fetcher.get(),
+        log->log_signer.get(), &checker,
+        logs.size() > 1 ? logs.front()->server.get() : nullptr));
+    log->server->Initialise(false /* is_mirror */);
+
+    const string leaf_hash_file(
+        ForShard("leaf_hash_file", FLAGS_leaf_hash_file, log->name));
+    if (!leaf_hash_file.empty()) {
+      log->leaf_hashes.reset(new LeafHashFile(leaf_hash_file));
     }
+    log->tree_signer.reset(new TreeSigner<LoggedCertificate>(
+        std::chrono::duration<double>(FLAGS_guard_window_seconds), log->db,
+        log->server->log_lookup()->GetCompactMerkleTree(new Sha256Hasher),
+        log->server->consistent_store(), log->log_signer.get(),
+        log->leaf_hashes.get(), &sequencing_policy));
+
+    if (stand_alone_mode) {
+      // Set up a simple single-node environment.
+      //
+      // Put a sensible single-node config into FakeEtcd. For a real
+      // clustered log we'd expect a ClusterConfig already to be present
+      // within etcd as part of the provisioning of the log.
+      //
+      // TODO(alcutter): Note that we're currently broken wrt to restarting
+      // the log server when there's data in the log.  It's a temporary
+      // thing though, so fear ye not.
+      ct::ClusterConfig config;
+      config.set_minimum_serving_nodes(1);
+      config.set_minimum_serving_fraction(1);
+      LOG(INFO) << "Setting default single-node ClusterConfig:\n"
+                << config.DebugString();
+      log->server->consistent_store()->SetClusterConfig(config);
+
+      // Since we're a single node cluster, we'll settle that we're the
+      // master here, so that we can populate the initial STH
+      // (StrictConsistentStore won't allow us to do so unless we're
+      // master.)
+      log->server->election()->StartElection();
+      log->server->election()->WaitToBecomeMaster();
+
+      {
+        EtcdClient::Response resp;
+        util::SyncTask task(event_base.get());
+        etcd_client->Create(options.etcd_root + "/sequence_mapping", "",
+                            &resp, task.task());
+        task.Wait();
+        CHECK_EQ(util::Status::OK, task.status());
+      }
 
-    // Do an initial signing run to get the initial STH, again this is
-    // temporary until we re-populate FakeEtcd from the DB.
-    CHECK_EQ(tree_signer.UpdateTree(), TreeSigner<LoggedCertificate>::OK);
+      // Do an initial signing run to get the initial STH, again this is
+      // temporary until we re-populate FakeEtcd from the DB.
+      CHECK_EQ(log->tree_signer->UpdateTree(),
+               TreeSigner<LoggedCertificate>::OK);
 
-    // Need to boot-strap the Serving STH too because we consider it an error
-    // if it's not set, which in turn causes us to not attempt to become
-    // master:
-    server.consistent_store()->SetServingSTH(tree_signer.LatestSTH());
-  } else {
-    CHECK(!FLAGS_server.empty());
+      // Need to boot-strap the Serving STH too because we consider it an
+      // error if it's not set, which in turn causes us to not attempt to
+      // become master:
+      log->server->consistent_store()->SetServingSTH(
+          log->tree_signer->LatestSTH());
+    }
   }
 
+  JsonOutput routing_output(event_base.get());
+  if (!shards.ValueOrDie().empty()) {
+    vector<HttpHandler*> handlers;
+    for (const auto& log : logs) {
+      handlers.push_back(log->server->http_handler());
+    }
+    HttpHandler::AddTemporalShardRouting(logs.front()->server->http_server(),
+                                         &routing_output, handlers);
+  }
 
   // TODO(pphaneuf): We should be remaining in an "unhealthy state"
   // (either not accepting any requests, or returning some internal
   // server error) until we have an STH to serve.
-  const function<bool()> is_master(
-      bind(&Server<LoggedCertificate>::IsMaster, &server));
-  thread sequencer(&SequenceEntries, &tree_signer, is_master);
-  thread cleanup(&CleanUpEntries, server.consistent_store(), is_master);
-  thread signer(&SignMerkleTree, &tree_signer, server.consistent_store(),
-                server.cluster_state_controller());
-
-  server.Run();
+  vector<MasterElection*> elections;
+  for (const auto& log : logs) {
+    const function<bool()> is_master(
+        bind(&Server<LoggedCertificate>::IsMaster, log->server.get()));
+    log->pending_entries_watch.reset(new PendingEntriesWatch(
+        event_base.get(), log->server->consistent_store(),
+        &log->sequencer_wakeup));
+    log->threads.emplace_back(&SequenceEntries, log->tree_signer.get(),
+                              is_master, &log->sequencer_wakeup,
+                              &log->signer_wakeup,
+                              log->pending_entries_watch.get());
+    log->threads.emplace_back(&CleanUpEntries,
+                              log->server->consistent_store(), is_master);
+    log->threads.emplace_back(&SignMerkleTree, log->tree_signer.get(),
+                              log->server->consistent_store(),
+                              log->server->cluster_state_controller(),
+                              log->db, &log->signer_wakeup);
+    elections.push_back(log->server->election());
+  }
+  thread leave_election(&LeaveElectionOnSignal, termination_signals,
+                        elections);
+
+  // Never returns, LeaveElectionOnSignal() exits the process.
+  logs.front()->server->Run();
 
   return 0;
 }
@@ -0,0 +1,63 @@
+#include "server/dns_response_cache.h"
+
+#include <glog/logging.h>
+
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+// The transaction ID is the first two bytes of the twelve-byte DNS
+// header (RFC 1035, section 4.1.1).
+const size_t kIdSize = 2;
+const size_t kHeaderSize = 12;
+
+
+}  // namespace
+
+
+DnsResponseCache::DnsResponseCache(size_t max_entries)
+    : max_entries_(max_entries) {
+  CHECK_GT(max_entries_, 0U);
+}
+
+
+bool DnsResponseCache::Lookup(const char* query, size_t len, string* reply) {
+  if (len < kHeaderSize) {
+    return false;
+  }
+
+  key_.assign(query + kIdSize, len - kIdSize);
+  const auto it(replies_.find(key_));
+  if (it == replies_.end()) {
+    return false;
+  }
+
+  *reply = it->second;
+  reply->replace(0, kIdSize, query, kIdSize);
+  return true;
+}
+
+
+void DnsResponseCache::Insert(const char* query, size_t len,
+                              const string& reply) {
+  if (len < kHeaderSize || reply.size() < kHeaderSize) {
+    return;
+  }
+
+  // Under a flood of distinct queries, any eviction policy does
+  // badly, so keep it simple.
+  if (replies_.size() >= max_entries_) {
+    Clear();
+  }
+  replies_[string(query + kIdSize, len - kIdSize)] = reply;
+}
+
+
+void DnsResponseCache::Clear() {
+  replies_.clear();
+}
+
+
+}  // namespace cert_trans
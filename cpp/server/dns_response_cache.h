@@ -0,0 +1,55 @@
+#ifndef CERT_TRANS_SERVER_DNS_RESPONSE_CACHE_H_
+#define CERT_TRANS_SERVER_DNS_RESPONSE_CACHE_H_
+
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Caches wire-format DNS replies, keyed by the query they answer.
+// Queries are compared byte for byte, except for their transaction
+// ID, which is patched into the cached reply on the way out. This
+// allows answering repeated queries without parsing them, or building
+// the reply.
+//
+// This class is not thread-safe.
+class DnsResponseCache {
+ public:
+  // Once |max_entries| replies are cached, the cache is cleared to
+  // make room for new ones.
+  explicit DnsResponseCache(size_t max_entries);
+
+  // If a reply to |query| is cached, sets |reply| to it, with the
+  // transaction ID of |query|, and returns true.
+  bool Lookup(const char* query, size_t len, std::string* reply);
+
+  // Caches |reply| as the answer to |query|. Queries too short to be
+  // DNS messages are ignored.
+  void Insert(const char* query, size_t len, const std::string& reply);
+
+  // Drops every cached reply. Must be called whenever the data the
+  // replies were built from changes (e.g. a new STH).
+  void Clear();
+
+  size_t size() const {
+    return replies_.size();
+  }
+
+ private:
+  const size_t max_entries_;
+  std::unordered_map<std::string, std::string> replies_;
+  // Reused to build the lookup keys, to avoid an allocation per
+  // lookup.
+  std::string key_;
+
+  DISALLOW_COPY_AND_ASSIGN(DnsResponseCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_DNS_RESPONSE_CACHE_H_
@@ -0,0 +1,108 @@
+#include "server/dns_response_cache.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+
+
+// A DNS header (ID, flags, and counts) followed by |question|.
+string Message(const string& id, const string& question) {
+  return id + string("\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00", 10) +
+         question;
+}
+
+
+class DnsResponseCacheTest : public ::testing::Test {
+ protected:
+  DnsResponseCacheTest() : cache_(3) {
+  }
+
+  bool Lookup(const string& query, string* reply) {
+    return cache_.Lookup(query.data(), query.size(), reply);
+  }
+
+  void Insert(const string& query, const string& reply) {
+    cache_.Insert(query.data(), query.size(), reply);
+  }
+
+  DnsResponseCache cache_;
+};
+
+
+TEST_F(DnsResponseCacheTest, PatchesTransactionId) {
+  Insert(Message("ab", "sth"), Message("ab", "sth answer"));
+
+  string reply;
+  ASSERT_TRUE(Lookup(Message("xy", "sth"), &reply));
+  EXPECT_EQ(Message("xy", "sth answer"), reply);
+
+  // The cached reply must not have been modified.
+  ASSERT_TRUE(Lookup(Message("ab", "sth"), &reply));
+  EXPECT_EQ(Message("ab", "sth answer"), reply);
+}
+
+
+TEST_F(DnsResponseCacheTest, MatchesWholeQuery) {
+  Insert(Message("ab", "sth"), Message("ab", "sth answer"));
+
+  string reply;
+  EXPECT_FALSE(Lookup(Message("ab", "STH"), &reply));
+  EXPECT_FALSE(Lookup(Message("ab", "sth."), &reply));
+
+  string other_flags(Message("ab", "sth"));
+  other_flags[2] = '\0';
+  EXPECT_FALSE(Lookup(other_flags, &reply));
+}
+
+
+TEST_F(DnsResponseCacheTest, IgnoresShortMessages) {
+  Insert("short", Message("ab", "answer"));
+  Insert(Message("ab", "sth"), "short");
+  EXPECT_EQ(0U, cache_.size());
+
+  string reply;
+  EXPECT_FALSE(Lookup("short", &reply));
+  EXPECT_FALSE(Lookup(Message("ab", "sth"), &reply));
+}
+
+
+TEST_F(DnsResponseCacheTest, Clear) {
+  Insert(Message("ab", "sth"), Message("ab", "sth answer"));
+  cache_.Clear();
+  EXPECT_EQ(0U, cache_.size());
+
+  string reply;
+  EXPECT_FALSE(Lookup(Message("ab", "sth"), &reply));
+}
+
+
+TEST_F(DnsResponseCacheTest, ClearsWhenFull) {
+  Insert(Message("ab", "1"), Message("ab", "one"));
+  Insert(Message("ab", "2"), Message("ab", "two"));
+  Insert(Message("ab", "3"), Message("ab", "three"));
+  EXPECT_EQ(3U, cache_.size());
+
+  Insert(Message("ab", "4"), Message("ab", "four"));
+  EXPECT_EQ(1U, cache_.size());
+
+  string reply;
+  EXPECT_FALSE(Lookup(Message("ab", "1"), &reply));
+  ASSERT_TRUE(Lookup(Message("ab", "4"), &reply));
+  EXPECT_EQ(Message("ab", "four"), reply);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
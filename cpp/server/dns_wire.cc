@@ -0,0 +1,142 @@
+#include "server/dns_wire.h"
+
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+// See RFC 1035, section 4.1.
+const size_t kHeaderSize = 12;
+const size_t kMaxNameSize = 255;
+const size_t kMaxCharacterStringSize = 255;
+const uint16_t kTypeTxt = 16;
+const uint16_t kClassIn = 1;
+// A pointer to the name of the question, which always starts right
+// after the header.
+const uint16_t kQuestionNamePointer = 0xc000 | kHeaderSize;
+
+
+uint16_t Read16(const char* buf) {
+  return (static_cast<uint8_t>(buf[0]) << 8) | static_cast<uint8_t>(buf[1]);
+}
+
+
+void Append16(uint16_t value, string* out) {
+  out->push_back(static_cast<char>(value >> 8));
+  out->push_back(static_cast<char>(value));
+}
+
+
+void Append32(uint32_t value, string* out) {
+  Append16(value >> 16, out);
+  Append16(value, out);
+}
+
+
+// Whether |c| can appear in a name as is, in presentation format. This
+// is more restrictive than necessary, but covers everything CT over
+// DNS uses, including base64.
+bool IsPlainNameCharacter(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '+' ||
+         c == '/' || c == '=';
+}
+
+
+}  // namespace
+
+
+bool ParseDnsTxtQuery(const char* buf, size_t len, DnsTxtQuery* query) {
+  if (len < kHeaderSize) {
+    return false;
+  }
+
+  // QR must be 0 (a query), and the opcode 0 (QUERY). The other flags
+  // do not matter.
+  if ((static_cast<uint8_t>(buf[2]) & 0xf8) != 0) {
+    return false;
+  }
+
+  // QDCOUNT, ANCOUNT, NSCOUNT and ARCOUNT.
+  if (Read16(buf + 4) != 1 || Read16(buf + 6) != 0 || Read16(buf + 8) != 0 ||
+      Read16(buf + 10) != 0) {
+    return false;
+  }
+
+  query->id = Read16(buf);
+  query->name.clear();
+
+  size_t pos(kHeaderSize);
+  while (true) {
+    if (pos >= len) {
+      return false;
+    }
+    const uint8_t label_len(buf[pos]);
+    ++pos;
+    if (label_len == 0) {
+      break;
+    }
+    // Refuse compression pointers (and the reserved label types).
+    if ((label_len & 0xc0) != 0 || pos + label_len > len ||
+        pos - kHeaderSize + label_len > kMaxNameSize) {
+      return false;
+    }
+    for (size_t i = pos; i < pos + label_len; ++i) {
+      if (!IsPlainNameCharacter(buf[i])) {
+        return false;
+      }
+    }
+    query->name.append(buf + pos, label_len);
+    query->name.push_back('.');
+    pos += label_len;
+  }
+
+  // The root name is not something we answer for.
+  if (query->name.empty()) {
+    return false;
+  }
+
+  // QTYPE and QCLASS, which must end the message.
+  if (pos + 4 != len || Read16(buf + pos) != kTypeTxt ||
+      Read16(buf + pos + 2) != kClassIn) {
+    return false;
+  }
+
+  query->question = buf + kHeaderSize;
+  query->question_len = len - kHeaderSize;
+
+  return true;
+}
+
+
+bool EncodeDnsTxtResponse(const DnsTxtQuery& query, const string* txt,
+                          uint32_t ttl, string* reply) {
+  if (txt && txt->size() > kMaxCharacterStringSize) {
+    return false;
+  }
+
+  reply->clear();
+  Append16(query.id, reply);
+  // Only QR is set, like the responses built with ldns used to be.
+  Append16(0x8000, reply);
+  Append16(1, reply);  // QDCOUNT
+  Append16(txt ? 1 : 0, reply);  // ANCOUNT
+  Append16(0, reply);  // NSCOUNT
+  Append16(0, reply);  // ARCOUNT
+  reply->append(query.question, query.question_len);
+
+  if (txt) {
+    Append16(kQuestionNamePointer, reply);
+    Append16(kTypeTxt, reply);
+    Append16(kClassIn, reply);
+    Append32(ttl, reply);
+    Append16(1 + txt->size(), reply);  // RDLENGTH
+    reply->push_back(static_cast<char>(txt->size()));
+    reply->append(*txt);
+  }
+
+  return true;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,47 @@
+#ifndef CERT_TRANS_SERVER_DNS_WIRE_H_
+#define CERT_TRANS_SERVER_DNS_WIRE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace cert_trans {
+
+
+// A query for the TXT record of a single name, which is the only kind
+// of query CT over DNS uses.
+struct DnsTxtQuery {
+  uint16_t id;
+  // The name queried, in presentation format with a trailing dot
+  // (e.g. "sth.example.com."), as ldns_rdf2buffer_str_dname() would
+  // print it.
+  std::string name;
+  // The question section of the query, which is echoed in the
+  // response. Points into the buffer passed to ParseDnsTxtQuery().
+  const char* question;
+  size_t question_len;
+};
+
+
+// Parses |buf| as a standard query with a single IN TXT question, and
+// no other records. This only handles the common case, and returns
+// false for anything else, including some valid queries (e.g. with
+// EDNS, compressed names, or characters that would need escaping in
+// the name): those should be handled by a general purpose DNS library
+// instead.
+//
+// Reusing the same |query| avoids any allocation, once its |name| is
+// large enough.
+bool ParseDnsTxtQuery(const char* buf, size_t len, DnsTxtQuery* query);
+
+// Sets |reply| to the response to |query|, which has a single TXT
+// record holding |txt| as its answer, or no answer at all if |txt| is
+// NULL. Returns false if |txt| does not fit in a single
+// character-string (255 bytes).
+bool EncodeDnsTxtResponse(const DnsTxtQuery& query, const std::string* txt,
+                          uint32_t ttl, std::string* reply);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_DNS_WIRE_H_
@@ -0,0 +1,220 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <ldns/ldns.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "server/dns_wire.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+DEFINE_int32(dns_wire_iterations, 20000,
+             "Number of times to answer each query with each encoder.");
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::to_string;
+using std::vector;
+
+const char kDomain[] = "example.com.";
+const uint32_t kTtl = 123;
+
+
+// A query like the ones ct-dns-server-test.py sends.
+string MakeQuery(uint16_t id, const string& name) {
+  ldns_rdf* const dname(ldns_dname_new_frm_str(name.c_str()));
+  CHECK(dname);
+  ldns_pkt* const query(ldns_pkt_query_new(dname, LDNS_RR_TYPE_TXT,
+                                           LDNS_RR_CLASS_IN, LDNS_RD));
+  CHECK(query);
+  ldns_pkt_set_id(query, id);
+
+  uint8_t* wire;
+  size_t wire_size;
+  CHECK_EQ(LDNS_STATUS_OK, ldns_pkt2wire(&wire, query, &wire_size));
+  const string retval(reinterpret_cast<const char*>(wire), wire_size);
+  free(wire);
+  ldns_pkt_free(query);
+
+  return retval;
+}
+
+
+// Stands in for the database lookups, which are not what is being
+// measured.
+string Response(const string& name) {
+  return "1234." + to_string(name.size()) +
+         ".9t/V2aibZkMUmgVE2pWx4K5rrXz1K5O0pO6A9GwQ9AY=";
+}
+
+
+// How ct-dns-server answered queries before DnsTxtQuery, for
+// comparison.
+bool AnswerWithLdns(const string& buf, string* reply) {
+  ldns_pkt* packet = NULL;
+  if (ldns_wire2pkt(&packet, reinterpret_cast<const uint8_t*>(buf.data()),
+                    buf.size()) != LDNS_STATUS_OK) {
+    return false;
+  }
+
+  ldns_pkt* answers = ldns_pkt_new();
+  ldns_pkt_set_id(answers, ldns_pkt_id(packet));
+  ldns_pkt_set_qr(answers, true);
+
+  ldns_rr_list* questions = ldns_pkt_question(packet);
+  ldns_pkt_safe_push_rr_list(answers, LDNS_SECTION_QUESTION,
+                             ldns_rr_list_clone(questions));
+
+  for (size_t n = 0; n < ldns_rr_list_rr_count(questions); ++n) {
+    ldns_rr* question = ldns_rr_list_rr(questions, n);
+    ldns_buffer* dname = ldns_buffer_new(512);
+    CHECK_EQ(LDNS_STATUS_OK,
+             ldns_rdf2buffer_str_dname(dname, ldns_rr_owner(question)));
+    char* owner_name_raw = ldns_buffer2str(dname);
+    const string owner_name(owner_name_raw);
+    free(owner_name_raw);
+    ldns_buffer_free(dname);
+
+    const string response(Response(owner_name));
+    ldns_rr* answer = ldns_rr_new();
+    ldns_rr_set_owner(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_DNAME,
+                                                   owner_name.c_str()));
+    ldns_rr_set_type(answer, LDNS_RR_TYPE_TXT);
+    ldns_rr_set_ttl(answer, kTtl);
+    ldns_rr_push_rdf(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_STR,
+                                                  response.c_str()));
+    ldns_pkt_safe_push_rr(answers, LDNS_SECTION_ANSWER, answer);
+  }
+  ldns_pkt_free(packet);
+
+  uint8_t* wire_answer;
+  size_t answer_size;
+  CHECK_EQ(LDNS_STATUS_OK, ldns_pkt2wire(&wire_answer, answers, &answer_size));
+  reply->assign(reinterpret_cast<const char*>(wire_answer), answer_size);
+  free(wire_answer);
+  ldns_pkt_free(answers);
+
+  return true;
+}
+
+
+bool AnswerWithDnsWire(const string& buf, DnsTxtQuery* query,
+                       string* response, string* reply) {
+  if (!ParseDnsTxtQuery(buf.data(), buf.size(), query)) {
+    return false;
+  }
+  *response = Response(query->name);
+  return EncodeDnsTxtResponse(*query, response, kTtl, reply);
+}
+
+
+// Returns the owner and text of the only answer in |reply|.
+void DecodeReply(const string& reply, uint16_t* id, string* owner,
+                 string* txt) {
+  ldns_pkt* packet = NULL;
+  ASSERT_EQ(LDNS_STATUS_OK,
+            ldns_wire2pkt(&packet,
+                          reinterpret_cast<const uint8_t*>(reply.data()),
+                          reply.size()));
+  *id = ldns_pkt_id(packet);
+  ldns_rr_list* const answers(ldns_pkt_answer(packet));
+  ASSERT_EQ(1U, ldns_rr_list_rr_count(answers));
+  ldns_rr* const answer(ldns_rr_list_rr(answers, 0));
+  EXPECT_EQ(LDNS_RR_TYPE_TXT, ldns_rr_get_type(answer));
+  EXPECT_EQ(kTtl, ldns_rr_ttl(answer));
+
+  char* const owner_str(ldns_rdf2str(ldns_rr_owner(answer)));
+  *owner = owner_str;
+  free(owner_str);
+  char* const txt_str(ldns_rdf2str(ldns_rr_rdf(answer, 0)));
+  *txt = txt_str;
+  free(txt_str);
+
+  ldns_pkt_free(packet);
+}
+
+
+class DnsWireLargeTest : public ::testing::Test {
+ protected:
+  DnsWireLargeTest() {
+    // The shapes of query used by ct-dns-server-test.py.
+    uint16_t id(0);
+    queries_.push_back(MakeQuery(++id, string("sth.") + kDomain));
+    for (int i = 0; i < 10; ++i) {
+      queries_.push_back(
+          MakeQuery(++id, to_string(i * 37) + ".leafhash." + kDomain));
+      const string node(to_string(i) + "." + to_string(i * 37) + ".1000");
+      queries_.push_back(MakeQuery(++id, node + ".tree." + kDomain));
+    }
+  }
+
+  void LogThroughput(const string& encoder, uint64_t elapsed_ms) {
+    const int64_t num_queries(static_cast<int64_t>(queries_.size()) *
+                              FLAGS_dns_wire_iterations);
+    const int original_log_level(FLAGS_minloglevel);
+    FLAGS_minloglevel = 0;
+    LOG(INFO) << encoder << ": " << num_queries << " queries in "
+              << elapsed_ms << " ms ("
+              << (elapsed_ms > 0 ? num_queries * 1000 / elapsed_ms : 0)
+              << " queries/s)";
+    FLAGS_minloglevel = original_log_level;
+  }
+
+  vector<string> queries_;
+};
+
+
+TEST_F(DnsWireLargeTest, MatchesLdns) {
+  DnsTxtQuery query;
+  string response;
+  for (const string& buf : queries_) {
+    string ldns_reply, reply;
+    ASSERT_TRUE(AnswerWithLdns(buf, &ldns_reply));
+    ASSERT_TRUE(AnswerWithDnsWire(buf, &query, &response, &reply));
+
+    uint16_t expected_id, id;
+    string expected_owner, owner, expected_txt, txt;
+    DecodeReply(ldns_reply, &expected_id, &expected_owner, &expected_txt);
+    DecodeReply(reply, &id, &owner, &txt);
+    EXPECT_EQ(expected_id, id);
+    EXPECT_EQ(expected_owner, owner);
+    EXPECT_EQ(expected_txt, txt);
+  }
+}
+
+
+TEST_F(DnsWireLargeTest, Throughput) {
+  string reply;
+  uint64_t start(util::TimeInMilliseconds());
+  for (int i = 0; i < FLAGS_dns_wire_iterations; ++i) {
+    for (const string& buf : queries_) {
+      ASSERT_TRUE(AnswerWithLdns(buf, &reply));
+    }
+  }
+  LogThroughput("ldns", util::TimeInMilliseconds() - start);
+
+  DnsTxtQuery query;
+  string response;
+  start = util::TimeInMilliseconds();
+  for (int i = 0; i < FLAGS_dns_wire_iterations; ++i) {
+    for (const string& buf : queries_) {
+      ASSERT_TRUE(AnswerWithDnsWire(buf, &query, &response, &reply));
+    }
+  }
+  LogThroughput("DnsTxtQuery", util::TimeInMilliseconds() - start);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
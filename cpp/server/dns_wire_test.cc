@@ -0,0 +1,181 @@
+#include "server/dns_wire.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+
+
+string Bytes16(uint16_t value) {
+  return string(1, static_cast<char>(value >> 8)) +
+         string(1, static_cast<char>(value));
+}
+
+
+// Encodes |name| ("sth.example.com") as a sequence of labels.
+string WireName(const string& name) {
+  string retval;
+  size_t start(0);
+  while (start < name.size()) {
+    size_t end(name.find('.', start));
+    if (end == string::npos) {
+      end = name.size();
+    }
+    retval.push_back(static_cast<char>(end - start));
+    retval.append(name, start, end - start);
+    start = end + 1;
+  }
+  retval.push_back('\0');
+  return retval;
+}
+
+
+string Question(const string& name, uint16_t type = 16, uint16_t cls = 1) {
+  return WireName(name) + Bytes16(type) + Bytes16(cls);
+}
+
+
+// A query with the RD flag set, as most resolvers send.
+string Query(uint16_t id, const string& question, uint16_t qdcount = 1,
+             uint16_t arcount = 0) {
+  return Bytes16(id) + Bytes16(0x0100) + Bytes16(qdcount) + Bytes16(0) +
+         Bytes16(0) + Bytes16(arcount) + question;
+}
+
+
+bool Parse(const string& buf, DnsTxtQuery* query) {
+  return ParseDnsTxtQuery(buf.data(), buf.size(), query);
+}
+
+
+TEST(DnsWireTest, ParsesQuery) {
+  const string buf(Query(0x1234, Question("sth.example.com")));
+  DnsTxtQuery query;
+  ASSERT_TRUE(Parse(buf, &query));
+  EXPECT_EQ(0x1234, query.id);
+  EXPECT_EQ("sth.example.com.", query.name);
+  EXPECT_EQ(Question("sth.example.com"),
+            string(query.question, query.question_len));
+}
+
+
+TEST(DnsWireTest, ParsesBase64Labels) {
+  DnsTxtQuery query;
+  ASSERT_TRUE(Parse(Query(1, Question("ab+/cd==.hash.example.com")), &query));
+  EXPECT_EQ("ab+/cd==.hash.example.com.", query.name);
+}
+
+
+TEST(DnsWireTest, ReusesQuery) {
+  DnsTxtQuery query;
+  ASSERT_TRUE(Parse(Query(1, Question("1.2.3.tree.example.com")), &query));
+  ASSERT_TRUE(Parse(Query(2, Question("sth.example.com")), &query));
+  EXPECT_EQ(2, query.id);
+  EXPECT_EQ("sth.example.com.", query.name);
+}
+
+
+TEST(DnsWireTest, RefusesUnusualQueries) {
+  const string question(Question("sth.example.com"));
+  const string valid(Query(1, question));
+  DnsTxtQuery query;
+  ASSERT_TRUE(Parse(valid, &query));
+
+  // Truncated anywhere.
+  for (size_t len = 0; len < valid.size(); ++len) {
+    EXPECT_FALSE(Parse(valid.substr(0, len), &query)) << len;
+  }
+  // Trailing garbage.
+  EXPECT_FALSE(Parse(valid + "x", &query));
+
+  // Not a query, or not a standard query.
+  string response(valid);
+  response[2] |= 0x80;
+  EXPECT_FALSE(Parse(response, &query));
+  string notify(valid);
+  notify[2] |= 4 << 3;
+  EXPECT_FALSE(Parse(notify, &query));
+
+  // Not exactly one question, or additional records (e.g. EDNS).
+  EXPECT_FALSE(Parse(Query(1, question + question, 2), &query));
+  EXPECT_FALSE(Parse(Query(1, "", 0), &query));
+  EXPECT_FALSE(Parse(Query(1, question, 1, 1), &query));
+
+  // Not IN TXT.
+  EXPECT_FALSE(Parse(Query(1, Question("sth.example.com", 1)), &query));
+  EXPECT_FALSE(Parse(Query(1, Question("sth.example.com", 16, 3)), &query));
+
+  // The root name, names needing escaping, and compression pointers.
+  EXPECT_FALSE(Parse(Query(1, Question("")), &query));
+  EXPECT_FALSE(Parse(Query(1, Question("s h.example.com")), &query));
+  EXPECT_FALSE(Parse(Query(1, Question("s\\h.example.com")), &query));
+  EXPECT_FALSE(Parse(Query(1, string("\xc0\x0c", 2) + Bytes16(16) +
+                                  Bytes16(1)),
+                     &query));
+
+  // Labels too long.
+  EXPECT_FALSE(Parse(Query(1, Question(string(64, 'a') + ".com")), &query));
+}
+
+
+TEST(DnsWireTest, EncodesAnswer) {
+  const string question(Question("sth.example.com"));
+  const string buf(Query(0xabcd, question));
+  DnsTxtQuery query;
+  ASSERT_TRUE(Parse(buf, &query));
+
+  const string txt("1.2.abc=.def=");
+  string reply("previous contents");
+  ASSERT_TRUE(EncodeDnsTxtResponse(query, &txt, 123, &reply));
+  EXPECT_EQ(Bytes16(0xabcd) + Bytes16(0x8000) + Bytes16(1) + Bytes16(1) +
+                Bytes16(0) + Bytes16(0) + question +
+                // Answer: pointer to the question name, TXT, IN.
+                Bytes16(0xc00c) + Bytes16(16) + Bytes16(1) +
+                // TTL, RDLENGTH, and the character-string.
+                Bytes16(0) + Bytes16(123) + Bytes16(1 + txt.size()) +
+                string(1, static_cast<char>(txt.size())) + txt,
+            reply);
+}
+
+
+TEST(DnsWireTest, EncodesNoAnswer) {
+  const string question(Question("sth.example.org"));
+  // |query| points into |buf|, which has to outlive it.
+  const string buf(Query(7, question));
+  DnsTxtQuery query;
+  ASSERT_TRUE(Parse(buf, &query));
+
+  string reply;
+  ASSERT_TRUE(EncodeDnsTxtResponse(query, NULL, 123, &reply));
+  EXPECT_EQ(Bytes16(7) + Bytes16(0x8000) + Bytes16(1) + Bytes16(0) +
+                Bytes16(0) + Bytes16(0) + question,
+            reply);
+}
+
+
+TEST(DnsWireTest, RefusesLongAnswers) {
+  const string buf(Query(7, Question("sth.example.com")));
+  DnsTxtQuery query;
+  ASSERT_TRUE(Parse(buf, &query));
+
+  string reply;
+  const string max_txt(255, 'a');
+  EXPECT_TRUE(EncodeDnsTxtResponse(query, &max_txt, 123, &reply));
+  const string long_txt(256, 'a');
+  EXPECT_FALSE(EncodeDnsTxtResponse(query, &long_txt, 123, &reply));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
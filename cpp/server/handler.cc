@@ -23,6 +23,7 @@
 #include "monitoring/latency.h"
 #include "server/json_output.h"
 #include "server/proxy.h"
+#include "util/json_reader.h"
 #include "util/json_wrapper.h"
 #include "util/thread_pool.h"
 
@@ -34,10 +35,13 @@ using cert_trans::CertChecker;
 using cert_trans::Counter;
 using cert_trans::HttpHandler;
 using cert_trans::JsonOutput;
+using cert_trans::JsonReader;
 using cert_trans::Latency;
 using cert_trans::LoggedCertificate;
 using cert_trans::Proxy;
+using cert_trans::PreCertChain;
 using cert_trans::ScopedLatency;
+using cert_trans::TemporalShard;
 using ct::ShortMerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
@@ -60,6 +64,9 @@ using std::vector;
 DEFINE_int32(max_leaf_entries_per_response, 1000,
              "maximum number of entries to put in the response of a "
              "get-entries request");
+DEFINE_int32(max_proofs_per_response, 1000,
+             "maximum number of audit paths to put in the response of a "
+             "get-proofs request");
 DEFINE_int32(staleness_check_delay_secs, 5,
              "number of seconds between node staleness checks");
 
@@ -70,6 +77,17 @@ static Latency<milliseconds, string> http_server_request_latency_ms(
     "total_http_server_request_latency_ms", "path",
     "Total request latency in ms broken down by path");
 
+static Counter<string, string>* total_http_server_routed_requests(
+    Counter<string, string>::New(
+        "total_http_server_routed_requests", "path", "route",
+        "Number of API requests by path, and by whether they were served "
+        "locally or proxied to a fresher node."));
+
+static Counter<string>* total_temporal_shard_submissions(
+    Counter<string>::New("total_temporal_shard_submissions", "shard",
+                         "Number of submissions routed by notAfter, by "
+                         "temporal shard (\"none\" if none accepts it)."));
+
 
 bool ExtractChain(JsonOutput* output, evhttp_request* req, CertChain* chain) {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
@@ -116,6 +134,20 @@ bool ExtractChain(JsonOutput* output, evhttp_request* req, CertChain* chain) {
 }
 
 
+// Replies with an error and returns false if the notAfter of the leaf
+// certificate of |chain| cannot be had.
+bool GetLeafNotAfter(JsonOutput* output, evhttp_request* req,
+                     const CertChain& chain, uint64_t* not_after) {
+  if (!chain.LeafCert() ||
+      chain.LeafCert()->NotAfter(not_after) != Cert::TRUE) {
+    output->SendError(req, HTTP_BADREQUEST,
+                      "Unable to parse provided chain.");
+    return false;
+  }
+  return true;
+}
+
+
 void AddChainReply(JsonOutput* output, evhttp_request* req,
                    const util::Status& add_status,
                    const SignedCertificateTimestamp& sct) {
@@ -215,6 +247,44 @@ bool GetBoolParam(const multimap<string, string>& query, const string& param) {
 }
 
 
+// Parses the body of a get-proofs request, which has a "tree_size",
+// and either "leaf_indices" or (base64-encoded) "hashes".
+bool ParseGetProofsRequest(evhttp_request* req, int64_t* tree_size,
+                           vector<int64_t>* indices, vector<string>* hashes) {
+  evbuffer* const body(evhttp_request_get_input_buffer(req));
+  const size_t length(evbuffer_get_length(body));
+  JsonReader reader(reinterpret_cast<const char*>(evbuffer_pullup(body, -1)),
+                    length);
+  bool have_indices(false), have_hashes(false);
+
+  reader.BeginObject();
+  string key;
+  while (reader.NextMember(&key)) {
+    if (key == "tree_size") {
+      reader.ReadInt(tree_size);
+    } else if (key == "leaf_indices") {
+      have_indices = true;
+      reader.BeginArray();
+      while (reader.NextElement()) {
+        indices->push_back(-1);
+        reader.ReadInt(&indices->back());
+      }
+    } else if (key == "hashes") {
+      have_hashes = true;
+      reader.BeginArray();
+      while (reader.NextElement()) {
+        hashes->emplace_back();
+        reader.ReadBase64(&hashes->back());
+      }
+    } else {
+      reader.SkipValue();
+    }
+  }
+
+  return reader.Finish() && have_indices != have_hashes;
+}
+
+
 }  // namespace
 
 
@@ -223,7 +293,8 @@ HttpHandler::HttpHandler(
     const ReadOnlyDatabase<LoggedCertificate>* db,
     const ClusterStateController<LoggedCertificate>* controller,
     const CertChecker* cert_checker, Frontend* frontend, Proxy* proxy,
-    ThreadPool* pool, libevent::Base* event_base)
+    ThreadPool* pool, libevent::Base* event_base,
+    const TemporalShard* temporal_shard)
     : output_(CHECK_NOTNULL(output)),
       log_lookup_(CHECK_NOTNULL(log_lookup)),
       db_(CHECK_NOTNULL(db)),
@@ -233,6 +304,7 @@ HttpHandler::HttpHandler(
       proxy_(CHECK_NOTNULL(proxy)),
       pool_(CHECK_NOTNULL(pool)),
       event_base_(CHECK_NOTNULL(event_base)),
+      temporal_shard_(temporal_shard),
       task_(pool_),
       node_is_stale_(controller_->NodeIsStale()) {
   event_base_->Delay(seconds(FLAGS_staleness_check_delay_secs),
@@ -258,15 +330,18 @@ void StatsHandlerInterceptor(const string& path,
 
 
 void HttpHandler::ProxyInterceptor(
+    const string& path, const LocalPredicate& can_serve_locally,
     const libevent::HttpServer::HandlerCallback& local_handler,
     evhttp_request* request) {
   VLOG(2) << "Running proxy interceptor...";
-  // TODO(alcutter): We can be a bit smarter about when to proxy off
-  // the request - being stale wrt to the current serving STH doesn't
-  // automatically mean we're unable to answer this request.
-  if (IsNodeStale()) {
+  // Being stale with respect to the current serving STH doesn't mean
+  // we're unable to answer this request, so only proxy the ones that
+  // need data we don't have yet.
+  if (IsNodeStale() && !(can_serve_locally && can_serve_locally(request))) {
+    total_http_server_routed_requests->Increment(path, "proxied");
     proxy_->ProxyRequest(request);
   } else {
+    total_http_server_routed_requests->Increment(path, "local");
     local_handler(request);
   }
 }
@@ -274,47 +349,164 @@ void HttpHandler::ProxyInterceptor(
 
 void HttpHandler::AddProxyWrappedHandler(
     libevent::HttpServer* server, const string& path,
-    const libevent::HttpServer::HandlerCallback& local_handler) {
+    const libevent::HttpServer::HandlerCallback& local_handler,
+    const LocalPredicate& can_serve_locally) {
   const libevent::HttpServer::HandlerCallback stats_handler(
       bind(&StatsHandlerInterceptor, path, local_handler, _1));
   CHECK(server->AddHandler(path, bind(&HttpHandler::ProxyInterceptor, this,
-                                      stats_handler, _1)));
+                                      path, can_serve_locally, stats_handler,
+                                      _1)));
 }
 
 
-void HttpHandler::Add(libevent::HttpServer* server) {
+void HttpHandler::Add(libevent::HttpServer* server, const string& prefix) {
   CHECK_NOTNULL(server);
-  // TODO(pphaneuf): An optional prefix might be nice?
   // TODO(pphaneuf): Find out which methods are CPU intensive enough
   // that they should be spun off to the thread pool.
-  AddProxyWrappedHandler(server, "/ct/v1/get-entries",
-                         bind(&HttpHandler::GetEntries, this, _1));
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-entries",
+                         bind(&HttpHandler::GetEntries, this, _1),
+                         bind(&HttpHandler::CanServeEntries, this, _1));
+  // This is non-standard, and lets monitors verify the entries they
+  // fetch without an extra request per entry.
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-entries-and-proof",
+                         bind(&HttpHandler::GetEntriesAndProof, this, _1),
+                         bind(&HttpHandler::CanServeEntriesAndProof, this,
+                              _1));
   // TODO(alcutter): Support this for mirrors too
   if (cert_checker_) {
-    // Don't really need to proxy this one, but may as well just to keep
-    // everything tidy:
-    AddProxyWrappedHandler(server, "/ct/v1/get-roots",
-                           bind(&HttpHandler::GetRoots, this, _1));
-  }
-  AddProxyWrappedHandler(server, "/ct/v1/get-proof-by-hash",
-                         bind(&HttpHandler::GetProof, this, _1));
-  AddProxyWrappedHandler(server, "/ct/v1/get-sth",
+    // The roots don't depend on the state of the log, so this can
+    // always be served locally.
+    AddProxyWrappedHandler(server, prefix + "/ct/v1/get-roots",
+                           bind(&HttpHandler::GetRoots, this, _1),
+                           [](evhttp_request*) { return true; });
+  }
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-proof-by-hash",
+                         bind(&HttpHandler::GetProof, this, _1),
+                         bind(&HttpHandler::CanServeProof, this, _1));
+  // This is non-standard, and lets auditors fetch many audit paths at
+  // once.
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-proofs",
+                         bind(&HttpHandler::GetProofs, this, _1),
+                         bind(&HttpHandler::CanServeProofs, this, _1));
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-sth",
                          bind(&HttpHandler::GetSTH, this, _1));
-  AddProxyWrappedHandler(server, "/ct/v1/get-sth-consistency",
-                         bind(&HttpHandler::GetConsistency, this, _1));
+  AddProxyWrappedHandler(server, prefix + "/ct/v1/get-sth-consistency",
+                         bind(&HttpHandler::GetConsistency, this, _1),
+                         bind(&HttpHandler::CanServeConsistency, this, _1));
 
   if (frontend_) {
     // Proxy the add-* calls too, technically we could serve them, but a
     // more up-to-date node will have a better chance of handling dupes
     // correctly, rather than bloating the tree.
-    AddProxyWrappedHandler(server, "/ct/v1/add-chain",
+    AddProxyWrappedHandler(server, prefix + "/ct/v1/add-chain",
                            bind(&HttpHandler::AddChain, this, _1));
-    AddProxyWrappedHandler(server, "/ct/v1/add-pre-chain",
+    AddProxyWrappedHandler(server, prefix + "/ct/v1/add-pre-chain",
                            bind(&HttpHandler::AddPreChain, this, _1));
   }
 }
 
 
+// static
+void HttpHandler::AddTemporalShardRouting(
+    libevent::HttpServer* server, JsonOutput* output,
+    const vector<HttpHandler*>& handlers) {
+  CHECK_NOTNULL(server);
+  CHECK_NOTNULL(output);
+  // The shards of |handlers|, at the same indices, to look them up.
+  vector<TemporalShard> shards;
+  for (const HttpHandler* const handler : handlers) {
+    CHECK_NOTNULL(CHECK_NOTNULL(handler)->frontend_);
+    const TemporalShard& shard(*CHECK_NOTNULL(handler->temporal_shard_));
+    CHECK(shards.empty() ||
+          shards.back().not_after_limit <= shard.not_after_start)
+        << "The handlers must be in the order of their shards, which must "
+        << "not overlap";
+    shards.push_back(shard);
+  }
+
+  const string add_chain_path("/ct/v1/add-chain");
+  const libevent::HttpServer::HandlerCallback add_chain(
+      bind(&HttpHandler::RouteChain<CertChain>, output, handlers, shards,
+           add_chain_path, &HttpHandler::BlockingAddChain, _1));
+  CHECK(server->AddHandler(add_chain_path,
+                           bind(&StatsHandlerInterceptor, add_chain_path,
+                                add_chain, _1)));
+
+  const string add_pre_chain_path("/ct/v1/add-pre-chain");
+  const libevent::HttpServer::HandlerCallback add_pre_chain(
+      bind(&HttpHandler::RouteChain<PreCertChain>, output, handlers, shards,
+           add_pre_chain_path, &HttpHandler::BlockingAddPreChain, _1));
+  CHECK(server->AddHandler(add_pre_chain_path,
+                           bind(&StatsHandlerInterceptor, add_pre_chain_path,
+                                add_pre_chain, _1)));
+}
+
+
+bool HttpHandler::AcceptsNotAfter(uint64_t not_after) const {
+  return !temporal_shard_ || temporal_shard_->Accepts(not_after);
+}
+
+
+bool HttpHandler::CheckNotAfter(evhttp_request* req,
+                                const CertChain& chain) const {
+  if (!temporal_shard_) {
+    return true;
+  }
+
+  uint64_t not_after;
+  if (!GetLeafNotAfter(output_, req, chain, &not_after)) {
+    return false;
+  }
+  if (!AcceptsNotAfter(not_after)) {
+    output_->SendError(req, HTTP_BADREQUEST,
+                       "This log does not accept certificates expiring at " +
+                           chain.LeafCert()->PrintNotAfter() + ".");
+    return false;
+  }
+  return true;
+}
+
+
+// static
+template <class Chain>
+void HttpHandler::RouteChain(
+    JsonOutput* output, const vector<HttpHandler*>& handlers,
+    const vector<TemporalShard>& shards, const string& path,
+    void (HttpHandler::*blocking_add)(evhttp_request*,
+                                      const shared_ptr<Chain>&) const,
+    evhttp_request* req) {
+  const shared_ptr<Chain> chain(make_shared<Chain>());
+  if (!ExtractChain(output, req, chain.get())) {
+    return;
+  }
+
+  uint64_t not_after;
+  if (!GetLeafNotAfter(output, req, *chain, &not_after)) {
+    return;
+  }
+
+  const int index(FindTemporalShard(shards, not_after));
+  if (index < 0) {
+    total_temporal_shard_submissions->Increment("none");
+    return output->SendError(req, HTTP_BADREQUEST,
+                             "No log accepts certificates expiring at " +
+                                 chain->LeafCert()->PrintNotAfter() + ".");
+  }
+  HttpHandler* const handler(handlers[index]);
+  total_temporal_shard_submissions->Increment(handler->temporal_shard_->name);
+
+  // ExtractChain() leaves the body in place, so a fresher node can
+  // still route the request itself.
+  if (handler->IsNodeStale()) {
+    total_http_server_routed_requests->Increment(path, "proxied");
+    return handler->proxy_->ProxyRequest(req);
+  }
+
+  total_http_server_routed_requests->Increment(path, "local");
+  handler->pool_->Add(bind(blocking_add, handler, req, chain));
+}
+
+
 void HttpHandler::GetEntries(evhttp_request* req) const {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
     return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
@@ -343,7 +535,41 @@ void HttpHandler::GetEntries(evhttp_request* req) const {
   // "following" nodes with more data.
   const bool include_scts(GetBoolParam(query, "include_scts"));
 
-  BlockingGetEntries(req, start, end, include_scts);
+  BlockingGetEntries(req, start, end, include_scts, -1);
+}
+
+
+void HttpHandler::GetEntriesAndProof(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+
+  const multimap<string, string> query(ParseQuery(req));
+
+  const int64_t tree_size(GetIntParam(query, "tree_size"));
+  if (tree_size < 1 || tree_size > log_lookup_->GetSTH().tree_size()) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"tree_size\" parameter.");
+  }
+
+  const int64_t start(GetIntParam(query, "start"));
+  if (start < 0 || start >= tree_size) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"start\" parameter.");
+  }
+
+  int64_t end(GetIntParam(query, "end"));
+  if (end < start) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"end\" parameter.");
+  }
+
+  // Limit the number of entries returned in a single request, and only
+  // return entries that are in the tree.
+  end = std::min(end, start + FLAGS_max_leaf_entries_per_response);
+  end = std::min(end, tree_size - 1);
+
+  BlockingGetEntries(req, start, end, false, tree_size);
 }
 
 
@@ -416,6 +642,50 @@ void HttpHandler::GetProof(evhttp_request* req) const {
 }
 
 
+void HttpHandler::GetProofs(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+
+  int64_t tree_size(-1);
+  const shared_ptr<vector<int64_t>> indices(make_shared<vector<int64_t>>());
+  vector<string> hashes;
+  if (!ParseGetProofsRequest(req, &tree_size, indices.get(), &hashes)) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Unable to parse provided JSON.");
+  }
+
+  if (tree_size < 0 || tree_size > log_lookup_->GetSTH().tree_size()) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"tree_size\" parameter.");
+  }
+
+  if (indices->size() + hashes.size() >
+      static_cast<size_t>(FLAGS_max_proofs_per_response)) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Too many proofs requested.");
+  }
+
+  for (const auto& hash : hashes) {
+    indices->push_back(-1);
+    if (log_lookup_->GetIndex(hash, &indices->back()) !=
+        LogLookup<LoggedCertificate>::OK) {
+      return output_->SendError(req, HTTP_BADREQUEST, "Couldn't find hash.");
+    }
+  }
+
+  for (const auto& index : *indices) {
+    if (index < 0 || index >= tree_size) {
+      return output_->SendError(req, HTTP_BADREQUEST,
+                                "Invalid leaf index or hash for tree size.");
+    }
+  }
+
+  pool_->Add(
+      bind(&HttpHandler::BlockingGetProofs, this, req, tree_size, indices));
+}
+
+
 void HttpHandler::GetSTH(evhttp_request* req) const {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
     return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
@@ -473,7 +743,8 @@ void HttpHandler::GetConsistency(evhttp_request* req) const {
 
 void HttpHandler::AddChain(evhttp_request* req) {
   const shared_ptr<CertChain> chain(make_shared<CertChain>());
-  if (!ExtractChain(output_, req, chain.get())) {
+  if (!ExtractChain(output_, req, chain.get()) ||
+      !CheckNotAfter(req, *chain)) {
     return;
   }
 
@@ -483,7 +754,8 @@ void HttpHandler::AddChain(evhttp_request* req) {
 
 void HttpHandler::AddPreChain(evhttp_request* req) {
   const shared_ptr<PreCertChain> chain(make_shared<PreCertChain>());
-  if (!ExtractChain(output_, req, chain.get())) {
+  if (!ExtractChain(output_, req, chain.get()) ||
+      !CheckNotAfter(req, *chain)) {
     return;
   }
 
@@ -492,7 +764,8 @@ void HttpHandler::AddPreChain(evhttp_request* req) {
 
 
 void HttpHandler::BlockingGetEntries(evhttp_request* req, int64_t start,
-                                     int64_t end, bool include_scts) const {
+                                     int64_t end, bool include_scts,
+                                     int64_t proof_tree_size) const {
   JsonArray json_entries;
   for (int64_t i = start; i <= end; ++i) {
     LoggedCertificate cert;
@@ -534,6 +807,43 @@ void HttpHandler::BlockingGetEntries(evhttp_request* req, int64_t start,
   JsonObject json_reply;
   json_reply.Add("entries", json_entries);
 
+  if (proof_tree_size >= 0) {
+    // This is non-standard, see GetEntriesAndProof().
+    JsonArray json_proof;
+    for (const auto& node : log_lookup_->RangeProof(
+             start, start + json_entries.Length() - 1, proof_tree_size)) {
+      json_proof.AddBase64(node);
+    }
+    json_reply.Add("range_proof", json_proof);
+  }
+
+  output_->SendJsonReply(req, HTTP_OK, json_reply);
+}
+
+
+void HttpHandler::BlockingGetProofs(
+    evhttp_request* req, int64_t tree_size,
+    const shared_ptr<vector<int64_t>>& indices) const {
+  vector<ShortMerkleAuditProof> proofs;
+  CHECK_EQ(LogLookup<LoggedCertificate>::OK,
+           log_lookup_->AuditProofs(*indices, tree_size, &proofs));
+
+  JsonArray json_proofs;
+  for (const auto& proof : proofs) {
+    JsonArray json_audit;
+    for (const auto& node : proof.path_node()) {
+      json_audit.AddBase64(node);
+    }
+
+    JsonObject json_proof;
+    json_proof.Add("leaf_index", proof.leaf_index());
+    json_proof.Add("audit_path", json_audit);
+    json_proofs.Add(&json_proof);
+  }
+
+  JsonObject json_reply;
+  json_reply.Add("proofs", json_proofs);
+
   output_->SendJsonReply(req, HTTP_OK, json_reply);
 }
 
@@ -560,6 +870,47 @@ void HttpHandler::BlockingAddPreChain(
 }
 
 
+// The predicates below only look at the parameters that decide
+// whether the local data is enough, malformed requests are answered
+// locally, with the same error a fresh node would give.
+bool HttpHandler::CanServeEntries(evhttp_request* req) const {
+  // GetEntries() returns the prefix of the range it has, and clients
+  // then ask for the remainder, which we proxy once we run out.
+  const int64_t start(GetIntParam(ParseQuery(req), "start"));
+  return start < db_->TreeSize();
+}
+
+
+bool HttpHandler::CanServeEntriesAndProof(evhttp_request* req) const {
+  const int64_t tree_size(GetIntParam(ParseQuery(req), "tree_size"));
+  return tree_size <= log_lookup_->GetSTH().tree_size();
+}
+
+
+bool HttpHandler::CanServeProof(evhttp_request* req) const {
+  const int64_t tree_size(GetIntParam(ParseQuery(req), "tree_size"));
+  return tree_size <= log_lookup_->GetSTH().tree_size();
+}
+
+
+bool HttpHandler::CanServeProofs(evhttp_request* req) const {
+  // This does not consume the body, so GetProofs() can parse it again.
+  int64_t tree_size(-1);
+  vector<int64_t> indices;
+  vector<string> hashes;
+  if (!ParseGetProofsRequest(req, &tree_size, &indices, &hashes)) {
+    return true;
+  }
+  return tree_size <= log_lookup_->GetSTH().tree_size();
+}
+
+
+bool HttpHandler::CanServeConsistency(evhttp_request* req) const {
+  const int64_t second(GetIntParam(ParseQuery(req), "second"));
+  return second <= log_lookup_->GetSTH().tree_size();
+}
+
+
 bool HttpHandler::IsNodeStale() const {
   lock_guard<mutex> lock(mutex_);
   return node_is_stale_;
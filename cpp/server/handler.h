@@ -1,11 +1,14 @@
 #ifndef CERT_TRANS_SERVER_HANDLER_H_
 #define CERT_TRANS_SERVER_HANDLER_H_
 
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
+#include "log/temporal_shards.h"
 #include "util/libevent_wrapper.h"
 #include "util/sync_task.h"
 #include "util/task.h"
@@ -34,36 +37,86 @@ class HttpHandler {
   // Does not take ownership of its parameters, which must outlive
   // this instance. The "frontend" parameter can be NULL, in which
   // case this server will not accept "add-chain" and "add-pre-chain"
-  // requests.
+  // requests. If "temporal_shard" is not NULL, only chains whose leaf
+  // certificate expires within its window are accepted.
   HttpHandler(JsonOutput* json_output,
               LogLookup<LoggedCertificate>* log_lookup,
               const ReadOnlyDatabase<LoggedCertificate>* db,
               const ClusterStateController<LoggedCertificate>* controller,
               const CertChecker* cert_checker, Frontend* frontend,
-              Proxy* proxy, ThreadPool* pool, libevent::Base* event_base);
+              Proxy* proxy, ThreadPool* pool, libevent::Base* event_base,
+              const TemporalShard* temporal_shard = nullptr);
   ~HttpHandler();
 
-  void Add(libevent::HttpServer* server);
+  // Registers the handlers of the API with |server|, with |prefix|
+  // prepended to their path (which lets several logs share a server).
+  void Add(libevent::HttpServer* server,
+           const std::string& prefix = std::string());
+
+  // Registers "add-chain" and "add-pre-chain" handlers with |server|
+  // (without prefix), routing each submission to the one of |handlers|
+  // whose temporal shard accepts the notAfter of its leaf certificate.
+  // The handlers must all accept submissions, and have a temporal
+  // shard, in the order returned by ParseTemporalShards().
+  static void AddTemporalShardRouting(
+      libevent::HttpServer* server, JsonOutput* output,
+      const std::vector<HttpHandler*>& handlers);
 
  private:
+  // Returns whether a request can be answered correctly from the
+  // local database and tree, even when this node is stale.
+  typedef std::function<bool(evhttp_request*)> LocalPredicate;
+
   void ProxyInterceptor(
+      const std::string& path, const LocalPredicate& can_serve_locally,
       const libevent::HttpServer::HandlerCallback& next_handler,
       evhttp_request* request);
 
+  // If |can_serve_locally| is empty, all the requests received while
+  // this node is stale are proxied.
   void AddProxyWrappedHandler(
       libevent::HttpServer* server, const std::string& path,
-      const libevent::HttpServer::HandlerCallback& local_handler);
+      const libevent::HttpServer::HandlerCallback& local_handler,
+      const LocalPredicate& can_serve_locally = LocalPredicate());
+
+  bool CanServeEntries(evhttp_request* req) const;
+  bool CanServeEntriesAndProof(evhttp_request* req) const;
+  bool CanServeProof(evhttp_request* req) const;
+  bool CanServeProofs(evhttp_request* req) const;
+  bool CanServeConsistency(evhttp_request* req) const;
 
   void GetEntries(evhttp_request* req) const;
+  void GetEntriesAndProof(evhttp_request* req) const;
   void GetRoots(evhttp_request* req) const;
   void GetProof(evhttp_request* req) const;
+  void GetProofs(evhttp_request* req) const;
   void GetSTH(evhttp_request* req) const;
   void GetConsistency(evhttp_request* req) const;
   void AddChain(evhttp_request* req);
   void AddPreChain(evhttp_request* req);
 
+  // Returns whether the temporal shard of this handler (if any)
+  // accepts certificates expiring at |not_after|.
+  bool AcceptsNotAfter(uint64_t not_after) const;
+  // Replies with an error and returns false if |chain| is not accepted
+  // by the temporal shard of this handler.
+  bool CheckNotAfter(evhttp_request* req, const CertChain& chain) const;
+
+  template <class Chain>
+  static void RouteChain(
+      JsonOutput* output, const std::vector<HttpHandler*>& handlers,
+      const std::vector<TemporalShard>& shards, const std::string& path,
+      void (HttpHandler::*blocking_add)(
+          evhttp_request*, const std::shared_ptr<Chain>&) const,
+      evhttp_request* req);
+
+  // If |proof_tree_size| is not negative, the reply also has the range
+  // proof for the entries returned in the tree of that size.
   void BlockingGetEntries(evhttp_request* req, int64_t start, int64_t end,
-                          bool include_scts) const;
+                          bool include_scts, int64_t proof_tree_size) const;
+  void BlockingGetProofs(
+      evhttp_request* req, int64_t tree_size,
+      const std::shared_ptr<std::vector<int64_t>>& indices) const;
   void BlockingAddChain(evhttp_request* req,
                         const std::shared_ptr<CertChain>& chain) const;
   void BlockingAddPreChain(evhttp_request* req,
@@ -81,6 +134,7 @@ class HttpHandler {
   Proxy* const proxy_;
   ThreadPool* const pool_;
   libevent::Base* const event_base_;
+  const TemporalShard* const temporal_shard_;
 
   util::SyncTask task_;
   mutable std::mutex mutex_;
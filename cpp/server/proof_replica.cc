@@ -0,0 +1,287 @@
+#include "server/proof_replica.h"
+
+#include <errno.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+#include <functional>
+#include <glog/logging.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+#include "server/json_output.h"
+#include "util/json_wrapper.h"
+#include "util/util.h"
+
+using ct::SignedTreeHead;
+using std::bind;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::placeholders::_1;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+static Gauge<>* proof_replica_leaf_count =
+    Gauge<>::New("proof_replica_leaf_count",
+                 "Number of leaf hashes mapped by the proof replica.");
+
+static Gauge<>* proof_replica_tree_size =
+    Gauge<>::New("proof_replica_tree_size",
+                 "Tree size of the STH served by the proof replica.");
+
+static Counter<string>* proof_replica_sths = Counter<string>::New(
+    "proof_replica_sths", "result",
+    "Number of STHs checked against the leaf hashes, by result.");
+
+
+// Sets |query| to the query parameters of |req|, which must be freed
+// with evhttp_clear_headers(). They are empty if the query could not
+// be parsed.
+void ParseQuery(evhttp_request* req, evkeyvalq* query) {
+  evhttp_parse_query_str(evhttp_uri_get_query(
+                             evhttp_request_get_evhttp_uri(req)),
+                         query);
+}
+
+
+// Returns -1 if |param| is missing or not a non-negative integer.
+int64_t GetIntParam(evkeyvalq* query, const char* param) {
+  const char* const value(evhttp_find_header(query, param));
+  if (!value || *value == '\0') {
+    return -1;
+  }
+  char* end;
+  errno = 0;
+  const long long retval(strtoll(value, &end, 10));
+  if (errno || *end != '\0' || retval < 0) {
+    return -1;
+  }
+  return retval;
+}
+
+
+}  // namespace
+
+
+ProofReplica::ProofReplica(JsonOutput* output, const string& leaf_hash_file)
+    : output_(CHECK_NOTNULL(output)),
+      leaf_hash_file_(leaf_hash_file),
+      leaf_hashes_(new MappedLeafHashFile(leaf_hash_file)),
+      tree_(new LeafHashTree(new Sha256Hasher)) {
+}
+
+
+void ProofReplica::Add(libevent::HttpServer* server) {
+  CHECK_NOTNULL(server);
+  CHECK(server->AddHandler("/ct/v1/get-sth",
+                           bind(&ProofReplica::GetSTH, this, _1)));
+  CHECK(server->AddHandler("/ct/v1/get-proof-by-hash",
+                           bind(&ProofReplica::GetProof, this, _1)));
+  CHECK(server->AddHandler("/ct/v1/get-sth-consistency",
+                           bind(&ProofReplica::GetConsistency, this, _1)));
+}
+
+
+void ProofReplica::NewSTH(const SignedTreeHead& sth) {
+  lock_guard<mutex> lock(mutex_);
+  if (sth_.has_tree_size() && sth.timestamp() <= sth_.timestamp()) {
+    return;
+  }
+
+  SignedTreeHead& pending(pending_sths_[sth.tree_size()]);
+  if (!pending.has_timestamp() || pending.timestamp() < sth.timestamp()) {
+    pending.CopyFrom(sth);
+  }
+}
+
+
+bool ProofReplica::Refresh() {
+  lock_guard<mutex> refresh_lock(refresh_mutex_);
+
+  // Map the file anew, as |tree_| keeps using the current mapping
+  // until the new tree replaces it.
+  unique_ptr<MappedLeafHashFile> leaf_hashes(
+      new MappedLeafHashFile(leaf_hash_file_));
+  if (!leaf_hashes->Refresh()) {
+    return false;
+  }
+
+  // Hashing the new leaves (or all of them) is done without holding
+  // |mutex_|, only swapping the result in is done with it.
+  unique_ptr<LeafHashTree> tree;
+  if (!tree_->IsPrefixOf(leaf_hashes->data(), leaf_hashes->size())) {
+    // The signer discarded some leaf hashes, which it only does when
+    // they were not part of any STH it signed, and might have written
+    // others in their place.
+    LOG(WARNING) << "Leaf hash file was rewritten (" << tree_->LeafCount()
+                 << " entries before, " << leaf_hashes->size()
+                 << " now), hashing it again";
+    tree.reset(new LeafHashTree(new Sha256Hasher));
+    tree->Update(leaf_hashes->data(), leaf_hashes->size());
+  } else if (leaf_hashes->size() > tree_->LeafCount()) {
+    tree = tree_->Extend(leaf_hashes->data(), leaf_hashes->size());
+  }
+
+  lock_guard<mutex> lock(mutex_);
+  if (tree) {
+    // The previous tree and mapping are freed along with |tree| and
+    // |leaf_hashes|, once |mutex_| is released.
+    tree_.swap(tree);
+    leaf_hashes_.swap(leaf_hashes);
+  }
+  proof_replica_leaf_count->Set(tree_->LeafCount());
+
+  for (map<int64_t, SignedTreeHead>::iterator it(pending_sths_.begin());
+       it != pending_sths_.end() && it->first <= tree_->LeafCount();
+       it = pending_sths_.erase(it)) {
+    const SignedTreeHead& sth(it->second);
+    if (tree_->RootAtSnapshot(sth.tree_size()) != sth.sha256_root_hash()) {
+      LOG(WARNING) << "Root hash mismatch for STH of size "
+                   << sth.tree_size();
+      proof_replica_sths->Increment("root_mismatch");
+      continue;
+    }
+    if (sth_.has_tree_size() && sth.timestamp() <= sth_.timestamp()) {
+      proof_replica_sths->Increment("stale");
+      continue;
+    }
+    VLOG(1) << "Serving STH of size " << sth.tree_size();
+    proof_replica_sths->Increment("served");
+    sth_.CopyFrom(sth);
+  }
+  if (sth_.has_tree_size()) {
+    proof_replica_tree_size->Set(sth_.tree_size());
+  }
+
+  return true;
+}
+
+
+SignedTreeHead ProofReplica::ServingSTH() const {
+  lock_guard<mutex> lock(mutex_);
+  return sth_;
+}
+
+
+void ProofReplica::GetSTH(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+
+  const SignedTreeHead sth(ServingSTH());
+  if (!sth.has_tree_size()) {
+    return output_->SendError(req, HTTP_SERVUNAVAIL, "No STH available yet.");
+  }
+
+  JsonObject json_reply;
+  json_reply.Add("tree_size", sth.tree_size());
+  json_reply.Add("timestamp", sth.timestamp());
+  json_reply.AddBase64("sha256_root_hash", sth.sha256_root_hash());
+  json_reply.Add("tree_head_signature", sth.signature());
+
+  output_->SendJsonReply(req, HTTP_OK, json_reply);
+}
+
+
+void ProofReplica::GetProof(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+
+  evkeyvalq query;
+  ParseQuery(req, &query);
+  const char* const b64_hash(evhttp_find_header(&query, "hash"));
+  const string hash(b64_hash ? util::FromBase64(b64_hash) : "");
+  const int64_t tree_size(GetIntParam(&query, "tree_size"));
+  evhttp_clear_headers(&query);
+
+  if (hash.empty()) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"hash\" parameter.");
+  }
+
+  int64_t serving_tree_size;
+  int64_t leaf_index;
+  vector<string> audit_path;
+  {
+    lock_guard<mutex> lock(mutex_);
+    serving_tree_size = sth_.tree_size();
+    leaf_index = tree_->GetIndex(hash);
+    if (tree_size >= 0 && tree_size <= serving_tree_size && leaf_index >= 0 &&
+        leaf_index < tree_size) {
+      audit_path = tree_->PathToRootAtSnapshot(leaf_index + 1, tree_size);
+    }
+  }
+
+  if (tree_size < 0 || tree_size > serving_tree_size) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"tree_size\" parameter.");
+  }
+  if (leaf_index < 0 || leaf_index >= tree_size) {
+    return output_->SendError(req, HTTP_BADREQUEST, "Couldn't find hash.");
+  }
+
+  JsonArray json_audit;
+  for (const auto& node : audit_path) {
+    json_audit.AddBase64(node);
+  }
+
+  JsonObject json_reply;
+  json_reply.Add("leaf_index", leaf_index);
+  json_reply.Add("audit_path", json_audit);
+
+  output_->SendJsonReply(req, HTTP_OK, json_reply);
+}
+
+
+void ProofReplica::GetConsistency(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return output_->SendError(req, HTTP_BADMETHOD, "Method not allowed.");
+  }
+
+  evkeyvalq query;
+  ParseQuery(req, &query);
+  const int64_t first(GetIntParam(&query, "first"));
+  const int64_t second(GetIntParam(&query, "second"));
+  evhttp_clear_headers(&query);
+
+  if (first < 0) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"first\" parameter.");
+  }
+
+  int64_t serving_tree_size;
+  vector<string> consistency;
+  {
+    lock_guard<mutex> lock(mutex_);
+    serving_tree_size = sth_.tree_size();
+    if (second >= first && second <= serving_tree_size) {
+      consistency = tree_->SnapshotConsistency(first, second);
+    }
+  }
+
+  if (second < first || second > serving_tree_size) {
+    return output_->SendError(req, HTTP_BADREQUEST,
+                              "Missing or invalid \"second\" parameter.");
+  }
+
+  JsonArray json_cons;
+  for (const auto& node : consistency) {
+    json_cons.AddBase64(node);
+  }
+
+  JsonObject json_reply;
+  json_reply.Add("consistency", json_cons);
+
+  output_->SendJsonReply(req, HTTP_OK, json_reply);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,77 @@
+#ifndef CERT_TRANS_SERVER_PROOF_REPLICA_H_
+#define CERT_TRANS_SERVER_PROOF_REPLICA_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+#include "log/leaf_hash_file.h"
+#include "merkletree/leaf_hash_tree.h"
+#include "proto/ct.pb.h"
+#include "util/libevent_wrapper.h"
+
+namespace cert_trans {
+
+class JsonOutput;
+
+
+// Serves get-sth, get-proof-by-hash and get-sth-consistency from the
+// leaf hash file written by the signer (see LeafHashFile), without
+// needing a database or the rest of the cluster state. An STH is only
+// served once the leaf hashes it covers are available, and match its
+// root hash.
+//
+// This class is thread-safe.
+class ProofReplica {
+ public:
+  // Does not take ownership of |output|, which must outlive this
+  // instance.
+  ProofReplica(JsonOutput* output, const std::string& leaf_hash_file);
+
+  void Add(libevent::HttpServer* server);
+
+  // Queues |sth|, which the caller must have verified, to be served
+  // once the leaf hashes up to its tree size are available.
+  void NewSTH(const ct::SignedTreeHead& sth);
+
+  // Maps the leaf hashes written since the last call, and starts
+  // serving the newest queued STH they cover. Returns false if the leaf
+  // hash file could not be read. Queries keep being answered from the
+  // previous leaf hashes while the new ones are hashed.
+  bool Refresh();
+
+  // The STH being served, which does not have a tree size if there is
+  // none yet.
+  ct::SignedTreeHead ServingSTH() const;
+
+ private:
+  void GetSTH(evhttp_request* req) const;
+  void GetProof(evhttp_request* req) const;
+  void GetConsistency(evhttp_request* req) const;
+
+  JsonOutput* const output_;
+  const std::string leaf_hash_file_;
+
+  // Serialises Refresh().
+  std::mutex refresh_mutex_;
+
+  mutable std::mutex mutex_;
+  // These two are only replaced by Refresh(), with both mutexes held,
+  // so it can read them with only |refresh_mutex_|.
+  std::unique_ptr<MappedLeafHashFile> leaf_hashes_;
+  // Points into |leaf_hashes_|.
+  std::unique_ptr<LeafHashTree> tree_;
+  // STHs not covered by |leaf_hashes_| yet, by tree size.
+  std::map<int64_t, ct::SignedTreeHead> pending_sths_;
+  ct::SignedTreeHead sth_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProofReplica);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_PROOF_REPLICA_H_
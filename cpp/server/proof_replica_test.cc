@@ -0,0 +1,146 @@
+#include "server/proof_replica.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "log/leaf_hash_file.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "server/json_output.h"
+#include "util/libevent_wrapper.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using ct::SignedTreeHead;
+using std::string;
+using std::to_string;
+
+
+class ProofReplicaTest : public ::testing::Test {
+ protected:
+  ProofReplicaTest()
+      : path_(tmp_.TmpStorageDir() + "/leaf_hashes"),
+        file_(path_),
+        output_(&base_),
+        replica_(&output_, path_),
+        tree_(new Sha256Hasher) {
+  }
+
+  void AddLeaves(int count) {
+    for (int i = 0; i < count; ++i) {
+      tree_.AddLeaf("leaf " + to_string(tree_.LeafCount()));
+      file_.Append(tree_.LeafHash(tree_.LeafCount()));
+    }
+  }
+
+  SignedTreeHead STH(int64_t tree_size, uint64_t timestamp) {
+    SignedTreeHead sth;
+    sth.set_tree_size(tree_size);
+    sth.set_timestamp(timestamp);
+    sth.set_sha256_root_hash(tree_.RootAtSnapshot(tree_size));
+    return sth;
+  }
+
+  TmpStorage tmp_;
+  const string path_;
+  LeafHashFile file_;
+  libevent::Base base_;
+  JsonOutput output_;
+  ProofReplica replica_;
+  MerkleTree tree_;
+};
+
+
+TEST_F(ProofReplicaTest, NoSTH) {
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_FALSE(replica_.ServingSTH().has_tree_size());
+}
+
+
+TEST_F(ProofReplicaTest, WaitsForLeafHashes) {
+  AddLeaves(10);
+  replica_.NewSTH(STH(10, 1000));
+  // Not synced yet.
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_FALSE(replica_.ServingSTH().has_tree_size());
+
+  file_.Sync();
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_EQ(10, replica_.ServingSTH().tree_size());
+}
+
+
+TEST_F(ProofReplicaTest, ServesNewestMatchingSTH) {
+  AddLeaves(300);
+  file_.Sync();
+  replica_.NewSTH(STH(100, 1000));
+  replica_.NewSTH(STH(300, 1002));
+  SignedTreeHead bad(STH(200, 1001));
+  bad.set_sha256_root_hash(tree_.RootAtSnapshot(199));
+  replica_.NewSTH(bad);
+
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_EQ(300, replica_.ServingSTH().tree_size());
+
+  // Older STHs are ignored.
+  replica_.NewSTH(STH(200, 1001));
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_EQ(300, replica_.ServingSTH().tree_size());
+}
+
+
+TEST_F(ProofReplicaTest, FollowsGrowingFile) {
+  AddLeaves(5);
+  file_.Sync();
+  replica_.NewSTH(STH(5, 1000));
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_EQ(5, replica_.ServingSTH().tree_size());
+
+  AddLeaves(1000);
+  file_.Sync();
+  replica_.NewSTH(STH(1005, 1001));
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_EQ(1005, replica_.ServingSTH().tree_size());
+  EXPECT_EQ(tree_.RootAtSnapshot(1005),
+            replica_.ServingSTH().sha256_root_hash());
+}
+
+
+TEST_F(ProofReplicaTest, FollowsRewrittenFile) {
+  AddLeaves(10);
+  file_.Sync();
+  replica_.NewSTH(STH(10, 1000));
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_EQ(10, replica_.ServingSTH().tree_size());
+
+  // Same size, but different leaves after the first five.
+  MerkleTree rewritten(new Sha256Hasher);
+  for (int i = 0; i < 10; ++i) {
+    rewritten.AddLeaf((i < 5 ? "leaf " : "other leaf ") + to_string(i));
+  }
+  file_.Truncate(5);
+  for (int i = 5; i < 10; ++i) {
+    file_.Append(rewritten.LeafHash(i + 1));
+  }
+  file_.Sync();
+
+  SignedTreeHead sth(STH(10, 1001));
+  sth.set_sha256_root_hash(rewritten.CurrentRoot());
+  replica_.NewSTH(sth);
+  EXPECT_TRUE(replica_.Refresh());
+  EXPECT_EQ(1001U, replica_.ServingSTH().timestamp());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -22,6 +22,7 @@
 #include "log/log_lookup.h"
 #include "log/log_signer.h"
 #include "log/sqlite_db.h"
+#include "log/temporal_shards.h"
 #include "log/tree_signer.h"
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
@@ -54,25 +55,34 @@ template <class Logged>
 class Server {
  public:
   struct Options {
-    Options() : port(0), num_http_server_threads(16) {
+    Options()
+        : port(0), temporal_shard(nullptr), num_http_server_threads(16) {
     }
 
     std::string server;
     uint16_t port;
 
     std::string etcd_root;
+    // Prepended to the paths of the API, see HttpHandler::Add().
+    std::string path_prefix;
+    // If not NULL, the window of certificate expiry dates accepted by
+    // this log (which must outlive the server).
+    const TemporalShard* temporal_shard;
 
     int num_http_server_threads;
   };
 
   static void StaticInit();
 
-  // Doesn't take ownership of anything.
+  // Doesn't take ownership of anything. If |front_end| is not NULL,
+  // this server shares its HTTP server (and event loop) instead of
+  // binding its own port, which lets several logs be served from one
+  // process under different Options::path_prefix.
   Server(const Options& opts,
          const std::shared_ptr<libevent::Base>& event_base,
          Database<Logged>* db, EtcdClient* etcd_client,
          UrlFetcher* url_fetcher, LogSigner* log_signer,
-         CertChecker* cert_checker);
+         CertChecker* cert_checker, Server* front_end = nullptr);
   ~Server();
 
   bool IsMaster() const;
@@ -80,15 +90,21 @@ class Server {
   ConsistentStore<Logged>* consistent_store();
   ClusterStateController<Logged>* cluster_state_controller();
   LogLookup<Logged>* log_lookup();
+  libevent::HttpServer* http_server();
+  // Only valid after Initialise().
+  HttpHandler* http_handler();
 
   void Initialise(bool is_mirror);
+  // Must only be called on a server without a |front_end|, and serves
+  // those sharing it too.
   void Run();
 
  private:
   const Options options_;
   const std::shared_ptr<libevent::Base> event_base_;
   std::unique_ptr<libevent::EventPumpThread> event_pump_;
-  libevent::HttpServer http_server_;
+  const std::unique_ptr<libevent::HttpServer> own_http_server_;
+  libevent::HttpServer* const http_server_;
   Database<Logged>* const db_;
   CertChecker* const cert_checker_;
   const std::string node_id_;
@@ -99,6 +115,9 @@ class Server {
   util::SyncTask server_task_;
   StrictConsistentStore<Logged> consistent_store_;
   const std::unique_ptr<Frontend> frontend_;
+  // Only used by |log_lookup_|, which blocks the thread delivering an
+  // STH while it hashes the new leaves on this pool.
+  ThreadPool tree_pool_;
   std::unique_ptr<LogLookup<Logged>> log_lookup_;
   std::unique_ptr<ClusterStateController<LoggedCertificate>>
       cluster_controller_;
@@ -211,11 +230,15 @@ Server<Logged>::Server(const Options& opts,
                        const std::shared_ptr<libevent::Base>& event_base,
                        Database<Logged>* db, EtcdClient* etcd_client,
                        UrlFetcher* url_fetcher, LogSigner* log_signer,
-                       CertChecker* cert_checker)
+                       CertChecker* cert_checker, Server* front_end)
     : options_(opts),
       event_base_(event_base),
-      event_pump_(new libevent::EventPumpThread(event_base_)),
-      http_server_(*event_base_),
+      event_pump_(front_end ? nullptr
+                            : new libevent::EventPumpThread(event_base_)),
+      own_http_server_(front_end ? nullptr
+                                 : new libevent::HttpServer(*event_base_)),
+      http_server_(front_end ? front_end->http_server()
+                             : own_http_server_.get()),
       db_(CHECK_NOTNULL(db)),
       cert_checker_(cert_checker),
       node_id_(GetNodeId(db_)),
@@ -238,10 +261,14 @@ Server<Logged>::Server(const Options& opts,
       json_output_(event_base_.get()) {
   CHECK_LT(0, options_.port);
   CHECK_LT(0, options_.num_http_server_threads);
-  http_server_.AddHandler("/metrics",
-                          bind(&cert_trans::ExportPrometheusMetrics,
-                               std::placeholders::_1));
-  http_server_.Bind(nullptr, options_.port);
+  if (front_end) {
+    CHECK_EQ(front_end->event_base_, event_base_);
+  } else {
+    http_server_->AddHandler("/metrics",
+                             bind(&cert_trans::ExportPrometheusMetrics,
+                                  std::placeholders::_1));
+    http_server_->Bind(nullptr, options_.port);
+  }
   election_.StartElection();
 }
 
@@ -281,6 +308,18 @@ LogLookup<Logged>* Server<Logged>::log_lookup() {
 }
 
 
+template <class Logged>
+libevent::HttpServer* Server<Logged>::http_server() {
+  return http_server_;
+}
+
+
+template <class Logged>
+HttpHandler* Server<Logged>::http_handler() {
+  return CHECK_NOTNULL(handler_.get());
+}
+
+
 template <class Logged>
 void Server<Logged>::Initialise(bool is_mirror) {
   fetcher_.reset(ContinuousFetcher::New(event_base_.get(), &internal_pool_,
@@ -301,7 +340,7 @@ void Server<Logged>::Initialise(bool is_mirror) {
     }
   }
 
-  log_lookup_.reset(new LogLookup<LoggedCertificate>(db_));
+  log_lookup_.reset(new LogLookup<LoggedCertificate>(db_, &tree_pool_));
 
   cluster_controller_.reset(new ClusterStateController<LoggedCertificate>(
       &internal_pool_, event_base_, url_fetcher_, db_, &consistent_store_,
@@ -329,14 +368,15 @@ void Server<Logged>::Initialise(bool is_mirror) {
   handler_.reset(new HttpHandler(&json_output_, log_lookup_.get(), db_,
                                  cluster_controller_.get(), cert_checker_,
                                  frontend_.get(), proxy_.get(), &http_pool_,
-                                 event_base_.get()));
+                                 event_base_.get(), options_.temporal_shard));
 
-  handler_->Add(&http_server_);
+  handler_->Add(http_server_, options_.path_prefix);
 }
 
 
 template <class Logged>
 void Server<Logged>::Run() {
+  CHECK(own_http_server_) << "Run() the front end server instead";
   // Ding the temporary event pump because we're about to enter the event loop
   event_pump_.reset();
   event_base_->Dispatch();
@@ -0,0 +1,236 @@
+#include "server/udp_engine.h"
+
+#include <errno.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "monitoring/monitoring.h"
+
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+// Maximum number of datagrams moved per recvmmsg()/sendmmsg() call.
+const int kBatchSize = 64;
+// Larger than any DNS datagram we are willing to answer.
+const size_t kMaxDatagramSize = 4096;
+
+
+static Counter<string>* udp_engine_datagrams = Counter<string>::New(
+    "udp_engine_datagrams", "direction",
+    "Number of datagrams received, sent, or dropped by UdpEngine.");
+
+static Counter<>* udp_engine_batches =
+    Counter<>::New("udp_engine_batches",
+                   "Number of batches of datagrams received by UdpEngine.");
+
+
+int BindSocket(int port) {
+  const int sock(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+  PCHECK(sock >= 0) << "socket";
+
+  const int one(1);
+  PCHECK(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0)
+      << "setsockopt(SO_REUSEADDR)";
+  PCHECK(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0)
+      << "setsockopt(SO_REUSEPORT)";
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = INADDR_ANY;
+  PCHECK(bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+      << "bind to port " << port;
+
+  return sock;
+}
+
+
+int BoundPort(int sock) {
+  sockaddr_in addr;
+  socklen_t addr_len(sizeof(addr));
+  PCHECK(getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &addr_len) ==
+         0)
+      << "getsockname";
+  return ntohs(addr.sin_port);
+}
+
+
+}  // namespace
+
+
+UdpEngine::UdpEngine(int port, int num_threads, const HandlerFactory& factory)
+    : port_(port), stop_fd_(eventfd(0, EFD_CLOEXEC)) {
+  CHECK_GT(num_threads, 0);
+  PCHECK(stop_fd_ >= 0) << "eventfd";
+
+  for (int i = 0; i < num_threads; ++i) {
+    socks_.push_back(BindSocket(port_));
+    // When asked for an ephemeral port, the other sockets have to
+    // share the one picked for the first.
+    if (port_ == 0) {
+      port_ = BoundPort(socks_.back());
+    }
+  }
+
+  // The factory is copied by each thread, so the caller's copy does
+  // not have to outlive us.
+  for (const int sock : socks_) {
+    threads_.emplace_back(thread(&UdpEngine::Worker, this, sock, factory));
+  }
+}
+
+
+UdpEngine::~UdpEngine() {
+  Stop();
+  for (const int sock : socks_) {
+    close(sock);
+  }
+  close(stop_fd_);
+}
+
+
+void UdpEngine::Stop() {
+  if (threads_.empty()) {
+    return;
+  }
+
+  // The eventfd stays readable, so this wakes up every worker.
+  const uint64_t one(1);
+  PCHECK(write(stop_fd_, &one, sizeof(one)) == sizeof(one));
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+
+void UdpEngine::Worker(int sock, const HandlerFactory& factory) {
+  const unique_ptr<Handler> handler(factory());
+  CHECK(handler);
+
+  const int epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+  PCHECK(epoll_fd >= 0) << "epoll_create1";
+  for (const int fd : {sock, stop_fd_}) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    PCHECK(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0)
+        << "epoll_ctl";
+  }
+
+  // All the buffers are allocated once, and reused for every batch.
+  vector<char> in_bufs(kBatchSize * kMaxDatagramSize);
+  vector<sockaddr_in> from(kBatchSize);
+  vector<iovec> in_iovs(kBatchSize);
+  vector<mmsghdr> in_msgs(kBatchSize);
+  vector<string> replies(kBatchSize);
+  vector<iovec> out_iovs(kBatchSize);
+  vector<mmsghdr> out_msgs(kBatchSize);
+
+  while (true) {
+    epoll_event events[2];
+    const int num_events(epoll_wait(epoll_fd, events, 2, -1));
+    if (num_events < 0) {
+      PCHECK(errno == EINTR) << "epoll_wait";
+      continue;
+    }
+    for (int i = 0; i < num_events; ++i) {
+      if (events[i].data.fd == stop_fd_) {
+        close(epoll_fd);
+        return;
+      }
+    }
+
+    // Drain the socket before going back to epoll_wait().
+    while (true) {
+      for (int i = 0; i < kBatchSize; ++i) {
+        in_iovs[i].iov_base = &in_bufs[i * kMaxDatagramSize];
+        in_iovs[i].iov_len = kMaxDatagramSize;
+        memset(&in_msgs[i], 0, sizeof(in_msgs[i]));
+        in_msgs[i].msg_hdr.msg_name = &from[i];
+        in_msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        in_msgs[i].msg_hdr.msg_iov = &in_iovs[i];
+        in_msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      const int num_in(
+          recvmmsg(sock, in_msgs.data(), kBatchSize, MSG_DONTWAIT, nullptr));
+      if (num_in < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          PLOG(WARNING) << "recvmmsg";
+        }
+        break;
+      }
+      udp_engine_batches->Increment();
+      udp_engine_datagrams->IncrementBy("received", num_in);
+
+      int num_out(0);
+      int num_dropped(0);
+      for (int i = 0; i < num_in; ++i) {
+        if ((in_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ||
+            in_msgs[i].msg_hdr.msg_namelen != sizeof(from[i])) {
+          ++num_dropped;
+          continue;
+        }
+
+        string* const reply(&replies[num_out]);
+        reply->clear();
+        handler->HandlePacket(from[i], &in_bufs[i * kMaxDatagramSize],
+                              in_msgs[i].msg_len, reply);
+        if (reply->empty()) {
+          continue;
+        }
+
+        out_iovs[num_out].iov_base = &(*reply)[0];
+        out_iovs[num_out].iov_len = reply->size();
+        memset(&out_msgs[num_out], 0, sizeof(out_msgs[num_out]));
+        out_msgs[num_out].msg_hdr.msg_name = &from[i];
+        out_msgs[num_out].msg_hdr.msg_namelen = sizeof(from[i]);
+        out_msgs[num_out].msg_hdr.msg_iov = &out_iovs[num_out];
+        out_msgs[num_out].msg_hdr.msg_iovlen = 1;
+        ++num_out;
+      }
+      handler->BatchDone();
+
+      // The socket is blocking for writes, so this only returns short
+      // on errors, which are per-datagram: skip the offending one.
+      int sent(0);
+      while (sent < num_out) {
+        const int num_sent(
+            sendmmsg(sock, &out_msgs[sent], num_out - sent, 0));
+        if (num_sent < 0) {
+          if (errno != EINTR) {
+            PLOG(WARNING) << "sendmmsg";
+            ++num_dropped;
+            ++sent;
+          }
+          continue;
+        }
+        udp_engine_datagrams->IncrementBy("sent", num_sent);
+        sent += num_sent;
+      }
+      if (num_dropped > 0) {
+        udp_engine_datagrams->IncrementBy("dropped", num_dropped);
+      }
+
+      if (num_in < kBatchSize) {
+        break;
+      }
+    }
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,74 @@
+#ifndef CERT_TRANS_SERVER_UDP_ENGINE_H_
+#define CERT_TRANS_SERVER_UDP_ENGINE_H_
+
+#include <functional>
+#include <memory>
+#include <netinet/in.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Serves a datagram request/response protocol (such as DNS) from
+// several threads. Every thread has its own SO_REUSEPORT socket bound
+// to the same port, so that the kernel spreads incoming datagrams
+// between them, waits on it with epoll, and moves datagrams in
+// batches with recvmmsg() and sendmmsg().
+class UdpEngine {
+ public:
+  class Handler {
+   public:
+    virtual ~Handler() = default;
+
+    // Handles one datagram. If |reply| is not empty on return, it is
+    // sent back to |from|. |reply| is passed in empty.
+    virtual void HandlePacket(const sockaddr_in& from, const char* buf,
+                              size_t len, std::string* reply) = 0;
+
+    // Called after every batch of datagrams, before the replies are
+    // sent. Useful to publish statistics kept locally while handling
+    // the batch.
+    virtual void BatchDone() {
+    }
+  };
+
+  // Called once in each worker thread, to create the handler owned by
+  // that thread. Handlers are never shared between threads.
+  typedef std::function<std::unique_ptr<Handler>()> HandlerFactory;
+
+  // Binds |num_threads| sockets to |port| and starts the worker
+  // threads. If |port| is 0, an ephemeral port is picked (see
+  // port()).
+  UdpEngine(int port, int num_threads, const HandlerFactory& factory);
+
+  // Calls Stop().
+  ~UdpEngine();
+
+  int port() const {
+    return port_;
+  }
+
+  // Stops the worker threads, and waits for them to exit. Datagrams
+  // still queued on the sockets are dropped.
+  void Stop();
+
+ private:
+  void Worker(int sock, const HandlerFactory& factory);
+
+  int port_;
+  // Written to by Stop() to wake up the workers.
+  const int stop_fd_;
+  std::vector<int> socks_;
+  std::vector<std::thread> threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(UdpEngine);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_UDP_ENGINE_H_
@@ -0,0 +1,172 @@
+#include "server/udp_engine.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <set>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::atomic;
+using std::lock_guard;
+using std::mutex;
+using std::set;
+using std::string;
+using std::thread;
+using std::to_string;
+using std::unique_ptr;
+
+
+// Replies with the datagram prefixed by a per-handler identifier,
+// except for "drop", which gets no reply.
+class EchoHandler : public UdpEngine::Handler {
+ public:
+  EchoHandler(int id, atomic<int>* batches) : id_(id), batches_(batches) {
+  }
+
+  void HandlePacket(const sockaddr_in& from, const char* buf, size_t len,
+                    string* reply) override {
+    EXPECT_TRUE(reply->empty());
+    const string packet(buf, len);
+    if (packet != "drop") {
+      *reply = to_string(id_) + ":" + packet;
+    }
+  }
+
+  void BatchDone() override {
+    ++*batches_;
+  }
+
+ private:
+  const int id_;
+  atomic<int>* const batches_;
+};
+
+
+class UdpEngineTest : public ::testing::Test {
+ protected:
+  UdpEngineTest() : batches_(0) {
+  }
+
+  UdpEngine::HandlerFactory Factory() {
+    return [this]() {
+      lock_guard<mutex> lock(lock_);
+      handler_threads_.insert(std::this_thread::get_id());
+      return unique_ptr<UdpEngine::Handler>(
+          new EchoHandler(handler_threads_.size(), &batches_));
+    };
+  }
+
+  int ClientSocket(int port) {
+    const int sock(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+    CHECK_GE(sock, 0);
+
+    timeval timeout;
+    timeout.tv_sec = 5;
+    timeout.tv_usec = 0;
+    CHECK_EQ(0, setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                           sizeof(timeout)));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK_EQ(0,
+             connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    return sock;
+  }
+
+  static void Send(int sock, const string& packet) {
+    ASSERT_EQ(static_cast<ssize_t>(packet.size()),
+              send(sock, packet.data(), packet.size(), 0));
+  }
+
+  static string Receive(int sock) {
+    char buf[1024];
+    const ssize_t len(recv(sock, buf, sizeof(buf), 0));
+    if (len < 0) {
+      return "";
+    }
+    return string(buf, len);
+  }
+
+  atomic<int> batches_;
+  mutex lock_;
+  set<std::thread::id> handler_threads_;
+};
+
+
+TEST_F(UdpEngineTest, Echoes) {
+  UdpEngine engine(0, 1, Factory());
+  EXPECT_NE(0, engine.port());
+
+  const int sock(ClientSocket(engine.port()));
+  for (int i = 0; i < 100; ++i) {
+    Send(sock, "packet " + to_string(i));
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ("1:packet " + to_string(i), Receive(sock));
+  }
+  EXPECT_GT(batches_.load(), 0);
+  close(sock);
+}
+
+
+TEST_F(UdpEngineTest, EmptyReplyIsNotSent) {
+  UdpEngine engine(0, 1, Factory());
+
+  const int sock(ClientSocket(engine.port()));
+  Send(sock, "drop");
+  Send(sock, "keep");
+  EXPECT_EQ("1:keep", Receive(sock));
+  close(sock);
+}
+
+
+TEST_F(UdpEngineTest, OneHandlerPerThread) {
+  const int kNumThreads(4);
+  UdpEngine engine(0, kNumThreads, Factory());
+
+  // The kernel picks the socket by hashing the source address, so
+  // use many client sockets to reach every thread.
+  set<string> handlers;
+  for (int i = 0; i < 100 && handlers.size() < kNumThreads; ++i) {
+    const int sock(ClientSocket(engine.port()));
+    Send(sock, "hello");
+    const string reply(Receive(sock));
+    ASSERT_NE("", reply);
+    handlers.insert(reply.substr(0, reply.find(':')));
+    close(sock);
+  }
+
+  EXPECT_EQ(static_cast<size_t>(kNumThreads), handlers.size());
+  lock_guard<mutex> lock(lock_);
+  EXPECT_EQ(static_cast<size_t>(kNumThreads), handler_threads_.size());
+}
+
+
+TEST_F(UdpEngineTest, StopIsIdempotent) {
+  UdpEngine engine(0, 2, Factory());
+  engine.Stop();
+  engine.Stop();
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
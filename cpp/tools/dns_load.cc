@@ -0,0 +1,195 @@
+// Generates DNS load against ct-dns-server, and reports how many
+// queries per second it answers. To see how the server scales with
+// cores, run it with different values of --dns_threads, e.g.:
+//
+//   for t in 1 2 4 8; do
+//     taskset -c 0-$((t - 1)) ct-dns-server --dns_threads=$t ... &
+//     dns_load --port=... --query=sth.example.com.
+//     kill %1
+//   done
+//
+// Make sure to run the load generator on different cores (or a
+// different machine), so that it does not compete with the server.
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+#include <ldns/ldns.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using std::atomic;
+using std::chrono::duration;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::cout;
+using std::endl;
+using std::string;
+using std::thread;
+using std::vector;
+
+DEFINE_string(server, "127.0.0.1", "IPv4 address of the DNS server");
+DEFINE_int32(port, 53, "Port of the DNS server");
+DEFINE_string(query, "sth.example.com.", "Name to query the TXT record of");
+DEFINE_int32(threads, 1, "Number of threads sending queries");
+DEFINE_int32(window, 64, "Number of outstanding queries per thread");
+DEFINE_int32(duration_seconds, 10, "How long to send queries for");
+
+namespace {
+
+
+const size_t kMaxDatagramSize = 4096;
+
+
+string MakeQuery(const string& name) {
+  ldns_rdf* const dname(ldns_dname_new_frm_str(name.c_str()));
+  CHECK(dname) << "Invalid query name: " << name;
+  ldns_pkt* const query(ldns_pkt_query_new(dname, LDNS_RR_TYPE_TXT,
+                                           LDNS_RR_CLASS_IN, LDNS_RD));
+  CHECK(query);
+
+  uint8_t* wire;
+  size_t wire_size;
+  CHECK_EQ(LDNS_STATUS_OK, ldns_pkt2wire(&wire, query, &wire_size));
+  const string retval(reinterpret_cast<const char*>(wire), wire_size);
+  free(wire);
+  ldns_pkt_free(query);
+
+  return retval;
+}
+
+
+int ConnectSocket() {
+  const int sock(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+  PCHECK(sock >= 0) << "socket";
+
+  // Lost datagrams are noticed by recvmmsg() timing out.
+  timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 100000;
+  PCHECK(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                    sizeof(timeout)) == 0)
+      << "setsockopt(SO_RCVTIMEO)";
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(FLAGS_port);
+  CHECK_EQ(1, inet_pton(AF_INET, FLAGS_server.c_str(), &addr.sin_addr))
+      << "Invalid server address: " << FLAGS_server;
+  PCHECK(connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ==
+         0)
+      << "connect";
+
+  return sock;
+}
+
+
+void Send(int sock, vector<mmsghdr>* msgs, int count) {
+  int sent(0);
+  while (sent < count) {
+    const int num_sent(sendmmsg(sock, &(*msgs)[sent], count - sent, 0));
+    PCHECK(num_sent > 0 || errno == EINTR) << "sendmmsg";
+    if (num_sent > 0) {
+      sent += num_sent;
+    }
+  }
+}
+
+
+// Keeps FLAGS_window queries outstanding until |deadline|, sending a
+// new query for every reply received.
+void LoadThread(const string& query, steady_clock::time_point deadline,
+                atomic<int64_t>* replies, atomic<int64_t>* timeouts) {
+  const int sock(ConnectSocket());
+
+  iovec out_iov;
+  out_iov.iov_base = const_cast<char*>(query.data());
+  out_iov.iov_len = query.size();
+  vector<mmsghdr> out_msgs(FLAGS_window);
+  for (auto& msg : out_msgs) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_hdr.msg_iov = &out_iov;
+    msg.msg_hdr.msg_iovlen = 1;
+  }
+
+  vector<char> in_bufs(FLAGS_window * kMaxDatagramSize);
+  vector<iovec> in_iovs(FLAGS_window);
+  vector<mmsghdr> in_msgs(FLAGS_window);
+  for (int i = 0; i < FLAGS_window; ++i) {
+    in_iovs[i].iov_base = &in_bufs[i * kMaxDatagramSize];
+    in_iovs[i].iov_len = kMaxDatagramSize;
+    memset(&in_msgs[i], 0, sizeof(in_msgs[i]));
+    in_msgs[i].msg_hdr.msg_iov = &in_iovs[i];
+    in_msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int64_t num_replies(0);
+  int64_t num_timeouts(0);
+  Send(sock, &out_msgs, FLAGS_window);
+  while (steady_clock::now() < deadline) {
+    const int num_in(recvmmsg(sock, in_msgs.data(), FLAGS_window,
+                              MSG_WAITFORONE, nullptr));
+    if (num_in < 0) {
+      PCHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+          << "recvmmsg";
+      if (errno != EINTR) {
+        // Some queries or replies were lost, start over with a full
+        // window.
+        ++num_timeouts;
+        Send(sock, &out_msgs, FLAGS_window);
+      }
+      continue;
+    }
+
+    num_replies += num_in;
+    Send(sock, &out_msgs, num_in);
+  }
+
+  close(sock);
+  *replies += num_replies;
+  *timeouts += num_timeouts;
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_threads, 0);
+  CHECK_GT(FLAGS_window, 0);
+  CHECK_GT(FLAGS_duration_seconds, 0);
+
+  const string query(MakeQuery(FLAGS_query));
+  atomic<int64_t> replies(0);
+  atomic<int64_t> timeouts(0);
+
+  const steady_clock::time_point start(steady_clock::now());
+  const steady_clock::time_point deadline(start +
+                                          seconds(FLAGS_duration_seconds));
+  vector<thread> threads;
+  for (int i = 0; i < FLAGS_threads; ++i) {
+    threads.emplace_back(
+        thread(&LoadThread, query, deadline, &replies, &timeouts));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const duration<double> elapsed(steady_clock::now() - start);
+
+  cout << FLAGS_threads << " threads, window of " << FLAGS_window << ": "
+       << replies << " replies in " << elapsed.count() << " s ("
+       << static_cast<int64_t>(replies / elapsed.count())
+       << " queries/s), " << timeouts << " timeouts" << endl;
+
+  return 0;
+}
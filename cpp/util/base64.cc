@@ -0,0 +1,441 @@
+#include "util/base64.h"
+
+#include <glog/logging.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BASE64_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+using std::string;
+
+namespace util {
+namespace {
+
+
+const char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The SIMD decoders write a few bytes past the end of the data they
+// decode.
+const size_t kDecodeSlack = 8;
+
+
+class DecodeTable {
+ public:
+  DecodeTable() {
+    memset(values_, -1, sizeof(values_));
+    for (int i = 0; i < 64; ++i) {
+      values_[static_cast<uint8_t>(kAlphabet[i])] = i;
+    }
+  }
+
+  int8_t operator[](char c) const {
+    return values_[static_cast<uint8_t>(c)];
+  }
+
+ private:
+  int8_t values_[256];
+};
+
+
+const DecodeTable& GetDecodeTable() {
+  static const DecodeTable* const table(new DecodeTable);
+  return *table;
+}
+
+
+// Encodes all of [src, src + size), including the padding.
+void EncodeScalar(const uint8_t* src, size_t size, char* dst) {
+  for (; size >= 3; src += 3, size -= 3) {
+    const uint32_t triple((src[0] << 16) | (src[1] << 8) | src[2]);
+    *dst++ = kAlphabet[triple >> 18];
+    *dst++ = kAlphabet[(triple >> 12) & 0x3f];
+    *dst++ = kAlphabet[(triple >> 6) & 0x3f];
+    *dst++ = kAlphabet[triple & 0x3f];
+  }
+
+  if (size > 0) {
+    const uint32_t triple((src[0] << 16) | (size > 1 ? src[1] << 8 : 0));
+    *dst++ = kAlphabet[triple >> 18];
+    *dst++ = kAlphabet[(triple >> 12) & 0x3f];
+    *dst++ = size > 1 ? kAlphabet[(triple >> 6) & 0x3f] : '=';
+    *dst++ = '=';
+  }
+}
+
+
+// Decodes [src, src + size), where |size| is a multiple of 4, and
+// only the last quad can have padding.
+bool DecodeScalar(const char* src, size_t size, uint8_t* dst) {
+  const DecodeTable& table(GetDecodeTable());
+  if (size == 0) {
+    return true;
+  }
+
+  const char* const last_quad(src + size - 4);
+  for (; src < last_quad; src += 4) {
+    const int8_t a(table[src[0]]), b(table[src[1]]), c(table[src[2]]),
+        d(table[src[3]]);
+    if ((a | b | c | d) < 0) {
+      return false;
+    }
+    *dst++ = (a << 2) | (b >> 4);
+    *dst++ = (b << 4) | (c >> 2);
+    *dst++ = (c << 6) | d;
+  }
+
+  const int padding(last_quad[3] != '=' ? 0 : (last_quad[2] != '=' ? 1 : 2));
+  const int8_t a(table[last_quad[0]]), b(table[last_quad[1]]);
+  const int8_t c(padding > 1 ? 0 : table[last_quad[2]]);
+  const int8_t d(padding > 0 ? 0 : table[last_quad[3]]);
+  if ((a | b | c | d) < 0) {
+    return false;
+  }
+  *dst++ = (a << 2) | (b >> 4);
+  if (padding < 2) {
+    *dst++ = (b << 4) | (c >> 2);
+  }
+  if (padding < 1) {
+    *dst++ = (c << 6) | d;
+  }
+
+  return true;
+}
+
+
+#ifdef BASE64_HAVE_X86_SIMD
+
+
+// The SIMD codecs are based on the algorithms described by Wojciech
+// Muła and Daniel Lemire in "Faster Base64 Encoding and Decoding
+// Using AVX2 Instructions" (ACM TOW, 2018). They work on whole
+// blocks, and return how many input bytes they consumed, leaving the
+// rest (including the padding) to the scalar code.
+
+
+// Spreads 12 bytes into 16 6-bit values, one per byte.
+__attribute__((target("ssse3"))) inline __m128i EncodeReshuffle(
+    __m128i in) {
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3,
+                                         4, 1, 2, 0, 1));
+  const __m128i t0(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)));
+  const __m128i t1(_mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040)));
+  const __m128i t2(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)));
+  const __m128i t3(_mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010)));
+  return _mm_or_si128(t1, t3);
+}
+
+
+// Maps 6-bit values to their ASCII characters.
+__attribute__((target("ssse3"))) inline __m128i EncodeTranslate(
+    __m128i in) {
+  __m128i offset_index(_mm_subs_epu8(in, _mm_set1_epi8(51)));
+  const __m128i is_upper(_mm_cmpgt_epi8(_mm_set1_epi8(26), in));
+  offset_index =
+      _mm_or_si128(offset_index, _mm_and_si128(is_upper, _mm_set1_epi8(13)));
+  const __m128i offsets(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                      '/' - 63, 'A', 0, 0));
+  return _mm_add_epi8(in, _mm_shuffle_epi8(offsets, offset_index));
+}
+
+
+__attribute__((target("ssse3"))) size_t EncodeSsse3(const uint8_t* src,
+                                                    size_t size, char* dst) {
+  size_t consumed(0);
+  // Each iteration loads 16 bytes, but only uses 12 of them.
+  for (; size - consumed >= 16; consumed += 12, dst += 16) {
+    const __m128i in(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + consumed)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                     EncodeTranslate(EncodeReshuffle(in)));
+  }
+  return consumed;
+}
+
+
+// Maps ASCII characters to their 6-bit values. Returns false if any
+// of the characters is not part of the base64 alphabet.
+__attribute__((target("ssse3"))) inline bool DecodeTranslate(__m128i* str) {
+  const __m128i lut_lo(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                     0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                     0x1b, 0x1b, 0x1b, 0x1a));
+  const __m128i lut_hi(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                     0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                     0x10, 0x10, 0x10, 0x10));
+  const __m128i lut_roll(
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+  const __m128i mask_2f(_mm_set1_epi8(0x2f));
+
+  const __m128i hi_nibbles(
+      _mm_and_si128(_mm_srli_epi32(*str, 4), mask_2f));
+  const __m128i lo_nibbles(_mm_and_si128(*str, mask_2f));
+  const __m128i hi(_mm_shuffle_epi8(lut_hi, hi_nibbles));
+  const __m128i lo(_mm_shuffle_epi8(lut_lo, lo_nibbles));
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+                                       _mm_setzero_si128())) != 0xffff) {
+    return false;
+  }
+
+  const __m128i eq_2f(_mm_cmpeq_epi8(*str, mask_2f));
+  const __m128i roll(
+      _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+  *str = _mm_add_epi8(*str, roll);
+  return true;
+}
+
+
+// Packs 16 6-bit values into the first 12 bytes.
+__attribute__((target("ssse3"))) inline __m128i DecodeReshuffle(
+    __m128i in) {
+  const __m128i merge_ab_and_bc(
+      _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140)));
+  const __m128i out(
+      _mm_madd_epi16(merge_ab_and_bc, _mm_set1_epi32(0x00011000)));
+  return _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                             13, 12, -1, -1, -1, -1));
+}
+
+
+__attribute__((target("ssse3"))) size_t DecodeSsse3(const char* src,
+                                                    size_t size,
+                                                    uint8_t* dst) {
+  size_t consumed(0);
+  // Leave at least the last quad, which might be padded.
+  for (; size - consumed >= 20; consumed += 16, dst += 12) {
+    __m128i str(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + consumed)));
+    if (!DecodeTranslate(&str)) {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), DecodeReshuffle(str));
+  }
+  return consumed;
+}
+
+
+__attribute__((target("avx2"))) size_t EncodeAvx2(const uint8_t* src,
+                                                  size_t size, char* dst) {
+  const __m256i shuffle(_mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5,
+      4, 7, 6, 8, 7, 10, 9, 11, 10));
+  const __m256i offsets(_mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+
+  size_t consumed(0);
+  // Each iteration loads 12 bytes into each 128-bit lane, reading 28
+  // bytes in total.
+  for (; size - consumed >= 28; consumed += 24, dst += 32) {
+    const __m128i lo(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + consumed)));
+    const __m128i hi(_mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(src + consumed + 12)));
+    __m256i in(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+
+    in = _mm256_shuffle_epi8(in, shuffle);
+    const __m256i t0(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)));
+    const __m256i t1(_mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040)));
+    const __m256i t2(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)));
+    const __m256i t3(_mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010)));
+    const __m256i indices(_mm256_or_si256(t1, t3));
+
+    __m256i offset_index(_mm256_subs_epu8(indices, _mm256_set1_epi8(51)));
+    const __m256i is_upper(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices));
+    offset_index = _mm256_or_si256(
+        offset_index, _mm256_and_si256(is_upper, _mm256_set1_epi8(13)));
+    const __m256i out(_mm256_add_epi8(
+        indices, _mm256_shuffle_epi8(offsets, offset_index)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), out);
+  }
+  return consumed;
+}
+
+
+__attribute__((target("avx2"))) size_t DecodeAvx2(const char* src,
+                                                  size_t size, uint8_t* dst) {
+  const __m256i lut_lo(_mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+      0x1b, 0x1b, 0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a));
+  const __m256i lut_hi(_mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+  const __m256i lut_roll(_mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4,
+      -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+  const __m256i mask_2f(_mm256_set1_epi8(0x2f));
+  const __m256i pack_lanes(_mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5,
+      4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+  size_t consumed(0);
+  // Leave at least the last quad, which might be padded.
+  for (; size - consumed >= 36; consumed += 32, dst += 24) {
+    __m256i str(_mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(src + consumed)));
+
+    const __m256i hi_nibbles(
+        _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f));
+    const __m256i lo_nibbles(_mm256_and_si256(str, mask_2f));
+    const __m256i hi(_mm256_shuffle_epi8(lut_hi, hi_nibbles));
+    const __m256i lo(_mm256_shuffle_epi8(lut_lo, lo_nibbles));
+    if (!_mm256_testz_si256(lo, hi)) {
+      break;
+    }
+    const __m256i eq_2f(_mm256_cmpeq_epi8(str, mask_2f));
+    const __m256i roll(
+        _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+    str = _mm256_add_epi8(str, roll);
+
+    const __m256i merge_ab_and_bc(
+        _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140)));
+    __m256i out(
+        _mm256_madd_epi16(merge_ab_and_bc, _mm256_set1_epi32(0x00011000)));
+    out = _mm256_shuffle_epi8(out, pack_lanes);
+    // Move the 12 bytes of the upper lane right after the 12 bytes of
+    // the lower one.
+    out = _mm256_permutevar8x32_epi32(
+        out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), out);
+  }
+  return consumed;
+}
+
+
+#endif  // BASE64_HAVE_X86_SIMD
+
+
+internal::Base64Codec BestCodec() {
+#ifdef BASE64_HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return internal::Base64Codec::AVX2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return internal::Base64Codec::SSSE3;
+  }
+#endif
+  return internal::Base64Codec::SCALAR;
+}
+
+
+internal::Base64Codec GetBestCodec() {
+  static const internal::Base64Codec codec(BestCodec());
+  return codec;
+}
+
+
+}  // namespace
+
+
+void AppendToBase64(const char* data, size_t size, string* out) {
+  internal::AppendToBase64(GetBestCodec(), data, size, out);
+}
+
+
+bool AppendFromBase64(const char* data, size_t size, string* out) {
+  return internal::AppendFromBase64(GetBestCodec(), data, size, out);
+}
+
+
+namespace internal {
+
+
+bool Base64CodecSupported(Base64Codec codec) {
+  switch (codec) {
+    case Base64Codec::SCALAR:
+      return true;
+#ifdef BASE64_HAVE_X86_SIMD
+    case Base64Codec::SSSE3:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("ssse3");
+    case Base64Codec::AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+
+void AppendToBase64(Base64Codec codec, const char* data, size_t size,
+                    string* out) {
+  const size_t old_size(out->size());
+  out->resize(old_size + (size + 2) / 3 * 4);
+  const uint8_t* src(reinterpret_cast<const uint8_t*>(data));
+  char* dst(&(*out)[old_size]);
+
+  size_t consumed(0);
+  switch (codec) {
+    case Base64Codec::SCALAR:
+      break;
+#ifdef BASE64_HAVE_X86_SIMD
+    case Base64Codec::SSSE3:
+      consumed = EncodeSsse3(src, size, dst);
+      break;
+    case Base64Codec::AVX2:
+      consumed = EncodeAvx2(src, size, dst);
+      break;
+#endif
+    default:
+      LOG(FATAL) << "unsupported codec: " << static_cast<int>(codec);
+  }
+
+  EncodeScalar(src + consumed, size - consumed, dst + consumed / 3 * 4);
+}
+
+
+bool AppendFromBase64(Base64Codec codec, const char* data, size_t size,
+                      string* out) {
+  if (size % 4 != 0) {
+    return false;
+  }
+  size_t decoded_size(size / 4 * 3);
+  if (size > 0 && data[size - 1] == '=') {
+    decoded_size -= data[size - 2] == '=' ? 2 : 1;
+  }
+
+  const size_t old_size(out->size());
+  out->resize(old_size + decoded_size + kDecodeSlack);
+  uint8_t* const dst(reinterpret_cast<uint8_t*>(&(*out)[old_size]));
+
+  size_t consumed(0);
+  switch (codec) {
+    case Base64Codec::SCALAR:
+      break;
+#ifdef BASE64_HAVE_X86_SIMD
+    case Base64Codec::SSSE3:
+      consumed = DecodeSsse3(data, size, dst);
+      break;
+    case Base64Codec::AVX2:
+      consumed = DecodeAvx2(data, size, dst);
+      break;
+#endif
+    default:
+      LOG(FATAL) << "unsupported codec: " << static_cast<int>(codec);
+  }
+
+  // If a SIMD codec stopped early because of an invalid character,
+  // the scalar code will find it again.
+  if (!DecodeScalar(data + consumed, size - consumed,
+                    dst + consumed / 4 * 3)) {
+    out->resize(old_size);
+    return false;
+  }
+
+  out->resize(old_size + decoded_size);
+  return true;
+}
+
+
+}  // namespace internal
+}  // namespace util
@@ -0,0 +1,47 @@
+#ifndef CERT_TRANS_UTIL_BASE64_H_
+#define CERT_TRANS_UTIL_BASE64_H_
+
+#include <stddef.h>
+#include <string>
+
+namespace util {
+
+
+// Appends the (padded) base64 encoding of [data, data + size) to
+// |out|.
+void AppendToBase64(const char* data, size_t size, std::string* out);
+
+// Appends the decoding of the base64 string [data, data + size) to
+// |out|. Unlike FromBase64(), this is strict: the input must be
+// padded, and cannot contain whitespace. Returns false if the input
+// is invalid, in which case |out| is left unchanged.
+bool AppendFromBase64(const char* data, size_t size, std::string* out);
+
+
+namespace internal {
+
+
+// The codecs used by the functions above, which pick the fastest one
+// the CPU supports. Exposed for testing and benchmarking.
+enum class Base64Codec {
+  SCALAR,
+  SSSE3,
+  AVX2,
+};
+
+
+bool Base64CodecSupported(Base64Codec codec);
+
+// REQUIRES: Base64CodecSupported(codec).
+void AppendToBase64(Base64Codec codec, const char* data, size_t size,
+                    std::string* out);
+
+// REQUIRES: Base64CodecSupported(codec).
+bool AppendFromBase64(Base64Codec codec, const char* data, size_t size,
+                      std::string* out);
+
+
+}  // namespace internal
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_BASE64_H_
@@ -0,0 +1,123 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>  // for resolv.h
+#include <resolv.h>      // for b64_ntop
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "util/base64.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+DEFINE_int32(base64_value_bytes, 1500,
+             "Size of the values to encode and decode, which should be "
+             "about the size of a certificate.");
+DEFINE_int32(base64_total_megabytes, 64,
+             "Total amount of data to encode and decode with each codec.");
+
+namespace util {
+namespace {
+
+using internal::Base64Codec;
+using std::string;
+using std::vector;
+
+
+class Base64LargeTest : public ::testing::Test {
+ protected:
+  Base64LargeTest()
+      : data_(RandomString(FLAGS_base64_value_bytes,
+                           FLAGS_base64_value_bytes)),
+        iterations_(static_cast<int64_t>(FLAGS_base64_total_megabytes) *
+                    1000000 / data_.size()) {
+    AppendToBase64(data_.data(), data_.size(), &encoded_);
+  }
+
+  void LogThroughput(const string& codec, const string& operation,
+                     uint64_t elapsed_ms) {
+    const int original_log_level(FLAGS_minloglevel);
+    FLAGS_minloglevel = 0;
+    LOG(INFO) << codec << " " << operation << ": " << iterations_
+              << " values of " << data_.size() << " bytes in " << elapsed_ms
+              << " ms ("
+              << (elapsed_ms > 0 ? iterations_ * data_.size() / elapsed_ms /
+                                       1000
+                                 : 0)
+              << " MB/s)";
+    FLAGS_minloglevel = original_log_level;
+  }
+
+  const string data_;
+  const int64_t iterations_;
+  string encoded_;
+};
+
+
+TEST_F(Base64LargeTest, Resolv) {
+  vector<char> buf(encoded_.size() + 1);
+  uint64_t start(TimeInMilliseconds());
+  for (int64_t i = 0; i < iterations_; ++i) {
+    ASSERT_EQ(static_cast<int>(encoded_.size()),
+              b64_ntop(reinterpret_cast<const u_char*>(data_.data()),
+                       data_.size(), buf.data(), buf.size()));
+  }
+  LogThroughput("b64_ntop/b64_pton", "encode",
+                TimeInMilliseconds() - start);
+
+  start = TimeInMilliseconds();
+  for (int64_t i = 0; i < iterations_; ++i) {
+    ASSERT_EQ(static_cast<int>(data_.size()),
+              b64_pton(encoded_.c_str(), reinterpret_cast<u_char*>(buf.data()),
+                       buf.size()));
+  }
+  LogThroughput("b64_ntop/b64_pton", "decode",
+                TimeInMilliseconds() - start);
+}
+
+
+TEST_F(Base64LargeTest, Codecs) {
+  const struct {
+    Base64Codec codec;
+    const char* name;
+  } codecs[] = {{Base64Codec::SCALAR, "scalar"},
+                {Base64Codec::SSSE3, "SSSE3"},
+                {Base64Codec::AVX2, "AVX2"}};
+
+  for (const auto& codec : codecs) {
+    if (!internal::Base64CodecSupported(codec.codec)) {
+      LOG(WARNING) << codec.name << " is not supported on this CPU";
+      continue;
+    }
+
+    // Reuse the output buffers, like JsonReader does.
+    string out;
+    uint64_t start(TimeInMilliseconds());
+    for (int64_t i = 0; i < iterations_; ++i) {
+      out.clear();
+      internal::AppendToBase64(codec.codec, data_.data(), data_.size(), &out);
+    }
+    LogThroughput(codec.name, "encode", TimeInMilliseconds() - start);
+    EXPECT_EQ(encoded_, out);
+
+    start = TimeInMilliseconds();
+    for (int64_t i = 0; i < iterations_; ++i) {
+      out.clear();
+      ASSERT_TRUE(internal::AppendFromBase64(codec.codec, encoded_.data(),
+                                             encoded_.size(), &out));
+    }
+    LogThroughput(codec.name, "decode", TimeInMilliseconds() - start);
+    EXPECT_EQ(data_, out);
+  }
+}
+
+
+}  // namespace
+}  // namespace util
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
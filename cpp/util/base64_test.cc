@@ -0,0 +1,153 @@
+#include "util/base64.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace util {
+namespace {
+
+using internal::Base64Codec;
+using internal::Base64CodecSupported;
+using std::string;
+using std::vector;
+
+
+vector<Base64Codec> SupportedCodecs() {
+  vector<Base64Codec> retval;
+  for (const Base64Codec codec :
+       {Base64Codec::SCALAR, Base64Codec::SSSE3, Base64Codec::AVX2}) {
+    if (Base64CodecSupported(codec)) {
+      retval.push_back(codec);
+    }
+  }
+  return retval;
+}
+
+
+string Encode(Base64Codec codec, const string& data) {
+  string retval;
+  internal::AppendToBase64(codec, data.data(), data.size(), &retval);
+  return retval;
+}
+
+
+bool Decode(Base64Codec codec, const string& data, string* out) {
+  return internal::AppendFromBase64(codec, data.data(), data.size(), out);
+}
+
+
+TEST(Base64Test, Rfc4648Vectors) {
+  const char* const vectors[][2] = {{"", ""},
+                                    {"f", "Zg=="},
+                                    {"fo", "Zm8="},
+                                    {"foo", "Zm9v"},
+                                    {"foob", "Zm9vYg=="},
+                                    {"fooba", "Zm9vYmE="},
+                                    {"foobar", "Zm9vYmFy"}};
+  for (const Base64Codec codec : SupportedCodecs()) {
+    for (const auto& vec : vectors) {
+      EXPECT_EQ(vec[1], Encode(codec, vec[0]));
+      string decoded;
+      EXPECT_TRUE(Decode(codec, vec[1], &decoded));
+      EXPECT_EQ(vec[0], decoded);
+    }
+  }
+}
+
+
+TEST(Base64Test, CodecsAgree) {
+  for (size_t length = 0; length < 300; ++length) {
+    const string data(RandomString(length, length));
+    const string expected(Encode(Base64Codec::SCALAR, data));
+    ASSERT_EQ((length + 2) / 3 * 4, expected.size());
+
+    for (const Base64Codec codec : SupportedCodecs()) {
+      EXPECT_EQ(expected, Encode(codec, data))
+          << "codec " << static_cast<int>(codec) << ", length " << length;
+      string decoded;
+      ASSERT_TRUE(Decode(codec, expected, &decoded));
+      EXPECT_EQ(data, decoded) << "codec " << static_cast<int>(codec)
+                               << ", length " << length;
+    }
+  }
+}
+
+
+TEST(Base64Test, AllCharacters) {
+  string data;
+  for (int i = 0; i < 3 * 256; ++i) {
+    data.push_back(static_cast<char>(i * 7 + i / 256));
+  }
+  const string encoded(Encode(Base64Codec::SCALAR, data));
+  for (const Base64Codec codec : SupportedCodecs()) {
+    string decoded;
+    ASSERT_TRUE(Decode(codec, encoded, &decoded));
+    EXPECT_EQ(data, decoded);
+  }
+}
+
+
+TEST(Base64Test, AppendsToExistingContents) {
+  for (const Base64Codec codec : SupportedCodecs()) {
+    string out("prefix");
+    internal::AppendToBase64(codec, "foobar", 6, &out);
+    EXPECT_EQ("prefixZm9vYmFy", out);
+
+    string decoded("prefix");
+    ASSERT_TRUE(Decode(codec, "Zm9vYmFy", &decoded));
+    EXPECT_EQ("prefixfoobar", decoded);
+  }
+}
+
+
+TEST(Base64Test, RejectsInvalidInput) {
+  const string valid(Encode(Base64Codec::SCALAR, RandomString(90, 90)));
+  const char bad_chars[] = {'=', '-', '_', ' ', '\n', '\0', '\x80', '\xff'};
+
+  for (const Base64Codec codec : SupportedCodecs()) {
+    // Every invalid character, at every position, must be caught,
+    // whichever part of the codec handles it.
+    for (size_t pos = 0; pos < valid.size(); ++pos) {
+      for (const char bad : bad_chars) {
+        if (bad == '=' && pos == valid.size() - 1) {
+          // That is just padding.
+          continue;
+        }
+        string input(valid);
+        input[pos] = bad;
+        string decoded("unchanged");
+        EXPECT_FALSE(Decode(codec, input, &decoded))
+            << "codec " << static_cast<int>(codec) << ", position " << pos
+            << ", character " << static_cast<int>(bad);
+        EXPECT_EQ("unchanged", decoded);
+      }
+    }
+
+    string decoded;
+    EXPECT_FALSE(Decode(codec, "Zm9", &decoded));
+    EXPECT_FALSE(Decode(codec, "Zg=a", &decoded));
+    EXPECT_FALSE(Decode(codec, "Z===", &decoded));
+    EXPECT_FALSE(Decode(codec, "====", &decoded));
+  }
+}
+
+
+TEST(Base64Test, FromBase64IsLenient) {
+  EXPECT_EQ("foobar", FromBase64("Zm9v\nYmFy"));
+  EXPECT_EQ("", FromBase64("not base64!"));
+  EXPECT_EQ("foobar", FromBase64(ToBase64("foobar").c_str()));
+}
+
+
+}  // namespace
+}  // namespace util
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,12 +1,17 @@
+#include <chrono>
 #include <event2/thread.h>
 #include <functional>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <map>
 #include <memory>
+#include <stdio.h>
+#include <string.h>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "net/url_fetcher.h"
 #include "util/etcd.h"
 #include "util/libevent_wrapper.h"
 #include "util/sync_task.h"
@@ -16,6 +21,10 @@ namespace libevent = cert_trans::libevent;
 using cert_trans::EtcdClient;
 using cert_trans::UrlFetcher;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::make_pair;
+using std::map;
 using std::make_shared;
 using std::placeholders::_1;
 using std::shared_ptr;
@@ -33,10 +42,146 @@ DEFINE_int32(requests_per_thread, 10, "number of requests per thread");
 DEFINE_int32(bytes_per_request, 10, "number of bytes per requests");
 DEFINE_int32(num_threads, 1, "number of threads");
 DEFINE_string(test_key, "/bench_etcd", "base etcd key for testing");
+DEFINE_bool(fake_etcd, false,
+            "Serve the requests from an in-process fake instead of --etcd, "
+            "to measure the cost of the requests to the client alone.");
+DEFINE_bool(get_after_create, false,
+            "Follow each create request with a get of the same key.");
 
 namespace {
 
 
+const char kKeysPrefix[] = "/v2/keys";
+
+
+void AppendJsonString(const string& value, string* out) {
+  out->push_back('"');
+  for (const char c : value) {
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escape[7];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      out->append(escape);
+    } else {
+      out->push_back(c);
+    }
+  }
+  out->push_back('"');
+}
+
+
+void AppendNodeJson(const EtcdClient::Node& node, string* out) {
+  out->append("{\"createdIndex\":" + to_string(node.created_index_) +
+              ",\"key\":");
+  AppendJsonString(node.key_, out);
+  out->append(",\"modifiedIndex\":" + to_string(node.modified_index_));
+  if (node.is_dir_) {
+    out->append(",\"dir\":true,\"nodes\":[");
+    for (size_t i = 0; i < node.nodes_.size(); ++i) {
+      if (i > 0) {
+        out->push_back(',');
+      }
+      AppendNodeJson(node.nodes_[i], out);
+    }
+    out->push_back(']');
+  } else {
+    out->append(",\"value\":");
+    AppendJsonString(node.value_, out);
+  }
+  out->push_back('}');
+}
+
+
+// Returns the URL-decoded value of |name| in the URL-encoded |params|.
+string FormValue(const string& params, const string& name) {
+  const string prefix(name + "=");
+  size_t begin(0);
+  while (begin < params.size()) {
+    size_t end(params.find('&', begin));
+    if (end == string::npos) {
+      end = params.size();
+    }
+    if (params.compare(begin, prefix.size(), prefix) == 0) {
+      string value;
+      for (size_t i = begin + prefix.size(); i < end; ++i) {
+        if (params[i] == '%' && i + 2 < end) {
+          value.push_back(stoi(params.substr(i + 1, 2), nullptr, 16));
+          i += 2;
+        } else {
+          value.push_back(params[i]);
+        }
+      }
+      return value;
+    }
+    begin = end + 1;
+  }
+  return string();
+}
+
+
+// Speaks the part of the etcd v2 protocol the benchmark uses (creating
+// and getting single keys) from an in-memory map, cheaply enough that
+// the benchmark measures EtcdClient rather than the server.
+class FakeEtcdFetcher : public UrlFetcher {
+ public:
+  FakeEtcdFetcher() : index_(0) {
+  }
+
+  void Fetch(const Request& req, Response* resp, Task* task) override;
+
+ private:
+  void Reply(int status_code, const EtcdClient::Node* node, Response* resp);
+
+  int64_t index_;
+  map<string, EtcdClient::Node> entries_;
+};
+
+
+void FakeEtcdFetcher::Fetch(const Request& req, Response* resp, Task* task) {
+  CHECK_EQ(0, req.url.Path().compare(0, strlen(kKeysPrefix), kKeysPrefix))
+      << req.url.Path();
+  const string key(req.url.Path().substr(strlen(kKeysPrefix)));
+
+  if (req.verb == UrlFetcher::Verb::PUT) {
+    CHECK_EQ("false", FormValue(req.body, "prevExist")) << "not implemented";
+    const auto inserted(entries_.insert(make_pair(key, EtcdClient::Node())));
+    if (!inserted.second) {
+      Reply(412, nullptr, resp);
+    } else {
+      ++index_;
+      inserted.first->second =
+          EtcdClient::Node(index_, index_, key, false,
+                           FormValue(req.body, "value"), {}, false);
+      Reply(201, &inserted.first->second, resp);
+    }
+  } else {
+    CHECK(req.verb == UrlFetcher::Verb::GET) << "not implemented";
+    const auto it(entries_.find(key));
+    Reply(it == entries_.end() ? 404 : 200,
+          it == entries_.end() ? nullptr : &it->second, resp);
+  }
+  task->Return();
+}
+
+
+void FakeEtcdFetcher::Reply(int status_code, const EtcdClient::Node* node,
+                            Response* resp) {
+  resp->status_code = status_code;
+  resp->headers.clear();
+  resp->headers.insert(make_pair("X-Etcd-Index", to_string(index_)));
+  if (!node) {
+    resp->body = "{\"errorCode\":100,\"message\":\"failed\"}";
+    return;
+  }
+  resp->body = status_code == 201 ? "{\"action\":\"create\",\"node\":"
+                                  : "{\"action\":\"get\",\"node\":";
+  AppendNodeJson(*node, &resp->body);
+  resp->body.push_back('}');
+}
+
+
 struct State {
   State(EtcdClient* etcd, int thread_num, Task* task)
       : etcd_(CHECK_NOTNULL(etcd)),
@@ -50,6 +195,7 @@ struct State {
 
   void MakeRequest();
   void RequestDone(Task* child_task);
+  void GetDone(Task* child_task);
 
   EtcdClient* const etcd_;
   const string key_prefix_;
@@ -57,13 +203,16 @@ struct State {
   const string data_;
 
   int64_t next_key_;
+  string key_;
   EtcdClient::Response resp_;
+  EtcdClient::GetResponse get_resp_;
   int num_left_;
 };
 
 
 void State::MakeRequest() {
-  etcd_->Create(key_prefix_ + to_string(next_key_), "value", &resp_,
+  key_ = key_prefix_ + to_string(next_key_);
+  etcd_->Create(key_, data_, &resp_,
                 task_->AddChild(bind(&State::RequestDone, this, _1)));
 }
 
@@ -73,6 +222,21 @@ void State::RequestDone(Task* child_task) {
   --num_left_;
   next_key_ = resp_.etcd_index;
 
+  if (FLAGS_get_after_create) {
+    etcd_->Get(key_, &get_resp_,
+               task_->AddChild(bind(&State::GetDone, this, _1)));
+  } else if (num_left_ > 0) {
+    MakeRequest();
+  } else {
+    task_->Return();
+  }
+}
+
+
+void State::GetDone(Task* child_task) {
+  CHECK_EQ(Status::OK, child_task->status());
+  CHECK_EQ(data_, get_resp_.node.value_);
+
   if (num_left_ > 0) {
     MakeRequest();
   } else {
@@ -84,8 +248,10 @@ void State::RequestDone(Task* child_task) {
 void test_etcd(int thread_num) {
   const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
   libevent::EventPumpThread pump(event_base);
-  UrlFetcher fetcher(event_base.get());
-  EtcdClient etcd(&fetcher, FLAGS_etcd, FLAGS_etcd_port);
+  std::unique_ptr<UrlFetcher> fetcher(
+      FLAGS_fake_etcd ? new FakeEtcdFetcher
+                      : new UrlFetcher(event_base.get()));
+  EtcdClient etcd(fetcher.get(), FLAGS_etcd, FLAGS_etcd_port);
   SyncTask task(event_base.get());
   State state(&etcd, thread_num, task.task());
 
@@ -110,6 +276,7 @@ int main(int argc, char* argv[]) {
   CHECK_GE(FLAGS_bytes_per_request, 0);
   CHECK_GT(FLAGS_num_threads, 0);
 
+  const steady_clock::time_point start(steady_clock::now());
   vector<thread> threads;
   for (int i = 0; i < FLAGS_num_threads; ++i) {
     threads.emplace_back(bind(test_etcd, i));
@@ -120,5 +287,16 @@ int main(int argc, char* argv[]) {
     it->join();
   }
 
+  // Each thread has its own event loop, and waits for each request
+  // before sending the next, so the rate per thread is the rate a
+  // single core can sustain (when --fake_etcd makes the server free).
+  const double seconds(duration<double>(steady_clock::now() - start).count());
+  const int64_t requests(static_cast<int64_t>(FLAGS_num_threads) *
+                         FLAGS_requests_per_thread *
+                         (FLAGS_get_after_create ? 2 : 1));
+  printf("%lld requests in %.3f seconds: %.0f requests/s, %.0f per thread\n",
+         static_cast<long long>(requests), seconds, requests / seconds,
+         requests / seconds / FLAGS_num_threads);
+
   return 0;
 }
@@ -5,9 +5,9 @@
 #include <glog/logging.h>
 #include <utility>
 
+#include "util/etcd_wire.h"
 #include "util/json_wrapper.h"
 #include "util/libevent_wrapper.h"
-#include "util/statusor.h"
 
 namespace libevent = cert_trans::libevent;
 
@@ -18,21 +18,17 @@ using std::chrono::system_clock;
 using std::ctime;
 using std::lock_guard;
 using std::make_pair;
-using std::make_shared;
 using std::map;
 using std::max;
 using std::move;
 using std::mutex;
 using std::ostringstream;
 using std::placeholders::_1;
-using std::shared_ptr;
 using std::string;
 using std::time_t;
-using std::to_string;
 using std::unique_ptr;
 using std::vector;
 using util::Status;
-using util::StatusOr;
 using util::Task;
 
 DEFINE_int32(etcd_watch_error_retry_delay_seconds, 5,
@@ -62,20 +58,6 @@ const char kStatsSpace[] = "/v2/stats";
 const char kStoreStatsKey[] = "/store";
 
 
-string MessageFromJsonStatus(const shared_ptr<JsonObject>& json) {
-  string message;
-  const JsonString m(*json, "message");
-
-  if (!m.Ok()) {
-    message = json->DebugString();
-  } else {
-    message = m.Value();
-  }
-
-  return message;
-}
-
-
 util::error::Code ErrorCodeForHttpResponseCode(int response_code) {
   switch (response_code) {
     case 200:
@@ -97,73 +79,15 @@ util::error::Code ErrorCodeForHttpResponseCode(int response_code) {
 }
 
 
-Status StatusFromResponseCode(const int response_code,
-                              const shared_ptr<JsonObject>& json) {
+Status StatusFromResponseCode(const int response_code, const string& body) {
   const util::error::Code error_code(
       ErrorCodeForHttpResponseCode(response_code));
   const string error_message(
-      error_code == util::error::OK ? "" : MessageFromJsonStatus(json));
+      error_code == util::error::OK ? "" : EtcdErrorMessage(body));
   return Status(error_code, error_message);
 }
 
 
-StatusOr<EtcdClient::Node> ParseNodeFromJson(const JsonObject& json_node) {
-  const JsonInt createdIndex(json_node, "createdIndex");
-  if (!createdIndex.Ok()) {
-    return Status(util::error::FAILED_PRECONDITION,
-                  "Invalid JSON: Couldn't find 'createdIndex'");
-  }
-
-  const JsonInt modifiedIndex(json_node, "modifiedIndex");
-  if (!modifiedIndex.Ok()) {
-    return Status(util::error::FAILED_PRECONDITION,
-                  "Invalid JSON: Couldn't find 'modifiedIndex'");
-  }
-
-  const JsonString key(json_node, "key");
-  if (!key.Ok()) {
-    return Status(util::error::FAILED_PRECONDITION,
-                  "Invalid JSON: Couldn't find 'key'");
-  }
-
-  const JsonString value(json_node, "value");
-  const JsonBoolean isDir(json_node, "dir");
-  const bool is_dir(isDir.Ok() && isDir.Value());
-  const bool deleted(!value.Ok() && !is_dir);
-  vector<EtcdClient::Node> nodes;
-  if (is_dir && !deleted) {
-    const JsonArray json_nodes(json_node, "nodes");
-    if (json_nodes.Ok()) {
-      for (int i = 0; i < json_nodes.Length(); ++i) {
-        const JsonObject json_entry(json_nodes, i);
-        if (!json_entry.Ok()) {
-          return Status(util::error::FAILED_PRECONDITION,
-                        "Invalid JSON: Couldn't get 'nodes' index " +
-                            to_string(i));
-        }
-
-        StatusOr<EtcdClient::Node> entry(ParseNodeFromJson(json_entry));
-        if (!entry.status().ok()) {
-          return entry.status();
-        }
-
-        if (entry.ValueOrDie().deleted_) {
-          return Status(util::error::FAILED_PRECONDITION,
-                        "Deleted sub-node " + string(key.Value()));
-        }
-
-        nodes.emplace_back(entry.ValueOrDie());
-      }
-    }
-  }
-
-  return EtcdClient::Node(createdIndex.Value(), modifiedIndex.Value(),
-                          key.Value(), is_dir,
-                          (deleted || is_dir) ? "" : value.Value(),
-                          move(nodes), deleted);
-}
-
-
 void GetRequestDone(const string& keyname, EtcdClient::GetResponse* resp,
                     Task* parent_task, EtcdClient::GenericResponse* gen_resp,
                     Task* task) {
@@ -179,21 +103,7 @@ void GetRequestDone(const string& keyname, EtcdClient::GetResponse* resp,
     return;
   }
 
-  const JsonObject json_node(*gen_resp->json_body, "node");
-  if (!json_node.Ok()) {
-    parent_task->Return(Status(util::error::FAILED_PRECONDITION,
-                               "Invalid JSON: Couldn't find 'node'"));
-    return;
-  }
-
-  StatusOr<EtcdClient::Node> node(ParseNodeFromJson(json_node));
-  if (!node.status().ok()) {
-    parent_task->Return(node.status());
-    return;
-  }
-
-  resp->node = node.ValueOrDie();
-  parent_task->Return();
+  parent_task->Return(ParseEtcdNodeResponse(gen_resp->body, &resp->node));
 }
 
 
@@ -220,14 +130,16 @@ void GetStoreStatsRequestDone(EtcdClient::StatsResponse* resp,
     return;
   }
 
-  if (!gen_resp->json_body->Ok()) {
+  // This is rare enough that json-c is fine.
+  const JsonObject json_body(gen_resp->body);
+  if (!json_body.Ok()) {
     parent_task->Return(Status(util::error::FAILED_PRECONDITION,
                                "Invalid JSON: json_body not Ok."));
     return;
   }
 
   for (const auto& stat : kStoreStats) {
-    CopyStat(stat, *gen_resp->json_body, &resp->stats);
+    CopyStat(stat, json_body, &resp->stats);
   }
   parent_task->Return();
 }
@@ -240,22 +152,16 @@ void CreateRequestDone(EtcdClient::Response* resp, Task* parent_task,
     return;
   }
 
-  const JsonObject json_node(*gen_resp->json_body, "node");
-  if (!json_node.Ok()) {
-    parent_task->Return(Status(util::error::FAILED_PRECONDITION,
-                               "Invalid JSON: Couldn't find 'node'"));
-    return;
-  }
-
-  StatusOr<EtcdClient::Node> node(ParseNodeFromJson(json_node));
-  if (!node.status().ok()) {
-    parent_task->Return(node.status());
+  EtcdClient::Node node;
+  const Status status(ParseEtcdNodeResponse(gen_resp->body, &node));
+  if (!status.ok()) {
+    parent_task->Return(status);
     return;
   }
 
-  CHECK_EQ(node.ValueOrDie().created_index_,
-           node.ValueOrDie().modified_index_);
-  resp->etcd_index = node.ValueOrDie().modified_index_;
+  CHECK_EQ(node.created_index_,
+           node.modified_index_);
+  resp->etcd_index = node.modified_index_;
   parent_task->Return();
 }
 
@@ -268,20 +174,14 @@ void UpdateRequestDone(EtcdClient::Response* resp, Task* parent_task,
     return;
   }
 
-  const JsonObject json_node(*gen_resp->json_body, "node");
-  if (!json_node.Ok()) {
-    parent_task->Return(Status(util::error::FAILED_PRECONDITION,
-                               "Invalid JSON: Couldn't find 'node'"));
-    return;
-  }
-
-  StatusOr<EtcdClient::Node> node(ParseNodeFromJson(json_node));
-  if (!node.status().ok()) {
-    parent_task->Return(node.status());
+  EtcdClient::Node node;
+  const Status status(ParseEtcdNodeResponse(gen_resp->body, &node));
+  if (!status.ok()) {
+    parent_task->Return(status);
     return;
   }
 
-  resp->etcd_index = node.ValueOrDie().modified_index_;
+  resp->etcd_index = node.modified_index_;
   parent_task->Return();
 }
 
@@ -294,46 +194,34 @@ void ForceSetRequestDone(EtcdClient::Response* resp, Task* parent_task,
     return;
   }
 
-  const JsonObject json_node(*gen_resp->json_body, "node");
-  if (!json_node.Ok()) {
-    parent_task->Return(Status(util::error::FAILED_PRECONDITION,
-                               "Invalid JSON: Couldn't find 'node'"));
-    return;
-  }
-
-  StatusOr<EtcdClient::Node> node(ParseNodeFromJson(json_node));
-  if (!node.status().ok()) {
-    parent_task->Return(node.status());
+  EtcdClient::Node node;
+  const Status status(ParseEtcdNodeResponse(gen_resp->body, &node));
+  if (!status.ok()) {
+    parent_task->Return(status);
     return;
   }
 
-  resp->etcd_index = node.ValueOrDie().modified_index_;
+  resp->etcd_index = node.modified_index_;
   parent_task->Return();
 }
 
 
-string UrlEscapeAndJoinParams(const map<string, string>& params) {
-  string retval;
-
-  bool first(true);
-  for (map<string, string>::const_iterator it = params.begin();
-       it != params.end(); ++it) {
-    if (first)
-      first = false;
-    else
-      retval += "&";
-
-    unique_ptr<char, void (*)(void*)> first(
-        evhttp_uriencode(it->first.c_str(), it->first.size(), 0), &free);
-    unique_ptr<char, void (*)(void*)> second(
-        evhttp_uriencode(it->second.c_str(), it->second.size(), 0), &free);
-
-    retval += first.get();
-    retval += "=";
-    retval += second.get();
+// The parameters of a request, with the "consistent" and "quorum"
+// parameters set according to the flags.
+//
+// TODO(pphaneuf): Setting "quorum=false" when waiting is a hack, as
+// "wait" is not incompatible with "quorum=true". It should be left to
+// the caller, though (and I'm not sure defaulting to "quorum=true" is
+// that good an idea, even).
+EtcdParams NewParams(bool wait) {
+  if (!FLAGS_etcd_consistent) {
+    LOG_EVERY_N(WARNING, 100) << "Sending request without 'consistent=true'";
   }
-
-  return retval;
+  if (!FLAGS_etcd_quorum && !wait) {
+    LOG_EVERY_N(WARNING, 100) << "Sending request without 'quorum=true'";
+  }
+  return EtcdParams(FLAGS_etcd_consistent ? "true" : nullptr,
+                    wait ? "false" : (FLAGS_etcd_quorum ? "true" : nullptr));
 }
 
 
@@ -345,7 +233,7 @@ static const EtcdClient::Node kInvalidNode(-1, -1, "", false, "", {}, true);
 
 struct EtcdClient::RequestState {
   RequestState(UrlFetcher::Verb verb, const string& key,
-               const string& key_space, map<string, string> params,
+               const string& key_space, string params,
                const HostPortPair& host_port, GenericResponse* gen_resp,
                Task* parent_task)
       : gen_resp_(CHECK_NOTNULL(gen_resp)),
@@ -356,28 +244,20 @@ struct EtcdClient::RequestState {
     req_.verb = verb;
     SetHostPort(host_port);
 
-    if (FLAGS_etcd_consistent) {
-      params.insert(make_pair("consistent", "true"));
-    } else {
-      LOG_EVERY_N(WARNING, 100) << "Sending request without 'consistent=true'";
-    }
-    if (FLAGS_etcd_quorum) {
-      params.insert(make_pair("quorum", "true"));
-    } else {
-      LOG_EVERY_N(WARNING, 100) << "Sending request without 'quorum=true'";
-    }
-
-    req_.url.SetPath(key_space + key);
+    string path;
+    path.reserve(key_space.size() + key.size());
+    path.append(key_space).append(key);
+    req_.url.SetPath(path);
     switch (req_.verb) {
       case UrlFetcher::Verb::POST:
       case UrlFetcher::Verb::PUT:
         req_.headers.insert(
             make_pair("Content-Type", "application/x-www-form-urlencoded"));
-        req_.body = UrlEscapeAndJoinParams(params);
+        req_.body = move(params);
         break;
 
       default:
-        req_.url.SetQuery(UrlEscapeAndJoinParams(params));
+        req_.url.SetQuery(params);
     }
     VLOG(2) << "path query: " << req_.url.PathQuery();
   }
@@ -670,8 +550,7 @@ void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
     return;
   }
 
-  etcd_req->gen_resp_->json_body =
-      make_shared<JsonObject>(etcd_req->resp_.body);
+  etcd_req->gen_resp_->body = move(etcd_req->resp_.body);
   etcd_req->gen_resp_->etcd_index = -1;
 
   UrlFetcher::Headers::const_iterator it(
@@ -682,7 +561,7 @@ void EtcdClient::FetchDone(RequestState* etcd_req, Task* task) {
 
   etcd_req->parent_task_->Return(
       StatusFromResponseCode(etcd_req->resp_.status_code,
-                             etcd_req->gen_resp_->json_body));
+                             etcd_req->gen_resp_->body));
 }
 
 
@@ -703,35 +582,30 @@ EtcdClient::HostPortPair EtcdClient::UpdateEndpoint(const string& host,
 
 
 void EtcdClient::Get(const Request& req, GetResponse* resp, Task* task) {
-  map<string, string> params;
+  EtcdParams params(NewParams(req.wait_index > 0));
   if (req.recursive) {
-    params["recursive"] = "true";
+    params.Add("recursive", "true");
   }
   if (req.wait_index > 0) {
-    params["wait"] = "true";
-    params["waitIndex"] = to_string(req.wait_index);
-    // TODO(pphaneuf): This is a hack, as "wait" is not incompatible
-    // with "quorum=true". It should be left to the caller, though
-    // (and I'm not sure defaulting to "quorum=true" is that good an
-    // idea, even).
-    params["quorum"] = "false";
+    params.Add("wait", "true");
+    params.Add("waitIndex", req.wait_index);
   }
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
-  Generic(req.key, kKeysSpace, params, UrlFetcher::Verb::GET, gen_resp,
-          task->AddChild(
-              bind(&GetRequestDone, req.key, resp, task, gen_resp, _1)));
+  Generic(req.key, kKeysSpace, params.Finish(), UrlFetcher::Verb::GET,
+          gen_resp, task->AddChild(bind(&GetRequestDone, req.key, resp, task,
+                                        gen_resp, _1)));
 }
 
 
 void EtcdClient::Create(const string& key, const string& value, Response* resp,
                         Task* task) {
-  map<string, string> params;
-  params["value"] = value;
-  params["prevExist"] = "false";
+  EtcdParams params(NewParams(false));
+  params.Add("prevExist", "false");
+  params.Add("value", value);
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
-  Generic(key, kKeysSpace, params, UrlFetcher::Verb::PUT, gen_resp,
+  Generic(key, kKeysSpace, params.Finish(), UrlFetcher::Verb::PUT, gen_resp,
           task->AddChild(bind(&CreateRequestDone, resp, task, gen_resp, _1)));
 }
 
@@ -739,13 +613,13 @@ void EtcdClient::Create(const string& key, const string& value, Response* resp,
 void EtcdClient::CreateWithTTL(const string& key, const string& value,
                                const seconds& ttl, Response* resp,
                                Task* task) {
-  map<string, string> params;
-  params["value"] = value;
-  params["prevExist"] = "false";
-  params["ttl"] = to_string(ttl.count());
+  EtcdParams params(NewParams(false));
+  params.Add("prevExist", "false");
+  params.Add("ttl", ttl.count());
+  params.Add("value", value);
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
-  Generic(key, kKeysSpace, params, UrlFetcher::Verb::PUT, gen_resp,
+  Generic(key, kKeysSpace, params.Finish(), UrlFetcher::Verb::PUT, gen_resp,
           task->AddChild(bind(&CreateRequestDone, resp, task, gen_resp, _1)));
 }
 
@@ -753,12 +627,12 @@ void EtcdClient::CreateWithTTL(const string& key, const string& value,
 void EtcdClient::Update(const string& key, const string& value,
                         const int64_t previous_index, Response* resp,
                         Task* task) {
-  map<string, string> params;
-  params["value"] = value;
-  params["prevIndex"] = to_string(previous_index);
+  EtcdParams params(NewParams(false));
+  params.Add("prevIndex", previous_index);
+  params.Add("value", value);
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
-  Generic(key, kKeysSpace, params, UrlFetcher::Verb::PUT, gen_resp,
+  Generic(key, kKeysSpace, params.Finish(), UrlFetcher::Verb::PUT, gen_resp,
           task->AddChild(bind(&UpdateRequestDone, resp, task, gen_resp, _1)));
 }
 
@@ -767,24 +641,24 @@ void EtcdClient::UpdateWithTTL(const string& key, const string& value,
                                const seconds& ttl,
                                const int64_t previous_index, Response* resp,
                                Task* task) {
-  map<string, string> params;
-  params["value"] = value;
-  params["prevIndex"] = to_string(previous_index);
-  params["ttl"] = to_string(ttl.count());
+  EtcdParams params(NewParams(false));
+  params.Add("prevIndex", previous_index);
+  params.Add("ttl", ttl.count());
+  params.Add("value", value);
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
-  Generic(key, kKeysSpace, params, UrlFetcher::Verb::PUT, gen_resp,
+  Generic(key, kKeysSpace, params.Finish(), UrlFetcher::Verb::PUT, gen_resp,
           task->AddChild(bind(&UpdateRequestDone, resp, task, gen_resp, _1)));
 }
 
 
 void EtcdClient::ForceSet(const string& key, const string& value,
                           Response* resp, Task* task) {
-  map<string, string> params;
-  params["value"] = value;
+  EtcdParams params(NewParams(false));
+  params.Add("value", value);
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
-  Generic(key, kKeysSpace, params, UrlFetcher::Verb::PUT, gen_resp,
+  Generic(key, kKeysSpace, params.Finish(), UrlFetcher::Verb::PUT, gen_resp,
           task->AddChild(
               bind(&ForceSetRequestDone, resp, task, gen_resp, _1)));
 }
@@ -793,12 +667,12 @@ void EtcdClient::ForceSet(const string& key, const string& value,
 void EtcdClient::ForceSetWithTTL(const string& key, const string& value,
                                  const seconds& ttl, Response* resp,
                                  Task* task) {
-  map<string, string> params;
-  params["value"] = value;
-  params["ttl"] = to_string(ttl.count());
+  EtcdParams params(NewParams(false));
+  params.Add("ttl", ttl.count());
+  params.Add("value", value);
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
-  Generic(key, kKeysSpace, params, UrlFetcher::Verb::PUT, gen_resp,
+  Generic(key, kKeysSpace, params.Finish(), UrlFetcher::Verb::PUT, gen_resp,
           task->AddChild(
               bind(&ForceSetRequestDone, resp, task, gen_resp, _1)));
 }
@@ -806,12 +680,13 @@ void EtcdClient::ForceSetWithTTL(const string& key, const string& value,
 
 void EtcdClient::Delete(const string& key, const int64_t current_index,
                         Task* task) {
-  map<string, string> params;
-  params["prevIndex"] = to_string(current_index);
+  EtcdParams params(NewParams(false));
+  params.Add("prevIndex", current_index);
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
 
-  Generic(key, kKeysSpace, params, UrlFetcher::Verb::DELETE, gen_resp, task);
+  Generic(key, kKeysSpace, params.Finish(), UrlFetcher::Verb::DELETE,
+          gen_resp, task);
 }
 
 
@@ -819,17 +694,17 @@ void EtcdClient::ForceDelete(const string& key, Task* task) {
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
 
-  Generic(key, kKeysSpace, map<string, string>(), UrlFetcher::Verb::DELETE,
-          gen_resp, task);
+  Generic(key, kKeysSpace, NewParams(false).Finish(),
+          UrlFetcher::Verb::DELETE, gen_resp, task);
 }
 
 
 void EtcdClient::GetStoreStats(StatsResponse* resp, Task* task) {
-  map<string, string> params;
   GenericResponse* const gen_resp(new GenericResponse);
   task->DeleteWhenDone(gen_resp);
 
-  Generic(kStoreStatsKey, kStatsSpace, params, UrlFetcher::Verb::GET, gen_resp,
+  Generic(kStoreStatsKey, kStatsSpace, NewParams(false).Finish(),
+          UrlFetcher::Verb::GET, gen_resp,
           task->AddChild(
               bind(&GetStoreStatsRequestDone, resp, task, gen_resp, _1)));
 }
@@ -848,11 +723,10 @@ void EtcdClient::Watch(const string& key, const WatchCallback& cb,
 
 
 void EtcdClient::Generic(const string& key, const string& key_space,
-                         const map<string, string>& params,
-                         UrlFetcher::Verb verb, GenericResponse* resp,
-                         Task* task) {
-  RequestState* const etcd_req(new RequestState(verb, key, key_space, params,
-                                                GetEndpoint(), resp, task));
+                         string params, UrlFetcher::Verb verb,
+                         GenericResponse* resp, Task* task) {
+  RequestState* const etcd_req(new RequestState(
+      verb, key, key_space, move(params), GetEndpoint(), resp, task));
   task->DeleteWhenDone(etcd_req);
 
   fetcher_->Fetch(etcd_req->req_, &etcd_req->resp_,
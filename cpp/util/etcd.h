@@ -14,8 +14,6 @@
 #include "util/status.h"
 #include "util/task.h"
 
-class JsonObject;
-
 namespace cert_trans {
 
 
@@ -67,7 +65,8 @@ class EtcdClient {
   };
 
   struct GenericResponse : public Response {
-    std::shared_ptr<JsonObject> json_body;
+    // The JSON body, left for the caller to parse.
+    std::string body;
   };
 
   struct StatsResponse : public Response {
@@ -134,9 +133,10 @@ class EtcdClient {
   HostPortPair GetEndpoint() const;
   HostPortPair UpdateEndpoint(const std::string& host, uint16_t port);
   void FetchDone(RequestState* etcd_req, util::Task* task);
+  // |params| are URL-encoded, as built by EtcdParams.
   void Generic(const std::string& key, const std::string& key_space,
-               const std::map<std::string, std::string>& params,
-               UrlFetcher::Verb verb, GenericResponse* resp, util::Task* task);
+               std::string params, UrlFetcher::Verb verb,
+               GenericResponse* resp, util::Task* task);
 
   void WatchInitialGetDone(WatchState* state, GetResponse* resp,
                            util::Task* task);
@@ -0,0 +1,470 @@
+#include "util/etcd_v3.h"
+
+#include <chrono>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <google/protobuf/message_lite.h>
+#include <memory>
+#include <set>
+#include <stdlib.h>
+
+#include "net/url.h"
+
+using etcdserverpb::KeyValue;
+using etcdserverpb::LeaseGrantRequest;
+using etcdserverpb::LeaseGrantResponse;
+using etcdserverpb::RangeRequest;
+using etcdserverpb::RangeResponse;
+using etcdserverpb::TxnRequest;
+using etcdserverpb::TxnResponse;
+using google::protobuf::MessageLite;
+using std::bind;
+using std::chrono::milliseconds;
+using std::make_pair;
+using std::placeholders::_1;
+using std::set;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::Task;
+
+DEFINE_int32(etcd_v3_range_page_size, 1000,
+             "Maximum number of keys to get from etcd v3 in one request, "
+             "larger ranges are fetched in several.");
+DEFINE_int32(etcd_v3_watch_poll_interval_ms, 100,
+             "How often to poll etcd v3 for changes to watched keys.");
+
+namespace cert_trans {
+namespace {
+
+
+const char kGrpcStatus[] = "grpc-status";
+const char kGrpcMessage[] = "grpc-message";
+const size_t kGrpcPrefixLength = 5;
+
+
+// The "grpc-message" is percent-encoded.
+string PercentDecode(const string& in) {
+  string out;
+  out.reserve(in.size());
+  for (size_t i = 0; i < in.size(); ++i) {
+    if (in[i] == '%' && i + 2 < in.size()) {
+      out.push_back(static_cast<char>(strtol(in.substr(i + 1, 2).c_str(),
+                                             nullptr, 16)));
+      i += 2;
+    } else {
+      out.push_back(in[i]);
+    }
+  }
+  return out;
+}
+
+
+class RangeAllState {
+ public:
+  RangeAllState(EtcdV3Client* client, const RangeRequest& req,
+                vector<KeyValue>* kvs, int64_t* revision, Task* task)
+      : client_(CHECK_NOTNULL(client)),
+        req_(req),
+        kvs_(CHECK_NOTNULL(kvs)),
+        revision_(CHECK_NOTNULL(revision)),
+        task_(CHECK_NOTNULL(task)) {
+    CHECK_EQ(0, req_.limit());
+    CHECK_GT(FLAGS_etcd_v3_range_page_size, 0);
+    req_.set_limit(FLAGS_etcd_v3_range_page_size);
+  }
+
+  void Next() {
+    resp_.Clear();
+    client_->Range(req_, &resp_,
+                   task_->AddChild(bind(&RangeAllState::PageDone, this, _1)));
+  }
+
+ private:
+  void PageDone(Task* child_task) {
+    if (!child_task->status().ok()) {
+      task_->Return(child_task->status());
+      return;
+    }
+
+    if (req_.revision() == 0) {
+      req_.set_revision(resp_.header().revision());
+    }
+    *revision_ = req_.revision();
+    for (KeyValue& kv : *resp_.mutable_kvs()) {
+      kvs_->emplace_back();
+      kvs_->back().Swap(&kv);
+    }
+
+    if (resp_.more() && resp_.kvs_size() > 0) {
+      // Carry on from just after the last key.
+      req_.set_key(kvs_->back().key() + '\0');
+      Next();
+      return;
+    }
+    task_->Return();
+  }
+
+  EtcdV3Client* const client_;
+  RangeRequest req_;
+  RangeResponse resp_;
+  vector<KeyValue>* const kvs_;
+  int64_t* const revision_;
+  Task* const task_;
+};
+
+
+class WatchState {
+ public:
+  WatchState(EtcdV3Client* client, libevent::Base* base, const string& key,
+             const string& range_end, const EtcdV3WatchCallback& cb,
+             Task* task)
+      : client_(CHECK_NOTNULL(client)),
+        base_(CHECK_NOTNULL(base)),
+        key_(key),
+        range_end_(range_end),
+        cb_(cb),
+        task_(CHECK_NOTNULL(task)),
+        revision_(0),
+        new_revision_(0) {
+  }
+
+  void Poll();
+
+ private:
+  RangeRequest NewRequest() const;
+  bool Failed(const Task* child_task);
+  void InitialDone(Task* child_task);
+  void CountDone(Task* child_task);
+  void ChangedDone(Task* child_task);
+  void KeysDone(Task* child_task);
+  void Finish(const vector<string>& deleted);
+  void ScheduleNextPoll();
+
+  EtcdV3Client* const client_;
+  libevent::Base* const base_;
+  const string key_;
+  const string range_end_;
+  const EtcdV3WatchCallback cb_;
+  Task* const task_;
+
+  // The revision of the last poll (zero before the first one), and
+  // the keys which existed then.
+  int64_t revision_;
+  set<string> known_;
+
+  // The state of the poll in progress.
+  RangeResponse count_resp_;
+  int64_t new_revision_;
+  vector<KeyValue> changed_;
+  vector<KeyValue> keys_;
+};
+
+
+void WatchState::Poll() {
+  if (task_->CancelRequested()) {
+    task_->Return(Status::CANCELLED);
+    return;
+  }
+
+  if (revision_ == 0) {
+    changed_.clear();
+    EtcdV3RangeAll(client_, NewRequest(), &changed_, &new_revision_,
+                   task_->AddChild(bind(&WatchState::InitialDone, this, _1)));
+    return;
+  }
+
+  RangeRequest req(NewRequest());
+  req.set_count_only(true);
+  count_resp_.Clear();
+  client_->Range(req, &count_resp_,
+                 task_->AddChild(bind(&WatchState::CountDone, this, _1)));
+}
+
+
+RangeRequest WatchState::NewRequest() const {
+  RangeRequest req;
+  req.set_key(key_);
+  if (!range_end_.empty()) {
+    req.set_range_end(range_end_);
+  }
+  return req;
+}
+
+
+// Returns true if |child_task| failed, in which case the next poll is
+// scheduled, to start over from |revision_|.
+bool WatchState::Failed(const Task* child_task) {
+  if (child_task->status().ok()) {
+    return false;
+  }
+  if (!task_->CancelRequested()) {
+    LOG(WARNING) << "polling " << key_ << " failed: " << child_task->status();
+  }
+  ScheduleNextPoll();
+  return true;
+}
+
+
+void WatchState::InitialDone(Task* child_task) {
+  if (Failed(child_task)) {
+    return;
+  }
+  for (const KeyValue& kv : changed_) {
+    known_.insert(kv.key());
+  }
+  revision_ = new_revision_;
+  cb_(changed_, vector<string>());
+  ScheduleNextPoll();
+}
+
+
+void WatchState::CountDone(Task* child_task) {
+  if (Failed(child_task)) {
+    return;
+  }
+  new_revision_ = count_resp_.header().revision();
+  if (new_revision_ == revision_) {
+    // Nothing at all changed.
+    ScheduleNextPoll();
+    return;
+  }
+
+  RangeRequest req(NewRequest());
+  req.set_revision(new_revision_);
+  req.set_min_mod_revision(revision_ + 1);
+  changed_.clear();
+  EtcdV3RangeAll(client_, req, &changed_, &new_revision_,
+                 task_->AddChild(bind(&WatchState::ChangedDone, this, _1)));
+}
+
+
+void WatchState::ChangedDone(Task* child_task) {
+  if (Failed(child_task)) {
+    return;
+  }
+
+  // Every key that exists now was either known, or was changed since,
+  // so if there are fewer than that, some were deleted.
+  int64_t num_keys(known_.size());
+  for (const KeyValue& kv : changed_) {
+    num_keys += known_.count(kv.key()) == 0 ? 1 : 0;
+  }
+  if (num_keys == count_resp_.count()) {
+    Finish(vector<string>());
+    return;
+  }
+
+  RangeRequest req(NewRequest());
+  req.set_revision(new_revision_);
+  req.set_keys_only(true);
+  keys_.clear();
+  EtcdV3RangeAll(client_, req, &keys_, &new_revision_,
+                 task_->AddChild(bind(&WatchState::KeysDone, this, _1)));
+}
+
+
+void WatchState::KeysDone(Task* child_task) {
+  if (Failed(child_task)) {
+    return;
+  }
+
+  set<string> present;
+  for (const KeyValue& kv : keys_) {
+    present.insert(kv.key());
+  }
+  vector<string> deleted;
+  for (const string& key : known_) {
+    if (present.count(key) == 0) {
+      deleted.push_back(key);
+    }
+  }
+  Finish(deleted);
+}
+
+
+void WatchState::Finish(const vector<string>& deleted) {
+  for (const KeyValue& kv : changed_) {
+    known_.insert(kv.key());
+  }
+  for (const string& key : deleted) {
+    known_.erase(key);
+  }
+  revision_ = new_revision_;
+  if (!changed_.empty() || !deleted.empty()) {
+    cb_(changed_, deleted);
+  }
+  ScheduleNextPoll();
+}
+
+
+void WatchState::ScheduleNextPoll() {
+  base_->Delay(milliseconds(FLAGS_etcd_v3_watch_poll_interval_ms),
+               task_->AddChild(bind(&WatchState::Poll, this)));
+}
+
+
+}  // namespace
+
+
+GrpcEtcdV3Client::GrpcEtcdV3Client(UrlFetcher* fetcher, const string& host,
+                                   uint16_t port)
+    : fetcher_(CHECK_NOTNULL(fetcher)),
+      url_prefix_("http://" + host + ":" + to_string(port)) {
+}
+
+
+struct GrpcEtcdV3Client::Call {
+  Call(const string& url, MessageLite* resp_msg, Task* task)
+      : req(URL(url)), resp_msg(resp_msg), task(task) {
+  }
+
+  UrlFetcher::Request req;
+  UrlFetcher::Response resp;
+  MessageLite* const resp_msg;
+  Task* const task;
+};
+
+
+void GrpcEtcdV3Client::Range(const RangeRequest& req, RangeResponse* resp,
+                             Task* task) {
+  StartCall("/etcdserverpb.KV/Range", req, resp, task);
+}
+
+
+void GrpcEtcdV3Client::Txn(const TxnRequest& req, TxnResponse* resp,
+                           Task* task) {
+  StartCall("/etcdserverpb.KV/Txn", req, resp, task);
+}
+
+
+void GrpcEtcdV3Client::LeaseGrant(const LeaseGrantRequest& req,
+                                  LeaseGrantResponse* resp, Task* task) {
+  StartCall("/etcdserverpb.Lease/LeaseGrant", req, resp, task);
+}
+
+
+void GrpcEtcdV3Client::StartCall(const char* method, const MessageLite& req,
+                                 MessageLite* resp, Task* task) {
+  VLOG(2) << "GrpcEtcdV3Client: " << method;
+  Call* const call(new Call(url_prefix_ + method, CHECK_NOTNULL(resp),
+                            CHECK_NOTNULL(task)));
+  call->req.verb = UrlFetcher::Verb::POST;
+  call->req.headers.insert(make_pair("Content-Type", "application/grpc"));
+  call->req.headers.insert(make_pair("TE", "trailers"));
+  AppendGrpcMessage(req, &call->req.body);
+
+  fetcher_->Fetch(call->req, &call->resp,
+                  task->AddChild(
+                      bind(&GrpcEtcdV3Client::CallDone, this, call, _1)));
+}
+
+
+void GrpcEtcdV3Client::CallDone(Call* call, Task* fetch_task) {
+  const unique_ptr<Call> call_deleter(call);
+  if (!fetch_task->status().ok()) {
+    call->task->Return(fetch_task->status());
+    return;
+  }
+  call->task->Return(ParseGrpcResponse(call->resp, call->resp_msg));
+}
+
+
+void AppendGrpcMessage(const MessageLite& msg, string* out) {
+  const int size(msg.ByteSize());
+  out->reserve(out->size() + kGrpcPrefixLength + size);
+  // Not compressed.
+  out->push_back(0);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>((size >> shift) & 0xff));
+  }
+  CHECK(msg.AppendToString(out));
+}
+
+
+Status ParseGrpcResponse(const UrlFetcher::Response& resp, MessageLite* msg) {
+  if (resp.status_code != 200) {
+    return Status(util::error::UNKNOWN,
+                  "gRPC call failed with HTTP status " +
+                      to_string(resp.status_code));
+  }
+
+  const UrlFetcher::Headers::const_iterator status_it(
+      resp.headers.find(kGrpcStatus));
+  if (status_it == resp.headers.end()) {
+    return Status(util::error::INTERNAL, "gRPC response has no status");
+  }
+  const int code(atoi(status_it->second.c_str()));
+  if (code != util::error::OK) {
+    const UrlFetcher::Headers::const_iterator message_it(
+        resp.headers.find(kGrpcMessage));
+    const string message(message_it != resp.headers.end()
+                             ? PercentDecode(message_it->second)
+                             : "gRPC status " + status_it->second);
+    return Status(code > 0 && code <= util::error::DATA_LOSS
+                      ? static_cast<util::error::Code>(code)
+                      : util::error::UNKNOWN,
+                  message);
+  }
+
+  const string& body(resp.body);
+  if (body.size() < kGrpcPrefixLength) {
+    return Status(util::error::INTERNAL, "truncated gRPC response");
+  }
+  if (body[0] != 0) {
+    return Status(util::error::UNIMPLEMENTED,
+                  "compressed gRPC responses are not supported");
+  }
+  size_t size(0);
+  for (size_t i = 1; i < kGrpcPrefixLength; ++i) {
+    size = (size << 8) | static_cast<unsigned char>(body[i]);
+  }
+  if (body.size() != kGrpcPrefixLength + size) {
+    return Status(util::error::INTERNAL,
+                  "gRPC response is not a single message");
+  }
+  if (!msg->ParseFromArray(body.data() + kGrpcPrefixLength, size)) {
+    return Status(util::error::INTERNAL, "couldn't parse gRPC response");
+  }
+
+  return Status::OK;
+}
+
+
+string EtcdV3PrefixEnd(const string& prefix) {
+  string end(prefix);
+  while (!end.empty()) {
+    if (static_cast<unsigned char>(end.back()) != 0xff) {
+      ++end.back();
+      return end;
+    }
+    end.pop_back();
+  }
+  // Every byte is 0xff (or there are none), so every key from the
+  // prefix onward.
+  return string(1, '\0');
+}
+
+
+void EtcdV3RangeAll(EtcdV3Client* client, const RangeRequest& req,
+                    vector<KeyValue>* kvs, int64_t* revision, Task* task) {
+  RangeAllState* const state(
+      new RangeAllState(client, req, kvs, revision, task));
+  task->DeleteWhenDone(state);
+  state->Next();
+}
+
+
+void EtcdV3Watch(EtcdV3Client* client, libevent::Base* base,
+                 const string& key, const string& range_end,
+                 const EtcdV3WatchCallback& cb, Task* task) {
+  WatchState* const state(
+      new WatchState(client, base, key, range_end, cb, task));
+  task->DeleteWhenDone(state);
+  state->Poll();
+}
+
+
+}  // namespace cert_trans
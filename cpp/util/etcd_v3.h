@@ -0,0 +1,143 @@
+#ifndef CERT_TRANS_UTIL_ETCD_V3_H_
+#define CERT_TRANS_UTIL_ETCD_V3_H_
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "net/url_fetcher.h"
+#include "util/etcdserverpb/rpc.pb.h"
+#include "util/libevent_wrapper.h"
+#include "util/status.h"
+#include "util/task.h"
+
+namespace google {
+namespace protobuf {
+class MessageLite;
+}  // namespace protobuf
+}  // namespace google
+
+namespace cert_trans {
+
+
+// A client for the etcd v3 API, which, unlike the v2 one spoken by
+// EtcdClient, has atomic multi-key transactions, ranges with limits,
+// and leases that can be shared by many keys.
+//
+// Keys are flat byte strings, "directories" are ranges of keys
+// sharing a prefix (see EtcdV3PrefixEnd()).
+class EtcdV3Client {
+ public:
+  virtual ~EtcdV3Client() = default;
+
+  virtual void Range(const etcdserverpb::RangeRequest& req,
+                     etcdserverpb::RangeResponse* resp, util::Task* task) = 0;
+
+  // A transaction that is not |succeeded| is not an error, |task|
+  // returns OK.
+  virtual void Txn(const etcdserverpb::TxnRequest& req,
+                   etcdserverpb::TxnResponse* resp, util::Task* task) = 0;
+
+  virtual void LeaseGrant(const etcdserverpb::LeaseGrantRequest& req,
+                          etcdserverpb::LeaseGrantResponse* resp,
+                          util::Task* task) = 0;
+
+ protected:
+  EtcdV3Client() = default;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(EtcdV3Client);
+};
+
+
+// Speaks gRPC to an etcd v3 server, over |fetcher|, which must speak
+// HTTP/2 (such as Http2UrlFetcher). Only unary calls can be made that
+// way, so there are no watch or lease keep-alive streams, see
+// EtcdV3Watch() instead.
+class GrpcEtcdV3Client : public EtcdV3Client {
+ public:
+  // No change of ownership for |fetcher|.
+  GrpcEtcdV3Client(UrlFetcher* fetcher, const std::string& host,
+                   uint16_t port);
+
+  void Range(const etcdserverpb::RangeRequest& req,
+             etcdserverpb::RangeResponse* resp, util::Task* task) override;
+
+  void Txn(const etcdserverpb::TxnRequest& req,
+           etcdserverpb::TxnResponse* resp, util::Task* task) override;
+
+  void LeaseGrant(const etcdserverpb::LeaseGrantRequest& req,
+                  etcdserverpb::LeaseGrantResponse* resp,
+                  util::Task* task) override;
+
+ private:
+  struct Call;
+
+  // |method| is the full gRPC path, e.g. "/etcdserverpb.KV/Range".
+  void StartCall(const char* method, const google::protobuf::MessageLite& req,
+                 google::protobuf::MessageLite* resp, util::Task* task);
+  void CallDone(Call* call, util::Task* fetch_task);
+
+  UrlFetcher* const fetcher_;
+  const std::string url_prefix_;
+
+  DISALLOW_COPY_AND_ASSIGN(GrpcEtcdV3Client);
+};
+
+
+// Appends the gRPC length-prefixed (uncompressed) framing of |msg| to
+// |out|.
+void AppendGrpcMessage(const google::protobuf::MessageLite& msg,
+                       std::string* out);
+
+
+// Checks the HTTP status, and the gRPC status in the "grpc-status"
+// header (or trailer) of |resp|, and parses its single message into
+// |msg|. gRPC status codes are the same as the util::error ones.
+util::Status ParseGrpcResponse(const UrlFetcher::Response& resp,
+                               google::protobuf::MessageLite* msg);
+
+
+// Returns the range_end which, with |prefix| as the key, covers all
+// the keys that start with |prefix|.
+std::string EtcdV3PrefixEnd(const std::string& prefix);
+
+
+// Gets all the keys in the range of |req| (which must not have a
+// limit), --etcd_v3_range_page_size at a time, all at the revision of
+// the first page (or |req.revision()|, if set), so that they are
+// consistent with each other. The keys are appended to |kvs|, and the
+// revision they were read at is put in |revision|.
+void EtcdV3RangeAll(EtcdV3Client* client,
+                    const etcdserverpb::RangeRequest& req,
+                    std::vector<etcdserverpb::KeyValue>* kvs,
+                    int64_t* revision, util::Task* task);
+
+
+// Called with the keys which were created or modified (with their new
+// values), and the keys which were deleted.
+typedef std::function<void(const std::vector<etcdserverpb::KeyValue>& updated,
+                           const std::vector<std::string>& deleted)>
+    EtcdV3WatchCallback;
+
+// Calls |cb| with the changes to the keys in [|key|, |range_end|) (or
+// just |key|, if |range_end| is empty), until |task| is cancelled. The
+// first call has all the keys which currently exist, and is made even
+// if there are none, later ones are only made when something changed.
+// The calls are made one at a time.
+//
+// This polls every --etcd_v3_watch_poll_interval_ms, rather than using
+// the watch stream, which cannot go through a UrlFetcher. When nothing
+// changed in the whole store, a poll is a single count-only range,
+// otherwise only the keys modified since the last poll are fetched
+// (plus their names, if some were deleted).
+void EtcdV3Watch(EtcdV3Client* client, libevent::Base* base,
+                 const std::string& key, const std::string& range_end,
+                 const EtcdV3WatchCallback& cb, util::Task* task);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_ETCD_V3_H_
@@ -0,0 +1,392 @@
+#include "util/etcd_v3.h"
+
+#include <gflags/gflags.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "base/notification.h"
+#include "net/mock_url_fetcher.h"
+#include "util/fake_etcd_v3.h"
+#include "util/libevent_wrapper.h"
+#include "util/status_test_util.h"
+#include "util/sync_task.h"
+#include "util/testing.h"
+
+DECLARE_int32(etcd_v3_range_page_size);
+DECLARE_int32(etcd_v3_watch_poll_interval_ms);
+
+namespace cert_trans {
+
+using etcdserverpb::KeyValue;
+using etcdserverpb::LeaseGrantRequest;
+using etcdserverpb::LeaseGrantResponse;
+using etcdserverpb::RangeRequest;
+using etcdserverpb::RangeResponse;
+using etcdserverpb::TxnRequest;
+using etcdserverpb::TxnResponse;
+using std::bind;
+using std::chrono::milliseconds;
+using std::make_pair;
+using std::make_shared;
+using std::placeholders::_1;
+using std::placeholders::_2;
+using std::placeholders::_3;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::vector;
+using testing::AllOf;
+using testing::Contains;
+using testing::ElementsAre;
+using testing::Invoke;
+using testing::Pair;
+using testing::StrictMock;
+using testing::_;
+using util::Status;
+using util::SyncTask;
+using util::Task;
+using util::testing::StatusIs;
+
+namespace {
+
+const char kEtcdHost[] = "etcd.example.net";
+const int kEtcdPort = 2379;
+
+
+string GrpcUrl(const string& method) {
+  return "http://" + string(kEtcdHost) + ":" + to_string(kEtcdPort) + method;
+}
+
+
+string GrpcBody(const google::protobuf::MessageLite& msg) {
+  string body;
+  AppendGrpcMessage(msg, &body);
+  return body;
+}
+
+
+void HandleFetch(Status status, int status_code,
+                 const UrlFetcher::Headers& headers, const string& body,
+                 const UrlFetcher::Request& req, UrlFetcher::Response* resp,
+                 Task* task) {
+  resp->status_code = status_code;
+  resp->headers = headers;
+  resp->body = body;
+  task->Return(status);
+}
+
+
+class EtcdV3Test : public ::testing::Test {
+ public:
+  EtcdV3Test()
+      : base_(make_shared<libevent::Base>()),
+        pump_(base_),
+        client_(&url_fetcher_, kEtcdHost, kEtcdPort) {
+  }
+
+ protected:
+  void ExpectCall(const string& method, const string& body, int status_code,
+                  const UrlFetcher::Headers& headers,
+                  const string& resp_body) {
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(
+                          UrlFetcher::Verb::POST, URL(GrpcUrl(method)),
+                          AllOf(Contains(Pair("Content-Type",
+                                              "application/grpc")),
+                                Contains(Pair("TE", "trailers"))),
+                          body),
+                      _, _))
+        .WillOnce(Invoke(bind(HandleFetch, Status::OK, status_code, headers,
+                              resp_body, _1, _2, _3)));
+  }
+
+  const shared_ptr<libevent::Base> base_;
+  StrictMock<MockUrlFetcher> url_fetcher_;
+  libevent::EventPumpThread pump_;
+  GrpcEtcdV3Client client_;
+};
+
+
+TEST(EtcdV3GrpcTest, AppendGrpcMessage) {
+  RangeRequest req;
+  req.set_key("/a");
+  string body("x");
+  AppendGrpcMessage(req, &body);
+  EXPECT_EQ(string("x\0\0\0\0\x04\x0a\x02/a", 10), body);
+}
+
+
+TEST(EtcdV3GrpcTest, ParseGrpcResponse) {
+  RangeResponse resp;
+  resp.set_count(3);
+  UrlFetcher::Response fetch_resp;
+  fetch_resp.status_code = 200;
+  fetch_resp.headers.insert(make_pair("grpc-status", "0"));
+  fetch_resp.body = GrpcBody(resp);
+
+  RangeResponse parsed;
+  EXPECT_OK(ParseGrpcResponse(fetch_resp, &parsed));
+  EXPECT_EQ(3, parsed.count());
+
+  // A missing message is an empty one.
+  fetch_resp.body.clear();
+  AppendGrpcMessage(RangeResponse(), &fetch_resp.body);
+  EXPECT_OK(ParseGrpcResponse(fetch_resp, &parsed));
+  EXPECT_EQ(0, parsed.count());
+}
+
+
+TEST(EtcdV3GrpcTest, ParseGrpcResponseErrors) {
+  RangeResponse parsed;
+  UrlFetcher::Response fetch_resp;
+  fetch_resp.status_code = 503;
+  EXPECT_THAT(ParseGrpcResponse(fetch_resp, &parsed),
+              StatusIs(util::error::UNKNOWN));
+
+  fetch_resp.status_code = 200;
+  EXPECT_THAT(ParseGrpcResponse(fetch_resp, &parsed),
+              StatusIs(util::error::INTERNAL));
+
+  fetch_resp.headers.insert(make_pair("Grpc-Status", "9"));
+  fetch_resp.headers.insert(
+      make_pair("grpc-message", "etcdserver:%20lease%20not%20found"));
+  EXPECT_THAT(ParseGrpcResponse(fetch_resp, &parsed),
+              StatusIs(util::error::FAILED_PRECONDITION,
+                       "etcdserver: lease not found"));
+
+  fetch_resp.headers.clear();
+  fetch_resp.headers.insert(make_pair("grpc-status", "16"));
+  EXPECT_THAT(ParseGrpcResponse(fetch_resp, &parsed),
+              StatusIs(util::error::UNKNOWN));
+
+  fetch_resp.headers.clear();
+  fetch_resp.headers.insert(make_pair("grpc-status", "0"));
+  fetch_resp.body = string("\0\0\0", 3);
+  EXPECT_THAT(ParseGrpcResponse(fetch_resp, &parsed),
+              StatusIs(util::error::INTERNAL));
+
+  fetch_resp.body = string("\0\0\0\0\x05\x08", 6);
+  EXPECT_THAT(ParseGrpcResponse(fetch_resp, &parsed),
+              StatusIs(util::error::INTERNAL));
+
+  fetch_resp.body = string("\x01\0\0\0\0", 5);
+  EXPECT_THAT(ParseGrpcResponse(fetch_resp, &parsed),
+              StatusIs(util::error::UNIMPLEMENTED));
+}
+
+
+TEST(EtcdV3GrpcTest, PrefixEnd) {
+  EXPECT_EQ("/b", EtcdV3PrefixEnd("/a"));
+  EXPECT_EQ("/entries0", EtcdV3PrefixEnd("/entries/"));
+  EXPECT_EQ("b", EtcdV3PrefixEnd(string("a\xff\xff")));
+  EXPECT_EQ(string(1, '\0'), EtcdV3PrefixEnd("\xff"));
+  EXPECT_EQ(string(1, '\0'), EtcdV3PrefixEnd(""));
+}
+
+
+TEST_F(EtcdV3Test, Range) {
+  RangeRequest req;
+  req.set_key("/some/key");
+  RangeResponse resp;
+  resp.mutable_header()->set_revision(12);
+  KeyValue* const kv(resp.add_kvs());
+  kv->set_key("/some/key");
+  kv->set_value("123");
+  kv->set_mod_revision(9);
+
+  ExpectCall("/etcdserverpb.KV/Range", GrpcBody(req), 200,
+             UrlFetcher::Headers{make_pair("grpc-status", "0")},
+             GrpcBody(resp));
+
+  SyncTask task(base_.get());
+  RangeResponse got;
+  client_.Range(req, &got, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(12, got.header().revision());
+  ASSERT_EQ(1, got.kvs_size());
+  EXPECT_EQ("123", got.kvs(0).value());
+  EXPECT_EQ(9, got.kvs(0).mod_revision());
+}
+
+
+TEST_F(EtcdV3Test, Txn) {
+  TxnRequest req;
+  etcdserverpb::Compare* const compare(req.add_compare());
+  compare->set_key("/a");
+  compare->set_target(etcdserverpb::Compare::CREATE);
+  compare->set_create_revision(0);
+  req.add_success()->mutable_request_put()->set_key("/a");
+  TxnResponse resp;
+  resp.set_succeeded(false);
+
+  ExpectCall("/etcdserverpb.KV/Txn", GrpcBody(req), 200,
+             UrlFetcher::Headers{make_pair("grpc-status", "0")},
+             GrpcBody(resp));
+
+  SyncTask task(base_.get());
+  TxnResponse got;
+  got.set_succeeded(true);
+  client_.Txn(req, &got, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_FALSE(got.succeeded());
+}
+
+
+TEST_F(EtcdV3Test, LeaseGrantError) {
+  LeaseGrantRequest req;
+  req.set_ttl(0);
+
+  ExpectCall("/etcdserverpb.Lease/LeaseGrant", GrpcBody(req), 200,
+             UrlFetcher::Headers{make_pair("grpc-status", "3"),
+                                 make_pair("grpc-message", "bad%20TTL")},
+             "");
+
+  SyncTask task(base_.get());
+  LeaseGrantResponse got;
+  client_.LeaseGrant(req, &got, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(),
+              StatusIs(util::error::INVALID_ARGUMENT, "bad TTL"));
+}
+
+
+TEST_F(EtcdV3Test, FetchFailure) {
+  EXPECT_CALL(url_fetcher_, Fetch(_, _, _))
+      .WillOnce(Invoke(bind(HandleFetch, Status(util::error::UNAVAILABLE, ""),
+                            0, UrlFetcher::Headers(), "", _1, _2, _3)));
+
+  SyncTask task(base_.get());
+  RangeResponse got;
+  client_.Range(RangeRequest(), &got, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::UNAVAILABLE));
+}
+
+
+class EtcdV3FakeTest : public ::testing::Test {
+ public:
+  EtcdV3FakeTest() : base_(make_shared<libevent::Base>()), pump_(base_) {
+    FLAGS_etcd_v3_watch_poll_interval_ms = 10;
+  }
+
+ protected:
+  void Put(const string& key, const string& value) {
+    TxnRequest req;
+    etcdserverpb::PutRequest* const put(
+        req.add_success()->mutable_request_put());
+    put->set_key(key);
+    put->set_value(value);
+    Run(req);
+  }
+
+  void Delete(const string& key) {
+    TxnRequest req;
+    req.add_success()->mutable_request_delete_range()->set_key(key);
+    Run(req);
+  }
+
+  void Run(const TxnRequest& req) {
+    TxnResponse resp;
+    SyncTask task(base_.get());
+    client_.Txn(req, &resp, task.task());
+    task.Wait();
+    ASSERT_OK(task);
+    ASSERT_TRUE(resp.succeeded());
+  }
+
+  const shared_ptr<libevent::Base> base_;
+  libevent::EventPumpThread pump_;
+  FakeEtcdV3Client client_;
+};
+
+
+TEST_F(EtcdV3FakeTest, RangeAllPages) {
+  FLAGS_etcd_v3_range_page_size = 2;
+  for (int i = 0; i < 5; ++i) {
+    Put("/dir/" + to_string(i), to_string(i));
+  }
+  Put("/dir0", "outside");
+
+  RangeRequest req;
+  req.set_key("/dir/");
+  req.set_range_end(EtcdV3PrefixEnd("/dir/"));
+  vector<KeyValue> kvs;
+  int64_t revision;
+  SyncTask task(base_.get());
+  EtcdV3RangeAll(&client_, req, &kvs, &revision, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  ASSERT_EQ(5, kvs.size());
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ("/dir/" + to_string(i), kvs[i].key());
+  }
+  EXPECT_EQ(7, revision);
+  FLAGS_etcd_v3_range_page_size = 1000;
+}
+
+
+TEST_F(EtcdV3FakeTest, Watch) {
+  Put("/dir/a", "1");
+  Put("/dir/b", "2");
+  Put("/other", "x");
+
+  vector<vector<string>> calls;
+  Notification initial;
+  Notification done;
+  SyncTask task(base_.get());
+  EtcdV3Watch(&client_, base_.get(), "/dir/", EtcdV3PrefixEnd("/dir/"),
+              [&](const vector<KeyValue>& updated,
+                  const vector<string>& deleted) {
+                vector<string> call;
+                for (const auto& kv : updated) {
+                  call.push_back(kv.key() + "=" + kv.value());
+                }
+                for (const auto& key : deleted) {
+                  call.push_back(key + " deleted");
+                }
+                // The calls are made one at a time.
+                calls.push_back(call);
+                if (calls.size() == 1) {
+                  initial.Notify();
+                } else if (!deleted.empty()) {
+                  // The deletion is the last change.
+                  done.Notify();
+                }
+              },
+              task.task());
+
+  // Let the initial state in before changing anything.
+  ASSERT_TRUE(initial.WaitForNotificationWithTimeout(milliseconds(5000)));
+  Put("/other", "y");
+  Put("/dir/b", "3");
+  Put("/dir/c", "4");
+  Delete("/dir/a");
+  EXPECT_TRUE(done.WaitForNotificationWithTimeout(milliseconds(5000)));
+  task.Cancel();
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::CANCELLED));
+
+  ASSERT_GE(calls.size(), 1);
+  EXPECT_THAT(calls[0], ElementsAre("/dir/a=1", "/dir/b=2"));
+  // The changes may have been seen in one poll or in two.
+  vector<string> changes;
+  for (size_t i = 1; i < calls.size(); ++i) {
+    changes.insert(changes.end(), calls[i].begin(), calls[i].end());
+  }
+  EXPECT_THAT(changes, AllOf(Contains("/dir/b=3"), Contains("/dir/c=4"),
+                             Contains("/dir/a deleted")));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,231 @@
+#include "util/etcd_wire.h"
+
+#include <glog/logging.h>
+#include <string.h>
+
+#include "util/json_reader.h"
+
+using std::string;
+using std::chrono::system_clock;
+using std::to_string;
+using util::Status;
+
+namespace cert_trans {
+
+namespace {
+
+
+const char kHexDigits[] = "0123456789ABCDEF";
+
+
+// The unreserved characters of RFC 3986, which evhttp_uriencode()
+// leaves alone.
+bool IsUnreserved(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+         c == '~';
+}
+
+
+Status InvalidJson(const string& what) {
+  return Status(util::error::FAILED_PRECONDITION, "Invalid JSON: " + what);
+}
+
+
+Status ParseNode(JsonReader* reader, EtcdClient::Node* node) {
+  bool has_created_index(false);
+  bool has_modified_index(false);
+  bool has_key(false);
+  bool has_value(false);
+  node->is_dir_ = false;
+  node->value_.clear();
+  node->nodes_.clear();
+  node->expires_ = system_clock::time_point::max();
+
+  // The member names of nodes are all short enough not to allocate.
+  string member;
+  if (!reader->BeginObject()) {
+    return InvalidJson("'node' is not an object");
+  }
+  while (reader->NextMember(&member)) {
+    if (member == "key") {
+      has_key = reader->ReadString(&node->key_);
+    } else if (member == "value") {
+      has_value = reader->ReadString(&node->value_);
+    } else if (member == "dir") {
+      reader->ReadBool(&node->is_dir_);
+    } else if (member == "createdIndex") {
+      has_created_index = reader->ReadInt(&node->created_index_);
+    } else if (member == "modifiedIndex") {
+      has_modified_index = reader->ReadInt(&node->modified_index_);
+    } else if (member == "nodes") {
+      reader->BeginArray();
+      while (reader->NextElement()) {
+        node->nodes_.emplace_back();
+        const Status status(ParseNode(reader, &node->nodes_.back()));
+        if (!status.ok()) {
+          return status;
+        }
+      }
+    } else {
+      reader->SkipValue();
+    }
+  }
+  if (!reader->ok()) {
+    return InvalidJson("syntax error or unexpected type in node");
+  }
+
+  if (!has_created_index) {
+    return InvalidJson("Couldn't find 'createdIndex'");
+  }
+  if (!has_modified_index) {
+    return InvalidJson("Couldn't find 'modifiedIndex'");
+  }
+  if (!has_key) {
+    return InvalidJson("Couldn't find 'key'");
+  }
+
+  node->deleted_ = !has_value && !node->is_dir_;
+  if (node->is_dir_) {
+    node->value_.clear();
+    for (const EtcdClient::Node& child : node->nodes_) {
+      if (child.deleted_) {
+        return Status(util::error::FAILED_PRECONDITION,
+                      "Deleted sub-node " + node->key_);
+      }
+    }
+  } else {
+    node->nodes_.clear();
+  }
+
+  return Status::OK;
+}
+
+
+}  // namespace
+
+
+EtcdParams::EtcdParams(const char* consistent, const char* quorum)
+    : consistent_(consistent),
+      quorum_(quorum),
+      implicit_done_(0),
+      last_name_(nullptr) {
+}
+
+
+void EtcdParams::Add(const char* name, const string& value) {
+  AddImplicitBefore(name);
+  AppendName(name);
+  AppendUrlEncoded(value, &encoded_);
+}
+
+
+void EtcdParams::Add(const char* name, int64_t value) {
+  AddImplicitBefore(name);
+  AppendName(name);
+  encoded_.append(to_string(value));
+}
+
+
+string EtcdParams::Finish() {
+  AddImplicitBefore(nullptr);
+  return encoded_;
+}
+
+
+void EtcdParams::AddImplicitBefore(const char* name) {
+  static const char* const kNames[] = {"consistent", "quorum"};
+  const char* const values[] = {consistent_, quorum_};
+
+  while (implicit_done_ < 2 &&
+         (!name || strcmp(kNames[implicit_done_], name) < 0)) {
+    if (values[implicit_done_]) {
+      AppendName(kNames[implicit_done_]);
+      encoded_.append(values[implicit_done_]);
+    }
+    ++implicit_done_;
+  }
+  CHECK(!name || implicit_done_ == 2 ||
+        strcmp(kNames[implicit_done_], name) != 0)
+      << "\"" << name << "\" is passed to the constructor";
+}
+
+
+void EtcdParams::AppendName(const char* name) {
+  if (last_name_) {
+    DCHECK_LT(strcmp(last_name_, name), 0) << "parameters out of order";
+    encoded_.push_back('&');
+  }
+  last_name_ = name;
+  encoded_.append(name);
+  encoded_.push_back('=');
+}
+
+
+void AppendUrlEncoded(const string& value, string* out) {
+  out->reserve(out->size() + value.size());
+  for (const char c : value) {
+    const unsigned char byte(c);
+    if (IsUnreserved(byte)) {
+      out->push_back(c);
+    } else {
+      out->push_back('%');
+      out->push_back(kHexDigits[byte >> 4]);
+      out->push_back(kHexDigits[byte & 0xf]);
+    }
+  }
+}
+
+
+Status ParseEtcdNodeResponse(const string& body, EtcdClient::Node* node) {
+  JsonReader reader(body);
+  // Like json-c, which was used before.
+  reader.AllowTrailingCommas();
+  string member;
+  bool has_node(false);
+  if (!reader.BeginObject()) {
+    return InvalidJson("response is not an object");
+  }
+  while (reader.NextMember(&member)) {
+    if (member == "node" && !has_node) {
+      const Status status(ParseNode(&reader, node));
+      if (!status.ok()) {
+        return status;
+      }
+      has_node = true;
+    } else {
+      reader.SkipValue();
+    }
+  }
+  if (!reader.Finish()) {
+    return InvalidJson("syntax error in response");
+  }
+  if (!has_node) {
+    return InvalidJson("Couldn't find 'node'");
+  }
+
+  return Status::OK;
+}
+
+
+string EtcdErrorMessage(const string& body) {
+  JsonReader reader(body);
+  reader.AllowTrailingCommas();
+  string member;
+  string message;
+  bool has_message(false);
+  if (reader.BeginObject()) {
+    while (reader.NextMember(&member)) {
+      if (member == "message") {
+        has_message = reader.ReadString(&message);
+      } else {
+        reader.SkipValue();
+      }
+    }
+  }
+
+  return has_message && reader.Finish() ? message : body;
+}
+
+
+}  // namespace cert_trans
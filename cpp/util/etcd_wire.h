@@ -0,0 +1,69 @@
+#ifndef CERT_TRANS_UTIL_ETCD_WIRE_H_
+#define CERT_TRANS_UTIL_ETCD_WIRE_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "util/etcd.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// Builds the URL-encoded parameters of an etcd v2 request, used as
+// either its query string or its form body, straight into a string.
+//
+// Parameters must be added in the alphabetical order of their names,
+// which is the order etcd requests have always been sent in. The
+// "consistent" and "quorum" parameters, which almost every request
+// has, are given to the constructor and slotted into place.
+class EtcdParams {
+ public:
+  // |consistent| and |quorum| are the values of the parameters of the
+  // same name, or NULL to leave them out.
+  EtcdParams(const char* consistent, const char* quorum);
+
+  // |name| must not need escaping.
+  void Add(const char* name, const std::string& value);
+  void Add(const char* name, int64_t value);
+
+  // Returns the encoded parameters. Nothing can be added afterwards.
+  std::string Finish();
+
+ private:
+  // Adds the implicit parameters which sort before |name| (all of
+  // them if it is NULL).
+  void AddImplicitBefore(const char* name);
+  void AppendName(const char* name);
+
+  const char* const consistent_;
+  const char* const quorum_;
+  // Number of implicit parameters already added or skipped.
+  int implicit_done_;
+  const char* last_name_;
+  std::string encoded_;
+};
+
+
+// Appends |value|, URL-encoded the same way as evhttp_uriencode()
+// (every byte but unreserved characters is percent-encoded), to |out|.
+void AppendUrlEncoded(const std::string& value, std::string* out);
+
+
+// Parses the "node" of a successful etcd v2 keys API response into
+// |node|, the same way as building a json-c DOM and reading it through
+// JsonObject would, without allocating anything but the node contents.
+// Members which EtcdClient::Node does not have (e.g. "prevNode" or
+// "expiration") are skipped.
+util::Status ParseEtcdNodeResponse(const std::string& body,
+                                   EtcdClient::Node* node);
+
+
+// Returns the "message" of an etcd error response, or the whole body if
+// it has none.
+std::string EtcdErrorMessage(const std::string& body);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_ETCD_WIRE_H_
@@ -0,0 +1,192 @@
+#include "util/etcd_wire.h"
+
+#include <event2/http.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+
+#include "util/status_test_util.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+using util::testing::StatusIs;
+
+
+TEST(EtcdParamsTest, ImplicitParams) {
+  EtcdParams params("true", "true");
+  params.Add("prevExist", "false");
+  params.Add("ttl", 100);
+  params.Add("value", "123");
+  EXPECT_EQ("consistent=true&prevExist=false&quorum=true&ttl=100&value=123",
+            params.Finish());
+}
+
+
+TEST(EtcdParamsTest, ImplicitParamsOnly) {
+  EXPECT_EQ("consistent=true&quorum=true",
+            EtcdParams("true", "true").Finish());
+  EXPECT_EQ("quorum=false", EtcdParams(nullptr, "false").Finish());
+  EXPECT_EQ("", EtcdParams(nullptr, nullptr).Finish());
+}
+
+
+TEST(EtcdParamsTest, WithoutImplicitParams) {
+  EtcdParams params(nullptr, nullptr);
+  params.Add("recursive", "true");
+  params.Add("wait", "true");
+  params.Add("waitIndex", 42);
+  EXPECT_EQ("recursive=true&wait=true&waitIndex=42", params.Finish());
+}
+
+
+TEST(EtcdParamsTest, EscapingMatchesLibevent) {
+  string value;
+  for (int i = 0; i < 256; ++i) {
+    value.push_back(static_cast<char>(i));
+  }
+  value.append("a b+c/d=e&f");
+
+  unique_ptr<char, void (*)(void*)> expected(
+      evhttp_uriencode(value.data(), value.size(), 0), &free);
+  string encoded;
+  AppendUrlEncoded(value, &encoded);
+  EXPECT_EQ(expected.get(), encoded);
+}
+
+
+TEST(EtcdNodeResponseTest, Value) {
+  EtcdClient::Node node;
+  ASSERT_OK(ParseEtcdNodeResponse(
+      "{\"action\": \"get\", \"node\": {\"createdIndex\": 6, "
+      "\"key\": \"/some/key\", \"modifiedIndex\": 9, \"value\": \"1\\\"23\", "
+      "\"expiration\": \"2013-12-04T12:01:21.874888581-08:00\", \"ttl\": 5}}",
+      &node));
+  EXPECT_EQ(6, node.created_index_);
+  EXPECT_EQ(9, node.modified_index_);
+  EXPECT_EQ("/some/key", node.key_);
+  EXPECT_EQ("1\"23", node.value_);
+  EXPECT_FALSE(node.is_dir_);
+  EXPECT_FALSE(node.deleted_);
+  EXPECT_TRUE(node.nodes_.empty());
+}
+
+
+TEST(EtcdNodeResponseTest, Dir) {
+  EtcdClient::Node node;
+  ASSERT_OK(ParseEtcdNodeResponse(
+      "{\"node\": {\"createdIndex\": 1, \"dir\": true, \"key\": \"/some\", "
+      "\"modifiedIndex\": 2, \"nodes\": ["
+      "{\"createdIndex\": 6, \"key\": \"/some/key1\", \"modifiedIndex\": 9, "
+      "\"value\": \"123\"}, "
+      "{\"createdIndex\": 7, \"dir\": true, \"key\": \"/some/dir\", "
+      "\"modifiedIndex\": 7}]}}",
+      &node));
+  EXPECT_TRUE(node.is_dir_);
+  EXPECT_FALSE(node.deleted_);
+  ASSERT_EQ(2U, node.nodes_.size());
+  EXPECT_EQ("/some/key1", node.nodes_[0].key_);
+  EXPECT_EQ("123", node.nodes_[0].value_);
+  EXPECT_EQ("/some/dir", node.nodes_[1].key_);
+  EXPECT_TRUE(node.nodes_[1].is_dir_);
+  EXPECT_TRUE(node.nodes_[1].nodes_.empty());
+}
+
+
+TEST(EtcdNodeResponseTest, Deleted) {
+  EtcdClient::Node node;
+  ASSERT_OK(ParseEtcdNodeResponse(
+      "{\"action\": \"delete\", \"node\": {\"createdIndex\": 5, "
+      "\"key\": \"/some/key\", \"modifiedIndex\": 6}, "
+      "\"prevNode\": {\"createdIndex\": 5, \"key\": \"/some/key\", "
+      "\"modifiedIndex\": 5, \"value\": \"123\"}}",
+      &node));
+  EXPECT_TRUE(node.deleted_);
+  EXPECT_EQ(6, node.modified_index_);
+  EXPECT_EQ("", node.value_);
+
+  EXPECT_THAT(ParseEtcdNodeResponse(
+                  "{\"node\": {\"createdIndex\": 1, \"dir\": true, "
+                  "\"key\": \"/some\", \"modifiedIndex\": 2, \"nodes\": ["
+                  "{\"createdIndex\": 6, \"key\": \"/some/key1\", "
+                  "\"modifiedIndex\": 9}]}}",
+                  &node),
+              StatusIs(util::error::FAILED_PRECONDITION,
+                       "Deleted sub-node /some"));
+}
+
+
+TEST(EtcdNodeResponseTest, ReusesNode) {
+  EtcdClient::Node node;
+  ASSERT_OK(ParseEtcdNodeResponse(
+      "{\"node\": {\"createdIndex\": 1, \"dir\": true, \"key\": \"/some\", "
+      "\"modifiedIndex\": 2, \"nodes\": [{\"createdIndex\": 6, "
+      "\"key\": \"/some/key1\", \"modifiedIndex\": 9, \"value\": \"1\"}]}}",
+      &node));
+  ASSERT_OK(ParseEtcdNodeResponse(
+      "{\"node\": {\"createdIndex\": 3, \"key\": \"/other\", "
+      "\"modifiedIndex\": 4, \"value\": \"2\"}}",
+      &node));
+  EXPECT_EQ("/other", node.key_);
+  EXPECT_EQ("2", node.value_);
+  EXPECT_FALSE(node.is_dir_);
+  EXPECT_TRUE(node.nodes_.empty());
+}
+
+
+TEST(EtcdNodeResponseTest, Errors) {
+  EtcdClient::Node node;
+  EXPECT_THAT(ParseEtcdNodeResponse("{\"action\": \"get\"}", &node),
+              StatusIs(util::error::FAILED_PRECONDITION,
+                       "Invalid JSON: Couldn't find 'node'"));
+  EXPECT_THAT(ParseEtcdNodeResponse(
+                  "{\"node\": {\"key\": \"/a\", \"modifiedIndex\": 2}}",
+                  &node),
+              StatusIs(util::error::FAILED_PRECONDITION,
+                       "Invalid JSON: Couldn't find 'createdIndex'"));
+  EXPECT_THAT(ParseEtcdNodeResponse(
+                  "{\"node\": {\"key\": \"/a\", \"createdIndex\": 2}}",
+                  &node),
+              StatusIs(util::error::FAILED_PRECONDITION,
+                       "Invalid JSON: Couldn't find 'modifiedIndex'"));
+  EXPECT_THAT(ParseEtcdNodeResponse(
+                  "{\"node\": {\"createdIndex\": 1, \"modifiedIndex\": 2}}",
+                  &node),
+              StatusIs(util::error::FAILED_PRECONDITION,
+                       "Invalid JSON: Couldn't find 'key'"));
+
+  const char* const invalid[] = {
+      "", "[]", "{\"node\": 1}",
+      "{\"node\": {\"createdIndex\": \"1\", \"key\": \"/a\", "
+      "\"modifiedIndex\": 2}}",
+      "{\"node\": {\"createdIndex\": 1, \"key\": \"/a\", "
+      "\"modifiedIndex\": 2}",
+  };
+  for (const char* body : invalid) {
+    EXPECT_FALSE(ParseEtcdNodeResponse(body, &node).ok()) << body;
+  }
+}
+
+
+TEST(EtcdErrorMessageTest, Message) {
+  EXPECT_EQ("Key not found",
+            EtcdErrorMessage("{\"errorCode\": 100, \"message\": "
+                             "\"Key not found\", \"cause\": \"/a\", "
+                             "\"index\": 17}"));
+  EXPECT_EQ("<html>oops</html>", EtcdErrorMessage("<html>oops</html>"));
+  EXPECT_EQ("{\"errorCode\": 100}", EtcdErrorMessage("{\"errorCode\": 100}"));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
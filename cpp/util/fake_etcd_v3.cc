@@ -0,0 +1,370 @@
+#include "util/fake_etcd_v3.h"
+
+#include <glog/logging.h>
+#include <iterator>
+
+using etcdserverpb::Compare;
+using etcdserverpb::DeleteRangeRequest;
+using etcdserverpb::KeyValue;
+using etcdserverpb::LeaseGrantRequest;
+using etcdserverpb::LeaseGrantResponse;
+using etcdserverpb::PutRequest;
+using etcdserverpb::RangeRequest;
+using etcdserverpb::RangeResponse;
+using etcdserverpb::RequestOp;
+using etcdserverpb::TxnRequest;
+using etcdserverpb::TxnResponse;
+using std::chrono::seconds;
+using std::chrono::system_clock;
+using std::map;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::vector;
+using util::Status;
+using util::Task;
+
+namespace cert_trans {
+namespace {
+
+
+// Returns the revision of |versions| current as of |revision|, or
+// NULL if there was none.
+const KeyValue* AtRevision(const vector<KeyValue>& versions,
+                           int64_t revision) {
+  for (auto it = versions.rbegin(); it != versions.rend(); ++it) {
+    if (it->mod_revision() <= revision) {
+      return it->create_revision() != 0 ? &*it : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+
+int CompareInts(int64_t a, int64_t b) {
+  return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+
+}  // namespace
+
+
+FakeEtcdV3Client::FakeEtcdV3Client() : revision_(1), next_lease_id_(1) {
+}
+
+
+void FakeEtcdV3Client::Range(const RangeRequest& req, RangeResponse* resp,
+                             Task* task) {
+  VLOG(1) << "RANGE " << req.key();
+  unique_lock<mutex> lock(mutex_);
+  PurgeExpiredLeasesWithLock(lock);
+  const Status status(RangeWithLock(lock, req, resp));
+  lock.unlock();
+  task->Return(status);
+}
+
+
+void FakeEtcdV3Client::Txn(const TxnRequest& req, TxnResponse* resp,
+                           Task* task) {
+  unique_lock<mutex> lock(mutex_);
+  PurgeExpiredLeasesWithLock(lock);
+
+  bool succeeded(true);
+  for (const Compare& compare : req.compare()) {
+    succeeded = succeeded && CompareWithLock(lock, compare);
+  }
+  const google::protobuf::RepeatedPtrField<RequestOp>& ops(
+      succeeded ? req.success() : req.failure());
+  VLOG(1) << "TXN " << (succeeded ? "succeeded" : "failed") << ", "
+          << ops.size() << " ops";
+
+  // Check everything which could fail before changing anything, so
+  // that the transaction stays atomic.
+  bool writes(false);
+  for (const RequestOp& op : ops) {
+    if (op.has_request_put()) {
+      const int64_t lease(op.request_put().lease());
+      if (lease != 0 && leases_.find(lease) == leases_.end()) {
+        lock.unlock();
+        task->Return(Status(util::error::NOT_FOUND,
+                            "etcdserver: requested lease not found"));
+        return;
+      }
+    }
+    writes = writes || op.has_request_put() || op.has_request_delete_range();
+  }
+
+  // All the writes have the same revision, and the reads in the
+  // transaction see the writes before them.
+  const int64_t revision(revision_ + 1);
+  if (writes) {
+    revision_ = revision;
+  }
+  bool changed(false);
+  resp->set_succeeded(succeeded);
+  for (const RequestOp& op : ops) {
+    etcdserverpb::ResponseOp* const op_resp(resp->add_responses());
+    if (op.has_request_range()) {
+      const Status status(RangeWithLock(lock, op.request_range(),
+                                        op_resp->mutable_response_range()));
+      if (!status.ok()) {
+        lock.unlock();
+        task->Return(status);
+        return;
+      }
+    } else if (op.has_request_put()) {
+      CHECK_EQ(Status::OK, PutWithLock(lock, op.request_put(), revision));
+      op_resp->mutable_response_put();
+      changed = true;
+    } else if (op.has_request_delete_range()) {
+      const int64_t deleted(
+          DeleteRangeWithLock(lock, op.request_delete_range(), revision));
+      op_resp->mutable_response_delete_range()->set_deleted(deleted);
+      changed = changed || deleted > 0;
+    }
+  }
+  if (writes && !changed) {
+    // Like etcd, a transaction that deleted nothing (and put nothing)
+    // does not create a revision.
+    revision_ = revision - 1;
+  }
+  resp->mutable_header()->set_revision(revision_);
+
+  lock.unlock();
+  task->Return();
+}
+
+
+void FakeEtcdV3Client::LeaseGrant(const LeaseGrantRequest& req,
+                                  LeaseGrantResponse* resp, Task* task) {
+  if (req.ttl() <= 0) {
+    task->Return(Status(util::error::INVALID_ARGUMENT,
+                        "lease TTL must be positive"));
+    return;
+  }
+
+  unique_lock<mutex> lock(mutex_);
+  PurgeExpiredLeasesWithLock(lock);
+  int64_t id(req.id());
+  if (id == 0) {
+    while (leases_.find(next_lease_id_) != leases_.end()) {
+      ++next_lease_id_;
+    }
+    id = next_lease_id_++;
+  } else if (leases_.find(id) != leases_.end()) {
+    lock.unlock();
+    task->Return(Status(util::error::FAILED_PRECONDITION,
+                        "etcdserver: lease already exists"));
+    return;
+  }
+  leases_[id].expires = system_clock::now() + seconds(req.ttl());
+  VLOG(1) << "LEASE " << id << " for " << req.ttl() << "s";
+
+  resp->mutable_header()->set_revision(revision_);
+  resp->set_id(id);
+  resp->set_ttl(req.ttl());
+  lock.unlock();
+  task->Return();
+}
+
+
+const KeyValue* FakeEtcdV3Client::CurrentWithLock(
+    const unique_lock<mutex>& lock, const string& key) const {
+  CHECK(lock.owns_lock());
+  const auto it(entries_.find(key));
+  if (it == entries_.end()) {
+    return nullptr;
+  }
+  return it->second.back().create_revision() != 0 ? &it->second.back()
+                                                  : nullptr;
+}
+
+
+void FakeEtcdV3Client::PurgeExpiredLeasesWithLock(
+    const unique_lock<mutex>& lock) {
+  CHECK(lock.owns_lock());
+  const system_clock::time_point now(system_clock::now());
+  for (auto it = leases_.begin(); it != leases_.end();) {
+    if (it->second.expires > now) {
+      ++it;
+      continue;
+    }
+
+    VLOG(1) << "lease " << it->first << " expired";
+    // Each lease is revoked in a revision of its own.
+    if (!it->second.keys.empty()) {
+      ++revision_;
+      const std::set<string> keys(it->second.keys);
+      for (const string& key : keys) {
+        DeleteWithLock(lock, key, revision_);
+      }
+    }
+    it = leases_.erase(it);
+  }
+}
+
+
+Status FakeEtcdV3Client::RangeWithLock(const unique_lock<mutex>& lock,
+                                       const RangeRequest& req,
+                                       RangeResponse* resp) const {
+  CHECK(lock.owns_lock());
+  const int64_t revision(req.revision() > 0 ? req.revision() : revision_);
+  if (revision > revision_) {
+    return Status(util::error::OUT_OF_RANGE,
+                  "mvcc: required revision is a future revision");
+  }
+
+  map<string, vector<KeyValue>>::const_iterator it(
+      entries_.lower_bound(req.key()));
+  map<string, vector<KeyValue>>::const_iterator end;
+  if (req.range_end().empty()) {
+    end = it != entries_.end() && it->first == req.key() ? std::next(it) : it;
+  } else if (req.range_end() == string(1, '\0')) {
+    end = entries_.end();
+  } else {
+    end = req.range_end() > req.key() ? entries_.lower_bound(req.range_end())
+                                      : it;
+  }
+
+  int64_t count(0);
+  for (; it != end; ++it) {
+    const KeyValue* const kv(AtRevision(it->second, revision));
+    if (!kv || (req.min_mod_revision() > 0 &&
+                kv->mod_revision() < req.min_mod_revision()) ||
+        (req.max_mod_revision() > 0 &&
+         kv->mod_revision() > req.max_mod_revision())) {
+      continue;
+    }
+    ++count;
+    if (req.count_only() ||
+        (req.limit() > 0 && resp->kvs_size() >= req.limit())) {
+      continue;
+    }
+    KeyValue* const out(resp->add_kvs());
+    *out = *kv;
+    if (req.keys_only()) {
+      out->clear_value();
+    }
+  }
+
+  resp->mutable_header()->set_revision(revision_);
+  resp->set_count(count);
+  resp->set_more(!req.count_only() && count > resp->kvs_size());
+  return Status::OK;
+}
+
+
+bool FakeEtcdV3Client::CompareWithLock(const unique_lock<mutex>& lock,
+                                       const Compare& compare) const {
+  const KeyValue* const kv(CurrentWithLock(lock, compare.key()));
+  int result;
+  switch (compare.target()) {
+    case Compare::VALUE:
+      // Like etcd, comparing the value of a missing key always fails.
+      if (!kv) {
+        return false;
+      }
+      result = kv->value().compare(compare.value());
+      result = result < 0 ? -1 : (result > 0 ? 1 : 0);
+      break;
+    case Compare::VERSION:
+      result = CompareInts(kv ? kv->version() : 0, compare.version());
+      break;
+    case Compare::CREATE:
+      result = CompareInts(kv ? kv->create_revision() : 0,
+                           compare.create_revision());
+      break;
+    case Compare::MOD:
+      result =
+          CompareInts(kv ? kv->mod_revision() : 0, compare.mod_revision());
+      break;
+    case Compare::LEASE:
+      result = CompareInts(kv ? kv->lease() : 0, compare.lease());
+      break;
+    default:
+      LOG(FATAL) << "unknown compare target " << compare.target();
+  }
+
+  switch (compare.result()) {
+    case Compare::EQUAL:
+      return result == 0;
+    case Compare::GREATER:
+      return result > 0;
+    case Compare::LESS:
+      return result < 0;
+    case Compare::NOT_EQUAL:
+      return result != 0;
+  }
+  LOG(FATAL) << "unknown compare result " << compare.result();
+}
+
+
+Status FakeEtcdV3Client::PutWithLock(const unique_lock<mutex>& lock,
+                                     const PutRequest& req,
+                                     int64_t revision) {
+  CHECK(lock.owns_lock());
+  VLOG(1) << "PUT " << req.key();
+  const KeyValue* const prev(CurrentWithLock(lock, req.key()));
+  if (prev && prev->lease() != 0) {
+    const auto lease_it(leases_.find(prev->lease()));
+    if (lease_it != leases_.end()) {
+      lease_it->second.keys.erase(req.key());
+    }
+  }
+  if (req.lease() != 0) {
+    const auto lease_it(leases_.find(req.lease()));
+    if (lease_it == leases_.end()) {
+      return Status(util::error::NOT_FOUND,
+                    "etcdserver: requested lease not found");
+    }
+    lease_it->second.keys.insert(req.key());
+  }
+
+  KeyValue kv;
+  kv.set_key(req.key());
+  kv.set_value(req.value());
+  kv.set_create_revision(prev ? prev->create_revision() : revision);
+  kv.set_mod_revision(revision);
+  kv.set_version(prev ? prev->version() + 1 : 1);
+  kv.set_lease(req.lease());
+  entries_[req.key()].emplace_back(std::move(kv));
+  return Status::OK;
+}
+
+
+int64_t FakeEtcdV3Client::DeleteRangeWithLock(const unique_lock<mutex>& lock,
+                                              const DeleteRangeRequest& req,
+                                              int64_t revision) {
+  RangeRequest range;
+  range.set_key(req.key());
+  range.set_range_end(req.range_end());
+  range.set_keys_only(true);
+  RangeResponse resp;
+  CHECK_EQ(Status::OK, RangeWithLock(lock, range, &resp));
+  for (const KeyValue& kv : resp.kvs()) {
+    DeleteWithLock(lock, kv.key(), revision);
+  }
+  return resp.kvs_size();
+}
+
+
+void FakeEtcdV3Client::DeleteWithLock(const unique_lock<mutex>& lock,
+                                      const string& key, int64_t revision) {
+  const KeyValue* const prev(CurrentWithLock(lock, key));
+  CHECK_NOTNULL(prev);
+  VLOG(1) << "DELETE " << key;
+  if (prev->lease() != 0) {
+    const auto lease_it(leases_.find(prev->lease()));
+    if (lease_it != leases_.end()) {
+      lease_it->second.keys.erase(key);
+    }
+  }
+
+  KeyValue tombstone;
+  tombstone.set_key(key);
+  tombstone.set_mod_revision(revision);
+  entries_[key].emplace_back(std::move(tombstone));
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,76 @@
+#ifndef CERT_TRANS_UTIL_FAKE_ETCD_V3_H_
+#define CERT_TRANS_UTIL_FAKE_ETCD_V3_H_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/etcd_v3.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// An in-memory etcd v3 server, which completes every request before
+// returning. It keeps every revision of every key (there is no
+// compaction), so ranges at past revisions work as they would with
+// etcd, and the leases expire on their own.
+class FakeEtcdV3Client : public EtcdV3Client {
+ public:
+  FakeEtcdV3Client();
+
+  void Range(const etcdserverpb::RangeRequest& req,
+             etcdserverpb::RangeResponse* resp, util::Task* task) override;
+
+  void Txn(const etcdserverpb::TxnRequest& req,
+           etcdserverpb::TxnResponse* resp, util::Task* task) override;
+
+  void LeaseGrant(const etcdserverpb::LeaseGrantRequest& req,
+                  etcdserverpb::LeaseGrantResponse* resp,
+                  util::Task* task) override;
+
+ private:
+  struct Lease {
+    std::chrono::system_clock::time_point expires;
+    std::set<std::string> keys;
+  };
+
+  // The current value of |key|, or NULL if it does not exist.
+  const etcdserverpb::KeyValue* CurrentWithLock(
+      const std::unique_lock<std::mutex>& lock, const std::string& key) const;
+
+  void PurgeExpiredLeasesWithLock(const std::unique_lock<std::mutex>& lock);
+
+  util::Status RangeWithLock(const std::unique_lock<std::mutex>& lock,
+                             const etcdserverpb::RangeRequest& req,
+                             etcdserverpb::RangeResponse* resp) const;
+  bool CompareWithLock(const std::unique_lock<std::mutex>& lock,
+                       const etcdserverpb::Compare& compare) const;
+  util::Status PutWithLock(const std::unique_lock<std::mutex>& lock,
+                           const etcdserverpb::PutRequest& req,
+                           int64_t revision);
+  int64_t DeleteRangeWithLock(const std::unique_lock<std::mutex>& lock,
+                              const etcdserverpb::DeleteRangeRequest& req,
+                              int64_t revision);
+  void DeleteWithLock(const std::unique_lock<std::mutex>& lock,
+                      const std::string& key, int64_t revision);
+
+  std::mutex mutex_;
+  int64_t revision_;
+  int64_t next_lease_id_;
+  // All the revisions of every key, oldest first. A deletion is
+  // recorded as a KeyValue with only a key and mod_revision.
+  std::map<std::string, std::vector<etcdserverpb::KeyValue>> entries_;
+  std::map<int64_t, Lease> leases_;
+
+  DISALLOW_COPY_AND_ASSIGN(FakeEtcdV3Client);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_FAKE_ETCD_V3_H_
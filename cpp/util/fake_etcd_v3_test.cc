@@ -0,0 +1,287 @@
+#include "util/fake_etcd_v3.h"
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "util/libevent_wrapper.h"
+#include "util/status_test_util.h"
+#include "util/sync_task.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using etcdserverpb::Compare;
+using etcdserverpb::LeaseGrantRequest;
+using etcdserverpb::LeaseGrantResponse;
+using etcdserverpb::RangeRequest;
+using etcdserverpb::RangeResponse;
+using etcdserverpb::TxnRequest;
+using etcdserverpb::TxnResponse;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using util::Status;
+using util::SyncTask;
+using util::testing::StatusIs;
+
+namespace {
+
+
+class FakeEtcdV3Test : public ::testing::Test {
+ public:
+  FakeEtcdV3Test() : base_(make_shared<libevent::Base>()), pump_(base_) {
+  }
+
+ protected:
+  Status Range(const RangeRequest& req, RangeResponse* resp) {
+    SyncTask task(base_.get());
+    client_.Range(req, resp, task.task());
+    task.Wait();
+    return task.status();
+  }
+
+  Status Txn(const TxnRequest& req, TxnResponse* resp) {
+    SyncTask task(base_.get());
+    client_.Txn(req, resp, task.task());
+    task.Wait();
+    return task.status();
+  }
+
+  // Returns the revision of the put.
+  int64_t Put(const string& key, const string& value, int64_t lease = 0) {
+    TxnRequest req;
+    etcdserverpb::PutRequest* const put(
+        req.add_success()->mutable_request_put());
+    put->set_key(key);
+    put->set_value(value);
+    put->set_lease(lease);
+    TxnResponse resp;
+    CHECK_EQ(Status::OK, Txn(req, &resp));
+    return resp.header().revision();
+  }
+
+  RangeResponse Get(const string& key, int64_t revision = 0) {
+    RangeRequest req;
+    req.set_key(key);
+    req.set_revision(revision);
+    RangeResponse resp;
+    CHECK_EQ(Status::OK, Range(req, &resp));
+    return resp;
+  }
+
+  const shared_ptr<libevent::Base> base_;
+  libevent::EventPumpThread pump_;
+  FakeEtcdV3Client client_;
+};
+
+
+TEST_F(FakeEtcdV3Test, PutAndGet) {
+  EXPECT_EQ(0, Get("/a").kvs_size());
+
+  const int64_t created(Put("/a", "1"));
+  const int64_t modified(Put("/a", "2"));
+  EXPECT_EQ(created + 1, modified);
+
+  const RangeResponse resp(Get("/a"));
+  ASSERT_EQ(1, resp.kvs_size());
+  EXPECT_EQ("2", resp.kvs(0).value());
+  EXPECT_EQ(created, resp.kvs(0).create_revision());
+  EXPECT_EQ(modified, resp.kvs(0).mod_revision());
+  EXPECT_EQ(2, resp.kvs(0).version());
+  EXPECT_EQ(modified, resp.header().revision());
+
+  // The old value is still there at the old revision.
+  const RangeResponse old(Get("/a", created));
+  ASSERT_EQ(1, old.kvs_size());
+  EXPECT_EQ("1", old.kvs(0).value());
+
+  RangeRequest future;
+  future.set_key("/a");
+  future.set_revision(modified + 1);
+  RangeResponse unused;
+  EXPECT_THAT(Range(future, &unused), StatusIs(util::error::OUT_OF_RANGE));
+}
+
+
+TEST_F(FakeEtcdV3Test, RangeOptions) {
+  Put("/dir/a", "1");
+  const int64_t b_revision(Put("/dir/b", "2"));
+  Put("/dir/c", "3");
+  Put("/dir0", "4");
+
+  RangeRequest req;
+  req.set_key("/dir/");
+  req.set_range_end("/dir0");
+  req.set_limit(2);
+  RangeResponse resp;
+  ASSERT_OK(Range(req, &resp));
+  ASSERT_EQ(2, resp.kvs_size());
+  EXPECT_EQ("/dir/a", resp.kvs(0).key());
+  EXPECT_EQ("/dir/b", resp.kvs(1).key());
+  EXPECT_TRUE(resp.more());
+  EXPECT_EQ(3, resp.count());
+
+  req.clear_limit();
+  req.set_min_mod_revision(b_revision);
+  req.set_keys_only(true);
+  resp.Clear();
+  ASSERT_OK(Range(req, &resp));
+  ASSERT_EQ(2, resp.kvs_size());
+  EXPECT_EQ("/dir/b", resp.kvs(0).key());
+  EXPECT_EQ("", resp.kvs(0).value());
+  EXPECT_FALSE(resp.more());
+
+  req.clear_min_mod_revision();
+  req.set_count_only(true);
+  resp.Clear();
+  ASSERT_OK(Range(req, &resp));
+  EXPECT_EQ(0, resp.kvs_size());
+  EXPECT_EQ(3, resp.count());
+
+  // From a key to the end.
+  req.Clear();
+  req.set_key("/dir/c");
+  req.set_range_end(string(1, '\0'));
+  resp.Clear();
+  ASSERT_OK(Range(req, &resp));
+  EXPECT_EQ(2, resp.count());
+}
+
+
+TEST_F(FakeEtcdV3Test, TxnCompares) {
+  const int64_t revision(Put("/a", "1"));
+
+  TxnRequest req;
+  Compare* const compare(req.add_compare());
+  compare->set_key("/a");
+  compare->set_target(Compare::MOD);
+  compare->set_result(Compare::EQUAL);
+  compare->set_mod_revision(revision);
+  req.add_success()->mutable_request_put()->set_key("/b");
+  req.add_success()->mutable_request_range()->set_key("/b");
+  req.add_failure()->mutable_request_range()->set_key("/a");
+
+  TxnResponse resp;
+  ASSERT_OK(Txn(req, &resp));
+  EXPECT_TRUE(resp.succeeded());
+  ASSERT_EQ(2, resp.responses_size());
+  // Reads see the writes before them.
+  EXPECT_EQ(1, resp.responses(1).response_range().kvs_size());
+  EXPECT_EQ(revision + 1, resp.header().revision());
+
+  Put("/a", "2");
+  resp.Clear();
+  ASSERT_OK(Txn(req, &resp));
+  EXPECT_FALSE(resp.succeeded());
+  ASSERT_EQ(1, resp.responses_size());
+  EXPECT_EQ("2", resp.responses(0).response_range().kvs(0).value());
+
+  // Comparing the value of a missing key always fails.
+  req.Clear();
+  Compare* const value_compare(req.add_compare());
+  value_compare->set_key("/missing");
+  value_compare->set_target(Compare::VALUE);
+  value_compare->set_result(Compare::LESS);
+  value_compare->set_value("z");
+  resp.Clear();
+  ASSERT_OK(Txn(req, &resp));
+  EXPECT_FALSE(resp.succeeded());
+}
+
+
+TEST_F(FakeEtcdV3Test, DeleteOnlyMakesARevisionIfSomethingWasDeleted) {
+  const int64_t revision(Put("/a", "1"));
+
+  TxnRequest req;
+  req.add_success()->mutable_request_delete_range()->set_key("/b");
+  TxnResponse resp;
+  ASSERT_OK(Txn(req, &resp));
+  EXPECT_EQ(0, resp.responses(0).response_delete_range().deleted());
+  EXPECT_EQ(revision, resp.header().revision());
+
+  req.mutable_success(0)->mutable_request_delete_range()->set_key("/a");
+  resp.Clear();
+  ASSERT_OK(Txn(req, &resp));
+  EXPECT_EQ(1, resp.responses(0).response_delete_range().deleted());
+  EXPECT_EQ(revision + 1, resp.header().revision());
+  EXPECT_EQ(0, Get("/a").kvs_size());
+  EXPECT_EQ(1, Get("/a", revision).kvs_size());
+
+  // Re-creating it starts a new generation.
+  const int64_t recreated(Put("/a", "2"));
+  EXPECT_EQ(recreated, Get("/a").kvs(0).create_revision());
+  EXPECT_EQ(1, Get("/a").kvs(0).version());
+}
+
+
+TEST_F(FakeEtcdV3Test, Leases) {
+  LeaseGrantRequest req;
+  req.set_ttl(1);
+  LeaseGrantResponse resp;
+  SyncTask task(base_.get());
+  client_.LeaseGrant(req, &resp, task.task());
+  task.Wait();
+  ASSERT_OK(task);
+  ASSERT_NE(0, resp.id());
+
+  Put("/a", "1", resp.id());
+  Put("/b", "2", resp.id());
+  Put("/c", "3");
+  EXPECT_EQ(1, Get("/a").kvs_size());
+  EXPECT_EQ(resp.id(), Get("/a").kvs(0).lease());
+
+  sleep(2);
+  EXPECT_EQ(0, Get("/a").kvs_size());
+  EXPECT_EQ(0, Get("/b").kvs_size());
+  EXPECT_EQ(1, Get("/c").kvs_size());
+
+  // Putting with an expired lease fails, and changes nothing.
+  TxnRequest txn;
+  etcdserverpb::PutRequest* const put(
+      txn.add_success()->mutable_request_put());
+  put->set_key("/a");
+  put->set_lease(resp.id());
+  TxnResponse txn_resp;
+  EXPECT_THAT(Txn(txn, &txn_resp), StatusIs(util::error::NOT_FOUND));
+  EXPECT_EQ(0, Get("/a").kvs_size());
+}
+
+
+TEST_F(FakeEtcdV3Test, LeaseGrantErrors) {
+  LeaseGrantRequest req;
+  LeaseGrantResponse resp;
+  {
+    SyncTask task(base_.get());
+    client_.LeaseGrant(req, &resp, task.task());
+    task.Wait();
+    EXPECT_THAT(task.status(), StatusIs(util::error::INVALID_ARGUMENT));
+  }
+
+  req.set_ttl(10);
+  req.set_id(42);
+  {
+    SyncTask task(base_.get());
+    client_.LeaseGrant(req, &resp, task.task());
+    task.Wait();
+    ASSERT_OK(task);
+    EXPECT_EQ(42, resp.id());
+  }
+  {
+    SyncTask task(base_.get());
+    client_.LeaseGrant(req, &resp, task.task());
+    task.Wait();
+    EXPECT_THAT(task.status(), StatusIs(util::error::FAILED_PRECONDITION));
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,460 @@
+#include "util/json_reader.h"
+
+#include <glog/logging.h>
+#include <limits>
+#include <string.h>
+
+#include "util/base64.h"
+
+using std::numeric_limits;
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+// Arrays and objects nested deeper than this are considered an error,
+// rather than risking to run out of stack in SkipValue().
+const size_t kMaxDepth = 64;
+
+
+bool ParseHex4(const char* pos, uint32_t* value) {
+  *value = 0;
+  for (int i = 0; i < 4; ++i) {
+    const char c(pos[i]);
+    *value <<= 4;
+    if (c >= '0' && c <= '9') {
+      *value |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      *value |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      *value |= c - 'A' + 10;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+void AppendUtf8(uint32_t code_point, string* out) {
+  if (code_point < 0x80) {
+    out->push_back(code_point);
+  } else if (code_point < 0x800) {
+    out->push_back(0xc0 | (code_point >> 6));
+    out->push_back(0x80 | (code_point & 0x3f));
+  } else if (code_point < 0x10000) {
+    out->push_back(0xe0 | (code_point >> 12));
+    out->push_back(0x80 | ((code_point >> 6) & 0x3f));
+    out->push_back(0x80 | (code_point & 0x3f));
+  } else {
+    out->push_back(0xf0 | (code_point >> 18));
+    out->push_back(0x80 | ((code_point >> 12) & 0x3f));
+    out->push_back(0x80 | ((code_point >> 6) & 0x3f));
+    out->push_back(0x80 | (code_point & 0x3f));
+  }
+}
+
+
+}  // namespace
+
+
+JsonReader::JsonReader(const char* data, size_t size)
+    : pos_(CHECK_NOTNULL(data)),
+      end_(data + size),
+      ok_(true),
+      allow_trailing_commas_(false) {
+}
+
+
+JsonReader::JsonReader(const string& data)
+    : JsonReader(data.data(), data.size()) {
+}
+
+
+bool JsonReader::BeginObject() {
+  if (!Consume('{')) {
+    return false;
+  }
+  if (first_.size() >= kMaxDepth) {
+    return Fail();
+  }
+  first_.push_back(true);
+  return true;
+}
+
+
+bool JsonReader::NextMember(string* key) {
+  const char* begin;
+  const char* end;
+  bool escaped;
+  if (!NextRawMember(&begin, &end, &escaped)) {
+    return false;
+  }
+
+  key->clear();
+  if (!escaped) {
+    key->append(begin, end);
+    return true;
+  }
+
+  return Unescape(begin, end, key) || Fail();
+}
+
+
+bool JsonReader::BeginArray() {
+  if (!Consume('[')) {
+    return false;
+  }
+  if (first_.size() >= kMaxDepth) {
+    return Fail();
+  }
+  first_.push_back(true);
+  return true;
+}
+
+
+bool JsonReader::NextElement() {
+  if (!ok_ || first_.empty()) {
+    return Fail();
+  }
+
+  if (EndOfContainer(']')) {
+    return false;
+  }
+  if (!first_.back() &&
+      (!Consume(',') || (allow_trailing_commas_ && EndOfContainer(']')))) {
+    return false;
+  }
+  first_.back() = false;
+
+  return true;
+}
+
+
+bool JsonReader::ReadString(string* value) {
+  const char* begin;
+  const char* end;
+  bool escaped;
+  if (!ReadRawString(&begin, &end, &escaped)) {
+    return false;
+  }
+
+  value->clear();
+  if (!escaped) {
+    value->append(begin, end);
+    return true;
+  }
+
+  return Unescape(begin, end, value) || Fail();
+}
+
+
+bool JsonReader::ReadBase64(string* value) {
+  const char* begin;
+  const char* end;
+  bool escaped;
+  if (!ReadRawString(&begin, &end, &escaped)) {
+    return false;
+  }
+
+  // json-c escapes forward slashes, which are part of the base64
+  // alphabet, so escapes are not that rare.
+  if (escaped) {
+    scratch_.clear();
+    if (!Unescape(begin, end, &scratch_)) {
+      return Fail();
+    }
+    begin = scratch_.data();
+    end = begin + scratch_.size();
+  }
+
+  value->clear();
+  return util::AppendFromBase64(begin, end - begin, value) || Fail();
+}
+
+
+bool JsonReader::ReadInt(int64_t* value) {
+  SkipWhitespace();
+  if (!ok_ || pos_ == end_) {
+    return Fail();
+  }
+
+  const bool negative(*pos_ == '-');
+  if (negative) {
+    ++pos_;
+  }
+
+  if (pos_ == end_ || *pos_ < '0' || *pos_ > '9' ||
+      (*pos_ == '0' && pos_ + 1 < end_ && pos_[1] >= '0' && pos_[1] <= '9')) {
+    return Fail();
+  }
+
+  // Accumulate as a negative number, since its range is larger.
+  int64_t result(0);
+  while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') {
+    const int digit(*pos_ - '0');
+    if (result < (numeric_limits<int64_t>::min() + digit) / 10) {
+      return Fail();
+    }
+    result = result * 10 - digit;
+    ++pos_;
+  }
+
+  if (pos_ < end_ && (*pos_ == '.' || *pos_ == 'e' || *pos_ == 'E')) {
+    return Fail();
+  }
+
+  if (!negative) {
+    if (result == numeric_limits<int64_t>::min()) {
+      return Fail();
+    }
+    result = -result;
+  }
+
+  *value = result;
+  return true;
+}
+
+
+bool JsonReader::ReadBool(bool* value) {
+  SkipWhitespace();
+  if (ConsumeLiteral("true")) {
+    *value = true;
+    return true;
+  }
+  if (ConsumeLiteral("false")) {
+    *value = false;
+    return true;
+  }
+  return Fail();
+}
+
+
+bool JsonReader::Finish() {
+  SkipWhitespace();
+  return ok_ && first_.empty() && pos_ == end_;
+}
+
+
+bool JsonReader::Fail() {
+  ok_ = false;
+  return false;
+}
+
+
+void JsonReader::SkipWhitespace() {
+  while (pos_ < end_ &&
+         (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t')) {
+    ++pos_;
+  }
+}
+
+
+bool JsonReader::Consume(char c) {
+  SkipWhitespace();
+  if (!ok_ || pos_ == end_ || *pos_ != c) {
+    return Fail();
+  }
+  ++pos_;
+  return true;
+}
+
+
+// Consumes |c| and leaves the current object or array if |c| is next.
+bool JsonReader::EndOfContainer(char c) {
+  SkipWhitespace();
+  if (pos_ == end_ || *pos_ != c) {
+    return false;
+  }
+  ++pos_;
+  first_.pop_back();
+  return true;
+}
+
+
+// Does not skip whitespace, nor fail if |literal| is not next.
+bool JsonReader::ConsumeLiteral(const char* literal) {
+  const size_t length(strlen(literal));
+  if (!ok_ || static_cast<size_t>(end_ - pos_) < length ||
+      memcmp(pos_, literal, length) != 0) {
+    return false;
+  }
+  pos_ += length;
+  return true;
+}
+
+
+bool JsonReader::NextRawMember(const char** begin, const char** end,
+                               bool* escaped) {
+  if (!ok_ || first_.empty()) {
+    return Fail();
+  }
+
+  if (EndOfContainer('}')) {
+    return false;
+  }
+  if (!first_.back() &&
+      (!Consume(',') || (allow_trailing_commas_ && EndOfContainer('}')))) {
+    return false;
+  }
+  first_.back() = false;
+
+  return ReadRawString(begin, end, escaped) && Consume(':');
+}
+
+
+bool JsonReader::ReadRawString(const char** begin, const char** end,
+                               bool* escaped) {
+  if (!Consume('"')) {
+    return false;
+  }
+
+  *begin = pos_;
+  *escaped = false;
+  while (pos_ < end_ && *pos_ != '"') {
+    if (*pos_ == '\\') {
+      *escaped = true;
+      // Skip the escaped character, so that \" does not end the
+      // string. Unescape() validates the escapes.
+      ++pos_;
+    } else if (static_cast<unsigned char>(*pos_) < 0x20) {
+      return Fail();
+    }
+    ++pos_;
+  }
+
+  if (pos_ >= end_) {
+    return Fail();
+  }
+
+  *end = pos_;
+  ++pos_;
+  return true;
+}
+
+
+bool JsonReader::Unescape(const char* begin, const char* end, string* value) {
+  value->reserve(value->size() + (end - begin));
+  for (const char* pos = begin; pos < end; ++pos) {
+    if (*pos != '\\') {
+      value->push_back(*pos);
+      continue;
+    }
+
+    ++pos;
+    switch (*pos) {
+      case '"':
+      case '\\':
+      case '/':
+        value->push_back(*pos);
+        break;
+      case 'b':
+        value->push_back('\b');
+        break;
+      case 'f':
+        value->push_back('\f');
+        break;
+      case 'n':
+        value->push_back('\n');
+        break;
+      case 'r':
+        value->push_back('\r');
+        break;
+      case 't':
+        value->push_back('\t');
+        break;
+      case 'u': {
+        uint32_t code_point;
+        if (end - pos < 5 || !ParseHex4(pos + 1, &code_point)) {
+          return false;
+        }
+        pos += 4;
+        if (code_point >= 0xd800 && code_point < 0xdc00) {
+          // A high surrogate, which must be followed by a low one.
+          uint32_t low;
+          if (end - pos < 7 || pos[1] != '\\' || pos[2] != 'u' ||
+              !ParseHex4(pos + 3, &low) || low < 0xdc00 || low >= 0xe000) {
+            return false;
+          }
+          pos += 6;
+          code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+        } else if (code_point >= 0xdc00 && code_point < 0xe000) {
+          return false;
+        }
+        AppendUtf8(code_point, value);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+
+  return true;
+}
+
+
+bool JsonReader::SkipValue() {
+  SkipWhitespace();
+  if (!ok_ || pos_ == end_) {
+    return Fail();
+  }
+
+  switch (*pos_) {
+    case '{': {
+      if (!BeginObject()) {
+        return false;
+      }
+      const char* key_begin;
+      const char* key_end;
+      bool escaped;
+      while (NextRawMember(&key_begin, &key_end, &escaped)) {
+        if (!SkipValue()) {
+          return false;
+        }
+      }
+      return ok_;
+    }
+
+    case '[':
+      if (!BeginArray()) {
+        return false;
+      }
+      while (NextElement()) {
+        if (!SkipValue()) {
+          return false;
+        }
+      }
+      return ok_;
+
+    case '"': {
+      const char* begin;
+      const char* end;
+      bool escaped;
+      return ReadRawString(&begin, &end, &escaped);
+    }
+
+    case 't':
+    case 'f':
+    case 'n':
+      return ConsumeLiteral("true") || ConsumeLiteral("false") ||
+             ConsumeLiteral("null") || Fail();
+
+    default: {
+      // A number, possibly with a fraction and an exponent.
+      const char* const start(pos_);
+      if (*pos_ == '-') {
+        ++pos_;
+      }
+      while (pos_ < end_ && ((*pos_ >= '0' && *pos_ <= '9') || *pos_ == '.' ||
+                             *pos_ == 'e' || *pos_ == 'E' || *pos_ == '+' ||
+                             *pos_ == '-')) {
+        ++pos_;
+      }
+      return pos_ > start + (*start == '-' ? 1 : 0) || Fail();
+    }
+  }
+}
+
+
+}  // namespace cert_trans
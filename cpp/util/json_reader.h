@@ -0,0 +1,124 @@
+#ifndef CERT_TRANS_UTIL_JSON_READER_H_
+#define CERT_TRANS_UTIL_JSON_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// A streaming (pull) JSON parser, for the hot paths where building a
+// json-c DOM with JsonObject would be too costly. Values are read in
+// document order, straight out of the input, and strings are decoded
+// into caller-provided buffers, which can be reused from one value to
+// the next to avoid allocations.
+//
+// Any error (syntax error, or a value of an unexpected type) is
+// sticky: once ok() returns false, every method fails. For example,
+// to read {"a": [1, 2], "b": "foo"}:
+//
+//   JsonReader reader(input);
+//   string key;
+//   reader.BeginObject();
+//   while (reader.NextMember(&key)) {
+//     if (key == "a") {
+//       reader.BeginArray();
+//       while (reader.NextElement()) {
+//         int64_t value;
+//         reader.ReadInt(&value);
+//       }
+//     } else {
+//       reader.SkipValue();
+//     }
+//   }
+//   if (!reader.Finish()) {
+//     // Handle the error.
+//   }
+//
+// The input must outlive the reader.
+class JsonReader {
+ public:
+  JsonReader(const char* data, size_t size);
+  explicit JsonReader(const std::string& data);
+
+  bool ok() const {
+    return ok_;
+  }
+
+  // Accepts a comma after the last member of an object or element of an
+  // array, as json-c does.
+  void AllowTrailingCommas() {
+    allow_trailing_commas_ = true;
+  }
+
+  // Consumes the opening brace of an object.
+  bool BeginObject();
+
+  // Returns true and sets |key| if the current object has another
+  // member, whose value must then be consumed. Returns false (and
+  // consumes the closing brace) at the end of the object, or in case
+  // of an error.
+  bool NextMember(std::string* key);
+
+  // Consumes the opening bracket of an array.
+  bool BeginArray();
+
+  // Returns true if the current array has another element, which
+  // must then be consumed. Returns false (and consumes the closing
+  // bracket) at the end of the array, or in case of an error.
+  bool NextElement();
+
+  // Replaces the contents of |value| with the next value, which must
+  // be a string.
+  bool ReadString(std::string* value);
+
+  // Replaces the contents of |value| with the decoding of the next
+  // value, which must be a base64-encoded string.
+  bool ReadBase64(std::string* value);
+
+  // The next value must be an integer (not a floating point number)
+  // that fits in an int64_t.
+  bool ReadInt(int64_t* value);
+
+  // The next value must be true or false.
+  bool ReadBool(bool* value);
+
+  // Consumes the next value, whatever it is.
+  bool SkipValue();
+
+  // Returns true if there were no errors, and there is nothing but
+  // whitespace left.
+  bool Finish();
+
+ private:
+  bool Fail();
+  void SkipWhitespace();
+  bool Consume(char c);
+  bool ConsumeLiteral(const char* literal);
+  bool EndOfContainer(char c);
+  bool NextRawMember(const char** begin, const char** end, bool* escaped);
+  bool ReadRawString(const char** begin, const char** end, bool* escaped);
+  bool Unescape(const char* begin, const char* end, std::string* value);
+
+  const char* pos_;
+  const char* const end_;
+  bool ok_;
+  bool allow_trailing_commas_;
+  // For each object or array being read, whether its first member or
+  // element has yet to be read.
+  std::vector<bool> first_;
+  // Holds unescaped base64 strings, in the rare case where they
+  // contain escapes.
+  std::string scratch_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonReader);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_JSON_READER_H_
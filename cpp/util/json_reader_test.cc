@@ -0,0 +1,226 @@
+#include "util/json_reader.h"
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+
+using std::string;
+
+
+TEST(JsonReaderTest, UnwrapResponse) {
+  const string response(
+      "{\"leaf_index\":3,\"audit_path\":"
+      "[\"j17CTFWsQGwnQkYsebYS7CondFpbzIo+N1jPi9UrqTI=\","
+      "\"QSNVV8\\/waZ5rezVSTFcSPbKtqjalAwVqdF2Vv0\\/l3\\/Q=\"]}");
+
+  JsonReader reader(response);
+  string key, node;
+  int64_t leaf_index(-1);
+  ASSERT_TRUE(reader.BeginObject());
+
+  ASSERT_TRUE(reader.NextMember(&key));
+  EXPECT_EQ("leaf_index", key);
+  ASSERT_TRUE(reader.ReadInt(&leaf_index));
+  EXPECT_EQ(3, leaf_index);
+
+  ASSERT_TRUE(reader.NextMember(&key));
+  EXPECT_EQ("audit_path", key);
+  ASSERT_TRUE(reader.BeginArray());
+  ASSERT_TRUE(reader.NextElement());
+  ASSERT_TRUE(reader.ReadBase64(&node));
+  EXPECT_EQ("8f5ec24c55ac406c2742462c79b612ec2a27745a5bcc8a3e3758cf8bd52ba932",
+            util::HexString(node));
+  ASSERT_TRUE(reader.NextElement());
+  ASSERT_TRUE(reader.ReadBase64(&node));
+  EXPECT_EQ("41235557cff0699e6b7b35524c57123db2adaa36a503056a745d95bf4fe5dff4",
+            util::HexString(node));
+  EXPECT_FALSE(reader.NextElement());
+
+  EXPECT_FALSE(reader.NextMember(&key));
+  EXPECT_TRUE(reader.Finish());
+}
+
+
+TEST(JsonReaderTest, Base64MatchesUtil) {
+  string data;
+  for (int length = 0; length < 10; ++length) {
+    const string json("\"" + util::ToBase64(data) + "\"");
+    JsonReader reader(json);
+    string decoded("garbage");
+    ASSERT_TRUE(reader.ReadBase64(&decoded)) << json;
+    EXPECT_EQ(data, decoded);
+    EXPECT_TRUE(reader.Finish());
+    data.push_back(static_cast<char>(0xf0 + length));
+  }
+}
+
+
+TEST(JsonReaderTest, InvalidBase64) {
+  const char* const inputs[] = {"\"abc\"", "\"ab=c\"", "\"a===\"",
+                                "\"ab!d\"", "\"====\""};
+  for (const char* input : inputs) {
+    JsonReader reader(input, strlen(input));
+    string decoded;
+    EXPECT_FALSE(reader.ReadBase64(&decoded)) << input;
+    EXPECT_FALSE(reader.ok());
+  }
+}
+
+
+TEST(JsonReaderTest, Escapes) {
+  const string json("\"a\\\"b\\\\c\\/d\\n\\u00e9\\ud83d\\ude00\"");
+  JsonReader reader(json);
+  string value;
+  ASSERT_TRUE(reader.ReadString(&value));
+  EXPECT_EQ("a\"b\\c/d\n\xc3\xa9\xf0\x9f\x98\x80", value);
+  EXPECT_TRUE(reader.Finish());
+}
+
+
+TEST(JsonReaderTest, InvalidEscapes) {
+  const char* const inputs[] = {"\"\\x\"", "\"\\u12\"", "\"\\ud83d\"",
+                                "\"\\ude00\"", "\"abc"};
+  for (const char* input : inputs) {
+    JsonReader reader(input, strlen(input));
+    string value;
+    EXPECT_FALSE(reader.ReadString(&value)) << input;
+  }
+}
+
+
+TEST(JsonReaderTest, Ints) {
+  const char* const valid[] = {"0", "-0", "42", "-42", "9223372036854775807",
+                               "-9223372036854775808"};
+  const int64_t expected[] = {0, 0, 42, -42, INT64_MAX, INT64_MIN};
+  for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); ++i) {
+    JsonReader reader(valid[i], strlen(valid[i]));
+    int64_t value;
+    ASSERT_TRUE(reader.ReadInt(&value)) << valid[i];
+    EXPECT_EQ(expected[i], value);
+    EXPECT_TRUE(reader.Finish());
+  }
+
+  const char* const invalid[] = {"",    "-",   "01",   "1.5",
+                                 "1e3", "\"1\"", "9223372036854775808",
+                                 "-9223372036854775809"};
+  for (const char* input : invalid) {
+    JsonReader reader(input, strlen(input));
+    int64_t value;
+    EXPECT_FALSE(reader.ReadInt(&value)) << input;
+  }
+}
+
+
+TEST(JsonReaderTest, Bools) {
+  const string input("[true, false]");
+  JsonReader reader(input);
+  bool value;
+  ASSERT_TRUE(reader.BeginArray());
+  ASSERT_TRUE(reader.NextElement());
+  ASSERT_TRUE(reader.ReadBool(&value));
+  EXPECT_TRUE(value);
+  ASSERT_TRUE(reader.NextElement());
+  ASSERT_TRUE(reader.ReadBool(&value));
+  EXPECT_FALSE(value);
+  EXPECT_FALSE(reader.NextElement());
+  EXPECT_TRUE(reader.Finish());
+
+  const char* const invalid[] = {"", "null", "1", "\"true\"", "tru"};
+  for (const char* input : invalid) {
+    JsonReader reader(input, strlen(input));
+    EXPECT_FALSE(reader.ReadBool(&value)) << input;
+  }
+}
+
+
+TEST(JsonReaderTest, SkipValue) {
+  const string json(
+      "{\"skip\": {\"a\": [1, -2.5e3, true, false, null, \"x\\\"}\"], "
+      "\"b\": {}}, \"keep\": 7}");
+  JsonReader reader(json);
+  string key;
+  int64_t value(0);
+  ASSERT_TRUE(reader.BeginObject());
+  while (reader.NextMember(&key)) {
+    if (key == "keep") {
+      ASSERT_TRUE(reader.ReadInt(&value));
+    } else {
+      ASSERT_TRUE(reader.SkipValue());
+    }
+  }
+  EXPECT_TRUE(reader.Finish());
+  EXPECT_EQ(7, value);
+}
+
+
+TEST(JsonReaderTest, EmptyContainers) {
+  const string json(" { \"a\" : [ ] } ");
+  JsonReader reader(json);
+  string key;
+  ASSERT_TRUE(reader.BeginObject());
+  ASSERT_TRUE(reader.NextMember(&key));
+  ASSERT_TRUE(reader.BeginArray());
+  EXPECT_FALSE(reader.NextElement());
+  EXPECT_FALSE(reader.NextMember(&key));
+  EXPECT_TRUE(reader.Finish());
+}
+
+
+TEST(JsonReaderTest, SyntaxErrors) {
+  const char* const inputs[] = {"{\"a\" 1}", "{\"a\": 1,}", "{,\"a\": 1}",
+                                "[1 2]",     "{\"a\": 1",  "{\"a\": tru}",
+                                "[[[[",      "{\"a\": 1}}"};
+  for (const char* input : inputs) {
+    JsonReader reader(input, strlen(input));
+    EXPECT_TRUE(!reader.SkipValue() || !reader.Finish()) << input;
+  }
+}
+
+
+TEST(JsonReaderTest, TrailingCommas) {
+  const string json("{\"a\": [1, 2, ], \"b\": {\"c\": 3,}, }");
+  JsonReader reader(json);
+  reader.AllowTrailingCommas();
+  EXPECT_TRUE(reader.SkipValue());
+  EXPECT_TRUE(reader.Finish());
+
+  // Only one, and not in empty containers.
+  const char* const invalid[] = {"[1,,]", "[,]", "{,}"};
+  for (const char* input : invalid) {
+    JsonReader reader(input, strlen(input));
+    reader.AllowTrailingCommas();
+    EXPECT_FALSE(reader.SkipValue()) << input;
+  }
+}
+
+
+TEST(JsonReaderTest, DeepNesting) {
+  const string json(string(1000, '[') + string(1000, ']'));
+  JsonReader reader(json);
+  EXPECT_FALSE(reader.SkipValue());
+}
+
+
+TEST(JsonReaderTest, ErrorsAreSticky) {
+  const string json("[1, 2]");
+  JsonReader reader(json);
+  string value;
+  EXPECT_FALSE(reader.ReadString(&value));
+  EXPECT_FALSE(reader.BeginArray());
+  EXPECT_FALSE(reader.Finish());
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -201,6 +201,10 @@ class JsonArray : public JsonObject {
     Add(json_object_new_string(addand.c_str()));
   }
 
+  void Add(int64_t addand) {
+    Add(json_object_new_int64(addand));
+  }
+
   void Add(JsonObject* addand) {
     Add(addand->Extract());
   }
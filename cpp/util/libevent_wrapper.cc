@@ -205,6 +205,12 @@ evhttp_connection* Base::HttpConnectionNew(const string& host,
 }
 
 
+bufferevent* Base::BufferEventSocketNew(evutil_socket_t sock,
+                                        int options) const {
+  return CHECK_NOTNULL(bufferevent_socket_new(base_.get(), sock, options));
+}
+
+
 void Base::RunClosures(evutil_socket_t sock, short flag, void* userdata) {
   Base* self(static_cast<Base*>(CHECK_NOTNULL(userdata)));
 
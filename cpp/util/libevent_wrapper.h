@@ -3,6 +3,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <event2/bufferevent.h>
 #include <event2/dns.h>
 #include <event2/event.h>
 #include <event2/http.h>
@@ -46,6 +47,7 @@ class Base : public util::Executor {
   evdns_base* GetDns();
   evhttp_connection* HttpConnectionNew(const std::string& host,
                                        unsigned short port);
+  bufferevent* BufferEventSocketNew(evutil_socket_t sock, int options) const;
 
  private:
   static void RunClosures(evutil_socket_t sock, short flag, void* userdata);
@@ -12,7 +12,10 @@ namespace cert_trans {
 
 using cert_trans::Gauge;
 using std::bind;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::move;
 using std::mutex;
 using std::placeholders::_1;
 using std::placeholders::_2;
@@ -23,11 +26,16 @@ using std::unique_ptr;
 using std::vector;
 using util::Task;
 
-DEFINE_int32(master_keepalive_interval_seconds, 60,
-             "Interval between refreshing mastership proposal.");
-DEFINE_int32(masterelection_retry_delay_seconds, 5,
-             "Seconds to delay before retrying a failed attempt to create a "
-             "proposal file.");
+DEFINE_int32(master_keepalive_interval_ms, 500,
+             "Interval between refreshing mastership proposal, must be less "
+             "than --master_lease_ttl_seconds.");
+DEFINE_int32(master_lease_ttl_seconds, 2,
+             "TTL of mastership proposals, which is how long a master keeps "
+             "its mastership without managing to refresh its proposal, and "
+             "so how long it takes to replace a master which died.");
+DEFINE_int32(masterelection_retry_delay_ms, 500,
+             "Milliseconds to delay before retrying a failed attempt to "
+             "create a proposal file.");
 
 namespace {
 
@@ -45,6 +53,11 @@ static Counter<>* proposal_creation_failures(
                    "Total number of failures to create an election "
                    "proposal."));
 
+static Counter<>* proposal_update_failures(
+    Counter<>::New("election_proposal_update_failures",
+                   "Total number of failures to refresh or update an "
+                   "election proposal."));
+
 
 // Special backing string which indicates that we're not backing any proposal.
 const char kNoBacking[] = "";
@@ -106,8 +119,12 @@ MasterElection::MasterElection(const shared_ptr<libevent::Base>& base,
       proposal_state_(ProposalState::NONE),
       running_(false),
       backed_proposal_(kNoBacking),
-      is_master_(false) {
+      is_master_(false),
+      fencing_token_(0) {
   CHECK_NE(kNoBacking, node_id);
+  CHECK_GT(FLAGS_master_keepalive_interval_ms, 0);
+  CHECK_LT(FLAGS_master_keepalive_interval_ms,
+           FLAGS_master_lease_ttl_seconds * 1000);
   is_master_gauge->Set(0);
   participating_in_election_gauge->Set(0);
 }
@@ -115,7 +132,9 @@ MasterElection::MasterElection(const shared_ptr<libevent::Base>& base,
 
 // Testing only c'tor
 MasterElection::MasterElection()
-    : client_(nullptr), proposal_state_(ProposalState::NONE) {
+    : client_(nullptr),
+      proposal_state_(ProposalState::NONE),
+      fencing_token_(0) {
 }
 
 
@@ -155,23 +174,35 @@ void MasterElection::StopElection() {
   // because the watch callback takes that lock. This means that we'll
   // stop updating our proposal, and maybe delay a master election,
   // but that's okay, as we're about to delete our proposal
-  // altogether.
+  // altogether. There is no watch yet if our proposal was never
+  // created, and now that |running_| is false, there never will be.
+  const unique_ptr<util::SyncTask> watch(move(proposal_watch_));
   lock.unlock();
-  VLOG(1) << my_proposal_path_ << ": Cancelling watch...";
-  proposal_watch_->Cancel();
-  proposal_watch_->Wait();
-  proposal_watch_.reset();
+  if (watch) {
+    VLOG(1) << my_proposal_path_ << ": Cancelling watch...";
+    watch->Cancel();
+    watch->Wait();
+  }
 
   lock.lock();
   is_master_ = false;
   is_master_cv_.notify_all();
 
-  // But wait for any in-flight updates to finish
+  // But wait for any in-flight updates to finish. If our proposal is
+  // still being created, that gives up on it once it fails (rather
+  // than retrying), and then there is nothing to delete.
   VLOG(1) << my_proposal_path_ << ": waiting for in-flight proposal update "
           << "to complete.";
   proposal_state_cv_.wait(lock, [this]() {
-    return proposal_state_ == ProposalState::UP_TO_DATE;
+    return proposal_state_ == ProposalState::UP_TO_DATE ||
+           proposal_state_ == ProposalState::NONE;
   });
+  if (proposal_state_ == ProposalState::NONE) {
+    CHECK(!proposal_refresh_callback_);
+    VLOG(1) << my_proposal_path_ << ": Departed election without a "
+            << "proposal.";
+    return;
+  }
 
   // No more refresh callbacks (this is not synchronous, the refresh
   // callback might be running right now, trying to lock the mutex, so
@@ -210,7 +241,13 @@ bool MasterElection::IsMaster() const {
 
 bool MasterElection::IsMaster(const unique_lock<mutex>& lock) const {
   CHECK(lock.owns_lock());
-  return is_master_;
+  return is_master_ && steady_clock::now() < lease_expiry_;
+}
+
+
+int64_t MasterElection::FencingToken() const {
+  unique_lock<mutex> lock(mutex_);
+  return fencing_token_;
 }
 
 
@@ -224,11 +261,13 @@ void MasterElection::Transition(const unique_lock<mutex>& lock,
       CHECK_EQ(to, ProposalState::AWAITING_CREATION);
       break;
     case ProposalState::AWAITING_CREATION:
-      CHECK_EQ(to, ProposalState::CREATING);
+      // Straight to NONE if the election was stopped in the meantime.
+      CHECK(to == ProposalState::CREATING || to == ProposalState::NONE)
+          << "proposal_state_: " << proposal_state_ << " to: " << to;
       break;
     case ProposalState::CREATING:
       CHECK(to == ProposalState::AWAITING_CREATION ||
-            to == ProposalState::UP_TO_DATE)
+            to == ProposalState::UP_TO_DATE || to == ProposalState::NONE)
           << "proposal_state_: " << proposal_state_ << " to: " << to;
       break;
     case ProposalState::UP_TO_DATE:
@@ -240,7 +279,9 @@ void MasterElection::Transition(const unique_lock<mutex>& lock,
       CHECK_EQ(to, ProposalState::UPDATING);
       break;
     case ProposalState::UPDATING:
-      CHECK_EQ(to, ProposalState::UP_TO_DATE);
+      CHECK(to == ProposalState::UP_TO_DATE ||
+            to == ProposalState::AWAITING_CREATION)
+          << "proposal_state_: " << proposal_state_ << " to: " << to;
       break;
     case ProposalState::AWAITING_DELETE:
       CHECK_EQ(to, ProposalState::DELETING);
@@ -258,6 +299,12 @@ void MasterElection::Transition(const unique_lock<mutex>& lock,
 
 void MasterElection::CreateProposal() {
   unique_lock<mutex> lock(mutex_);
+  if (!running_) {
+    VLOG(1) << my_proposal_path_ << ": Election stopped, not creating "
+            << "proposal.";
+    AbandonProposal(lock);
+    return;
+  }
   Transition(lock, ProposalState::CREATING);
 
   // We'll create an empty file indicating we're not backing anyone, so as to
@@ -265,11 +312,11 @@ void MasterElection::CreateProposal() {
   // Technically this could already exist if we had mastership before, crashed,
   // and then restarted before the TTL expired.
   EtcdClient::Response* const resp(new EtcdClient::Response);
+  lease_requested_ = steady_clock::now();
   client_->CreateWithTTL(
-      my_proposal_path_, kNoBacking,
-      seconds(FLAGS_master_keepalive_interval_seconds * 2), resp,
-      new Task(bind(&MasterElection::ProposalCreateDone, this, resp, _1),
-               base_.get()));
+      my_proposal_path_, kNoBacking, seconds(FLAGS_master_lease_ttl_seconds),
+      resp, new Task(bind(&MasterElection::ProposalCreateDone, this, resp, _1),
+                     base_.get()));
 }
 
 
@@ -281,10 +328,16 @@ void MasterElection::ProposalCreateDone(EtcdClient::Response* resp,
 
   if (!task->status().ok()) {
     proposal_creation_failures->Increment();
+    if (!running_) {
+      LOG(WARNING) << "Problem creating proposal: " << task->status() << " "
+                   << "but the election was stopped.";
+      AbandonProposal(lock);
+      return;
+    }
     Transition(lock, ProposalState::AWAITING_CREATION);
     LOG(WARNING) << "Problem creating proposal: " << task->status() << " "
                  << "will retry.";
-    base_->Delay(seconds(FLAGS_masterelection_retry_delay_seconds),
+    base_->Delay(milliseconds(FLAGS_masterelection_retry_delay_ms),
                  new Task(bind(&MasterElection::CreateProposal, this),
                           base_.get()));
     return;
@@ -296,18 +349,22 @@ void MasterElection::ProposalCreateDone(EtcdClient::Response* resp,
           << resp->etcd_index;
 
   my_proposal_modified_index_ = my_proposal_create_index_ = resp->etcd_index;
+  lease_expiry_ = lease_requested_ + seconds(FLAGS_master_lease_ttl_seconds);
   // Start a periodic callback to keep our proposal from being garbage
   // collected
   CHECK(!proposal_refresh_callback_);
   VLOG(1) << my_proposal_path_ << ": Creating refresh Callback";
   proposal_refresh_callback_.reset(new PeriodicClosure(
-      base_, seconds(FLAGS_master_keepalive_interval_seconds),
+      base_, milliseconds(FLAGS_master_keepalive_interval_ms),
       bind(&MasterElection::ProposalKeepAliveCallback, this)));
 
   // Watch the proposal directory so we're aware of other proposals
-  // coming and going
+  // coming and going. If we are re-creating a proposal which expired,
+  // the watch is still running (or StopElection() cancelled it).
+  if (proposal_watch_ || !running_) {
+    return;
+  }
   VLOG(1) << my_proposal_path_ << ": Watching proposals";
-  CHECK(!proposal_watch_);
   proposal_watch_.reset(new util::SyncTask(base_.get()));
   client_->Watch(proposal_dir_,
                  bind(&MasterElection::OnProposalUpdate, this, _1),
@@ -319,6 +376,14 @@ void MasterElection::ProposalCreateDone(EtcdClient::Response* resp,
 bool MasterElection::MaybeUpdateProposal(const unique_lock<mutex>& lock,
                                          const string& backed) {
   CHECK(lock.owns_lock());
+  if (proposal_state_ == ProposalState::AWAITING_CREATION ||
+      proposal_state_ == ProposalState::CREATING) {
+    // Our proposal is being re-created, the watch will tell us about
+    // it once it is, and we'll decide who to back then.
+    VLOG(1) << my_proposal_path_ << ": Dropping proposal update backing "
+            << backed << " because the proposal is being re-created.";
+    return false;
+  }
   if (proposal_state_ == ProposalState::UPDATING ||
       proposal_state_ == ProposalState::AWAITING_UPDATE) {
     // Don't want to have more than one proposal update happening at
@@ -345,8 +410,9 @@ void MasterElection::UpdateProposal(const string& backed) {
 
   // TODO(alcutter): Set the HTTP timeout inside here to something sensible.
   EtcdClient::Response* const resp(new EtcdClient::Response);
+  lease_requested_ = steady_clock::now();
   client_->UpdateWithTTL(my_proposal_path_, backed,
-                         seconds(FLAGS_master_keepalive_interval_seconds * 2),
+                         seconds(FLAGS_master_lease_ttl_seconds),
                          my_proposal_modified_index_, resp,
                          new Task(bind(&MasterElection::ProposalUpdateDone,
                                        this, backed, resp, _1),
@@ -358,16 +424,47 @@ void MasterElection::ProposalUpdateDone(const string& backed,
                                         EtcdClient::Response* resp,
                                         Task* task) {
   unique_ptr<EtcdClient::Response> resp_deleter(resp);
+  unique_ptr<Task> task_deleter(task);
   unique_lock<mutex> lock(mutex_);
-  // TODO(alcutter): Handle this
-  CHECK(task->status().ok()) << my_proposal_path_ << ": " << task->status();
+
+  if (!task->status().ok()) {
+    proposal_update_failures->Increment();
+    LOG(WARNING) << my_proposal_path_ << ": Problem updating proposal "
+                 << "backing " << backed << ": " << task->status();
+    const util::error::Code code(task->status().CanonicalCode());
+    if (running_ && (code == util::error::NOT_FOUND ||
+                     code == util::error::FAILED_PRECONDITION)) {
+      // Our proposal expired (or was changed under us), so the other
+      // participants have already moved on without us: start over
+      // with a new proposal, which will be a new term if we become
+      // master again.
+      VLOG(1) << my_proposal_path_ << ": Proposal lost, re-creating it.";
+      proposal_refresh_callback_.reset();
+      is_master_ = false;
+      is_master_gauge->Set(0);
+      backed_proposal_ = kNoBacking;
+      Transition(lock, ProposalState::AWAITING_CREATION);
+      base_->Add(bind(&MasterElection::CreateProposal, this));
+      return;
+    }
+    // The next keep-alive will try again, until our lease runs out, at
+    // which point IsMaster() will start returning false.
+    Transition(lock, ProposalState::UP_TO_DATE);
+    return;
+  }
+
   Transition(lock, ProposalState::UP_TO_DATE);
 
   // Keep a note of the current modification index of our proposal since
   // we'll need it in order to update or delete the proposal
   my_proposal_modified_index_ = resp->etcd_index;
+  lease_expiry_ = lease_requested_ + seconds(FLAGS_master_lease_ttl_seconds);
   VLOG(1) << my_proposal_path_ << ": Proposal refreshed @ "
           << resp->etcd_index;
+  if (is_master_) {
+    // In case our lease had run out in the meantime.
+    is_master_cv_.notify_all();
+  }
 }
 
 
@@ -389,8 +486,12 @@ void MasterElection::ProposalDeleteDone(Task* task) {
   }
 
   VLOG(1) << my_proposal_path_ << ": Delete done.";
+  AbandonProposal(lock);
+}
 
-  // Now clean up
+
+void MasterElection::AbandonProposal(const unique_lock<mutex>& lock) {
+  CHECK(lock.owns_lock());
   my_proposal_create_index_ = -1;
   proposals_.clear();
   Transition(lock, ProposalState::NONE);
@@ -545,6 +646,7 @@ void MasterElection::OnProposalUpdate(
                 apparent_master.created_index_ == my_proposal_create_index_);
   if (is_master_) {
     LOG(INFO) << my_proposal_path_ << ": Became master";
+    fencing_token_ = my_proposal_create_index_;
     is_master_gauge->Set(1);
     is_master_cv_.notify_all();
   }
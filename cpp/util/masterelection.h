@@ -1,6 +1,7 @@
 #ifndef CERT_TRANS_UTIL_MASTERELECTION_H_
 #define CERT_TRANS_UTIL_MASTERELECTION_H_
 
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
@@ -35,7 +36,19 @@ class PeriodicClosure;
 // This helps to detect failed candidates and clear up after them.
 // In order to keep this from happening to live candidates, each instance
 // maintains a periodic callback whose sole job is to update the TTL on its
-// proposal file.
+// proposal file, several times per TTL.
+//
+// The TTL doubles as a lease on mastership: the master only considers itself
+// master until the TTL of its last successful refresh (counted from when the
+// refresh was sent, so never later than etcd will expire it) runs out.
+// This way a master which can't refresh its proposal steps down no later than
+// the others can elect a new one, and a master which leaves the election
+// deletes its proposal, handing over to the next candidate straight away.
+//
+// Each term of mastership also gets a fencing token (the creation index of
+// the master's proposal), which increases with every new master, and which
+// writers can attach to their writes so that those from a deposed master can
+// be refused.
 //
 // TODO(alcutter): Some enhancements:
 //   - Recover gracefully from a crash where an old proposal exists for this
@@ -65,6 +78,11 @@ class MasterElection {
   // call.
   virtual bool IsMaster() const;
 
+  // Returns the fencing token of the most recent term during which this
+  // instance was master, or 0 if it has never been master. A token is
+  // greater than those of all the masters before it.
+  virtual int64_t FencingToken() const;
+
  protected:
   MasterElection();
 
@@ -116,6 +134,10 @@ class MasterElection {
   // directory.
   void ProposalDeleteDone(util::Task* task);
 
+  // Forgets about our proposal, which doesn't exist (anymore), and
+  // transitions to NONE.
+  void AbandonProposal(const std::unique_lock<std::mutex>& lock);
+
   // Thread entry point for the periodic callback to refresh the proposal TTL.
   void ProposalKeepAliveCallback();
 
@@ -130,7 +152,8 @@ class MasterElection {
   // more of the proposal files.
   void OnProposalUpdate(const std::vector<EtcdClient::Node>& updates);
 
-  // Internal non-locking accessor for is_master_
+  // Internal non-locking accessor for is_master_, which also checks that our
+  // lease hasn't run out.
   bool IsMaster(const std::unique_lock<std::mutex>& lock) const;
 
   const std::shared_ptr<libevent::Base> base_;
@@ -155,9 +178,15 @@ class MasterElection {
   int64_t my_proposal_create_index_;
   int64_t my_proposal_modified_index_;
 
+  // When the in-flight proposal create or update was sent, and when the
+  // lease obtained by the last successful one runs out.
+  std::chrono::steady_clock::time_point lease_requested_;
+  std::chrono::steady_clock::time_point lease_expiry_;
+
   std::string backed_proposal_;
 
   bool is_master_;
+  int64_t fencing_token_;
   EtcdClient::Node current_master_;
 
   friend class ElectionTest;
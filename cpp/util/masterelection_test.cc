@@ -22,7 +22,10 @@ namespace cert_trans {
 using cert_trans::Notification;
 using std::atomic;
 using std::bind;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::function;
 using std::make_shared;
 using std::map;
@@ -47,8 +50,9 @@ const char kProposalDir[] = "/master/";
 
 DEFINE_string(etcd, "", "etcd server address");
 DEFINE_int32(etcd_port, 4001, "etcd server port");
-DECLARE_int32(master_keepalive_interval_seconds);
-DECLARE_int32(masterelection_retry_delay_seconds);
+DECLARE_int32(master_keepalive_interval_ms);
+DECLARE_int32(master_lease_ttl_seconds);
+DECLARE_int32(masterelection_retry_delay_ms);
 
 
 // Simple helper class, represents a thread of interest in participating in
@@ -96,6 +100,10 @@ struct Participant {
     return election_->IsMaster();
   }
 
+  int64_t FencingToken() {
+    return election_->FencingToken();
+  }
+
   void ElectionMania(int num_rounds,
                      const vector<unique_ptr<Participant>>* all_participants) {
     notification_.reset(new Notification);
@@ -264,7 +272,7 @@ TEST_F(ElectionTest, OkToCallStartAndStopElectionMultipleTimes) {
 
 
 TEST_F(ElectionTest, RetresCreatingProposal) {
-  FLAGS_masterelection_retry_delay_seconds = 1;
+  FLAGS_masterelection_retry_delay_ms = 1000;
   {
     EtcdClient::Response resp;
     SyncTask task(base_.get());
@@ -292,6 +300,137 @@ TEST_F(ElectionTest, RetresCreatingProposal) {
 }
 
 
+TEST_F(ElectionTest, StopsWhileRetryingCreatingProposal) {
+  FLAGS_masterelection_retry_delay_ms = 100;
+  {
+    EtcdClient::Response resp;
+    SyncTask task(base_.get());
+    client_->Create(string(kProposalDir) + "1", "", &resp, task.task());
+    task.Wait();
+    ASSERT_OK(task.status());
+  }
+
+  Participant one(kProposalDir, "1", base_, client_.get());
+  one.StartElection();
+  sleep(1);
+  EXPECT_FALSE(one.IsMaster());
+  // Gives up on creating the proposal, and leaves the one in the way
+  // alone, since it isn't ours.
+  one.StopElection();
+
+  {
+    SyncTask task(base_.get());
+    client_->ForceDelete(string(kProposalDir) + "1", task.task());
+    task.Wait();
+    EXPECT_OK(task.status());
+  }
+}
+
+
+TEST_F(ElectionTest, StopsBeforeCreatingProposal) {
+  Participant one(kProposalDir, "1", base_, client_.get());
+  one.StartElection();
+  one.StopElection();
+}
+
+
+TEST_F(ElectionTest, FencingTokenIncreasesWithEachMaster) {
+  Participant one(kProposalDir, "1", base_, client_.get());
+  EXPECT_EQ(0, one.FencingToken());
+  one.ElectLikeABoss();
+  const int64_t first_token(one.FencingToken());
+  EXPECT_LT(0, first_token);
+
+  Participant two(kProposalDir, "2", base_, client_.get());
+  two.StartElection();
+  one.StopElection();
+  EXPECT_TRUE(two.WaitToBecomeMaster());
+  EXPECT_LT(first_token, two.FencingToken());
+  // The old master keeps its token, so that its writes can be told apart.
+  EXPECT_EQ(first_token, one.FencingToken());
+
+  two.StopElection();
+}
+
+
+TEST_F(ElectionTest, RecreatesLostProposal) {
+  Participant one(kProposalDir, "1", base_, client_.get());
+  one.ElectLikeABoss();
+  const int64_t first_token(one.FencingToken());
+
+  // As if it had expired.
+  {
+    SyncTask task(base_.get());
+    client_->ForceDelete(string(kProposalDir) + "1", task.task());
+    task.Wait();
+    ASSERT_OK(task.status());
+  }
+
+  // The next refresh fails, and the node rejoins with a new proposal,
+  // and so a new term.
+  const steady_clock::time_point deadline(steady_clock::now() + seconds(10));
+  while (one.FencingToken() == first_token &&
+         steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(milliseconds(50));
+  }
+  EXPECT_LT(first_token, one.FencingToken());
+  EXPECT_TRUE(one.WaitToBecomeMaster());
+
+  one.StopElection();
+}
+
+
+// Time from the master leaving the election to the next candidate taking
+// over, when it does so gracefully (and hands over by deleting its
+// proposal), and when it dies (and its proposal has to expire).
+TEST_F(ElectionTest, FailoverTime) {
+  FLAGS_master_keepalive_interval_ms = 200;
+  FLAGS_master_lease_ttl_seconds = 1;
+  const milliseconds lease(FLAGS_master_lease_ttl_seconds * 1000);
+
+  {
+    Participant one(kProposalDir, "1", base_, client_.get());
+    Participant two(kProposalDir, "2", base_, client_.get());
+    one.ElectLikeABoss();
+    two.StartElection();
+    sleep(1);
+    ASSERT_FALSE(two.IsMaster());
+
+    const steady_clock::time_point start(steady_clock::now());
+    one.StopElection();
+    EXPECT_TRUE(two.WaitToBecomeMaster());
+    const milliseconds handoff(
+        duration_cast<milliseconds>(steady_clock::now() - start));
+    LOG(INFO) << "Failover on handoff took " << handoff.count() << " ms";
+    EXPECT_LT(handoff, lease);
+    two.StopElection();
+  }
+
+  {
+    Participant one(kProposalDir, "1", base_, client_.get());
+    Participant two(kProposalDir, "2", base_, client_.get());
+    one.ElectLikeABoss();
+    two.StartElection();
+    sleep(1);
+    ASSERT_FALSE(two.IsMaster());
+
+    // Stop refreshing the master's proposal, as if it had wedged.
+    const steady_clock::time_point start(steady_clock::now());
+    KillProposalRefresh(&one);
+    EXPECT_TRUE(two.WaitToBecomeMaster());
+    const milliseconds expiry(
+        duration_cast<milliseconds>(steady_clock::now() - start));
+    LOG(INFO) << "Failover on expiry took " << expiry.count() << " ms";
+    // The old master's lease ran out before the new master took over.
+    EXPECT_FALSE(one.IsMaster());
+    EXPECT_LT(expiry, lease + milliseconds(FLAGS_master_keepalive_interval_ms +
+                                           500));
+    one.StopElection();
+    two.StopElection();
+  }
+}
+
+
 TEST_F(ElectionTest, ElectionMania) {
   const int kNumRounds(20);
   const int kNumParticipants(20);
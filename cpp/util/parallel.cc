@@ -0,0 +1,49 @@
+#include "util/parallel.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <glog/logging.h>
+#include <mutex>
+
+#include "util/executor.h"
+
+using std::condition_variable;
+using std::function;
+using std::lock_guard;
+using std::min;
+using std::mutex;
+using std::unique_lock;
+
+namespace util {
+
+
+void ParallelFor(Executor* executor, size_t count, size_t chunk_size,
+                 const function<void(size_t begin, size_t end)>& fn) {
+  CHECK_GT(chunk_size, 0U);
+  if (!executor || count <= chunk_size) {
+    if (count > 0) {
+      fn(0, count);
+    }
+    return;
+  }
+
+  mutex lock;
+  condition_variable done;
+  size_t pending((count + chunk_size - 1) / chunk_size);
+  for (size_t begin = 0; begin < count; begin += chunk_size) {
+    const size_t end(min(count, begin + chunk_size));
+    executor->Add([&fn, &lock, &done, &pending, begin, end]() {
+      fn(begin, end);
+      lock_guard<mutex> guard(lock);
+      if (--pending == 0) {
+        done.notify_one();
+      }
+    });
+  }
+
+  unique_lock<mutex> guard(lock);
+  done.wait(guard, [&pending]() { return pending == 0; });
+}
+
+
+}  // namespace util
@@ -0,0 +1,25 @@
+#ifndef CERT_TRANS_UTIL_PARALLEL_H_
+#define CERT_TRANS_UTIL_PARALLEL_H_
+
+#include <functional>
+#include <stddef.h>
+
+namespace util {
+
+class Executor;
+
+
+// Splits [0, |count|) into consecutive ranges of at most |chunk_size|
+// elements, calls |fn| with the bounds of each of them on |executor|,
+// and waits for all the calls to return. If |executor| is NULL, or
+// there is only one range, |fn| is called in the calling thread.
+//
+// This must not be called from one of the threads of |executor|, or it
+// might wait forever.
+void ParallelFor(Executor* executor, size_t count, size_t chunk_size,
+                 const std::function<void(size_t begin, size_t end)>& fn);
+
+
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_PARALLEL_H_
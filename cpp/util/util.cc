@@ -5,7 +5,7 @@
 #include <glog/logging.h>
 #include <iostream>
 #include <netinet/in.h>  // for resolv.h
-#include <resolv.h>      // for b64_ntop
+#include <resolv.h>      // for b64_pton
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,6 +13,8 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "util/base64.h"
+
 using std::string;
 
 namespace util {
@@ -168,6 +170,12 @@ string RandomString(size_t min_length, size_t max_length) {
 
 string FromBase64(const char* b64) {
   size_t length = strlen(b64);
+  string ret;
+  if (AppendFromBase64(b64, length, &ret)) {
+    return ret;
+  }
+
+  // Fall back to the more lenient b64_pton(), which skips whitespace.
   // Lazy: base 64 encoding is always >= in length to decoded value
   // (equality occurs for zero length).
   u_char* buf = new u_char[length];
@@ -175,19 +183,14 @@ string FromBase64(const char* b64) {
   // Treat decode errors as empty strings.
   if (rlength < 0)
     rlength = 0;
-  string ret(reinterpret_cast<char*>(buf), rlength);
+  ret.assign(reinterpret_cast<char*>(buf), rlength);
   delete[] buf;
   return ret;
 }
 
 string ToBase64(const string& from) {
-  // base 64 is 4 output bytes for every 3 input bytes (rounded up).
-  size_t length = ((from.size() + 2) / 3) * 4;
-  char* buf = new char[length + 1];
-  length =
-      b64_ntop((const u_char*)from.data(), from.length(), buf, length + 1);
-  string ret(buf, length);
-  delete[] buf;
+  string ret;
+  AppendToBase64(from.data(), from.size(), &ret);
   return ret;
 }
 